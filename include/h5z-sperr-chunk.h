@@ -0,0 +1,204 @@
+/*
+ * This header provides a C API that encodes and decodes a single chunk in the exact byte format
+ * that the H5Z-SPERR filter stores in HDF5 files, without going through HDF5 at all.
+ *
+ * A typical use is in-situ compression: simulation ranks encode their chunks on their own cores,
+ * ship the encoded bytes to I/O ranks, which then write them directly using `H5Dwrite_chunk()`
+ * (with a filter mask of 0) to a dataset that has the H5Z-SPERR filter defined with the same
+ * user cd_values[]. Chunks read back using `H5Dread_chunk()` can be decoded the same way.
+ */
+
+#ifndef H5Z_SPERR_CHUNK_H
+#define H5Z_SPERR_CHUNK_H
+
+#include <stddef.h>
+
+/* The same as in h5z-sperr.h, which only the filter itself may include. */
+#define H5Z_FILTER_SPERR 32028
+
+/*
+ * The maximum number of cd_values[] that the H5Z-SPERR filter stores for a dataset.
+ * Datasets of plain floating-point values never take more than 16.
+ */
+#define H5Z_SPERR_MAX_CD_VALUES 24
+
+/* The maximum number of floating-point components of compound or array values. */
+#define H5Z_SPERR_MAX_COMPONENTS 4
+
+/*
+ * 16-bit types, little-endian, that the filter converts to floats before compression and back
+ * afterwards. Integers are rounded to the nearest and saturate; a PWE tolerance below 0.5 thus
+ * brings integers back exactly.
+ */
+#define H5Z_SPERR_TYPE_INT16 2
+#define H5Z_SPERR_TYPE_UINT16 3
+#define H5Z_SPERR_TYPE_FLOAT16 4
+
+/* The maximum number of distinct missing values in missing value mode 5. */
+#define H5Z_SPERR_MAX_SENTINELS 4
+
+/* Status codes of the chunk encoding and decoding routines. */
+#define H5ZSPERR_OK 0
+#define H5ZSPERR_ERR_CD_VALUES 1 /* cd_values[] isn't valid */
+#define H5ZSPERR_ERR_VERSION 2   /* produced by a different compatibility version */
+#define H5ZSPERR_ERR_SIZE 3      /* input buffer length doesn't match the chunk */
+#define H5ZSPERR_ERR_MASK 4      /* compacting the bitmask failed */
+#define H5ZSPERR_ERR_COMP 5      /* SPERR compression failed */
+#define H5ZSPERR_ERR_DECOMP 6    /* SPERR decompression failed */
+#define H5ZSPERR_ERR_CORRUPT 7   /* the encoded chunk is malformed */
+#define H5ZSPERR_ERR_HDF5 8      /* an HDF5 call failed, or the dataset isn't supported */
+#define H5ZSPERR_ERR_RESIDUAL 9  /* the chunk holds residuals, see `H5Z_SPERR_read_temporal()` */
+
+#ifdef __cplusplus
+namespace C_API {
+extern "C" {
+#endif
+
+/*
+ * Assemble the cd_values[] that the filter keeps for a dataset, exactly as the filter's
+ * `set_local()` callback does when a dataset is created.
+ * -- `user_cd_values` and `user_cd_nelmts` are what would be passed to `H5Pset_filter()`,
+ *    i.e., the output of `H5Z_SPERR_make_cd_values()`, optionally followed by a missing value mode
+ *    (6, auto detection, when omitted),
+ *    and then the bits of the exact missing value in mode 3 (a float) or mode 4 (a double).
+ *    Unlike the filter, this function can't look up the dataset fill value, so the exact
+ *    missing value is mandatory in modes 3 and 4.
+ *    In mode 5, the mode is followed by the number of missing values (at most
+ *    H5Z_SPERR_MAX_SENTINELS), and then the bits of each missing value as a double.
+ * -- `is_float` is 1 for 32-bit floats, and 0 for 64-bit doubles; H5Z_SPERR_TYPE_INT16,
+ *    H5Z_SPERR_TYPE_UINT16, and H5Z_SPERR_TYPE_FLOAT16 are for 16-bit values, which are
+ *    compressed as floats and converted back upon decoding.
+ * -- `chunk_dims` has `ndims` (2, 3, or 4) elements in the HDF5 (C) order.
+ * -- `cd_values` needs to hold H5Z_SPERR_MAX_CD_VALUES elements, and the number of
+ *    elements used is returned in `cd_nelmts`.
+ * Returns H5ZSPERR_OK upon success.
+ */
+int H5Z_SPERR_chunk_cd_values(const unsigned int user_cd_values[],
+                              size_t user_cd_nelmts,
+                              int is_float,
+                              int ndims,
+                              const size_t chunk_dims[],
+                              unsigned int cd_values[],
+                              size_t* cd_nelmts);
+
+/*
+ * Same as `H5Z_SPERR_chunk_cd_values()`, for values of `elem_size` bytes made of `ncomp` (1 to
+ * H5Z_SPERR_MAX_COMPONENTS) floats or doubles, which start at the byte offsets in `offsets`,
+ * i.e., compound types of floating-point members, or array types of floating-point values.
+ * Each component is compressed as its own SPERR stream; see `H5Z_SPERR_make_components()` for
+ * giving them different compression parameters.
+ */
+int H5Z_SPERR_component_cd_values(const unsigned int user_cd_values[],
+                                  size_t user_cd_nelmts,
+                                  int is_float,
+                                  int ndims,
+                                  const size_t chunk_dims[],
+                                  int ncomp,
+                                  size_t elem_size,
+                                  const size_t offsets[],
+                                  unsigned int cd_values[],
+                                  size_t* cd_nelmts);
+
+/*
+ * Encode a chunk of `src_bytes` bytes using the cd_values[] produced by
+ * `H5Z_SPERR_chunk_cd_values()`. The input is left untouched.
+ * `*dst` has to be NULL; it will be allocated using malloc() and needs to be freed by the caller.
+ * Returns H5ZSPERR_OK upon success.
+ */
+int H5Z_SPERR_encode_chunk(size_t cd_nelmts,
+                           const unsigned int cd_values[],
+                           const void* src,
+                           size_t src_bytes,
+                           void** dst,
+                           size_t* dst_len);
+
+/*
+ * A coarse map of tolerance factors over a dataset, for keeping some regions more accurately than
+ * others. The map is a grid of cells that covers the dimensions along which chunks are longer than
+ * 1 (2 or 3 of them), in the HDF5 (C) order; values beyond the grid fall in its last cells.
+ * The PWE tolerance of a chunk, or of each of its sub-blocks (see `H5Z_SPERR_make_subblocks()`),
+ * is multiplied by the smallest factor of the cells that it overlaps.
+ * Factors apply in the PWE compression modes (3, 4, and 5) only, and have to be positive.
+ */
+typedef struct H5Z_SPERR_quality_map {
+  int rank;             /* 2 or 3 */
+  size_t dims[3];       /* number of cells along each dimension */
+  size_t cell[3];       /* edge lengths of a cell, in values */
+  const float* factors; /* the factor of each cell, in C order */
+} H5Z_SPERR_quality_map;
+
+/*
+ * Same as `H5Z_SPERR_encode_chunk()`, with tolerances that follow `map` for a chunk at `offset`,
+ * which has `map->rank` elements counted in values. A NULL map means a uniform tolerance.
+ */
+int H5Z_SPERR_encode_chunk_map(size_t cd_nelmts,
+                               const unsigned int cd_values[],
+                               const void* src,
+                               size_t src_bytes,
+                               const H5Z_SPERR_quality_map* map,
+                               const size_t offset[],
+                               void** dst,
+                               size_t* dst_len);
+
+/*
+ * Decode an encoded chunk of `src_len` bytes.
+ * `*dst` has to be NULL; it will be allocated using malloc() and needs to be freed by the caller.
+ * Returns H5ZSPERR_OK upon success.
+ */
+int H5Z_SPERR_decode_chunk(size_t cd_nelmts,
+                           const unsigned int cd_values[],
+                           const void* src,
+                           size_t src_len,
+                           void** dst,
+                           size_t* dst_len);
+
+/*
+ * Decode a region of an encoded chunk of `src_len` bytes into `dst`, which the caller allocates
+ * to hold the product of `count` values (whole compound or array values, if the chunk has
+ * components). `start` and `count` have as many elements as the chunk has dimensions longer
+ * than 1 (2 or 3), in the HDF5 (C) order. When the chunk is compressed
+ * as sub-blocks (see `H5Z_SPERR_make_subblocks()`), only the sub-blocks overlapping the region
+ * are decoded; otherwise, the whole chunk is.
+ * Returns H5ZSPERR_OK upon success.
+ */
+int H5Z_SPERR_decode_chunk_region(size_t cd_nelmts,
+                                  const unsigned int cd_values[],
+                                  const void* src,
+                                  size_t src_len,
+                                  const size_t start[],
+                                  const size_t count[],
+                                  void* dst);
+
+/*
+ * Set the memory cap, in bytes, of the process-wide cache of decoded chunks.
+ * HDF5 drops its chunk cache when a dataset is closed; this one survives, so reading the same
+ * chunks again after reopening a dataset skips SPERR decoding. It is off (0 byte) unless the
+ * environment variable H5ZSPERR_CHUNK_CACHE_MB sets it. Shrinking the cap evicts entries.
+ */
+void H5Z_SPERR_set_chunk_cache(size_t max_bytes);
+
+/* Report the hit and miss counters, the number of cached chunks, and the bytes they hold. */
+void H5Z_SPERR_chunk_cache_stats(size_t* hits, size_t* misses, size_t* entries, size_t* bytes);
+
+/*
+ * Record what the filter does to each chunk (building the bitmask, replacing missing values,
+ * SPERR encoding and decoding, ...) with thread ids and byte counts, in a ring buffer holding
+ * the latest `max_events` events. `H5Z_SPERR_trace_dump()` writes them to `path` as Chrome trace
+ * JSON, which chrome://tracing and Perfetto load next to traces of the application; it returns 0
+ * upon success. Setting the environment variable H5ZSPERR_TRACE to a file name turns tracing
+ * on from the start, and writes the trace to that file when the process exits.
+ * Start and stop tracing when no chunks are being encoded or decoded.
+ */
+void H5Z_SPERR_trace_start(size_t max_events);
+void H5Z_SPERR_trace_stop(void);
+int H5Z_SPERR_trace_dump(const char* path);
+
+/* Return a description of a status code. */
+const char* H5Z_SPERR_strerror(int status);
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+} /* end of namespace C_API */
+#endif
+
+#endif
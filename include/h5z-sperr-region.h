@@ -0,0 +1,90 @@
+/*
+ * This header provides a reader that extracts a hyperslab of an H5Z-SPERR dataset without going
+ * through the HDF5 filter pipeline: it reads the encoded chunks that the hyperslab touches using
+ * `H5Dread_chunk()`, and decodes only the regions of them that are needed.
+ *
+ * When the dataset is compressed as sub-blocks (see `H5Z_SPERR_make_subblocks()`), only the
+ * sub-blocks that overlap the hyperslab are decompressed, so extracting, e.g., the time series
+ * at one location decodes a small fraction of each chunk. Otherwise, whole chunks are decoded.
+ *
+ * The matching writer encodes chunks on its own as well, which lets the tolerance vary across
+ * the dataset following a map of tolerance factors.
+ *
+ * Time series whose steps change little can be written as keyframes and residuals instead:
+ * every `interval`-th step is compressed as usual, and the steps in between are compressed as
+ * their differences from the decoded keyframe before them, which are much smoother than the
+ * values themselves. The interval is kept in the dataset attribute `H5Z_SPERR_KEYFRAME_ATTR`,
+ * and such datasets have to be read using `H5Z_SPERR_read_temporal()`: chunks of residuals are
+ * flagged as such, and the filter refuses to decode them, so that `H5Dread()` fails on the steps
+ * between keyframes instead of returning residuals as values.
+ */
+
+#ifndef H5Z_SPERR_REGION_H
+#define H5Z_SPERR_REGION_H
+
+#include <hdf5.h>
+
+#include "h5z-sperr-chunk.h"
+
+/* The dataset attribute that holds the keyframe interval of `H5Z_SPERR_write_temporal()`. */
+#define H5Z_SPERR_KEYFRAME_ATTR "H5Z-SPERR keyframe interval"
+
+#ifdef __cplusplus
+namespace C_API {
+extern "C" {
+#endif
+
+/*
+ * Read the hyperslab of `count` values starting at `start`, both having the rank of the dataset,
+ * into `buf`, which holds the product of `count` values of the dataset's data type in C order.
+ * Chunks that aren't allocated read as the fill value of the dataset.
+ * H5Z-SPERR has to be the only filter of the dataset.
+ * Returns H5ZSPERR_OK upon success, or a status code of h5z-sperr-chunk.h.
+ */
+int H5Z_SPERR_read_region(hid_t dset, const hsize_t start[], const hsize_t count[], void* buf);
+
+/*
+ * Write the hyperslab of `count` values starting at `start` from `buf`, both aligned to chunks,
+ * by encoding each chunk and writing it using `H5Dwrite_chunk()`. The PWE tolerance follows
+ * `map` (see `H5Z_SPERR_quality_map`), or is uniform when `map` is NULL; the filter itself can't
+ * do this, as it doesn't know where in the dataset each chunk lies.
+ * H5Z-SPERR has to be the only filter of the dataset.
+ * Returns H5ZSPERR_OK upon success, or a status code of h5z-sperr-chunk.h.
+ */
+int H5Z_SPERR_write_region(hid_t dset,
+                           const hsize_t start[],
+                           const hsize_t count[],
+                           const void* buf,
+                           const H5Z_SPERR_quality_map* map);
+
+/*
+ * Write the `nt` steps starting at step `t0` from `buf`, which holds `nt` whole steps in C order.
+ * Time is the first dimension of the dataset, which has a rank of at least 3, chunks of one step,
+ * and chunks that divide the other dimensions. Steps that are multiples of `interval` are
+ * keyframes, and the others are stored as residuals against their keyframe, which has to be
+ * written already or within the same call. The interval has to be the same for all calls.
+ * The error bound of PWE modes holds for the values, and other modes apply to the residuals.
+ * H5Z-SPERR has to be the only filter of the dataset.
+ * Returns H5ZSPERR_OK upon success, or a status code of h5z-sperr-chunk.h.
+ */
+int H5Z_SPERR_write_temporal(hid_t dset,
+                             hsize_t t0,
+                             hsize_t nt,
+                             const void* buf,
+                             unsigned int interval);
+
+/*
+ * Read a hyperslab like `H5Z_SPERR_read_region()` does, adding keyframes back to the steps that
+ * `H5Z_SPERR_write_temporal()` stored as residuals. Keyframes are decoded once per call, and
+ * across calls when the chunk cache is enabled (see `H5ZSPERR_CHUNK_CACHE_MB`). Steps that were
+ * written otherwise, and datasets without keyframes, are read as they are.
+ * Returns H5ZSPERR_OK upon success, or a status code of h5z-sperr-chunk.h.
+ */
+int H5Z_SPERR_read_temporal(hid_t dset, const hsize_t start[], const hsize_t count[], void* buf);
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+} /* end of namespace C_API */
+#endif
+
+#endif
@@ -5,23 +5,41 @@
 #include <math.h>
 #include <stdlib.h>
 
+/*
+ * The functions of this header are `static inline`, so that any number of translation units
+ * of a program or library can include it.
+ */
+
 #define H5Z_FILTER_SPERR 32028
 
+/* The same as in h5z-sperr-chunk.h. */
+#define H5Z_SPERR_MAX_COMPONENTS 4
+
 #define FRACTIONAL_BITS 16
 #define INTEGER_BITS 12
 
+/*
+ * Passing `swap = H5Z_SPERR_SWAP_AUTO` lets the filter pick, for each chunk, whether to swap
+ * rank orders. It is kept in bit 26, which no meaningful quality reaches.
+ */
+#define H5Z_SPERR_SWAP_AUTO 2
+#define AUTO_SWAP_BIT 26
+
 /*
  * This function encodes 1) the SPERR compression mode, 2) compression quality, 3) if to swap
  * rank orders into a 32-bit unsigned int. Valid input and its meaning:
  *   - Fixed bitrate compression:                mode = 1; quality = target bitrate.
  *   - Fixed PSNR compression:                   mode = 2; quality = target PSNR.
  *   - Fixed PWE (point-wise error) compression: mode = 3; quality = PWE tolerance.
- *   - In all modes, swap != 0 means to perform rank order swaps.
+ *   - Relative PWE compression:                 mode = 5; quality = PWE tolerance as a fraction
+ *                                               of the value range of each chunk.
+ *   - In all modes, swap != 0 means to perform rank order swaps, and swap == H5Z_SPERR_SWAP_AUTO
+ *     means to decide for each chunk.
  * The encoded value is returned and needs to be passed to HDF5 as `cd_values[1]`.
  */
-unsigned int H5Z_SPERR_make_cd_values(int mode, double quality, int swap)
+static inline unsigned int H5Z_SPERR_make_cd_values(int mode, double quality, int swap)
 {
-  assert(1 <= mode && mode <= 3);
+  assert((1 <= mode && mode <= 3) || mode == 5);
   assert(quality > 0.0);
 
   unsigned int ret = 0;
@@ -30,7 +48,7 @@ unsigned int H5Z_SPERR_make_cd_values(int mode, double quality, int swap)
     quality = round(quality * (1u << FRACTIONAL_BITS));
     ret = (unsigned int)quality;
   }
-  else if (mode == 3) {
+  else if (mode == 3 || mode == 5) {
     /*
      *Use the logarithm of quality, and also encode its sign.
      */
@@ -63,29 +81,116 @@ unsigned int H5Z_SPERR_make_cd_values(int mode, double quality, int swap)
       mask |= 1u << (INTEGER_BITS + FRACTIONAL_BITS);
       mask |= 1u << (INTEGER_BITS + FRACTIONAL_BITS + 1);
       break;
+    case 5:
+      mask |= 1u << (INTEGER_BITS + FRACTIONAL_BITS + 1);
+      mask |= 1u << (INTEGER_BITS + FRACTIONAL_BITS + 2);
+      break;
     default:;
   }
   ret |= mask;
 
-  /* Encode swap flag at bit 31. */
-  if (swap)
+  /* Encode swap flag at bit 31, or the automatic swap flag at bit 26. */
+  if (swap == H5Z_SPERR_SWAP_AUTO)
+    ret |= 1u << AUTO_SWAP_BIT;
+  else if (swap)
+    ret |= 1u << (INTEGER_BITS + FRACTIONAL_BITS + 3);
+
+  return ret;
+}
+
+/*
+ * Bit 30 marks the extended compression modes, whose quality field packs more than one number.
+ * Fixed PWE with a bitrate cap (mode 4) keeps the logarithm of the PWE tolerance in the low
+ * CAPPED_PWE_BITS bits, its sign included, and the bitrate cap in quarters of a bit above them.
+ */
+#define CAPPED_PWE_BITS 18
+#define CAPPED_PWE_FRACTIONAL_BITS 11
+
+/*
+ * This function encodes fixed PWE compression with a bitrate cap (mode 4): each chunk is compressed
+ * to the PWE tolerance `pwe`, unless its bitstream would exceed `max_bpp` bits per value, in which
+ * case it is compressed to `max_bpp` instead. Valid input: pwe > 0.0; 0.25 <= max_bpp < 64.0.
+ * The encoded value is returned and needs to be passed to HDF5 as `cd_values[1]`.
+ */
+static inline unsigned int H5Z_SPERR_make_capped_cd_values(double pwe, double max_bpp, int swap)
+{
+  assert(pwe > 0.0);
+  assert(max_bpp >= 0.25 && max_bpp < 64.0);
+
+  /* Round towards a smaller tolerance, as mode 3 does. */
+  double q = log2(pwe) * (1u << CAPPED_PWE_FRACTIONAL_BITS);
+  int negative = 0;
+  if (q < 0.0) {
+    negative = 1;
+    q = ceil(-q);
+  }
+  else
+    q = floor(q);
+
+  unsigned int ret = (unsigned int)q;
+  assert(ret < (1u << (CAPPED_PWE_BITS - 1)));
+  if (negative)
+    ret |= 1u << (CAPPED_PWE_BITS - 1);
+  ret |= (unsigned int)floor(max_bpp * 4.0) << CAPPED_PWE_BITS;
+
+  /* Encode mode in bit 28, and the extended mode flag in bit 30. */
+  ret |= 1u << (INTEGER_BITS + FRACTIONAL_BITS);
+  ret |= 1u << (INTEGER_BITS + FRACTIONAL_BITS + 2);
+
+  /* Encode swap flag at bit 31, or the automatic swap flag at bit 26. */
+  if (swap == H5Z_SPERR_SWAP_AUTO)
+    ret |= 1u << AUTO_SWAP_BIT;
+  else if (swap)
     ret |= 1u << (INTEGER_BITS + FRACTIONAL_BITS + 3);
 
   return ret;
 }
 
-void H5Z_SPERR_decode_cd_values(unsigned int cd_val, /* input */
-                                int* mode,           /* output */
-                                double* quality,     /* output */
-                                int* swap)           /* output */
+/*
+ * Returns the bitrate cap of mode 4, or 0.0 in other modes.
+ */
+static inline double H5Z_SPERR_decode_max_bpp(unsigned int cd_val)
+{
+  if (((cd_val >> (INTEGER_BITS + FRACTIONAL_BITS)) & 7u) != 5u)
+    return 0.0;
+  return (double)((cd_val >> CAPPED_PWE_BITS) & 255u) / 4.0;
+}
+
+/*
+ * In mode 4, `quality` is the PWE tolerance; use `H5Z_SPERR_decode_max_bpp()` for the bitrate cap.
+ */
+static inline void H5Z_SPERR_decode_cd_values(unsigned int cd_val, /* input */
+                                              int* mode,           /* output */
+                                              double* quality,     /* output */
+                                              int* swap)           /* output */
 {
-  /* Decode the rank swap flag. */
+  /* Decode the rank swap flag, and then clear the automatic swap flag. */
   *swap = cd_val >> (INTEGER_BITS + FRACTIONAL_BITS + 3);
+  if ((cd_val >> AUTO_SWAP_BIT) & 1u)
+    *swap = H5Z_SPERR_SWAP_AUTO;
+  cd_val &= ~(1u << AUTO_SWAP_BIT);
 
-  /* Decode the compression mode from the next 3 bits */
+  /* Decode the compression mode from the next 3 bits; bit 30 marks the extended modes. */
   unsigned int bit1 = (cd_val >> (INTEGER_BITS + FRACTIONAL_BITS)) & 1u;
   unsigned int bit2 = (cd_val >> (INTEGER_BITS + FRACTIONAL_BITS + 1)) & 1u;
-  if (bit1 && !bit2)
+  unsigned int bit3 = (cd_val >> (INTEGER_BITS + FRACTIONAL_BITS + 2)) & 1u;
+  if (bit3 && bit1 && !bit2) {
+    *mode = 4;
+    unsigned int mask = 1u << (CAPPED_PWE_BITS - 1);
+    *quality = (double)(cd_val & (mask - 1)) / (double)(1u << CAPPED_PWE_FRACTIONAL_BITS);
+    if (cd_val & mask)
+      *quality *= -1.0;
+    *quality = exp2(*quality);
+    return;
+  }
+  else if (bit3 && !bit1 && bit2)
+    *mode = 5; /* shares the quality encoding of mode 3 */
+  else if (bit3) {
+    *mode = 0;
+    *quality = 0.0;
+    return;
+  }
+  else if (bit1 && !bit2)
     *mode = 1;
   else if (!bit1 && bit2)
     *mode = 2;
@@ -104,8 +209,83 @@ void H5Z_SPERR_decode_cd_values(unsigned int cd_val, /* input */
   if (negative)
     *quality *= -1.0;
 
-  if (*mode == 3)
+  if (*mode == 3 || *mode == 5)
     *quality = exp2(*quality);
 }
 
+/*
+ * Sub-blocks: the missing value mode (the second user cd_value) may carry the base-2 logarithm
+ * of a sub-block edge length in bits SUBBLOCK_SHIFT to SUBBLOCK_SHIFT + 3. Each chunk is then
+ * compressed as independent SPERR sub-blocks, so that a region of a chunk can be decoded by
+ * touching only the sub-blocks it overlaps (see `H5Z_SPERR_decode_chunk_region()`).
+ */
+#define SUBBLOCK_SHIFT 8
+#define SUBBLOCK_MIN_LOG2 3
+#define SUBBLOCK_MAX_LOG2 10
+
+/*
+ * This function returns the bits to OR into the missing value mode to compress each chunk as
+ * sub-blocks of `edge` values along each axis; the last sub-block along an axis takes what's left.
+ * Valid input: a power of two from 8 to 1024.
+ */
+static inline unsigned int H5Z_SPERR_make_subblocks(int edge)
+{
+  int log2_edge = 0;
+  while ((1 << log2_edge) < edge)
+    log2_edge++;
+  assert((1 << log2_edge) == edge);
+  assert(log2_edge >= SUBBLOCK_MIN_LOG2 && log2_edge <= SUBBLOCK_MAX_LOG2);
+
+  return (unsigned int)log2_edge << SUBBLOCK_SHIFT;
+}
+
+/*
+ * Effort presets trade compression speed for ratio; they ride in bits EFFORT_SHIFT and
+ * EFFORT_SHIFT + 1 of the missing value mode, next to the sub-block edge length. Chunks compressed
+ * with any preset decode the same way.
+ *   - H5Z_SPERR_EFFORT_BALANCED (the default) is how the filter has always behaved.
+ *   - H5Z_SPERR_EFFORT_FAST has SPERR transform 3D chunks as independent pieces of at most
+ *     FAST_SPERR_CHUNK values along each axis, which take fewer wavelet levels, and skips the
+ *     analysis behind automatic rank order swaps (no swaps happen). It thus only has an effect
+ *     on 3D chunks (or sub-blocks) longer than FAST_SPERR_CHUNK along some axis, or with
+ *     automatic swaps; 2D chunks, and e.g. 64^3 chunks without automatic swaps, compress
+ *     exactly as with H5Z_SPERR_EFFORT_BALANCED.
+ *   - H5Z_SPERR_EFFORT_MAX compresses chunks in both rank orders when swaps are automatic, and
+ *     keeps the shorter bitstream instead of guessing.
+ */
+#define EFFORT_SHIFT 12
+#define H5Z_SPERR_EFFORT_BALANCED 0
+#define H5Z_SPERR_EFFORT_FAST 1
+#define H5Z_SPERR_EFFORT_MAX 2
+#define FAST_SPERR_CHUNK 64
+
+/*
+ * This function returns the bits to OR into the missing value mode to use an effort preset.
+ */
+static inline unsigned int H5Z_SPERR_make_effort(int effort)
+{
+  assert(effort >= H5Z_SPERR_EFFORT_BALANCED && effort <= H5Z_SPERR_EFFORT_MAX);
+
+  return (unsigned int)effort << EFFORT_SHIFT;
+}
+
+/*
+ * Datasets of compound types whose members are all floats (or all doubles), and of array types
+ * of floats or doubles, are compressed as one SPERR stream per component in each chunk, e.g.,
+ * the u, v, and w of a wind field, or the real and imaginary parts of spectral coefficients.
+ * Every component takes the compression parameters of the first user cd_values[], unless
+ * `H5Z_SPERR_make_components(n)` is added to the missing value mode: the user cd_values[] then
+ * end with `n` more outputs of `H5Z_SPERR_make_cd_values()`, one for each of the `n` components
+ * in the order of the compound members or array elements. It rides in bits COMPONENT_SHIFT to
+ * COMPONENT_SHIFT + 2 of the missing value mode.
+ */
+#define COMPONENT_SHIFT 14
+
+static inline unsigned int H5Z_SPERR_make_components(int n)
+{
+  assert(n >= 0 && n <= H5Z_SPERR_MAX_COMPONENTS);
+
+  return (unsigned int)n << COMPONENT_SHIFT;
+}
+
 #endif
@@ -0,0 +1,28 @@
+/*
+ * This file contains the process-wide cache of decoded chunks.
+ *
+ * HDF5 drops its own chunk cache when a dataset is closed, so an application that opens, reads,
+ * and closes the same variable over and over pays for the full SPERR decoding each time.
+ * This cache lives as long as the process does, and is keyed by the encoded chunk bytes,
+ * salted with a hash of the cd_values[] of the dataset.
+ *
+ * It is opt-in: its capacity defaults to 0, and the environment variable
+ * `H5ZSPERR_CHUNK_CACHE_MB` or `H5Z_SPERR_set_chunk_cache()` (see h5z-sperr-chunk.h) sets it.
+ */
+
+#ifndef H5ZSPERR_CHUNK_CACHE_H
+#define H5ZSPERR_CHUNK_CACHE_H
+
+#include "h5zsperr_lru_cache.h"
+
+namespace h5zsperr {
+
+/* Decoded chunks, as raw bytes. */
+using ChunkCache = LruCache<std::vector<uint8_t>>;
+
+/* The chunk cache shared by the whole process. */
+ChunkCache& chunk_cache();
+
+}  // namespace h5zsperr
+
+#endif
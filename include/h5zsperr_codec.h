@@ -0,0 +1,276 @@
+/*
+ * This file contains `ChunkCodec<T>`, which encodes and decodes a single chunk in the exact
+ * format that H5Z-SPERR stores in HDF5 files:
+ * -- 1 byte: the real missing value mode of this chunk, which is never 6 (auto detection picks
+ *    one of modes 0, 1, 2, and 5 for each chunk). With automatic rank swaps, the highest bit
+ *    of this byte tells whether this chunk is swapped. In a double dataset, the next bit tells
+ *    whether this chunk went through SPERR as floats.
+ * -- 8 bytes: the max point-wise error this chunk achieved as a double, in compression mode 4.
+ *    It is the PWE tolerance unless the bitrate cap kicked in.
+ *    In compression mode 5: the range of the valid values of this chunk as a double, which
+ *    scales the relative PWE tolerance.
+ * -- 4 or 8 bytes: the value being replaced, in missing value mode 2, 3, or 4.
+ *    In missing value mode 5: 1 byte for the number of distinct missing values (K) present,
+ *    K values, and 4 bytes for the length of the class map.
+ *    0 byte: in missing value mode 0 or 1.
+ * -- A compact bitmask, in missing value mode 1 to 5.
+ *    0 byte: in missing value mode 0.
+ * -- A class map telling which of the K values each missing location has, in missing value
+ *    mode 5 when K > 1. It is a sequence of runs over the missing locations, each run being
+ *    1 byte for the value index and then the run length as a LEB128 varint.
+ * -- The regular SPERR bitstream.
+ *    With sub-blocks: 4 bytes for the number of sub-blocks (N), N times 4 bytes for where each
+ *    sub-block's bitstream ends (relative to the first one), and then the N SPERR bitstreams.
+ *
+ * Chunks of 16-bit values (see `narrow_type`) are converted to floats and encoded as such; decoding
+ * converts them back.
+ *
+ * Chunks of compound or array values (see `H5Z_SPERR_make_components()`) hold each component
+ * encoded as above: 4 bytes for where each component ends (relative to the first one), and then
+ * the encoded components, one after another.
+ *
+ * The HDF5 filter, `H5Z_filter_sperr()`, is a thin wrapper of this class, so other tools
+ * (e.g., parallel writers and readers) go through exactly the same code path.
+ * A codec owns its working buffers and reuses them across calls; it is move-only.
+ */
+
+#ifndef H5ZSPERR_CODEC_H
+#define H5ZSPERR_CODEC_H
+
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "h5zsperr_helper.h"
+#include "h5zsperr_mask_cache.h"
+
+namespace h5zsperr {
+
+/*
+ * Parameters of a chunk, as decoded from the cd_values[] assembled by `H5Z_set_local_sperr()`.
+ */
+struct ChunkParams {
+  int rank = 0;
+  int is_float = 0;
+  int missing_val_mode = 0; /* user-requested missing value mode; 6 means detect per chunk */
+  double missing_val = 0.0; /* the exact missing value, in missing value mode 3 or 4 */
+  int num_sentinels = 0;    /* the distinct missing values, in missing value mode 5 */
+  double sentinels[H5Z_SPERR_MAX_SENTINELS] = {};
+  int magic = 0;
+  int comp_mode = 0;
+  double quality = 0.0;
+  double max_bpp = 0.0; /* the bitrate cap, in compression mode 4 */
+  int swap = 0; /* 0, 1, or H5Z_SPERR_SWAP_AUTO */
+  size_t subblock = 0; /* the edge length of independent sub-blocks; 0 means no sub-blocks */
+  int effort = 0;      /* H5Z_SPERR_EFFORT_BALANCED, _FAST, or _MAX */
+  size_t dims[3] = {0, 0, 0}; /* in the order passed to SPERR, i.e., after any rank swap;
+                                 with automatic swaps, before the swap of each chunk */
+  int ncomp = 0;        /* floating-point components of compound or array values; 0 if plain */
+  size_t elem_size = 0; /* the bytes of a value made of components */
+  size_t comp_offset[H5Z_SPERR_MAX_COMPONENTS] = {};      /* where each component starts */
+  unsigned int comp_word[H5Z_SPERR_MAX_COMPONENTS] = {}; /* compression specifics of each */
+  int source = 0; /* the 16-bit type (`narrow_type`) of values compressed as floats; 0 if none */
+
+  size_t nelem() const { return dims[0] * dims[1] * dims[2]; }
+  size_t value_bytes() const { return ncomp ? elem_size : source ? 2 : (is_float ? 4 : 8); }
+  size_t raw_bytes() const { return nelem() * value_bytes(); }
+
+  /* The parameters of component `c` on its own, as a chunk of plain values. */
+  ChunkParams component(int c) const;
+};
+
+/* Whether a value is missing in the missing value mode of `p`, as the codec tells them apart. */
+template <typename T>
+bool is_missing(const ChunkParams& p, T v)
+{
+  const T large = (sizeof(T) == 4) ? T(LARGE_MAGNITUDE_F) : T(LARGE_MAGNITUDE_D);
+  switch (p.missing_val_mode) {
+    case 0:
+      return false;
+    case 1:
+      return std::isnan(v);
+    case 2:
+      return std::abs(v) >= large;
+    case 3:
+    case 4:
+      return std::isnan(p.missing_val) ? std::isnan(v) : v == T(p.missing_val);
+    case 5:
+      for (int i = 0; i < p.num_sentinels; i++)
+        if (std::isnan(p.sentinels[i]) ? std::isnan(v) : v == T(p.sentinels[i]))
+          return true;
+      return false;
+    default:
+      return std::isnan(v) || std::abs(v) >= large;
+  }
+}
+
+/* Fill `params` from cd_values[]. Returns H5ZSPERR_OK or an error status. */
+int parse_cd_values(size_t cd_nelmts, const unsigned int cd_values[], ChunkParams* params);
+
+/*
+ * How sub-blocks tile a chunk: in its memory order, i.e., the fastest varying axis first,
+ * regardless of any rank swap. Each axis holds max(1, floor(dim / edge)) sub-blocks, and the last
+ * one takes what's left, so sub-blocks are never thinner than the edge length unless the chunk is.
+ * Sub-blocks are numbered with the first axis varying the fastest. Without sub-blocks, the whole
+ * chunk is a single sub-block.
+ */
+struct BlockGrid {
+  size_t dims[3] = {1, 1, 1};    /* the chunk dimensions */
+  size_t edge = 0;               /* the edge length of sub-blocks */
+  size_t nblocks[3] = {1, 1, 1}; /* the number of sub-blocks along each axis */
+
+  explicit BlockGrid(const ChunkParams& params);
+  size_t count() const { return nblocks[0] * nblocks[1] * nblocks[2]; }
+  void block(size_t b, size_t origin[3], size_t extent[3]) const;
+};
+
+/*
+ * Whether H5Z_SPERR_EFFORT_FAST compresses chunks of `params` any differently from
+ * H5Z_SPERR_EFFORT_BALANCED: only 3D chunks whose SPERR streams (the whole chunk, or each
+ * sub-block) are longer than FAST_SPERR_CHUNK along some axis, or whose rank orders are swapped
+ * automatically, are.
+ */
+bool fast_effort_applies(const ChunkParams& params);
+
+/*
+ * Where each piece of an encoded chunk lives; offsets are in bytes from the start of the chunk.
+ * A field of zero bytes isn't present.
+ */
+struct ChunkLayout {
+  int missing_mode = 0;                   /* the real missing value mode of this chunk */
+  double max_error = 0.0;                 /* the achieved max point-wise error, in mode 4 */
+  double range = 0.0;                     /* the range of the valid values, in mode 5 */
+  int swapped = 0;                        /* whether this chunk is swapped, with auto swaps */
+  int demoted = 0;                        /* whether this double chunk is compressed as floats */
+  int residual = 0;                       /* whether this chunk holds residuals along time */
+  size_t fill_offset = 0, fill_bytes = 0; /* all K values in missing value mode 5 */
+  size_t mask_offset = 0, mask_bytes = 0;
+  size_t class_offset = 0, class_bytes = 0;
+  size_t sperr_offset = 0, sperr_bytes = 0;
+};
+
+/*
+ * The bit of the first byte of a chunk that marks residuals against a keyframe, which only
+ * `H5Z_SPERR_read_temporal()` can make sense of; decoding such chunks otherwise fails.
+ */
+constexpr uint8_t residual_flag = 0x20;
+
+/*
+ * Find the layout of an encoded chunk of `chunk_len` bytes by looking at its first `head_len`
+ * bytes only, which don't need to cover the bitmask or the SPERR bitstream.
+ * The first 64 bytes are always enough.
+ */
+int parse_chunk_layout(const ChunkParams& params,
+                       const void* head,
+                       size_t head_len,
+                       size_t chunk_len,
+                       ChunkLayout* layout);
+
+template <typename T>
+class ChunkCodec {
+ public:
+  ChunkCodec() = default;
+  ChunkCodec(const ChunkCodec&) = delete;
+  ChunkCodec& operator=(const ChunkCodec&) = delete;
+  ChunkCodec(ChunkCodec&&) = default;
+  ChunkCodec& operator=(ChunkCodec&&) = default;
+
+  /* The data type described by `params` has to match `T`. */
+  int set_params(const ChunkParams& params);
+  const ChunkParams& params() const { return m_params; }
+
+  /*
+   * Encode a chunk of `nelem` values, which has to match the chunk dimensions.
+   * `encode_inplace()` may overwrite missing values in `buf` during the process;
+   * `encode()` leaves `buf` untouched and works on an internal copy if needed.
+   * The encoded chunk is kept in the codec until the next encode.
+   */
+  int encode_inplace(T* buf, size_t nelem);
+  int encode(const T* buf, size_t nelem);
+  size_t encoded_size() const { return m_head.size() + m_sperr_len; }
+  void copy_encoded(void* dst) const;
+
+  /*
+   * Scale the PWE tolerance of each sub-block by a factor, so that some parts of a chunk are kept
+   * more accurately than others, in encodings until the next `set_params()`. There are
+   * `BlockGrid::count()` factors, one for the whole chunk without sub-blocks; nullptr goes back
+   * to a uniform tolerance. Only the PWE compression modes (3, 4, and 5) take factors.
+   */
+  int set_tolerance_scales(const float* scales, size_t n);
+
+  /*
+   * Decode an encoded chunk into `dst`, which holds `nelem` values.
+   * `dst` may alias `src`: the output is written only after the input is completely consumed.
+   */
+  int decode(const void* src, size_t src_len, T* dst, size_t nelem);
+
+  /*
+   * Decode the region of `count` values starting at `start` of an encoded chunk into `dst`,
+   * which holds the product of `count` values. `start` and `count` have `rank` elements, in the
+   * HDF5 (C) order. With sub-blocks, only the sub-blocks that overlap the region are decoded.
+   */
+  int decode_region(const void* src,
+                    size_t src_len,
+                    const size_t start[],
+                    const size_t count[],
+                    T* dst);
+
+ private:
+  struct free_deleter {
+    void operator()(void* p) const { std::free(p); }
+  };
+
+  ChunkParams m_params;
+  size_t m_dims[3] = {0, 0, 0};    /* dimensions of the current chunk, as passed to SPERR */
+  std::vector<uint64_t> m_bits;    /* naive bitmask */
+  std::shared_ptr<MaskRuns> m_runs; /* runs of missing values; reused unless the cache shares it */
+  std::vector<uint64_t> m_compact; /* compact bitmask; 64-bit words as required by icecream */
+  std::vector<uint8_t> m_classes;  /* missing value index of each missing location, in mode 5 */
+  std::vector<uint8_t> m_head;     /* everything in front of the SPERR bitstream */
+  std::vector<T> m_work;           /* a copy of the input, when it cannot be modified in place */
+  std::vector<float> m_demoted;    /* a double chunk as floats, when float precision suffices */
+  std::vector<uint8_t> m_block;    /* a sub-block being compressed */
+  std::vector<double> m_scales;    /* tolerance factor of each sub-block; empty means uniform */
+  std::unique_ptr<uint8_t, free_deleter> m_sperr; /* allocated by SPERR using malloc() */
+  size_t m_sperr_len = 0;
+
+  int m_encode(const T* src, T* scratch, size_t nelem);
+  int m_auto_mode(const T* src, double* vals, int* nvals);
+  void m_encode_classes(const T* src, size_t nmissing, const double* vals, int nvals);
+  int m_decode_missing(const uint8_t* src,
+                       const ChunkLayout& layout,
+                       size_t nelem,
+                       std::shared_ptr<const MaskRuns>* runs);
+  template <typename Put>
+  int m_put_missing(const ChunkLayout& layout,
+                    const uint8_t* fill,
+                    const MaskRuns* runs,
+                    Put put) const;
+  void m_set_dims(bool swapped);
+  bool m_pick_swap(const T* buf) const;
+  int m_sperr_encode(const T* buf);
+  int m_sperr_encode_dims(const T* buf);
+  int m_sperr_compress(const void* buf,
+                       int is_float,
+                       int mode,
+                       double quality,
+                       double margin = 0.0);
+  int m_sperr_decompress(const uint8_t* src, size_t src_len, int is_float, void** dst) const;
+  int m_sperr_compress_one(const void* buf,
+                           int is_float,
+                           const size_t dims[3],
+                           int mode,
+                           double quality,
+                           void** dst,
+                           size_t* dst_len) const;
+  int m_sperr_decompress_one(const uint8_t* src,
+                             size_t src_len,
+                             int is_float,
+                             const size_t dims[3],
+                             void** dst) const;
+};
+
+}  // namespace h5zsperr
+
+#endif
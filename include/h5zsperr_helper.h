@@ -7,9 +7,17 @@
 
 #include <stdlib.h>
 
+#include "h5z-sperr-chunk.h"
+
 #define LARGE_MAGNITUDE_F 1e35f
 #define LARGE_MAGNITUDE_D 1e35
-#define H5ZSPERR_COMPATIBILITY 1
+/*
+ * The format generation written into cd_values[0]: 0 for 0.1.x, 1 for chunks that start with
+ * their missing value mode, and 2 since the mode byte carries flags and chunks may hold header
+ * fields, sub-block indexes, components, or 16-bit values. Readers of an older generation reject
+ * newer files with a version error, and this reader accepts all generations up to its own.
+ */
+#define H5ZSPERR_COMPATIBILITY 2
 
 #ifdef __cplusplus
 namespace C_API {
@@ -53,6 +61,28 @@ double h5zsperr_treat_nan_f64(double* data_buf, size_t nelem);
 float h5zsperr_treat_large_mag_f32(float* data_buf, size_t nelem);
 double h5zsperr_treat_large_mag_f64(double* data_buf, size_t nelem);
 
+/*
+ * Put `fill_val` at every location marked by a 1 in the naive (i.e., decoded) bitmask `mask`.
+ */
+void h5zsperr_fill_mask_f32(float* data_buf, size_t nelem, const void* mask, float fill_val);
+void h5zsperr_fill_mask_f64(double* data_buf, size_t nelem, const void* mask, double fill_val);
+
+/*
+ * Encode and decode a chunk using the parameters in `cd_values[]`, through a per-thread
+ * `ChunkCodec`. These functions are what `H5Z_filter_sperr()` calls; they return a status code.
+ * -- `h5zsperr_chunk_encode()` may overwrite missing values in `buf`, and keeps the size of the
+ *    encoded chunk in `encoded_len`. The encoded chunk is then copied out by
+ *    `h5zsperr_chunk_copy_encoded()`, which needs to be called on the same thread.
+ * -- `h5zsperr_chunk_decode()` writes the decoded chunk to `dst`, which may alias `src`.
+ *    `dst_bytes` has to be at least `h5zsperr_chunk_raw_bytes()`.
+ */
+int h5zsperr_chunk_encode(size_t cd_nelmts, const unsigned int cd_values[],
+                          void* buf, size_t nbytes, size_t* encoded_len);
+void h5zsperr_chunk_copy_encoded(void* dst);
+int h5zsperr_chunk_decode(size_t cd_nelmts, const unsigned int cd_values[],
+                          const void* src, size_t nbytes, void* dst, size_t dst_bytes);
+size_t h5zsperr_chunk_raw_bytes(size_t cd_nelmts, const unsigned int cd_values[]);
+
 #ifdef __cplusplus
 } /* end of extern "C" */
 } /* end of namespace C_API */
@@ -0,0 +1,111 @@
+/*
+ * This file contains the low-level kernels used by the H5Z-SPERR helper and mask routines:
+ * missing value detection, bitmask packing, mean accumulation, value replacement, and value range,
+ * as well as the conversion of 16-bit values to and from floats.
+ *
+ * Every kernel has a portable scalar version. On x86-64, AVX2 and AVX-512 versions are also
+ * compiled using function-level target attributes, so no special compiler flags are needed.
+ * The best version that the running CPU supports is picked at runtime, which keeps a single
+ * plugin binary working on older nodes while still being fast on newer ones.
+ * The environment variable `H5ZSPERR_SIMD` (`scalar`, `avx2`, or `avx512`) caps the
+ * instruction set that will be used.
+ */
+
+#ifndef H5ZSPERR_KERNELS_H
+#define H5ZSPERR_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace h5zsperr {
+
+enum class simd_isa { scalar = 0, avx2 = 1, avx512 = 2 };
+
+/*
+ * `simd_supported()` returns the best instruction set supported by the CPU;
+ * `simd_active()` returns the instruction set currently in use;
+ * `simd_select()` requests an instruction set, and returns the one actually selected,
+ *                 which is capped by what the CPU supports.
+ */
+simd_isa simd_supported();
+simd_isa simd_active();
+simd_isa simd_select(simd_isa isa);
+const char* simd_name(simd_isa isa);
+
+/*
+ * Describe which values are considered missing:
+ *   nan:       std::isnan(v);
+ *   large_mag: std::abs(v) >= val;
+ *   equal:     v == val.
+ */
+enum class missing_kind { nan, large_mag, equal };
+
+template <typename T>
+struct missing_test {
+  missing_kind kind = missing_kind::nan;
+  T val = T{0};
+};
+
+/* Return the index of the first missing value, or `nelem` if there's none. */
+template <typename T>
+size_t kernel_find(const T* buf, size_t nelem, missing_test<T> test);
+
+/*
+ * Write a naive bitmask of the missing values into `bits`, which needs to hold
+ * at least (nelem + 63) / 64 words. Bit `i` of the mask is bit `i % 64` of word `i / 64`,
+ * which is the same layout as produced by `icecream_wbit()`.
+ * Returns the number of missing values.
+ */
+template <typename T>
+size_t kernel_make_bits(const T* buf, size_t nelem, missing_test<T> test, uint64_t* bits);
+
+/*
+ * Same as `kernel_make_bits()`, except that a value is missing when it passes any of the
+ * `ntests` (at most 8) tests. All tests are applied in a single pass over `buf`.
+ */
+template <typename T>
+size_t kernel_make_bits_multi(const T* buf,
+                              size_t nelem,
+                              const missing_test<T>* tests,
+                              size_t ntests,
+                              uint64_t* bits);
+
+/* Whether a single value passes a test. */
+template <typename T>
+bool kernel_is_missing(T val, missing_test<T> test);
+
+/* Return the sum of all non-missing values, and keep their count in `valid_cnt`. */
+template <typename T>
+double kernel_sum_valid(const T* buf, size_t nelem, missing_test<T> test, size_t* valid_cnt);
+
+/* Replace every missing value with `val`. */
+template <typename T>
+void kernel_replace(T* buf, size_t nelem, missing_test<T> test, T val);
+
+/* Set every location whose bit is 1 in the naive bitmask `bits` to `val`. */
+template <typename T>
+void kernel_fill_bits(T* buf, size_t nelem, const uint64_t* bits, T val);
+
+/* Find the smallest and largest of `nelem` (at least one) values, none of which is a NaN. */
+template <typename T>
+void kernel_minmax(const T* buf, size_t nelem, T* min, T* max);
+
+/*
+ * 16-bit types that the filter converts to floats before compression, and back afterwards.
+ * The values are the same as stored in cd_values[] (see `ChunkParams::source`).
+ */
+enum class narrow_type { int16 = 1, uint16 = 2, float16 = 3 };
+
+/* Convert `nelem` values of `type` in `src` to floats, exactly. */
+void kernel_widen(const void* src, size_t nelem, narrow_type type, float* dst);
+
+/*
+ * Convert `nelem` floats to values of `type` in `dst`. Integers are rounded to the nearest one
+ * (ties to even) and saturate at the limits of the type, NaNs becoming the lowest value;
+ * half-precision values are rounded to the nearest (ties to even), and overflow to infinity.
+ */
+void kernel_narrow(const float* src, size_t nelem, narrow_type type, void* dst);
+
+}  // namespace h5zsperr
+
+#endif
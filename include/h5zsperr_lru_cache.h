@@ -0,0 +1,201 @@
+/*
+ * This file contains `LruCache<V>`, which the process-wide caches of H5Z-SPERR are built upon.
+ *
+ * Entries are keyed by a byte string (e.g., a compact bitmask or an encoded chunk) plus a 64-bit
+ * salt that tells apart keys of different meanings (e.g., chunk sizes). Lookups go through a fast
+ * 64-bit hash, and every entry keeps its key bytes, so a hash collision is a miss rather than a
+ * wrong value. Values are shared, so they stay valid for whoever holds them after being evicted.
+ *
+ * The cache is a least-recently-used list bounded by the number of bytes it holds, keys included,
+ * and is safe to use from multiple threads. A capacity of 0 disables it.
+ * The size of a value is given by an overload of `cached_bytes()`.
+ */
+
+#ifndef H5ZSPERR_LRU_CACHE_H
+#define H5ZSPERR_LRU_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace h5zsperr {
+
+/* A fast 64-bit hash that consumes 8 bytes at a time; it doesn't need to be cryptographic. */
+inline uint64_t hash_bytes(const void* data, size_t len, uint64_t seed)
+{
+  constexpr uint64_t mul = 0x9E3779B97F4A7C15ull;
+  const auto* p = static_cast<const uint8_t*>(data);
+  uint64_t h = (uint64_t(len) * mul) ^ seed;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w = 0;
+    std::memcpy(&w, p + i, 8);
+    h = (h ^ w) * mul;
+    h ^= h >> 29;
+  }
+  if (i < len) {
+    uint64_t w = 0;
+    std::memcpy(&w, p + i, len - i);
+    h = (h ^ w) * mul;
+    h ^= h >> 29;
+  }
+  return h ^ (h >> 32);
+}
+
+inline size_t cached_bytes(const std::vector<uint8_t>& val)
+{
+  return val.size();
+}
+
+template <typename V>
+class LruCache {
+ public:
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+  };
+
+  explicit LruCache(size_t capacity_bytes) : m_capacity(capacity_bytes) {}
+  LruCache(const LruCache&) = delete;
+  LruCache& operator=(const LruCache&) = delete;
+
+  /* Look up the value of a key of `len` bytes; nullptr when it isn't cached. */
+  std::shared_ptr<const V> find(const void* key, size_t len, uint64_t salt)
+  {
+    const uint64_t hash = hash_bytes(key, len, salt);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_capacity == 0)
+      return nullptr;
+    auto it = m_index.find(hash);
+    if (it == m_index.end() || it->second->salt != salt || it->second->key.size() != len ||
+        std::memcmp(it->second->key.data(), key, len) != 0) {
+      m_misses++;
+      return nullptr;
+    }
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    m_hits++;
+    return it->second->val;
+  }
+
+  /* Keep a value, evicting the least recently used entries as needed. */
+  void insert(std::vector<uint8_t> key, uint64_t salt, std::shared_ptr<const V> val)
+  {
+    const size_t bytes = sizeof(Entry) + key.size() + cached_bytes(*val);
+    const uint64_t hash = hash_bytes(key.data(), key.size(), salt);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (bytes > m_capacity)
+      return;
+
+    /* An entry of the same hash is replaced, whether it has the same key or not. */
+    auto it = m_index.find(hash);
+    if (it != m_index.end()) {
+      m_bytes -= it->second->bytes;
+      m_lru.erase(it->second);
+      m_index.erase(it);
+    }
+    m_evict(m_capacity - bytes);
+
+    auto entry = Entry();
+    entry.hash = hash;
+    entry.salt = salt;
+    entry.key = std::move(key);
+    entry.val = std::move(val);
+    entry.bytes = bytes;
+    m_lru.push_front(std::move(entry));
+    m_index[hash] = m_lru.begin();
+    m_bytes += bytes;
+  }
+
+  void insert(const void* key, size_t len, uint64_t salt, std::shared_ptr<const V> val)
+  {
+    const auto* p = static_cast<const uint8_t*>(key);
+    insert(std::vector<uint8_t>(p, p + len), salt, std::move(val));
+  }
+
+  void set_capacity(size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_capacity = bytes;
+    m_evict(bytes);
+  }
+
+  size_t capacity() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_capacity;
+  }
+
+  Stats stats() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto s = Stats();
+    s.hits = m_hits;
+    s.misses = m_misses;
+    s.entries = m_lru.size();
+    s.bytes = m_bytes;
+    return s;
+  }
+
+  /* Drop all entries, and reset the counters. */
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lru.clear();
+    m_index.clear();
+    m_bytes = 0;
+    m_hits = 0;
+    m_misses = 0;
+  }
+
+ private:
+  struct Entry {
+    uint64_t hash = 0;
+    uint64_t salt = 0;
+    std::vector<uint8_t> key;
+    std::shared_ptr<const V> val;
+    size_t bytes = 0;
+  };
+
+  mutable std::mutex m_mutex;
+  std::list<Entry> m_lru; /* the most recently used at the front */
+  std::unordered_map<uint64_t, typename std::list<Entry>::iterator> m_index;
+  size_t m_capacity = 0;
+  size_t m_bytes = 0;
+  size_t m_hits = 0;
+  size_t m_misses = 0;
+
+  void m_evict(size_t budget)
+  {
+    while (m_bytes > budget && !m_lru.empty()) {
+      m_bytes -= m_lru.back().bytes;
+      m_index.erase(m_lru.back().hash);
+      m_lru.pop_back();
+    }
+  }
+};
+
+/* Read a cache capacity in MiB from an environment variable, or use `default_mb`. */
+inline size_t cache_capacity_from_env(const char* name, size_t default_mb)
+{
+  size_t mb = default_mb;
+  const char* env = std::getenv(name);
+  if (env && *env) {
+    char* end = nullptr;
+    const unsigned long long val = std::strtoull(env, &end, 10);
+    if (end && *end == '\0')
+      mb = size_t(val);
+  }
+  return mb * 1024 * 1024;
+}
+
+}  // namespace h5zsperr
+
+#endif
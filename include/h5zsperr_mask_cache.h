@@ -0,0 +1,47 @@
+/*
+ * This file contains the process-wide cache of decoded missing value masks.
+ *
+ * In time-series datasets, every chunk at the same spatial position usually carries the same
+ * mask (e.g., land in an ocean model), so decoding the compact bitmask again for each time step
+ * is wasted work. The cache is keyed by the compact bitmask bytes and the number of values
+ * it covers, and keeps the decoded mask as a list of runs of missing values, so fill values are
+ * written run by run.
+ *
+ * Its capacity defaults to 64 MiB, and the environment variable `H5ZSPERR_MASK_CACHE_MB`
+ * overrides it; a capacity of 0 disables the cache.
+ */
+
+#ifndef H5ZSPERR_MASK_CACHE_H
+#define H5ZSPERR_MASK_CACHE_H
+
+#include "h5zsperr_lru_cache.h"
+
+namespace h5zsperr {
+
+/*
+ * A run of `len` consecutive missing values starting at `start`; a chunk never holds 2^32 values.
+ */
+struct MaskRun {
+  uint32_t start = 0;
+  uint32_t len = 0;
+};
+
+using MaskRuns = std::vector<MaskRun>;
+
+inline size_t cached_bytes(const MaskRuns& runs)
+{
+  return runs.size() * sizeof(MaskRun);
+}
+
+/* Convert a naive bitmask of `nelem` bits into runs. */
+void mask_bits_to_runs(const uint64_t* bits, size_t nelem, MaskRuns* runs);
+
+/* Keyed by the compact bitmask, salted with the number of values. */
+using MaskCache = LruCache<MaskRuns>;
+
+/* The mask cache shared by the whole process. */
+MaskCache& mask_cache();
+
+}  // namespace h5zsperr
+
+#endif
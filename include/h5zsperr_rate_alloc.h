@@ -0,0 +1,78 @@
+/*
+ * This file contains the pieces of dataset-wide rate allocation.
+ *
+ * A PSNR target per chunk (compression mode 2) spends as many bits on a smooth chunk as on a
+ * busy one, although the error that matters is usually that of the dataset as a whole. Instead,
+ * each chunk is encoded at a ladder of fixed bitrates to find out what each rate costs and how
+ * much error it leaves, and then one rate is picked for every chunk so that the total squared
+ * error stays within a budget at the smallest total size. The picks minimize
+ * `bytes + lambda * sse` for each chunk, with the smallest `lambda` that meets the budget.
+ *
+ * Chunks encoded at a fixed bitrate decode like those of modes 2 and 3, so the picked encodings
+ * are stored in datasets of those modes as they are.
+ */
+
+#ifndef H5ZSPERR_RATE_ALLOC_H
+#define H5ZSPERR_RATE_ALLOC_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * The dataset attribute, a double, that holds the PSNR in dB which a dataset meets as a whole
+ * when its chunks are encoded at allocated bitrates. Their cd_values[] still say compression
+ * mode 2, but no single chunk is held to the PSNR there.
+ */
+#define H5Z_SPERR_PSNR_ATTR "H5Z-SPERR dataset PSNR"
+
+namespace h5zsperr {
+
+/* The cost and the error of a chunk at one bitrate. */
+struct RatePoint {
+  size_t bytes = 0; /* of the encoded chunk */
+  double sse = 0.0; /* the sum of squared errors over the valid values */
+};
+
+/* The extent of the valid, i.e., finite and not missing, values of a chunk. */
+struct ValueStats {
+  double lo = 0.0, hi = 0.0;
+  size_t nvalid = 0;
+
+  void merge(const ValueStats& other);
+};
+
+/* The bitrates that chunks of floats or doubles are tried at, from the lowest. */
+std::vector<double> trial_bitrates(bool is_float);
+
+/*
+ * Encode a chunk once for each of the `nrates` compression words in `rate_words`, each of which
+ * replaces `cd_values[1]`, and decode it again to measure the error. `points` receives one entry
+ * per word, and `stats` the extent of the valid values. Compound, array, and 16-bit values
+ * aren't supported.
+ * Returns H5ZSPERR_OK or a status code of h5z-sperr-chunk.h.
+ */
+int trial_encode(size_t cd_nelmts,
+                 const unsigned int cd_values[],
+                 const void* buf,
+                 size_t nbytes,
+                 const unsigned int rate_words[],
+                 size_t nrates,
+                 RatePoint points[],
+                 ValueStats* stats);
+
+/*
+ * Pick one of `nrates` points for each of `nchunks` chunks, whose points are laid out one chunk
+ * after another, so that their total squared error is at most `budget` at the smallest total
+ * size. `picks` receives the index of the point of each chunk, and `sse` their total error.
+ * Returns false when even the most accurate points exceed the budget; those are picked then.
+ */
+bool allocate_rates(const RatePoint* points,
+                    size_t nchunks,
+                    size_t nrates,
+                    double budget,
+                    size_t* picks,
+                    double* sse);
+
+}  // namespace h5zsperr
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * This file contains the optional tracing of H5Z-SPERR, which records what the filter does to
+ * each chunk (e.g., building the bitmask, replacing missing values, SPERR encoding) together with
+ * the thread and the number of bytes involved, and writes them out in the Chrome trace format.
+ * The output loads in chrome://tracing and Perfetto, next to traces of the application.
+ *
+ * Events go to a fixed-size ring buffer that threads write to without locks; when it's full,
+ * the oldest events are overwritten. Timestamps come from the monotonic clock, in microseconds.
+ * Tracing is off unless the environment variable `H5ZSPERR_TRACE` names an output file, in which
+ * case the trace is written there when the process exits, or `trace_start()` is called.
+ * A `%r` in that name stands for the MPI rank, so that the ranks of a job write separate files.
+ * `H5ZSPERR_TRACE_EVENTS` sets the size of the ring buffer (65536 events by default).
+ */
+
+#ifndef H5ZSPERR_TRACE_H
+#define H5ZSPERR_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace h5zsperr {
+
+enum class trace_event : uint8_t {
+  chunk_encode = 0,
+  chunk_decode,
+  mask_build,   /* locate missing values */
+  mask_compact, /* compact the bitmask */
+  mean_fill,    /* replace missing values with the mean */
+  sperr_encode,
+  sperr_decode,
+  mask_decode, /* find the runs of missing values */
+  fill,        /* put back the missing values */
+  assemble,    /* copy the encoded chunk out */
+  count
+};
+
+const char* trace_event_name(trace_event ev);
+
+/*
+ * `trace_start()` (re)starts tracing with a ring buffer of `max_events` events, and drops
+ * what's recorded so far; `trace_stop()` stops recording, but keeps the recorded events.
+ * Neither may run concurrently with chunks being encoded or decoded.
+ */
+void trace_start(size_t max_events);
+void trace_stop();
+bool trace_enabled();
+
+/* Write the recorded events to `path` as Chrome trace JSON. Returns 0 upon success. */
+int trace_dump(const char* path);
+
+/*
+ * Replace every `%r` in `pattern` with the rank of this process, as told by the environment
+ * variables that MPI launchers set, or with the process id when there's none.
+ */
+std::string trace_path(const char* pattern);
+
+/*
+ * A span of work, recorded as one event when it ends, i.e., when `end()` is called or
+ * the span goes out of scope. It costs an atomic load when tracing is off.
+ */
+class TraceSpan {
+ public:
+  TraceSpan(trace_event ev, size_t bytes);
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+  ~TraceSpan() { end(); }
+
+  void set_bytes(size_t bytes) { m_bytes = bytes; }
+  void end();
+
+ private:
+  trace_event m_ev;
+  bool m_active = false;
+  size_t m_bytes = 0;
+  uint64_t m_begin = 0; /* in nanoseconds */
+};
+
+}  // namespace h5zsperr
+
+#endif
@@ -15,16 +15,78 @@
 #include <H5PLextern.h>
 #include <hdf5.h>
 
-#include <SPERR_C_API.h>
 #include "h5z-sperr.h"
+#include "h5z-sperr-chunk.h"
 #include "h5zsperr_helper.h"
-#include "compactor.h"
-#include "icecream.h"
 
 #ifndef NDEBUG
 #include <stdio.h>
 #endif
 
+/*
+ * Find out the floating-point components of the values of a datatype: a float or a double is
+ * a single one, an array of them or a compound type of such members (all of the same size)
+ * has one for each element or member. Returns the number of components, or 0 if the values
+ * aren't made of floats or doubles (or have too many of them).
+ * Little-endian 16-bit integers and IEEE half-precision values are a single component too,
+ * which is compressed as floats; `is_float` is then one of the H5Z_SPERR_TYPE_* values.
+ */
+static int H5Z_sperr_components(hid_t type_id, int* is_float, size_t* elem_size, size_t offsets[])
+{
+  *elem_size = H5Tget_size(type_id);
+  const H5T_class_t cls = H5Tget_class(type_id);
+  if ((cls == H5T_INTEGER || cls == H5T_FLOAT) && *elem_size == 2) {
+    offsets[0] = 0;
+    if (H5Tget_order(type_id) != H5T_ORDER_LE || H5Tget_precision(type_id) != 16)
+      return 0;
+    if (cls == H5T_INTEGER) {
+      *is_float = H5Tget_sign(type_id) == H5T_SGN_2 ? H5Z_SPERR_TYPE_INT16 : H5Z_SPERR_TYPE_UINT16;
+      return 1;
+    }
+    size_t spos = 0, epos = 0, esize = 0, mpos = 0, msize = 0;
+    H5Tget_fields(type_id, &spos, &epos, &esize, &mpos, &msize);
+    if (spos != 15 || epos != 10 || esize != 5 || mpos != 0 || msize != 10 ||
+        H5Tget_ebias(type_id) != 15)
+      return 0;
+    *is_float = H5Z_SPERR_TYPE_FLOAT16;
+    return 1;
+  }
+  if (cls == H5T_FLOAT) {
+    *is_float = *elem_size == 4;
+    offsets[0] = 0;
+    return (*elem_size == 4 || *elem_size == 8) ? 1 : 0;
+  }
+
+  int ncomp = 0;
+  size_t esize = 0;
+  if (cls == H5T_ARRAY) {
+    hid_t base = H5Tget_super(type_id);
+    esize = H5Tget_size(base);
+    if (H5Tget_class(base) == H5T_FLOAT && (esize == 4 || esize == 8))
+      ncomp = (int)(*elem_size / esize);
+    H5Tclose(base);
+    for (int c = 0; c < ncomp && c < H5Z_SPERR_MAX_COMPONENTS; c++)
+      offsets[c] = (size_t)c * esize;
+  }
+  else if (cls == H5T_COMPOUND) {
+    ncomp = H5Tget_nmembers(type_id);
+    for (int c = 0; c < ncomp && c < H5Z_SPERR_MAX_COMPONENTS; c++) {
+      hid_t member = H5Tget_member_type(type_id, (unsigned)c);
+      const size_t msize = H5Tget_size(member);
+      if (H5Tget_class(member) != H5T_FLOAT || (msize != 4 && msize != 8) ||
+          (c > 0 && msize != esize))
+        ncomp = 0;
+      esize = msize;
+      offsets[c] = H5Tget_member_offset(type_id, (unsigned)c);
+      H5Tclose(member);
+    }
+  }
+  if (ncomp < 1 || ncomp > H5Z_SPERR_MAX_COMPONENTS)
+    return 0;
+  *is_float = esize == 4;
+  return ncomp;
+}
+
 static htri_t H5Z_can_apply_sperr(hid_t dcpl_id, hid_t type_id, hid_t space_id)
 {
   /*
@@ -33,10 +95,14 @@ static htri_t H5Z_can_apply_sperr(hid_t dcpl_id, hid_t type_id, hid_t space_id)
    * 	space_id  Dataspace identifier
    */
 
-  /* Get datatype class. Fail if not floats. */
-  if (H5Tget_class(type_id) != H5T_FLOAT) {
+  /* Get datatype class. Fail if not floats, or compound or array types of them. */
+  int is_float = 1;
+  size_t elem_size = 0;
+  size_t offsets[H5Z_SPERR_MAX_COMPONENTS];
+  if (H5Z_sperr_components(type_id, &is_float, &elem_size, offsets) == 0) {
     H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADTYPE,
-            "bad data type. Only floats are supported in H5Z-SPERR");
+            "bad data type. Only floats, compound or array types of up to 4 floats, and 16-bit "
+            "integers or half-precision floats are supported in H5Z-SPERR");
     return 0;
   }
 
@@ -122,12 +188,15 @@ static herr_t H5Z_set_local_sperr(hid_t dcpl_id, hid_t type_id, hid_t space_id)
   /*
    * Get the user-specified parameters. It has mandatory and optional fields.
    * -- One integer (mandatory): compression mode, quality, rank swap
-   * -- One integer (optional) : missing value mode
-   * -- One/two integers (optional): a float or double specifying the missing value
-   *    (not implemented)
+   * -- One integer (optional) : missing value mode; 6 (auto detection) if omitted.
+   *                              It may also ask for sub-blocks (see `H5Z_SPERR_make_subblocks()`).
+   * -- One or two integers (optional): the exact missing value in mode 3 or 4
+   * -- The number of missing values and each of them (optional): in mode 5
+   * -- The compression specifics of each component (optional): see `H5Z_SPERR_make_components()`
    */
-  size_t user_cd_nelem = 4; /* the maximum possible number */
-  unsigned int user_cd_values[4] = {0, 0, 0, 0};
+  size_t user_cd_nelem = H5Z_SPERR_MAX_CD_VALUES; /* the maximum possible number */
+  unsigned int user_cd_values[H5Z_SPERR_MAX_CD_VALUES];
+  memset(user_cd_values, 0, sizeof(user_cd_values));
   char name[16];
   for (size_t i = 0; i < 16; i++)
     name[i] = ' ';
@@ -135,117 +204,74 @@ static herr_t H5Z_set_local_sperr(hid_t dcpl_id, hid_t type_id, hid_t space_id)
   herr_t status = H5Pget_filter_by_id(dcpl_id, H5Z_FILTER_SPERR, &flags, &user_cd_nelem,
                                       user_cd_values, 16, name, &filter_config);
 
+  /* Get the floating-point components of the datatype, which are verified by `can_apply`.
+   * `is_float` may also tell a 16-bit type. */
+  int is_float = 1;
+  size_t elem_size = 0;
+  size_t offsets[H5Z_SPERR_MAX_COMPONENTS];
+  const int ncomp = H5Z_sperr_components(type_id, &is_float, &elem_size, offsets);
+  assert(ncomp > 0);
+
+  /* Get chunk sizes. */
+  hsize_t chunks[4] = {0, 0, 0, 0};
+  int ndims = H5Pget_chunk(dcpl_id, 4, chunks);
+  size_t chunk_dims[4] = {0, 0, 0, 0};
+  for (int i = 0; i < ndims; i++)
+    chunk_dims[i] = (size_t)chunks[i];
+
   /*
-   * `missing_val_mode` meaning:
-   * 0: no missing value
-   * 1: any NAN is a missing value
-   * 2: any value where abs(value) >= 1e35 is a missing value.
-   * 3: use a single 32-bit float as the missing value. (not implemented)
-   * 4: use a single 64-bit double as the missing value. (not implemented)
+   * In missing value mode 3 or 4 without the missing value itself, use the fill value
+   * of the dataset, which has to be set by the user. The fill value of values made of
+   * components isn't a single number, so it doesn't apply to them; 16-bit values are
+   * compressed as floats, and so is their fill value. The fill value is taken at the precision
+   * of the dataset, whichever of mode 3 or 4 the user asked for.
    */
-  int missing_val_mode = 0;
-  if (user_cd_nelem == 1) {
-    missing_val_mode = 0;
-  }
-  else if (user_cd_nelem == 2) {
-    missing_val_mode = user_cd_values[1];
-    if (missing_val_mode > 2) {
-#ifndef NDEBUG
-      printf("%s: %d, user_cd_nelem = %lu\n", __FILE__, __LINE__, user_cd_nelem);
-#endif
-      H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADSIZE,
-              "User cd_values[] isn't valid.");
+  const unsigned int missing_mode = user_cd_values[1] & ((1u << SUBBLOCK_SHIFT) - 1);
+  if (user_cd_nelem == 2 && (missing_mode == 3 || missing_mode == 4)) {
+    H5D_fill_value_t fill_status = H5D_FILL_VALUE_UNDEFINED;
+    H5Pfill_value_defined(dcpl_id, &fill_status);
+    if (fill_status != H5D_FILL_VALUE_USER_DEFINED || H5Tget_class(type_id) == H5T_COMPOUND ||
+        H5Tget_class(type_id) == H5T_ARRAY) {
+      H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADVALUE,
+              "Missing value mode 3 or 4 needs either the missing value or a user-defined fill "
+              "value.");
       return -1;
     }
-  }
-
-/* Mode 3 and 4 are not implemented. */
-#if 0
-  else if (user_cd_nelem == 3) {
-    missing_val_mode = user_cd_values[1];
-    if (missing_val_mode != 3) {
-#ifndef NDEBUG
-      printf("%s: %d, user_cd_nelem = %lu\n", __FILE__, __LINE__, user_cd_nelem);
-#endif
-      H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADSIZE,
-              "User cd_values[] isn't valid.");
-      return -1;
+    user_cd_values[1] &= ~((1u << SUBBLOCK_SHIFT) - 1);
+    if (is_float) {
+      user_cd_values[1] |= 3u;
+      float fill_val = 0.f;
+      H5Pget_fill_value(dcpl_id, H5T_NATIVE_FLOAT, &fill_val);
+      memcpy(&user_cd_values[2], &fill_val, sizeof(fill_val));
+      user_cd_nelem = 3;
     }
-    memcpy(&missing_val_f, &user_cd_values[2], sizeof(missing_val_f));
-  }
-  else if (user_cd_nelem == 4) {
-    missing_val_mode = user_cd_values[1];
-    if (missing_val_mode != 4) {
-#ifndef NDEBUG
-      printf("%s: %d, user_cd_nelem = %lu\n", __FILE__, __LINE__, user_cd_nelem);
-#endif
-      H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADSIZE,
-              "User cd_values[] isn't valid.");
-      return -1;
+    else {
+      user_cd_values[1] |= 4u;
+      double fill_val = 0.0;
+      H5Pget_fill_value(dcpl_id, H5T_NATIVE_DOUBLE, &fill_val);
+      memcpy(&user_cd_values[2], &fill_val, sizeof(fill_val));
+      user_cd_nelem = 4;
     }
-    memcpy(&missing_val_d, &user_cd_values[2], sizeof(missing_val_d));
   }
-#endif
 
-  else {
+  /*
+   * Assemble the meta info to be stored, in the same way as a standalone
+   * chunk encoder would do (see h5z-sperr-chunk.h).
+   */
+  unsigned int cd_values[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelems = 0;
+  int ret = H5Z_SPERR_component_cd_values(user_cd_values, user_cd_nelem, is_float, ndims,
+                                          chunk_dims, ncomp, elem_size, offsets, cd_values,
+                                          &cd_nelems);
+  if (ret) {
 #ifndef NDEBUG
     printf("%s: %d, user_cd_nelem = %lu\n", __FILE__, __LINE__, user_cd_nelem);
 #endif
     H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADSIZE,
-            "User cd_values[] has more than 4 elements.");
+            "User cd_values[] isn't valid.");
     return -1;
   }
 
-  /* Get the datatype size. It must be 4 or 8, since the float type is verified by `can_apply`. */
-  int is_float = 1;
-  if (H5Tget_size(type_id) == 8)
-    is_float = 0; /* !is_float, i.e. double */
-  else
-    assert(H5Tget_size(type_id) == 4);
-
-  /* Get chunk sizes. */
-  hsize_t chunks[4] = {0, 0, 0, 0};
-  int ndims = H5Pget_chunk(dcpl_id, 4, chunks);
-  int real_dims = 0;
-  for (int i = 0; i < 4; i++)
-    if (chunks[i] > 1)
-      real_dims++;
-  assert(real_dims == 2 || real_dims == 3);
-
-  /*
-   * Assemble the meta info to be stored.
-   * [0]  : 2D/3D, float/double, missing_val_mode, magic_number
-   * [1]  : compression specifics (user input)
-   * [2-3]: (dimx, dimy) in 2D cases.
-   * [2-4]: (dimx, dimy, dimz) in 3D cases.
-   * Followed by 0, 1, or 2 integers storing the exact missing value. (not implemented)
-   */
-  unsigned int cd_values[7] = {0, 0, 0, 0, 0, 0, 0};
-  cd_values[0] =
-      h5zsperr_pack_extra_info(real_dims, is_float, missing_val_mode, H5ZSPERR_COMPATIBILITY);
-  cd_values[1] = user_cd_values[0];
-  int i1 = 2, i2 = 0;
-  while (i2 < 4) {
-    if (chunks[i2] > 1)
-      cd_values[i1++] = (unsigned int)chunks[i2];
-    i2++;
-  }
-
-  /* figure out the length of cd_values[] */
-  size_t cd_nelems = (real_dims == 2) ? 4 : 5;
-
-  /* Mode 3 and 4 are not implemented. */
-#if 0
-  if (missing_val_mode == 3) { /* a specific float */
-    cd_nelems += 1;
-    memcpy(&cd_values[i1], &missing_val_f, sizeof(missing_val_f));
-  }
-  else if (missing_val_mode == 4) { /* a specific double */
-    cd_nelems += 2;
-    memcpy(&cd_values[i1], &missing_val_d, sizeof(missing_val_d));
-  }
-#endif
-
   H5Pmodify_filter(dcpl_id, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, cd_nelems, cd_values);
 
   return 1;
@@ -258,161 +284,34 @@ static size_t H5Z_filter_sperr(unsigned int flags,
                                size_t* buf_size,
                                void** buf)
 {
-  /* Extract info from cd_values[] */
-  int rank = 0, is_float = 0, missing_val_mode = 0, magic = 0;
-  h5zsperr_unpack_extra_info(cd_values[0], &rank, &is_float, &missing_val_mode, &magic);
-  assert(rank == 2 || rank == 3);
-  assert(is_float == 0 || is_float == 1);
-  assert(missing_val_mode >= 0 && missing_val_mode <= 2);
-  assert(cd_nelmts == (rank == 2 ? 4 : 5));
-
-  /* Support binaries from one generation back. */
-  if (magic < H5ZSPERR_COMPATIBILITY - 1 || magic > H5ZSPERR_COMPATIBILITY) {
-    H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADVALUE,
-            "This file is produced by H5Z-SPERR of a different compatibility version.");
-    return 0;
-  }
-
-  int comp_mode = 0, swap = 0;
-  double quality = 0.0;
-  H5Z_SPERR_decode_cd_values(cd_values[1], &comp_mode, &quality, &swap);
-  unsigned int dims[3] = {cd_values[2], cd_values[3], rank == 2 ? 1 : cd_values[4]};
-  if (swap) {
-    unsigned int tmp = dims[0];
-    if (rank == 2) {
-      dims[0] = dims[1];
-      dims[1] = tmp;
-    }
-    else {
-      dims[0] = dims[2];
-      dims[2] = tmp;
-    }
-  }
-
+  /*
+   * All the work happens in a `ChunkCodec` (see h5zsperr_codec.h); this function only
+   * manages the memory that HDF5 hands over.
+   */
   if (flags & H5Z_FLAG_REVERSE) { /* Decompression */
 
-    const size_t nelem = (size_t)dims[0] * dims[1] * dims[2];
-    const uint8_t* p = (uint8_t*)(*buf);
-
-    /*
-     * Since version 0.2.x, the real missing mode is explicitly stored in the first byte.
-     * However, there's no such byte storage in version 0.1.x. To be able to read binaries
-     * produced by 0.1.x, in such cases (magic == 0), real_missing_mode is always 0,
-     * and there's no byte offset.
-     * Can remove this logic when dropping support for 0.1.x.
-     */
-    int real_missing_mode = p[0];
-    size_t offset = 1;
-    if (magic == 0) {
-      real_missing_mode = 0;
-      offset = 0;
-    }
-
-    /* Save the fill value. */
-    float fill_val_f = 0.f;
-    double fill_val_d = 0.0;
-    if (real_missing_mode == 2) {
-      if (is_float)
-        memcpy(&fill_val_f, p + offset, sizeof(fill_val_f));
-      else
-        memcpy(&fill_val_d, p + offset, sizeof(fill_val_d));
-      offset += is_float ? 4 : 8;
+    size_t dst_len = h5zsperr_chunk_raw_bytes(cd_nelmts, cd_values);
+    if (dst_len == 0) {
+      H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADVALUE,
+              "cd_values[] isn't valid.");
+      return 0;
     }
 
-    /* Decode the bitmask. */
-    void* mask = NULL; /* naive bitmask */
-    size_t mask_bytes = 0;
-    if (real_missing_mode != 0) {
-      mask_bytes = (nelem + 7) / 8;
-      while (mask_bytes % 8)
-        mask_bytes++;
-      mask = malloc(mask_bytes);
-
-      size_t compact_bytes = compactor_useful_bytes(p + offset);
-      while (compact_bytes % 8)
-        compact_bytes++;
-
-      compactor_decode(p + offset, compact_bytes, mask);
-      offset += compactor_useful_bytes(p + offset);
-    }
+    /* Decode in place if the input buffer is big enough. */
+    void* dst = *buf;
+    if (dst_len > *buf_size)
+      dst = H5allocate_memory(dst_len, false);
 
-    /* Decompress the real data. */
-    void* dst = NULL; /* buffer to hold the decompressed data */
-    size_t dst_len = (is_float ? 4ul : 8ul) * nelem;
-    int ret = 0;
-    if (rank == 2)
-      ret = sperr_decomp_2d(p + offset, nbytes - offset, is_float, dims[0], dims[1], &dst);
-    else {
-      size_t dimx = 0, dimy = 0, dimz = 0;
-      ret = sperr_decomp_3d(p + offset, nbytes - offset, is_float, 1, &dimx, &dimy, &dimz, &dst);
-      assert(dimx == dims[0]);
-      assert(dimy == dims[1]);
-      assert(dimz == dims[2]);
-    }
+    int ret = h5zsperr_chunk_decode(cd_nelmts, cd_values, *buf, nbytes, dst, dst_len);
     if (ret) {
-      if (dst) {
-        free(dst);
-        dst = NULL;
-      }
-      if (mask) {
-        free(mask);
-        mask = NULL;
-      }
+      if (dst != *buf)
+        H5free_memory(dst);
       H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADVALUE,
-              "SPERR decompression failed.");
+              H5Z_SPERR_strerror(ret));
       return 0;
     }
 
-    /* Put back the fill value. */
-    if (real_missing_mode == 1) {
-      assert(mask);
-      icecream cream;
-      icecream_use_mem(&cream, mask, mask_bytes);
-      if (is_float) {
-        float* p = (float*)dst;
-        for (size_t i = 0; i < nelem; i++) {
-          if (icecream_rbit(&cream))
-            p[i] = nanf("1");
-        }
-      }
-      else {
-        double* p = (double*)dst;
-        for (size_t i = 0; i < nelem; i++) {
-          if (icecream_rbit(&cream))
-            p[i] = nan("1");
-        }
-      }
-      free(mask);
-      mask = NULL;
-    }
-    else if (real_missing_mode == 2) {
-      assert(mask);
-      icecream cream;
-      icecream_use_mem(&cream, mask, mask_bytes);
-      if (is_float) {
-        float* p = (float*)dst;
-        for (size_t i = 0; i < nelem; i++) {
-          if (icecream_rbit(&cream))
-            p[i] = fill_val_f;
-        }
-      }
-      else {
-        double* p = (double*)dst;
-        for (size_t i = 0; i < nelem; i++) {
-          if (icecream_rbit(&cream))
-            p[i] = fill_val_d;
-        }
-      }
-      free(mask);
-      mask = NULL;
-    }
-
-    if (dst_len <= *buf_size) { /* Re-use the input buffer */
-      memcpy(*buf, dst, dst_len);
-      free(dst); /* allocated by SPERR using malloc() */
-      dst = NULL;
-    }
-    else {                 /* Point to the new buffer */
+    if (dst != *buf) {     /* Point to the new buffer */
       H5free_memory(*buf); /* allocated by HDF5 */
       *buf = dst;
       *buf_size = dst_len;
@@ -423,138 +322,21 @@ static size_t H5Z_filter_sperr(unsigned int flags,
   } /* Finish Decompression */
   else { /* Compression */
 
-    /* Sanity check on the data size */
-    const size_t nelem = (size_t)dims[0] * dims[1] * dims[2];
-    if ((is_float ? 4ul : 8ul) * nelem != nbytes) {
-      H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADSIZE,
-              "Compression: input buffer len isn't right.");
-      return 0;
-    }
-
-    /* Step 1: figure out if there really exists missing values as specified. */
-    int real_missing_mode = 0;
-    if (missing_val_mode == 1 && h5zsperr_has_nan(*buf, nelem, is_float))
-      real_missing_mode = 1;
-    else if (missing_val_mode == 2 && h5zsperr_has_large_mag(*buf, nelem, is_float))
-      real_missing_mode = 2;
-
-    /* Step 2: save a compact bitmask indicating the missing value locations. */
-    size_t mask_useful_bytes = 0;
-    void* mask = NULL;
-    if (real_missing_mode != 0) {
-      size_t mask_bytes = nelem / 4; /* just pick a big enough value */
-      mask = malloc(mask_bytes);
-      int ret = 0;
-      if (real_missing_mode == 1) {
-        ret = h5zsperr_make_mask_nan(*buf, nelem, is_float, mask, mask_bytes, &mask_useful_bytes);
-      }
-      else if (real_missing_mode == 2) {
-        ret = h5zsperr_make_mask_large_mag(*buf, nelem, is_float, 
-                                           mask, mask_bytes, &mask_useful_bytes);
-      }
-
-      if (ret) {
-        free(mask);
-        H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADVALUE,
-                "SPERR compacting bitmask failed.");
-        return 0;
-      }
-    }
-
-    /* Step 3: treat the input buffer with missing values replaced. */
-    float replace_f = 0.f;
-    double replace_d = 0.0;
-    if (real_missing_mode == 1) {
-      /* not really making use of the return value */
-      if (is_float)
-        replace_f = h5zsperr_treat_nan_f32(*buf, nelem);
-      else
-        replace_d = h5zsperr_treat_nan_f64(*buf, nelem);
-    }
-    else if (real_missing_mode == 2) {
-      /* Keep the large-magnitude value to be replaced. */
-      if (is_float)
-        replace_f = h5zsperr_treat_large_mag_f32(*buf, nelem);
-      else
-        replace_d = h5zsperr_treat_large_mag_f64(*buf, nelem);
-    }
-
-    /* Step 4: SPERR compression! */
-    void* sperr = NULL; /* buffer to hold the compressed bitstream */
-    size_t sperr_len = 0;
-    int ret = 0;
-
-    if (rank == 2) {
-      ret = sperr_comp_2d(*buf, is_float, dims[0], dims[1], comp_mode, quality, 0,
-                          &sperr, &sperr_len);
-    }
-    else {
-      ret = sperr_comp_3d(*buf, is_float, dims[0], dims[1], dims[2], dims[0], dims[1], dims[2],
-                          comp_mode, quality, 1, &sperr, &sperr_len);
-    }
+    size_t out_len = 0;
+    int ret = h5zsperr_chunk_encode(cd_nelmts, cd_values, *buf, nbytes, &out_len);
     if (ret) {
-      if (sperr) {
-        free(sperr); /* allocated by SPERR using malloc() */
-        sperr = NULL;
-      }
-      if (mask) {
-        free(mask);
-        mask = NULL;
-      }
-      H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE, H5E_BADVALUE,
-              "SPERR compression failed.");
+      H5Epush(H5E_DEFAULT, __FILE__, __func__, __LINE__, H5E_ERR_CLS, H5E_PLINE,
+              ret == H5ZSPERR_ERR_SIZE ? H5E_BADSIZE : H5E_BADVALUE,
+              H5Z_SPERR_strerror(ret));
       return 0;
     }
 
-    /* Step 5: assemble the final output.
-     *
-     * The assembled output has the following format:
-     * -- 1 byte: the missing value mode.
-     * -- 4 or 8 bytes: the large-mag value being replaced, in missing value mode 2.
-     *    0 byte: in missing value mode 0 or 1.
-     * -- A compact bitmask, in missing value mode 1 or 2.
-     *    0 byte: in missing value mode 0.
-     * -- The regular SPERR bitstream.
-     */
-    size_t out_len = sperr_len + 1;
-    if (real_missing_mode == 2)
-      out_len += is_float ? 4 : 8;
-    if (real_missing_mode != 0)
-      out_len += mask_useful_bytes;
-
     if (out_len > *buf_size) { /* Need to allocate a new buffer */
       H5free_memory(*buf);
       *buf = H5allocate_memory(out_len, false);
       *buf_size = out_len;
     }
-
-    /* copy the missing value mode */
-    uint8_t* p = (uint8_t*)(*buf);
-    p[0] = (uint8_t)real_missing_mode;
-    size_t offset = 1;
-
-    /* copy the missing value to be filled */
-    if (real_missing_mode == 2) {
-      if (is_float)
-        memcpy(p + offset, &replace_f, sizeof(replace_f));
-      else
-        memcpy(p + offset, &replace_d, sizeof(replace_d));
-      offset += is_float ? 4 : 8;
-    }
-
-    /* copy the missing value mask */
-    if (real_missing_mode != 0) {
-      assert(mask);
-      memcpy(p + offset, mask, mask_useful_bytes);
-      offset += mask_useful_bytes;
-      free(mask);
-      mask = NULL;
-    }
-
-    /* copy the SPERR bitstream */
-    memcpy(p + offset, sperr, sperr_len);
-    free(sperr);
-    sperr = NULL;
+    h5zsperr_chunk_copy_encoded(*buf);
 
     return out_len;
 
@@ -0,0 +1,11 @@
+#include "h5zsperr_chunk_cache.h"
+
+namespace h5zsperr {
+
+ChunkCache& chunk_cache()
+{
+  static ChunkCache cache(cache_capacity_from_env("H5ZSPERR_CHUNK_CACHE_MB", 0));
+  return cache;
+}
+
+}  // namespace h5zsperr
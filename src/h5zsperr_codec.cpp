@@ -0,0 +1,1890 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <SPERR_C_API.h>
+#include "h5z-sperr.h"
+#include "h5zsperr_chunk_cache.h"
+#include "h5zsperr_codec.h"
+#include "h5zsperr_kernels.h"
+#include "h5zsperr_mask_cache.h"
+#include "h5zsperr_trace.h"
+
+#include "compactor.h"
+
+namespace h5zsperr {
+
+int parse_cd_values(size_t cd_nelmts, const unsigned int cd_values[], ChunkParams* params)
+{
+  if (cd_nelmts < 4)
+    return H5ZSPERR_ERR_CD_VALUES;
+
+  auto& p = *params;
+  C_API::h5zsperr_unpack_extra_info(cd_values[0], &p.rank, &p.is_float, &p.missing_val_mode,
+                                    &p.magic);
+  if (p.rank != 2 && p.rank != 3)
+    return H5ZSPERR_ERR_CD_VALUES;
+  if (p.missing_val_mode < 0 || p.missing_val_mode > 6)
+    return H5ZSPERR_ERR_CD_VALUES;
+
+  /*
+   * Mode 3 keeps a float after the chunk dimensions, and mode 4 keeps a double.
+   * Mode 5 keeps the number of missing values, and then each of them in the data type.
+   */
+  const size_t ndims = (p.rank == 2) ? 2 : 3;
+  const size_t words = p.is_float ? 1 : 2;
+  size_t nextra = (p.missing_val_mode == 3) ? 1 : (p.missing_val_mode == 4) ? 2 : 0;
+  p.num_sentinels = 0;
+  if (p.missing_val_mode == 5) {
+    if (cd_nelmts < 3 + ndims)
+      return H5ZSPERR_ERR_CD_VALUES;
+    p.num_sentinels = int(cd_values[2 + ndims]);
+    if (p.num_sentinels < 1 || p.num_sentinels > H5Z_SPERR_MAX_SENTINELS)
+      return H5ZSPERR_ERR_CD_VALUES;
+    nextra = 1 + size_t(p.num_sentinels) * words;
+  }
+  /* Compound or array values keep their size, and the offset and compression specifics of each
+   * component, at the end. */
+  p.ncomp = int((cd_values[0] >> 22) & 7u);
+  if (p.ncomp > H5Z_SPERR_MAX_COMPONENTS)
+    return H5ZSPERR_ERR_CD_VALUES;
+  const size_t ncomp_words = p.ncomp ? 1 + 2 * size_t(p.ncomp) : 0;
+  if (cd_nelmts != 2 + ndims + nextra + ncomp_words)
+    return H5ZSPERR_ERR_CD_VALUES;
+  if (p.ncomp) {
+    const unsigned int* comp = &cd_values[2 + ndims + nextra];
+    p.elem_size = comp[0];
+    for (int c = 0; c < p.ncomp; c++) {
+      p.comp_offset[c] = comp[1 + 2 * c];
+      p.comp_word[c] = comp[2 + 2 * c];
+      if (p.comp_offset[c] + (p.is_float ? 4 : 8) > p.elem_size)
+        return H5ZSPERR_ERR_CD_VALUES;
+      int mode = 0, swap = 0;
+      double quality = 0.0;
+      H5Z_SPERR_decode_cd_values(p.comp_word[c], &mode, &quality, &swap);
+      if (mode < 1 || mode > 5)
+        return H5ZSPERR_ERR_CD_VALUES;
+    }
+  }
+  /* Values of 16-bit types are compressed as floats, and can't be components. */
+  p.source = int((cd_values[0] >> 25) & 7u);
+  if (p.source > int(narrow_type::float16) || (p.source && (!p.is_float || p.ncomp)))
+    return H5ZSPERR_ERR_CD_VALUES;
+  p.missing_val = 0.0;
+  if (p.missing_val_mode == 3) {
+    float val = 0.f;
+    std::memcpy(&val, &cd_values[2 + ndims], sizeof(val));
+    p.missing_val = val;
+  }
+  else if (p.missing_val_mode == 4)
+    std::memcpy(&p.missing_val, &cd_values[2 + ndims], sizeof(p.missing_val));
+  for (int i = 0; i < p.num_sentinels; i++) {
+    const unsigned int* src = &cd_values[3 + ndims + i * words];
+    if (p.is_float) {
+      float val = 0.f;
+      std::memcpy(&val, src, sizeof(val));
+      p.sentinels[i] = val;
+    }
+    else
+      std::memcpy(&p.sentinels[i], src, sizeof(double));
+  }
+
+  /* Support binaries of all earlier generations, which don't use any of the newer fields. */
+  if (p.magic > H5ZSPERR_COMPATIBILITY)
+    return H5ZSPERR_ERR_VERSION;
+
+  p.comp_mode = 0;
+  H5Z_SPERR_decode_cd_values(cd_values[1], &p.comp_mode, &p.quality, &p.swap);
+  if (p.comp_mode < 1 || p.comp_mode > 5)
+    return H5ZSPERR_ERR_CD_VALUES;
+  p.max_bpp = H5Z_SPERR_decode_max_bpp(cd_values[1]);
+  const unsigned int subblock_log2 = (cd_values[0] >> 16) & 15u;
+  if (subblock_log2 != 0 &&
+      (subblock_log2 < SUBBLOCK_MIN_LOG2 || subblock_log2 > SUBBLOCK_MAX_LOG2))
+    return H5ZSPERR_ERR_CD_VALUES;
+  p.subblock = subblock_log2 ? (size_t{1} << subblock_log2) : 0;
+  p.effort = int((cd_values[0] >> 20) & 3u);
+  if (p.effort > H5Z_SPERR_EFFORT_MAX)
+    return H5ZSPERR_ERR_CD_VALUES;
+  p.dims[0] = cd_values[2];
+  p.dims[1] = cd_values[3];
+  p.dims[2] = (p.rank == 2) ? 1 : cd_values[4];
+  if (p.swap == 1) {
+    if (p.rank == 2)
+      std::swap(p.dims[0], p.dims[1]);
+    else
+      std::swap(p.dims[0], p.dims[2]);
+  }
+
+  return H5ZSPERR_OK;
+}
+
+ChunkParams ChunkParams::component(int c) const
+{
+  auto p = *this;
+  p.ncomp = 0;
+  p.elem_size = 0;
+  H5Z_SPERR_decode_cd_values(comp_word[c], &p.comp_mode, &p.quality, &p.swap);
+  p.max_bpp = H5Z_SPERR_decode_max_bpp(comp_word[c]);
+  if ((p.swap == 1) != (swap == 1)) {
+    if (rank == 2)
+      std::swap(p.dims[0], p.dims[1]);
+    else
+      std::swap(p.dims[0], p.dims[2]);
+  }
+  return p;
+}
+
+int parse_chunk_layout(const ChunkParams& params,
+                       const void* head,
+                       size_t head_len,
+                       size_t chunk_len,
+                       ChunkLayout* layout)
+{
+  const auto* p = static_cast<const uint8_t*>(head);
+  auto& lo = *layout;
+  lo = ChunkLayout();
+
+  /*
+   * Since version 0.2.x, the real missing mode is explicitly stored in the first byte.
+   * However, there's no such byte storage in version 0.1.x. To be able to read binaries
+   * produced by 0.1.x, in such cases (magic == 0), real_missing_mode is always 0,
+   * and there's no byte offset.
+   * Can remove this logic when dropping support for 0.1.x.
+   */
+  size_t offset = 0;
+  if (params.magic != 0) {
+    if (head_len < 1 || chunk_len < 1)
+      return H5ZSPERR_ERR_CORRUPT;
+    lo.missing_mode = p[0] & 0x1f;
+    lo.swapped = p[0] >> 7;
+    lo.demoted = (p[0] >> 6) & 1;
+    lo.residual = (p[0] & residual_flag) ? 1 : 0;
+    offset = 1;
+    if ((lo.swapped && params.swap != H5Z_SPERR_SWAP_AUTO) || (lo.demoted && params.is_float))
+      return H5ZSPERR_ERR_CORRUPT;
+  }
+  if (lo.missing_mode > 5)
+    return H5ZSPERR_ERR_CORRUPT;
+
+  /* The achieved error in compression mode 4, or the value range in compression mode 5. */
+  if (params.comp_mode == 4 || params.comp_mode == 5) {
+    if (head_len < offset + 8 || chunk_len < offset + 8)
+      return H5ZSPERR_ERR_CORRUPT;
+    std::memcpy(params.comp_mode == 4 ? &lo.max_error : &lo.range, p + offset, sizeof(double));
+    offset += 8;
+  }
+
+  /* The fill value(s), and the length of the class map in mode 5. */
+  const size_t val_bytes = params.is_float ? 4 : 8;
+  if (lo.missing_mode == 5) {
+    if (head_len < offset + 1 || chunk_len < offset + 1)
+      return H5ZSPERR_ERR_CORRUPT;
+    const size_t k = p[offset];
+    if (k < 1 || k > H5Z_SPERR_MAX_SENTINELS)
+      return H5ZSPERR_ERR_CORRUPT;
+    lo.fill_offset = offset + 1;
+    lo.fill_bytes = k * val_bytes;
+    offset = lo.fill_offset + lo.fill_bytes;
+    if (head_len < offset + 4 || chunk_len < offset + 4)
+      return H5ZSPERR_ERR_CORRUPT;
+    uint32_t class_bytes = 0;
+    std::memcpy(&class_bytes, p + offset, sizeof(class_bytes));
+    lo.class_bytes = class_bytes;
+    offset += 4;
+  }
+  else if (lo.missing_mode >= 2) {
+    lo.fill_offset = offset;
+    lo.fill_bytes = val_bytes;
+    offset += lo.fill_bytes;
+  }
+
+  /* The compact bitmask, which records its own length in the first 4 bytes. */
+  if (lo.missing_mode != 0) {
+    if (head_len < offset + 4 || chunk_len < offset + 4)
+      return H5ZSPERR_ERR_CORRUPT;
+    lo.mask_offset = offset;
+    lo.mask_bytes = compactor_useful_bytes(p + offset);
+    offset += lo.mask_bytes;
+  }
+  lo.class_offset = offset;
+  offset += lo.class_bytes;
+
+  if (chunk_len < offset)
+    return H5ZSPERR_ERR_CORRUPT;
+  lo.sperr_offset = offset;
+  lo.sperr_bytes = chunk_len - offset;
+
+  return H5ZSPERR_OK;
+}
+
+//
+// Type-specific pieces.
+//
+template <typename T>
+T nan_value();
+template <>
+float nan_value()
+{
+  return std::nanf("1");
+}
+template <>
+double nan_value()
+{
+  return std::nan("1");
+}
+
+template <typename T>
+missing_test<T> test_of_params(const ChunkParams& params)
+{
+  auto test = missing_test<T>();
+  if (params.missing_val_mode == 2) {
+    test.kind = missing_kind::large_mag;
+    test.val = (sizeof(T) == 4) ? T(LARGE_MAGNITUDE_F) : T(LARGE_MAGNITUDE_D);
+  }
+  else if ((params.missing_val_mode == 3 || params.missing_val_mode == 4) &&
+           !std::isnan(params.missing_val)) {
+    /* A NaN sentinel can never compare equal; treat it as mode 1 does. */
+    test.kind = missing_kind::equal;
+    test.val = T(params.missing_val);
+  }
+  return test;
+}
+
+template <typename T>
+missing_test<T> test_of_sentinel(double val)
+{
+  auto test = missing_test<T>();
+  if (!std::isnan(val)) {
+    test.kind = missing_kind::equal;
+    test.val = T(val);
+  }
+  return test;
+}
+
+//
+// Sub-blocks.
+//
+BlockGrid::BlockGrid(const ChunkParams& params) : edge(params.subblock)
+{
+  /* `params.dims` is in the HDF5 order unless swapped; the memory order is the reverse. */
+  std::copy(params.dims, params.dims + 3, dims);
+  if (params.swap != 1)
+    std::swap(dims[0], dims[params.rank == 2 ? 1 : 2]);
+  for (int i = 0; i < 3; i++)
+    nblocks[i] = edge ? std::max(dims[i] / edge, size_t{1}) : 1;
+}
+
+bool fast_effort_applies(const ChunkParams& params)
+{
+  if (params.rank != 3)
+    return false;
+  if (params.swap == H5Z_SPERR_SWAP_AUTO && params.subblock == 0)
+    return true;
+  /* The last sub-block along each axis is the longest one. */
+  const auto grid = BlockGrid(params);
+  for (int i = 0; i < 3; i++) {
+    const size_t longest = grid.edge ? grid.dims[i] - (grid.nblocks[i] - 1) * grid.edge
+                                     : grid.dims[i];
+    if (longest > FAST_SPERR_CHUNK)
+      return true;
+  }
+  return false;
+}
+
+void BlockGrid::block(size_t b, size_t origin[3], size_t extent[3]) const
+{
+  const size_t idx[3] = {b % nblocks[0], (b / nblocks[0]) % nblocks[1],
+                         b / (nblocks[0] * nblocks[1])};
+  for (int i = 0; i < 3; i++) {
+    origin[i] = idx[i] * edge;
+    extent[i] = (idx[i] + 1 == nblocks[i]) ? dims[i] - origin[i] : edge;
+  }
+}
+
+namespace {
+
+/*
+ * The index in front of the sub-block bitstreams: the number of sub-blocks, and then where
+ * each bitstream ends, relative to the first one, all as 4-byte integers.
+ */
+struct BlockIndex {
+  const uint8_t* ends = nullptr;
+  const uint8_t* streams = nullptr;
+  size_t count = 0;
+
+  bool parse(const uint8_t* src, size_t len, size_t nblocks)
+  {
+    uint32_t n = 0;
+    if (len < sizeof(n))
+      return false;
+    std::memcpy(&n, src, sizeof(n));
+    const size_t index_bytes = (1 + size_t(n)) * sizeof(uint32_t);
+    if (n != nblocks || len < index_bytes)
+      return false;
+    ends = src + sizeof(n);
+    streams = src + index_bytes;
+    count = n;
+    for (size_t b = 0; b < count; b++)
+      if (end(b) < begin(b))
+        return false;
+    return count == 0 || end(count - 1) == len - index_bytes;
+  }
+  size_t end(size_t b) const
+  {
+    uint32_t e = 0;
+    std::memcpy(&e, ends + b * sizeof(e), sizeof(e));
+    return e;
+  }
+  size_t begin(size_t b) const { return b ? end(b - 1) : 0; }
+  const uint8_t* stream(size_t b) const { return streams + begin(b); }
+  size_t stream_bytes(size_t b) const { return end(b) - begin(b); }
+};
+
+/* Copy a box of `len` values between two 3D arrays, the fastest varying axis first. */
+template <typename S, typename D>
+void copy_box(const S* src,
+              const size_t src_dims[3],
+              const size_t src_origin[3],
+              D* dst,
+              const size_t dst_dims[3],
+              const size_t dst_origin[3],
+              const size_t len[3])
+{
+  for (size_t z = 0; z < len[2]; z++)
+    for (size_t y = 0; y < len[1]; y++) {
+      const S* s = src + ((src_origin[2] + z) * src_dims[1] + src_origin[1] + y) * src_dims[0] +
+                   src_origin[0];
+      D* d = dst + ((dst_origin[2] + z) * dst_dims[1] + dst_origin[1] + y) * dst_dims[0] +
+             dst_origin[0];
+      std::copy(s, s + len[0], d);
+    }
+}
+
+}  // namespace
+
+//
+// ChunkCodec
+//
+template <typename T>
+int ChunkCodec<T>::set_params(const ChunkParams& params)
+{
+  /* Compound or array values go through a codec one component at a time. */
+  if (params.is_float != (sizeof(T) == 4) || params.ncomp != 0)
+    return H5ZSPERR_ERR_CD_VALUES;
+  m_params = params;
+  m_scales.clear();
+  return H5ZSPERR_OK;
+}
+
+template <typename T>
+int ChunkCodec<T>::set_tolerance_scales(const float* scales, size_t n)
+{
+  m_scales.clear();
+  if (scales == nullptr)
+    return H5ZSPERR_OK;
+  const int mode = m_params.comp_mode;
+  if ((mode != 3 && mode != 4 && mode != 5) || n != BlockGrid(m_params).count())
+    return H5ZSPERR_ERR_CD_VALUES;
+  for (size_t i = 0; i < n; i++)
+    if (!(scales[i] > 0.0f) || !std::isfinite(scales[i]))
+      return H5ZSPERR_ERR_CD_VALUES;
+  m_scales.assign(scales, scales + n);
+  return H5ZSPERR_OK;
+}
+
+template <typename T>
+int ChunkCodec<T>::encode_inplace(T* buf, size_t nelem)
+{
+  return m_encode(buf, buf, nelem);
+}
+
+template <typename T>
+int ChunkCodec<T>::encode(const T* buf, size_t nelem)
+{
+  return m_encode(buf, nullptr, nelem);
+}
+
+template <typename T>
+void ChunkCodec<T>::copy_encoded(void* dst) const
+{
+  TraceSpan span(trace_event::assemble, encoded_size());
+  auto* p = static_cast<uint8_t*>(dst);
+  std::memcpy(p, m_head.data(), m_head.size());
+  std::memcpy(p + m_head.size(), m_sperr.get(), m_sperr_len);
+}
+
+template <typename T>
+int ChunkCodec<T>::m_encode(const T* src, T* scratch, size_t nelem)
+{
+  m_head.clear();
+  m_sperr.reset();
+  m_sperr_len = 0;
+  if (nelem != m_params.nelem())
+    return H5ZSPERR_ERR_SIZE;
+
+  /* Step 1: figure out if there really exist missing values as specified, and
+   * record their locations in a naive bitmask at the same time. */
+  TraceSpan build_span(trace_event::mask_build, nelem * sizeof(T));
+  int real_missing_mode = 0;
+  size_t nmissing = 0;
+  const auto test = test_of_params<T>(m_params);
+  const size_t nwords = (nelem + 63) / 64;
+  const int mode = m_params.missing_val_mode;
+  double dict[H5Z_SPERR_MAX_SENTINELS] = {};
+  int ndict = 0;
+  if (mode == 5 || mode == 6) {
+    missing_test<T> tests[H5Z_SPERR_MAX_SENTINELS];
+    size_t ntests = 0;
+    if (mode == 5) {
+      for (int i = 0; i < m_params.num_sentinels; i++)
+        tests[ntests++] = test_of_sentinel<T>(m_params.sentinels[i]);
+    }
+    else {
+      /* NaNs, and anything as large as 1e35 in magnitude, which covers infinities and
+       * the netCDF default fill values. */
+      tests[ntests++] = missing_test<T>();
+      tests[ntests].kind = missing_kind::large_mag;
+      tests[ntests++].val = (sizeof(T) == 4) ? T(LARGE_MAGNITUDE_F) : T(LARGE_MAGNITUDE_D);
+    }
+    m_bits.resize(nwords);
+    nmissing = kernel_make_bits_multi(src, nelem, tests, ntests, m_bits.data());
+    if (nmissing && mode == 5) {
+      real_missing_mode = 5;
+      ndict = m_params.num_sentinels;
+      std::copy(m_params.sentinels, m_params.sentinels + ndict, dict);
+    }
+    else if (nmissing)
+      real_missing_mode = m_auto_mode(src, dict, &ndict);
+  }
+  else if (mode != 0) {
+    m_bits.resize(nwords);
+    if (kernel_make_bits(src, nelem, test, m_bits.data()))
+      real_missing_mode = mode;
+  }
+  build_span.end();
+  m_head.push_back(uint8_t(real_missing_mode));
+  if (m_params.comp_mode == 4 || m_params.comp_mode == 5)
+    m_head.resize(m_head.size() + 8); /* filled in by `m_sperr_encode()` */
+  if (real_missing_mode == 0)
+    return m_sperr_encode(src);
+  if (real_missing_mode == 5)
+    m_encode_classes(src, nmissing, dict, ndict);
+
+  /* Step 2: save a compact bitmask indicating the missing value locations. */
+  TraceSpan compact_span(trace_event::mask_compact, 0);
+  const size_t mask_bytes = nwords * 8;
+  const size_t comp_bytes = compactor_comp_size(m_bits.data(), mask_bytes);
+  m_compact.resize((comp_bytes + 7) / 8);
+  const size_t useful = compactor_encode(m_bits.data(), mask_bytes, m_compact.data(),
+                                         m_compact.size() * 8);
+  if (useful != comp_bytes)
+    return H5ZSPERR_ERR_MASK;
+  compact_span.set_bytes(useful);
+  compact_span.end();
+
+  /* Step 3: treat the input buffer with missing values replaced by the mean. */
+  TraceSpan fill_span(trace_event::mean_fill, nelem * sizeof(T));
+  if (scratch == nullptr) {
+    m_work.assign(src, src + nelem);
+    scratch = m_work.data();
+  }
+  if (real_missing_mode == 2) {
+    /* Keep the first large-magnitude value, which fills all missing locations. */
+    size_t first = 0;
+    while (m_bits[first] == 0)
+      first++;
+    const T orig = src[first * 64 + __builtin_ctzll(m_bits[first])];
+    const auto* b = reinterpret_cast<const uint8_t*>(&orig);
+    m_head.insert(m_head.end(), b, b + sizeof(T));
+  }
+  else if (real_missing_mode == 3 || real_missing_mode == 4) {
+    /* Keep the exact missing value, so that each chunk is self-contained. */
+    const T orig = T(m_params.missing_val);
+    const auto* b = reinterpret_cast<const uint8_t*>(&orig);
+    m_head.insert(m_head.end(), b, b + sizeof(T));
+  }
+  if (mode == 5 || mode == 6) {
+    /* Zero out all missing values so that they don't count towards the sum. */
+    kernel_fill_bits(scratch, nelem, m_bits.data(), T{0});
+    size_t cnt = 0;
+    const double sum = kernel_sum_valid(scratch, nelem, missing_test<T>(), &cnt);
+    const size_t valid_cnt = nelem - nmissing;
+    const T mean = valid_cnt ? T(sum / double(valid_cnt)) : T{0};
+    kernel_fill_bits(scratch, nelem, m_bits.data(), mean);
+  }
+  else {
+    size_t valid_cnt = 0;
+    const double sum = kernel_sum_valid(scratch, nelem, test, &valid_cnt);
+    const T mean = valid_cnt ? T(sum / double(valid_cnt)) : T{0};
+    kernel_replace(scratch, nelem, test, mean);
+  }
+
+  const auto* c = reinterpret_cast<const uint8_t*>(m_compact.data());
+  m_head.insert(m_head.end(), c, c + useful);
+  if (real_missing_mode == 5)
+    m_head.insert(m_head.end(), m_classes.begin(), m_classes.end());
+  fill_span.end();
+
+  /* Step 4: SPERR compression! */
+  return m_sperr_encode(scratch);
+}
+
+template <typename T>
+int ChunkCodec<T>::m_auto_mode(const T* src, double* vals, int* nvals)
+{
+  /*
+   * Collect the distinct values at the missing locations, and pick the cheapest encoding
+   * that restores them: mode 1 for NaNs only, mode 2 for a single other value, and mode 5
+   * otherwise. A NaN goes first in the dictionary, so that when there are more distinct
+   * values than the dictionary holds, the extra ones are restored as the last kept value
+   * instead of a NaN.
+   */
+  bool has_nan = false, overflow = false;
+  int n = 0;
+  double found[H5Z_SPERR_MAX_SENTINELS];
+  for (size_t w = 0; w < m_bits.size() && !overflow; w++) {
+    uint64_t bits = m_bits[w];
+    while (bits) {
+      const T v = src[w * 64 + __builtin_ctzll(bits)];
+      bits &= bits - 1;
+      if (std::isnan(v)) {
+        has_nan = true;
+        continue;
+      }
+      int i = 0;
+      while (i < n && found[i] != double(v))
+        i++;
+      if (i < n)
+        continue;
+      if (n == H5Z_SPERR_MAX_SENTINELS) {
+        overflow = true;
+        break;
+      }
+      found[n++] = double(v);
+    }
+  }
+
+  if (n == 0)
+    return 1;
+  if (n == 1 && !has_nan && !overflow)
+    return 2;
+  *nvals = 0;
+  if (has_nan) {
+    vals[(*nvals)++] = std::nan("1");
+    n = std::min(n, H5Z_SPERR_MAX_SENTINELS - 1);
+  }
+  for (int i = 0; i < n; i++)
+    vals[(*nvals)++] = found[i];
+  return 5;
+}
+
+template <typename T>
+void ChunkCodec<T>::m_encode_classes(const T* src, size_t nmissing, const double* vals, int nvals)
+{
+  /*
+   * Find out which missing value each missing location has, in a pass over the missing
+   * locations only. Then only the missing values that are present go to the dictionary,
+   * and `m_classes` becomes the run-length encoded class map.
+   * A location that matches none of them is assigned the last one.
+   */
+  missing_test<T> tests[H5Z_SPERR_MAX_SENTINELS];
+  for (int i = 0; i < nvals; i++)
+    tests[i] = test_of_sentinel<T>(vals[i]);
+
+  auto raw = std::vector<uint8_t>(nmissing);
+  bool present[H5Z_SPERR_MAX_SENTINELS] = {};
+  size_t idx = 0;
+  for (size_t w = 0; w < m_bits.size(); w++) {
+    uint64_t bits = m_bits[w];
+    while (bits) {
+      const T v = src[w * 64 + __builtin_ctzll(bits)];
+      uint8_t c = 0;
+      while (c + 1 < nvals && !kernel_is_missing(v, tests[c]))
+        c++;
+      raw[idx++] = c;
+      present[c] = true;
+      bits &= bits - 1;
+    }
+  }
+
+  /* The dictionary: 1 byte of count, then the values present. */
+  uint8_t remap[H5Z_SPERR_MAX_SENTINELS] = {};
+  uint8_t k = 0;
+  const size_t count_pos = m_head.size();
+  m_head.push_back(0);
+  for (int i = 0; i < nvals; i++) {
+    if (!present[i])
+      continue;
+    remap[i] = k++;
+    const T val = std::isnan(vals[i]) ? nan_value<T>() : T(vals[i]);
+    const auto* b = reinterpret_cast<const uint8_t*>(&val);
+    m_head.insert(m_head.end(), b, b + sizeof(T));
+  }
+  m_head[count_pos] = k;
+
+  /* The class map, only needed with more than one missing value present. */
+  m_classes.clear();
+  if (k > 1) {
+    for (size_t i = 0; i < nmissing;) {
+      const uint8_t c = remap[raw[i]];
+      size_t run = 1;
+      while (i + run < nmissing && remap[raw[i + run]] == c)
+        run++;
+      m_classes.push_back(c);
+      for (size_t len = run; true; len >>= 7) {
+        if (len < 128) {
+          m_classes.push_back(uint8_t(len));
+          break;
+        }
+        m_classes.push_back(uint8_t(0x80 | (len & 0x7f)));
+      }
+      i += run;
+    }
+  }
+  const uint32_t class_bytes = uint32_t(m_classes.size());
+  const auto* b = reinterpret_cast<const uint8_t*>(&class_bytes);
+  m_head.insert(m_head.end(), b, b + sizeof(class_bytes));
+}
+
+template <typename T>
+template <typename Put>
+int ChunkCodec<T>::m_put_missing(const ChunkLayout& layout,
+                                 const uint8_t* fill,
+                                 const MaskRuns* runs,
+                                 Put put) const
+{
+  if (layout.missing_mode == 0)
+    return H5ZSPERR_OK;
+  T vals[H5Z_SPERR_MAX_SENTINELS] = {nan_value<T>()};
+  const size_t k = layout.missing_mode == 5 ? layout.fill_bytes / sizeof(T) : 1;
+  std::memcpy(vals, fill, layout.fill_bytes);
+  if (k == 1) {
+    for (const auto& r : *runs)
+      put(r.start, r.len, vals[0]);
+    return H5ZSPERR_OK;
+  }
+
+  /* Walk through the runs of missing locations and the runs of the class map together. */
+  const uint8_t* map = m_classes.data();
+  const size_t map_len = m_classes.size();
+  size_t pos = 0, run = 0;
+  T val = vals[0];
+  for (const auto& r : *runs) {
+    size_t i = r.start;
+    const size_t end = size_t(r.start) + r.len;
+    while (i < end) {
+      if (run == 0) {
+        if (pos >= map_len || map[pos] >= k)
+          return H5ZSPERR_ERR_CORRUPT;
+        val = vals[map[pos++]];
+        for (int shift = 0; true; shift += 7) {
+          if (pos >= map_len || shift > 56)
+            return H5ZSPERR_ERR_CORRUPT;
+          const uint8_t byte = map[pos++];
+          run |= size_t(byte & 0x7f) << shift;
+          if ((byte & 0x80) == 0)
+            break;
+        }
+        if (run == 0)
+          return H5ZSPERR_ERR_CORRUPT;
+      }
+      const size_t n = std::min(run, end - i);
+      put(i, n, val);
+      i += n;
+      run -= n;
+    }
+  }
+  return (run == 0 && pos == map_len) ? H5ZSPERR_OK : H5ZSPERR_ERR_CORRUPT;
+}
+
+template <typename T>
+void ChunkCodec<T>::m_set_dims(bool swapped)
+{
+  std::copy(m_params.dims, m_params.dims + 3, m_dims);
+  if (swapped)
+    std::swap(m_dims[0], m_dims[m_params.rank == 2 ? 1 : 2]);
+}
+
+template <typename T>
+bool ChunkCodec<T>::m_pick_swap(const T* buf) const
+{
+  /*
+   * The fastest axis is the same either way, so compare the first-difference energy along
+   * the slower axes as laid out without and with the swap. The smoother layout is the one
+   * that compresses better. Every 7th location is sampled to keep this cheap.
+   */
+  const auto& d = m_params.dims;
+  const size_t nelem = m_params.nelem();
+  size_t y[2] = {d[0], d[1]}, z[2] = {0, 0};
+  if (m_params.rank == 3) {
+    y[1] = d[2];
+    z[0] = d[0] * d[1];
+    z[1] = d[2] * d[1];
+  }
+  const size_t reach = std::max(std::max(y[0], y[1]), std::max(z[0], z[1]));
+  double energy[2] = {0.0, 0.0};
+  for (size_t i = 0; i + reach < nelem; i += 7) {
+    const double v = double(buf[i]);
+    for (int c = 0; c < 2; c++) {
+      energy[c] += std::abs(double(buf[i + y[c]]) - v);
+      if (z[c])
+        energy[c] += std::abs(double(buf[i + z[c]]) - v);
+    }
+  }
+  return energy[1] < energy[0];
+}
+
+template <typename T>
+int ChunkCodec<T>::m_sperr_encode(const T* buf)
+{
+  const auto& p = m_params;
+  const bool auto_swap = p.swap == H5Z_SPERR_SWAP_AUTO && p.subblock == 0;
+  if (!auto_swap || p.effort != H5Z_SPERR_EFFORT_MAX) {
+    const bool swapped = auto_swap && p.effort != H5Z_SPERR_EFFORT_FAST && m_pick_swap(buf);
+    m_set_dims(swapped);
+    if (swapped)
+      m_head[0] |= 0x80;
+    return m_sperr_encode_dims(buf);
+  }
+
+  /* Compress in both rank orders, and keep the shorter bitstream; a tie keeps the first. */
+  const auto head = m_head;
+  m_set_dims(false);
+  int ret = m_sperr_encode_dims(buf);
+  if (ret)
+    return ret;
+  auto first_head = std::move(m_head);
+  auto first_sperr = std::move(m_sperr);
+  const size_t first_len = m_sperr_len;
+
+  m_head = head;
+  m_head[0] |= 0x80;
+  m_set_dims(true);
+  ret = m_sperr_encode_dims(buf);
+  if (ret)
+    return ret;
+  if (first_len <= m_sperr_len) {
+    m_head = std::move(first_head);
+    m_sperr = std::move(first_sperr);
+    m_sperr_len = first_len;
+  }
+  return H5ZSPERR_OK;
+}
+
+template <typename T>
+int ChunkCodec<T>::m_sperr_encode_dims(const T* buf)
+{
+  const auto& p = m_params;
+  const size_t nelem = p.nelem();
+  if (p.comp_mode == 3 || p.comp_mode == 5) {
+    double tol = p.quality;
+    T lo = T{0}, hi = T{0};
+    if (p.comp_mode == 5 || sizeof(T) == 8)
+      kernel_minmax(buf, nelem, &lo, &hi);
+
+    /*
+     * Relative PWE: scale the tolerance by the value range. Missing values have been replaced
+     * by the mean of the valid values at this point, so they don't widen the range.
+     * A constant chunk takes the relative tolerance as is.
+     */
+    if (p.comp_mode == 5) {
+      const double range = double(hi) - double(lo);
+      std::memcpy(m_head.data() + 1, &range, sizeof(range));
+      if (range > 0.0)
+        tol *= range;
+    }
+
+    /*
+     * A double chunk goes through SPERR as floats when rounding to float costs at most 1/8 of
+     * the (strictest) tolerance. Values are rounded twice, once going in and once more when
+     * SPERR reconstructs them as floats, so twice the rounding error is taken off the tolerance
+     * given to SPERR.
+     */
+    if (sizeof(T) == 8) {
+      const double mag = std::max(std::abs(double(lo)), std::abs(double(hi)));
+      const double rounding = mag * std::ldexp(1.0, -24) + std::numeric_limits<float>::denorm_min();
+      const double strictest =
+          m_scales.empty() ? tol : tol * *std::min_element(m_scales.begin(), m_scales.end());
+      if (mag < double(std::numeric_limits<float>::max()) && 2.0 * rounding <= strictest / 8.0) {
+        m_demoted.assign(buf, buf + nelem);
+        m_head[0] |= 0x40;
+        return m_sperr_compress(m_demoted.data(), 1, 3, tol, 2.0 * rounding);
+      }
+    }
+    return m_sperr_compress(buf, p.is_float, 3, tol);
+  }
+  if (p.comp_mode != 4)
+    return m_sperr_compress(buf, p.is_float, p.comp_mode, p.quality);
+
+  /*
+   * Fixed PWE with a bitrate cap: when the PWE bitstream is too long, compress to the cap
+   * instead, and find out the max point-wise error that it actually achieves.
+   * The error is measured against `buf`, where missing values have been replaced.
+   */
+  int ret = m_sperr_compress(buf, p.is_float, 3, p.quality);
+  if (ret)
+    return ret;
+  double max_err = p.quality;
+  if (!m_scales.empty())
+    max_err *= *std::max_element(m_scales.begin(), m_scales.end());
+  if (double(m_sperr_len) * 8.0 > p.max_bpp * double(nelem)) {
+    ret = m_sperr_compress(buf, p.is_float, 1, p.max_bpp);
+    if (ret)
+      return ret;
+    void* out = nullptr;
+    ret = m_sperr_decompress(m_sperr.get(), m_sperr_len, p.is_float, &out);
+    auto recon = std::unique_ptr<T, free_deleter>(static_cast<T*>(out));
+    if (ret)
+      return H5ZSPERR_ERR_COMP;
+    max_err = 0.0;
+    const T* r = recon.get();
+    for (size_t i = 0; i < nelem; i++)
+      max_err = std::max(max_err, std::abs(double(r[i]) - double(buf[i])));
+  }
+  std::memcpy(m_head.data() + 1, &max_err, sizeof(max_err));
+
+  return H5ZSPERR_OK;
+}
+
+/*
+ * In the PWE mode, each sub-block is compressed with `quality` times its tolerance factor,
+ * less `margin`; other modes take `quality` as is.
+ */
+template <typename T>
+int ChunkCodec<T>::m_sperr_compress(const void* buf,
+                                    int is_float,
+                                    int mode,
+                                    double quality,
+                                    double margin)
+{
+  auto block_quality = [&](size_t b) {
+    if (mode != 3)
+      return quality;
+    return (m_scales.empty() ? quality : quality * m_scales[b]) - margin;
+  };
+
+  m_sperr.reset();
+  m_sperr_len = 0;
+  if (m_params.subblock == 0) {
+    void* sperr = nullptr;
+    int ret = m_sperr_compress_one(buf, is_float, m_dims, mode, block_quality(0), &sperr,
+                                   &m_sperr_len);
+    m_sperr.reset(static_cast<uint8_t*>(sperr));
+    if (ret)
+      m_sperr_len = 0;
+    return ret;
+  }
+
+  /* Compress each sub-block on its own, and then put them after the index. */
+  const auto grid = BlockGrid(m_params);
+  const size_t nblocks = grid.count();
+  const size_t esize = is_float ? 4 : 8;
+  auto streams = std::vector<std::unique_ptr<uint8_t, free_deleter>>(nblocks);
+  auto index = std::vector<uint32_t>(1 + nblocks);
+  index[0] = uint32_t(nblocks);
+  size_t total = 0;
+  for (size_t b = 0; b < nblocks; b++) {
+    size_t origin[3], extent[3];
+    grid.block(b, origin, extent);
+    m_block.resize(extent[0] * extent[1] * extent[2] * esize);
+    const size_t zero[3] = {0, 0, 0};
+    if (is_float)
+      copy_box(static_cast<const float*>(buf), grid.dims, origin,
+               reinterpret_cast<float*>(m_block.data()), extent, zero, extent);
+    else
+      copy_box(static_cast<const double*>(buf), grid.dims, origin,
+               reinterpret_cast<double*>(m_block.data()), extent, zero, extent);
+    void* sperr = nullptr;
+    size_t sperr_len = 0;
+    int ret = m_sperr_compress_one(m_block.data(), is_float, extent, mode, block_quality(b),
+                                   &sperr, &sperr_len);
+    streams[b].reset(static_cast<uint8_t*>(sperr));
+    if (ret)
+      return ret;
+    total += sperr_len;
+    if (total > std::numeric_limits<uint32_t>::max())
+      return H5ZSPERR_ERR_COMP;
+    index[1 + b] = uint32_t(total);
+  }
+
+  const size_t index_bytes = index.size() * sizeof(uint32_t);
+  m_sperr.reset(static_cast<uint8_t*>(std::malloc(index_bytes + total)));
+  std::memcpy(m_sperr.get(), index.data(), index_bytes);
+  for (size_t b = 0; b < nblocks; b++) {
+    const size_t begin = b ? index[b] : 0;
+    std::memcpy(m_sperr.get() + index_bytes + begin, streams[b].get(), index[1 + b] - begin);
+  }
+  m_sperr_len = index_bytes + total;
+
+  return H5ZSPERR_OK;
+}
+
+template <typename T>
+int ChunkCodec<T>::m_sperr_compress_one(const void* buf,
+                                        int is_float,
+                                        const size_t dims[3],
+                                        int mode,
+                                        double quality,
+                                        void** dst,
+                                        size_t* dst_len) const
+{
+  TraceSpan span(trace_event::sperr_encode, 0);
+  int ret = 0;
+  if (m_params.rank == 2)
+    ret = C_API::sperr_comp_2d(buf, is_float, dims[0], dims[1], mode, quality, 0, dst, dst_len);
+  else {
+    /* SPERR transforms each of its own chunks separately, with fewer levels when they are small. */
+    size_t piece[3] = {dims[0], dims[1], dims[2]};
+    if (m_params.effort == H5Z_SPERR_EFFORT_FAST)
+      for (auto& len : piece)
+        len = std::min<size_t>(len, FAST_SPERR_CHUNK);
+    ret = C_API::sperr_comp_3d(buf, is_float, dims[0], dims[1], dims[2], piece[0], piece[1],
+                               piece[2], mode, quality, 1, dst, dst_len);
+  }
+  if (ret)
+    return H5ZSPERR_ERR_COMP;
+  span.set_bytes(*dst_len);
+
+  return H5ZSPERR_OK;
+}
+
+template <typename T>
+int ChunkCodec<T>::m_sperr_decompress(const uint8_t* src,
+                                      size_t src_len,
+                                      int is_float,
+                                      void** dst) const
+{
+  if (m_params.subblock == 0)
+    return m_sperr_decompress_one(src, src_len, is_float, m_dims, dst);
+
+  /* Decompress each sub-block, and put it in place. */
+  const auto grid = BlockGrid(m_params);
+  auto index = BlockIndex();
+  if (!index.parse(src, src_len, grid.count()))
+    return H5ZSPERR_ERR_CORRUPT;
+  const size_t esize = is_float ? 4 : 8;
+  auto out = std::unique_ptr<uint8_t, free_deleter>(
+      static_cast<uint8_t*>(std::malloc(m_params.nelem() * esize)));
+  for (size_t b = 0; b < index.count; b++) {
+    size_t origin[3], extent[3];
+    grid.block(b, origin, extent);
+    void* blk = nullptr;
+    int ret = m_sperr_decompress_one(index.stream(b), index.stream_bytes(b), is_float, extent,
+                                     &blk);
+    auto block = std::unique_ptr<uint8_t, free_deleter>(static_cast<uint8_t*>(blk));
+    if (ret)
+      return ret;
+    const size_t zero[3] = {0, 0, 0};
+    if (is_float)
+      copy_box(reinterpret_cast<const float*>(block.get()), extent, zero,
+               reinterpret_cast<float*>(out.get()), grid.dims, origin, extent);
+    else
+      copy_box(reinterpret_cast<const double*>(block.get()), extent, zero,
+               reinterpret_cast<double*>(out.get()), grid.dims, origin, extent);
+  }
+  *dst = out.release();
+
+  return H5ZSPERR_OK;
+}
+
+template <typename T>
+int ChunkCodec<T>::m_sperr_decompress_one(const uint8_t* src,
+                                          size_t src_len,
+                                          int is_float,
+                                          const size_t dims[3],
+                                          void** dst) const
+{
+  TraceSpan span(trace_event::sperr_decode, src_len);
+  int ret = 0;
+  if (m_params.rank == 2)
+    ret = C_API::sperr_decomp_2d(src, src_len, is_float, dims[0], dims[1], dst);
+  else {
+    size_t dimx = 0, dimy = 0, dimz = 0;
+    ret = C_API::sperr_decomp_3d(src, src_len, is_float, 1, &dimx, &dimy, &dimz, dst);
+    if (ret == 0 && (dimx != dims[0] || dimy != dims[1] || dimz != dims[2]))
+      ret = 1;
+  }
+  return ret ? H5ZSPERR_ERR_DECOMP : H5ZSPERR_OK;
+}
+
+template <typename T>
+int ChunkCodec<T>::m_decode_missing(const uint8_t* src,
+                                    const ChunkLayout& layout,
+                                    size_t nelem,
+                                    std::shared_ptr<const MaskRuns>* runs)
+{
+  /* Save the class map, which `m_put_missing()` walks through. */
+  if (layout.missing_mode == 5)
+    m_classes.assign(src + layout.class_offset, src + layout.class_offset + layout.class_bytes);
+
+  /*
+   * Find the runs of missing values. Chunks of a time series often share one mask, so the runs
+   * are looked up in the process-wide cache before decoding the compact bitmask.
+   */
+  runs->reset();
+  if (layout.missing_mode != 0) {
+    TraceSpan span(trace_event::mask_decode, layout.mask_bytes);
+    auto& cache = mask_cache();
+    const uint8_t* mask = src + layout.mask_offset;
+    *runs = cache.find(mask, layout.mask_bytes, nelem);
+    if (!*runs) {
+      const size_t nwords = (nelem + 63) / 64;
+      m_compact.assign((layout.mask_bytes + 7) / 8, 0);
+      std::memcpy(m_compact.data(), mask, layout.mask_bytes);
+      m_bits.resize(nwords);
+      if (compactor_decode(m_compact.data(), m_compact.size() * 8, m_bits.data()) < nwords * 8)
+        return H5ZSPERR_ERR_CORRUPT;
+      if (!m_runs || m_runs.use_count() > 1)
+        m_runs = std::make_shared<MaskRuns>();
+      mask_bits_to_runs(m_bits.data(), nelem, m_runs.get());
+      cache.insert(mask, layout.mask_bytes, nelem, m_runs);
+      *runs = m_runs;
+    }
+  }
+  return H5ZSPERR_OK;
+}
+
+template <typename T>
+int ChunkCodec<T>::decode(const void* src, size_t src_len, T* dst, size_t nelem)
+{
+  const auto& prm = m_params;
+  if (nelem != prm.nelem())
+    return H5ZSPERR_ERR_SIZE;
+  const auto* p = static_cast<const uint8_t*>(src);
+  auto layout = ChunkLayout();
+  int ret = parse_chunk_layout(prm, src, src_len, src_len, &layout);
+  if (ret)
+    return ret;
+  if (layout.residual)
+    return H5ZSPERR_ERR_RESIDUAL;
+
+  /* Save the fill value(s), and find the missing values. */
+  uint8_t fill[H5Z_SPERR_MAX_SENTINELS * sizeof(T)];
+  std::memcpy(fill, p + layout.fill_offset, layout.fill_bytes);
+  auto runs = std::shared_ptr<const MaskRuns>();
+  ret = m_decode_missing(p, layout, nelem, &runs);
+  if (ret)
+    return ret;
+
+  /* Decompress the real data. */
+  m_set_dims(layout.swapped != 0);
+  void* out = nullptr;
+  const int out_float = layout.demoted ? 1 : prm.is_float;
+  ret = m_sperr_decompress(p + layout.sperr_offset, layout.sperr_bytes, out_float, &out);
+  auto sperr_out = std::unique_ptr<uint8_t, free_deleter>(static_cast<uint8_t*>(out));
+  if (ret)
+    return ret;
+
+  /* The input is fully consumed; now it's safe to write to `dst`. */
+  if (layout.demoted) {
+    const auto* f = reinterpret_cast<const float*>(sperr_out.get());
+    std::copy(f, f + nelem, dst);
+  }
+  else
+    std::memcpy(dst, sperr_out.get(), nelem * sizeof(T));
+
+  /* Put back the fill value(s). */
+  TraceSpan fill_span(trace_event::fill, nelem * sizeof(T));
+  auto put = [dst](size_t start, size_t len, T val) { std::fill_n(dst + start, len, val); };
+  return m_put_missing(layout, fill, runs.get(), put);
+}
+
+template <typename T>
+int ChunkCodec<T>::decode_region(const void* src,
+                                 size_t src_len,
+                                 const size_t start[],
+                                 const size_t count[],
+                                 T* dst)
+{
+  /* Turn the region into the memory order of the chunk, i.e., the fastest varying axis first. */
+  const auto& prm = m_params;
+  const auto grid = BlockGrid(prm);
+  size_t r0[3] = {0, 0, 0}, rn[3] = {1, 1, 1};
+  for (int i = 0; i < prm.rank; i++) {
+    r0[i] = start[prm.rank - 1 - i];
+    rn[i] = count[prm.rank - 1 - i];
+    if (rn[i] == 0 || r0[i] + rn[i] > grid.dims[i])
+      return H5ZSPERR_ERR_SIZE;
+  }
+  const size_t zero[3] = {0, 0, 0};
+  const size_t nelem = prm.nelem();
+
+  /* Without sub-blocks, the whole chunk has to be decoded anyway. */
+  if (prm.subblock == 0) {
+    m_work.resize(nelem);
+    int ret = decode(src, src_len, m_work.data(), nelem);
+    if (ret == H5ZSPERR_OK)
+      copy_box(m_work.data(), grid.dims, r0, dst, rn, zero, rn);
+    return ret;
+  }
+
+  const auto* p = static_cast<const uint8_t*>(src);
+  auto layout = ChunkLayout();
+  int ret = parse_chunk_layout(prm, src, src_len, src_len, &layout);
+  if (ret)
+    return ret;
+  if (layout.residual)
+    return H5ZSPERR_ERR_RESIDUAL;
+  auto index = BlockIndex();
+  if (!index.parse(p + layout.sperr_offset, layout.sperr_bytes, grid.count()))
+    return H5ZSPERR_ERR_CORRUPT;
+  uint8_t fill[H5Z_SPERR_MAX_SENTINELS * sizeof(T)];
+  std::memcpy(fill, p + layout.fill_offset, layout.fill_bytes);
+  auto runs = std::shared_ptr<const MaskRuns>();
+  ret = m_decode_missing(p, layout, nelem, &runs);
+  if (ret)
+    return ret;
+
+  /* Decompress only the sub-blocks that overlap the region, and copy out the overlaps. */
+  const int out_float = layout.demoted ? 1 : prm.is_float;
+  for (size_t b = 0; b < index.count; b++) {
+    size_t origin[3], extent[3], lo[3], hi[3];
+    grid.block(b, origin, extent);
+    bool overlap = true;
+    for (int i = 0; i < 3; i++) {
+      lo[i] = std::max(origin[i], r0[i]);
+      hi[i] = std::min(origin[i] + extent[i], r0[i] + rn[i]);
+      overlap = overlap && lo[i] < hi[i];
+    }
+    if (!overlap)
+      continue;
+    void* blk = nullptr;
+    ret = m_sperr_decompress_one(index.stream(b), index.stream_bytes(b), out_float, extent, &blk);
+    auto block = std::unique_ptr<uint8_t, free_deleter>(static_cast<uint8_t*>(blk));
+    if (ret)
+      return ret;
+    const size_t from[3] = {lo[0] - origin[0], lo[1] - origin[1], lo[2] - origin[2]};
+    const size_t to[3] = {lo[0] - r0[0], lo[1] - r0[1], lo[2] - r0[2]};
+    const size_t len[3] = {hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]};
+    if (out_float)
+      copy_box(reinterpret_cast<const float*>(block.get()), extent, from, dst, rn, to, len);
+    else
+      copy_box(reinterpret_cast<const double*>(block.get()), extent, from, dst, rn, to, len);
+  }
+
+  /* Put back the fill value(s) that fall in the region, one row of the chunk at a time. */
+  TraceSpan fill_span(trace_event::fill, rn[0] * rn[1] * rn[2] * sizeof(T));
+  const size_t nx = grid.dims[0], ny = grid.dims[1];
+  auto put = [&](size_t pos, size_t len, T val) {
+    while (len) {
+      const size_t x = pos % nx, y = (pos / nx) % ny, z = pos / (nx * ny);
+      const size_t seg = std::min(len, nx - x);
+      if (y >= r0[1] && y < r0[1] + rn[1] && z >= r0[2] && z < r0[2] + rn[2]) {
+        const size_t lo = std::max(x, r0[0]), hi = std::min(x + seg, r0[0] + rn[0]);
+        if (lo < hi)
+          std::fill_n(dst + ((z - r0[2]) * rn[1] + (y - r0[1])) * rn[0] + (lo - r0[0]), hi - lo,
+                      val);
+      }
+      pos += seg;
+      len -= seg;
+    }
+  };
+  return m_put_missing(layout, fill, runs.get(), put);
+}
+
+template class ChunkCodec<float>;
+template class ChunkCodec<double>;
+
+}  // namespace h5zsperr
+
+//
+// C wrappers, each thread owning its codecs so that buffers are reused across chunks.
+//
+namespace {
+thread_local h5zsperr::ChunkCodec<float> codec_f;
+thread_local h5zsperr::ChunkCodec<double> codec_d;
+thread_local int last_is_float = 1;
+
+/* Values of 16-bit types go through the float codec, converted to and from this buffer. */
+thread_local std::vector<float> widened;
+
+float* widen(const h5zsperr::ChunkParams& params, const void* src)
+{
+  widened.resize(params.nelem());
+  h5zsperr::kernel_widen(src, params.nelem(), h5zsperr::narrow_type(params.source),
+                         widened.data());
+  return widened.data();
+}
+
+/*
+ * The encoding of the latest constant chunk, keyed on its cd_values[] and its value. Parallel HDF5
+ * compresses a chunk of fill values for every chunk of a dataset it allocates, and this keeps each
+ * of them down to a scan of the chunk. Encoding is deterministic, so the bytes are the same.
+ */
+struct ConstantChunk {
+  std::vector<unsigned int> cd_values;
+  std::vector<uint8_t> value;
+  std::vector<uint8_t> encoded;
+};
+thread_local ConstantChunk last_constant;
+thread_local bool last_was_constant = false;
+
+/* Whether the chunk of `nbytes` bytes in `buf` repeats its first value of `elem_size` bytes. */
+bool is_constant(const void* buf, size_t nbytes, size_t elem_size)
+{
+  const auto* p = static_cast<const uint8_t*>(buf);
+  return nbytes >= elem_size && std::memcmp(p, p + elem_size, nbytes - elem_size) == 0;
+}
+
+/* The encoded chunk of compound or array values, assembled from its components. */
+thread_local std::vector<uint8_t> comp_encoded;
+thread_local bool last_components = false;
+
+/* Copy out the chunk that the per-thread codecs encoded last. */
+void copy_codec_output(void* dst)
+{
+  if (last_components)
+    std::memcpy(dst, comp_encoded.data(), comp_encoded.size());
+  else if (last_is_float)
+    codec_f.copy_encoded(dst);
+  else
+    codec_d.copy_encoded(dst);
+}
+
+/*
+ * Encode each component of a chunk of compound or array values on its own, with the tolerance
+ * factors in `scales` (nullptr for none), into `comp_encoded`.
+ */
+template <typename T>
+int encode_components(h5zsperr::ChunkCodec<T>& codec,
+                      const h5zsperr::ChunkParams& params,
+                      const void* src,
+                      const float* scales,
+                      size_t nscales)
+{
+  thread_local std::vector<T> values;
+  const size_t nelem = params.nelem();
+  const size_t n = size_t(params.ncomp);
+  const auto* in = static_cast<const uint8_t*>(src);
+  values.resize(nelem);
+  comp_encoded.assign(n * 4, 0);
+  for (size_t c = 0; c < n; c++) {
+    const uint8_t* p = in + params.comp_offset[c];
+    for (size_t i = 0; i < nelem; i++)
+      std::memcpy(&values[i], p + i * params.elem_size, sizeof(T));
+    int ret = codec.set_params(params.component(int(c)));
+    if (ret == H5ZSPERR_OK)
+      ret = codec.set_tolerance_scales(scales, nscales);
+    if (ret == H5ZSPERR_OK)
+      ret = codec.encode_inplace(values.data(), nelem);
+    if (ret)
+      return ret;
+    const size_t offset = comp_encoded.size();
+    comp_encoded.resize(offset + codec.encoded_size());
+    codec.copy_encoded(comp_encoded.data() + offset);
+    const auto end = uint32_t(comp_encoded.size() - n * 4);
+    std::memcpy(comp_encoded.data() + c * 4, &end, 4);
+  }
+  return H5ZSPERR_OK;
+}
+
+/*
+ * Decode a chunk of compound or array values; `dst` may alias `src`. With `start` and `count`,
+ * only that region of the chunk is decoded (see `ChunkCodec::decode_region()`), and `dst` holds
+ * the values of the region only. Bytes in between components are zeroed.
+ */
+template <typename T>
+int decode_components(h5zsperr::ChunkCodec<T>& codec,
+                      const h5zsperr::ChunkParams& params,
+                      const void* src,
+                      size_t src_len,
+                      void* dst,
+                      const size_t start[],
+                      const size_t count[])
+{
+  thread_local std::vector<uint8_t> in;
+  thread_local std::vector<T> values;
+  const size_t n = size_t(params.ncomp);
+  if (src_len < n * 4)
+    return H5ZSPERR_ERR_CORRUPT;
+  const auto* s = static_cast<const uint8_t*>(src);
+  in.assign(s, s + src_len);
+  const size_t body = src_len - n * 4;
+
+  size_t nelem = params.nelem();
+  if (count)
+    nelem = count[0] * count[1] * (params.rank == 3 ? count[2] : 1);
+  values.resize(nelem);
+  auto* out = static_cast<uint8_t*>(dst);
+  std::memset(out, 0, nelem * params.elem_size);
+  uint32_t begin = 0;
+  for (size_t c = 0; c < n; c++) {
+    uint32_t end = 0;
+    std::memcpy(&end, in.data() + c * 4, 4);
+    if (end < begin || end > body)
+      return H5ZSPERR_ERR_CORRUPT;
+    const uint8_t* stream = in.data() + n * 4 + begin;
+    int ret = codec.set_params(params.component(int(c)));
+    if (ret == H5ZSPERR_OK)
+      ret = count ? codec.decode_region(stream, end - begin, start, count, values.data())
+                  : codec.decode(stream, end - begin, values.data(), nelem);
+    if (ret)
+      return ret;
+    uint8_t* p = out + params.comp_offset[c];
+    for (size_t i = 0; i < nelem; i++)
+      std::memcpy(p + i * params.elem_size, &values[i], sizeof(T));
+    begin = end;
+  }
+  return H5ZSPERR_OK;
+}
+}  // namespace
+
+int C_API::h5zsperr_chunk_encode(size_t cd_nelmts, const unsigned int cd_values[],
+                                 void* buf, size_t nbytes, size_t* encoded_len)
+{
+  auto params = h5zsperr::ChunkParams();
+  int ret = h5zsperr::parse_cd_values(cd_nelmts, cd_values, &params);
+  if (ret)
+    return ret;
+  if (nbytes != params.raw_bytes())
+    return H5ZSPERR_ERR_SIZE;
+
+  h5zsperr::TraceSpan span(h5zsperr::trace_event::chunk_encode, nbytes);
+
+  const size_t elem_size = nbytes / params.nelem();
+  const auto* first = static_cast<const uint8_t*>(buf);
+  last_was_constant = is_constant(buf, nbytes, elem_size);
+  if (last_was_constant && last_constant.encoded.size() &&
+      std::equal(cd_values, cd_values + cd_nelmts, last_constant.cd_values.begin(),
+                 last_constant.cd_values.end()) &&
+      std::equal(first, first + elem_size, last_constant.value.begin(),
+                 last_constant.value.end())) {
+    *encoded_len = last_constant.encoded.size();
+    return H5ZSPERR_OK;
+  }
+  if (last_was_constant) {
+    last_constant.cd_values.assign(cd_values, cd_values + cd_nelmts);
+    last_constant.value.assign(first, first + elem_size);
+    last_constant.encoded.clear();
+  }
+
+  last_is_float = params.is_float;
+  last_components = params.ncomp != 0;
+  if (last_components) {
+    ret = params.is_float ? encode_components(codec_f, params, buf, nullptr, 0)
+                          : encode_components(codec_d, params, buf, nullptr, 0);
+    *encoded_len = comp_encoded.size();
+  }
+  else if (params.is_float) {
+    codec_f.set_params(params);
+    float* vals = params.source ? widen(params, buf) : static_cast<float*>(buf);
+    ret = codec_f.encode_inplace(vals, params.nelem());
+    *encoded_len = codec_f.encoded_size();
+  }
+  else {
+    codec_d.set_params(params);
+    ret = codec_d.encode_inplace(static_cast<double*>(buf), params.nelem());
+    *encoded_len = codec_d.encoded_size();
+  }
+  if (last_was_constant && ret == H5ZSPERR_OK) {
+    last_constant.encoded.resize(*encoded_len);
+    copy_codec_output(last_constant.encoded.data());
+  }
+  return ret;
+}
+
+void C_API::h5zsperr_chunk_copy_encoded(void* dst)
+{
+  if (last_was_constant)
+    std::memcpy(dst, last_constant.encoded.data(), last_constant.encoded.size());
+  else
+    copy_codec_output(dst);
+}
+
+int C_API::h5zsperr_chunk_decode(size_t cd_nelmts, const unsigned int cd_values[],
+                                 const void* src, size_t nbytes, void* dst, size_t dst_bytes)
+{
+  auto params = h5zsperr::ChunkParams();
+  int ret = h5zsperr::parse_cd_values(cd_nelmts, cd_values, &params);
+  if (ret)
+    return ret;
+  const size_t raw_bytes = params.raw_bytes();
+  if (dst_bytes < raw_bytes)
+    return H5ZSPERR_ERR_SIZE;
+  h5zsperr::TraceSpan span(h5zsperr::trace_event::chunk_decode, nbytes);
+
+  /*
+   * Look up the opt-in cache of decoded chunks. The key is copied up front on a miss,
+   * because `dst` may alias `src`.
+   */
+  auto& cache = h5zsperr::chunk_cache();
+  const bool caching = cache.capacity() > 0;
+  uint64_t salt = 0;
+  auto key = std::vector<uint8_t>();
+  if (caching) {
+    salt = h5zsperr::hash_bytes(cd_values, cd_nelmts * sizeof(unsigned int), 0);
+    auto hit = cache.find(src, nbytes, salt);
+    if (hit && hit->size() == raw_bytes) {
+      std::memcpy(dst, hit->data(), raw_bytes);
+      return H5ZSPERR_OK;
+    }
+    const auto* p = static_cast<const uint8_t*>(src);
+    key.assign(p, p + nbytes);
+  }
+
+  if (params.ncomp) {
+    ret = params.is_float ? decode_components(codec_f, params, src, nbytes, dst, nullptr, nullptr)
+                          : decode_components(codec_d, params, src, nbytes, dst, nullptr, nullptr);
+  }
+  else if (params.source) {
+    codec_f.set_params(params);
+    widened.resize(params.nelem());
+    ret = codec_f.decode(src, nbytes, widened.data(), params.nelem());
+    if (ret == H5ZSPERR_OK)
+      h5zsperr::kernel_narrow(widened.data(), params.nelem(),
+                              h5zsperr::narrow_type(params.source), dst);
+  }
+  else if (params.is_float) {
+    codec_f.set_params(params);
+    ret = codec_f.decode(src, nbytes, static_cast<float*>(dst), params.nelem());
+  }
+  else {
+    codec_d.set_params(params);
+    ret = codec_d.decode(src, nbytes, static_cast<double*>(dst), params.nelem());
+  }
+
+  if (ret == H5ZSPERR_OK && caching) {
+    const auto* p = static_cast<const uint8_t*>(dst);
+    cache.insert(std::move(key), salt, std::make_shared<std::vector<uint8_t>>(p, p + raw_bytes));
+  }
+  return ret;
+}
+
+size_t C_API::h5zsperr_chunk_raw_bytes(size_t cd_nelmts, const unsigned int cd_values[])
+{
+  auto params = h5zsperr::ChunkParams();
+  if (h5zsperr::parse_cd_values(cd_nelmts, cd_values, &params))
+    return 0;
+  return params.raw_bytes();
+}
+
+//
+// The public chunk API, see h5z-sperr-chunk.h.
+//
+int C_API::H5Z_SPERR_chunk_cd_values(const unsigned int user_cd_values[],
+                                     size_t user_cd_nelmts,
+                                     int is_float,
+                                     int ndims,
+                                     const size_t chunk_dims[],
+                                     unsigned int cd_values[],
+                                     size_t* cd_nelmts)
+{
+  const size_t offset = 0;
+  const size_t esize = is_float == 0 ? 8 : is_float == 1 ? 4 : 2;
+  return H5Z_SPERR_component_cd_values(user_cd_values, user_cd_nelmts, is_float, ndims,
+                                       chunk_dims, 1, esize, &offset, cd_values, cd_nelmts);
+}
+
+int C_API::H5Z_SPERR_component_cd_values(const unsigned int user_cd_values[],
+                                         size_t user_cd_nelmts,
+                                         int is_float,
+                                         int ndims,
+                                         const size_t chunk_dims[],
+                                         int ncomp,
+                                         size_t elem_size,
+                                         const size_t offsets[],
+                                         unsigned int cd_values[],
+                                         size_t* cd_nelmts)
+{
+  /*
+   * The user-specified parameters have mandatory and optional fields.
+   * -- One integer (mandatory): compression mode, quality, rank swap
+   * -- One integer (optional) : missing value mode
+   * -- One or two integers (mode 3 or 4): the bits of the exact missing value
+   * -- The compression specifics of each component (optional): see `H5Z_SPERR_make_components()`
+   *
+   * `missing_val_mode` meaning:
+   * 0: no missing value
+   * 1: any NAN is a missing value
+   * 2: any value where abs(value) >= 1e35 is a missing value.
+   * 3: any value that equals a specific float is a missing value.
+   * 4: any value that equals a specific double is a missing value.
+   * 5: any value that equals one of up to H5Z_SPERR_MAX_SENTINELS doubles is a missing value.
+   * 6: detect NaNs and values where abs(value) >= 1e35 in each chunk, and restore them exactly.
+   *    This is the default when the missing value mode is omitted.
+   */
+  /* Values of 16-bit types are compressed as floats. */
+  int source = 0;
+  if (is_float >= H5Z_SPERR_TYPE_INT16 && is_float <= H5Z_SPERR_TYPE_FLOAT16) {
+    source = is_float - H5Z_SPERR_TYPE_INT16 + 1;
+    is_float = 1;
+  }
+
+  int missing_val_mode = 6;
+  unsigned int subblock_log2 = 0;
+  unsigned int effort = H5Z_SPERR_EFFORT_BALANCED;
+  size_t num_comp_words = 0;
+  double missing_val = 0.0;
+  size_t num_sentinels = 0;
+  double sentinels[H5Z_SPERR_MAX_SENTINELS] = {};
+  if (user_cd_nelmts >= 2) {
+    missing_val_mode = int(user_cd_values[1] & ((1u << SUBBLOCK_SHIFT) - 1));
+    subblock_log2 = (user_cd_values[1] >> SUBBLOCK_SHIFT) & 15u;
+    if (subblock_log2 != 0 &&
+        (subblock_log2 < SUBBLOCK_MIN_LOG2 || subblock_log2 > SUBBLOCK_MAX_LOG2))
+      return H5ZSPERR_ERR_CD_VALUES;
+    effort = (user_cd_values[1] >> EFFORT_SHIFT) & 3u;
+    num_comp_words = (user_cd_values[1] >> COMPONENT_SHIFT) & 7u;
+    if (effort > H5Z_SPERR_EFFORT_MAX || (user_cd_values[1] >> (COMPONENT_SHIFT + 3)) != 0)
+      return H5ZSPERR_ERR_CD_VALUES;
+  }
+
+  /*
+   * Values made of several components, or of a single one surrounded by other bytes, keep their
+   * layout. Per-component compression specifics come last, one for each component.
+   */
+  const size_t esize = source ? 2 : is_float ? 4 : 8;
+  if (ncomp < 1 || ncomp > H5Z_SPERR_MAX_COMPONENTS || elem_size > 0xffff)
+    return H5ZSPERR_ERR_CD_VALUES;
+  for (int c = 0; c < ncomp; c++)
+    if (offsets[c] + esize > elem_size)
+      return H5ZSPERR_ERR_CD_VALUES;
+  const bool components = ncomp > 1 || elem_size != esize;
+  if (source && components)
+    return H5ZSPERR_ERR_CD_VALUES;
+  if (num_comp_words != 0 && num_comp_words != size_t(ncomp))
+    return H5ZSPERR_ERR_CD_VALUES;
+  if (num_comp_words != 0 && !components)
+    return H5ZSPERR_ERR_CD_VALUES; /* only the first user cd_values[] applies to plain values */
+  if (num_comp_words != 0 && user_cd_nelmts < 2 + num_comp_words)
+    return H5ZSPERR_ERR_CD_VALUES;
+  const unsigned int* comp_words = user_cd_values + user_cd_nelmts - num_comp_words;
+  user_cd_nelmts -= num_comp_words;
+  if (missing_val_mode == 5) {
+    if (user_cd_nelmts < 3)
+      return H5ZSPERR_ERR_CD_VALUES;
+    num_sentinels = user_cd_values[2];
+    if (num_sentinels < 1 || num_sentinels > H5Z_SPERR_MAX_SENTINELS ||
+        user_cd_nelmts != 3 + 2 * num_sentinels)
+      return H5ZSPERR_ERR_CD_VALUES;
+    std::memcpy(sentinels, &user_cd_values[3], num_sentinels * sizeof(double));
+  }
+  else if (missing_val_mode == 3 && user_cd_nelmts == 3) {
+    float val = 0.f;
+    std::memcpy(&val, &user_cd_values[2], sizeof(val));
+    missing_val = val;
+  }
+  else if (missing_val_mode == 4 && user_cd_nelmts == 4)
+    std::memcpy(&missing_val, &user_cd_values[2], sizeof(missing_val));
+  else if (user_cd_nelmts != 1 && user_cd_nelmts != 2)
+    return H5ZSPERR_ERR_CD_VALUES;
+  if (missing_val_mode < 0 || missing_val_mode > 6)
+    return H5ZSPERR_ERR_CD_VALUES;
+  if ((missing_val_mode == 3 || missing_val_mode == 4) && user_cd_nelmts == 2)
+    return H5ZSPERR_ERR_CD_VALUES; /* the missing value itself is absent */
+
+  /* The exact missing value is kept in the data type, so mode 3 goes with floats and
+   * mode 4 goes with doubles regardless of what the user specified. */
+  if (missing_val_mode == 3 || missing_val_mode == 4)
+    missing_val_mode = is_float ? 3 : 4;
+
+  if (is_float != 0 && is_float != 1)
+    return H5ZSPERR_ERR_CD_VALUES;
+
+  /* Find out the real dimension (of each chunk). */
+  if (ndims < 2 || ndims > 4)
+    return H5ZSPERR_ERR_CD_VALUES;
+  int real_dims = 0;
+  for (int i = 0; i < ndims; i++)
+    if (chunk_dims[i] > 1)
+      real_dims++;
+  if (real_dims < 2 || real_dims > 3)
+    return H5ZSPERR_ERR_CD_VALUES;
+
+  /*
+   * Assemble the meta info to be stored.
+   * [0]  : 2D/3D, float/double, missing_val_mode, magic_number; the sub-block edge length
+   *        (base-2 logarithm) in bits 16-19, the effort preset in bits 20-21, and the 16-bit
+   *        type of values compressed as floats in bits 25-27
+   * [1]  : compression specifics (user input)
+   * [2-3]: (dimx, dimy) in 2D cases.
+   * [2-4]: (dimx, dimy, dimz) in 3D cases.
+   * [+1] : the exact missing value as a float, in mode 3.
+   * [+2] : the exact missing value as a double, in mode 4.
+   * [+1+K or +1+2K]: K, and then K missing values as floats or doubles, in mode 5.
+   * [+1+2C]: the size of a value, and then the byte offset and compression specifics of each of
+   *          its C components, for compound or array values; C is in bits 22-24 of [0].
+   */
+  cd_values[0] = h5zsperr_pack_extra_info(real_dims, is_float, missing_val_mode,
+                                          H5ZSPERR_COMPATIBILITY);
+  cd_values[0] |= subblock_log2 << 16;
+  cd_values[0] |= effort << 20;
+  if (components)
+    cd_values[0] |= (unsigned int)ncomp << 22;
+  cd_values[0] |= (unsigned int)source << 25;
+  cd_values[1] = user_cd_values[0];
+  size_t i1 = 2;
+  for (int i = 0; i < ndims; i++)
+    if (chunk_dims[i] > 1)
+      cd_values[i1++] = (unsigned int)chunk_dims[i];
+  if (missing_val_mode == 3) {
+    const float val = float(missing_val);
+    std::memcpy(&cd_values[i1], &val, sizeof(val));
+    i1 += 1;
+  }
+  else if (missing_val_mode == 4) {
+    std::memcpy(&cd_values[i1], &missing_val, sizeof(missing_val));
+    i1 += 2;
+  }
+  else if (missing_val_mode == 5) {
+    cd_values[i1++] = (unsigned int)num_sentinels;
+    for (size_t i = 0; i < num_sentinels; i++) {
+      if (is_float) {
+        const float val = float(sentinels[i]);
+        std::memcpy(&cd_values[i1], &val, sizeof(val));
+        i1 += 1;
+      }
+      else {
+        std::memcpy(&cd_values[i1], &sentinels[i], sizeof(double));
+        i1 += 2;
+      }
+    }
+  }
+  if (components) {
+    cd_values[i1++] = (unsigned int)elem_size;
+    for (int c = 0; c < ncomp; c++) {
+      cd_values[i1++] = (unsigned int)offsets[c];
+      cd_values[i1++] = num_comp_words ? comp_words[c] : user_cd_values[0];
+    }
+  }
+  *cd_nelmts = i1;
+
+  return H5ZSPERR_OK;
+}
+
+int C_API::H5Z_SPERR_encode_chunk(size_t cd_nelmts,
+                                  const unsigned int cd_values[],
+                                  const void* src,
+                                  size_t src_bytes,
+                                  void** dst,
+                                  size_t* dst_len)
+{
+  return H5Z_SPERR_encode_chunk_map(cd_nelmts, cd_values, src, src_bytes, NULL, NULL, dst,
+                                    dst_len);
+}
+
+namespace {
+
+/* The smallest factor of `map` over each sub-block of a chunk at `offset`. */
+int map_scales(const h5zsperr::ChunkParams& params,
+               const C_API::H5Z_SPERR_quality_map* map,
+               const size_t offset[],
+               std::vector<float>* scales)
+{
+  const int rank = params.rank;
+  if (map->rank != rank || map->factors == nullptr)
+    return H5ZSPERR_ERR_CD_VALUES;
+  for (int i = 0; i < rank; i++)
+    if (map->dims[i] == 0 || map->cell[i] == 0)
+      return H5ZSPERR_ERR_CD_VALUES;
+
+  const auto grid = h5zsperr::BlockGrid(params);
+  scales->resize(grid.count());
+  for (size_t b = 0; b < grid.count(); b++) {
+    /* The range of cells along each dimension of the map, i.e., in the HDF5 order. */
+    size_t origin[3], extent[3], lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0};
+    grid.block(b, origin, extent);
+    for (int i = 0; i < rank; i++) {
+      const int m = rank - 1 - i; /* the same axis in memory order */
+      lo[i] = std::min((offset[i] + origin[m]) / map->cell[i], map->dims[i] - 1);
+      hi[i] = std::min((offset[i] + origin[m] + extent[m] - 1) / map->cell[i], map->dims[i] - 1);
+    }
+    float factor = std::numeric_limits<float>::max();
+    const size_t nz = rank == 3 ? map->dims[2] : 1;
+    for (size_t x = lo[0]; x <= hi[0]; x++)
+      for (size_t y = lo[1]; y <= hi[1]; y++)
+        for (size_t z = lo[2]; z <= hi[2]; z++)
+          factor = std::min(factor, map->factors[(x * map->dims[1] + y) * nz + z]);
+    (*scales)[b] = factor;
+  }
+  return H5ZSPERR_OK;
+}
+
+}  // namespace
+
+int C_API::H5Z_SPERR_encode_chunk_map(size_t cd_nelmts,
+                                      const unsigned int cd_values[],
+                                      const void* src,
+                                      size_t src_bytes,
+                                      const H5Z_SPERR_quality_map* map,
+                                      const size_t offset[],
+                                      void** dst,
+                                      size_t* dst_len)
+{
+  if (*dst != nullptr)
+    return H5ZSPERR_ERR_SIZE;
+  auto params = h5zsperr::ChunkParams();
+  int ret = h5zsperr::parse_cd_values(cd_nelmts, cd_values, &params);
+  if (ret)
+    return ret;
+  if (src_bytes != params.raw_bytes())
+    return H5ZSPERR_ERR_SIZE;
+  thread_local std::vector<float> scales;
+  scales.clear();
+  if (map) {
+    ret = map_scales(params, map, offset, &scales);
+    if (ret)
+      return ret;
+  }
+
+  h5zsperr::TraceSpan span(h5zsperr::trace_event::chunk_encode, src_bytes);
+  const float* factors = map ? scales.data() : nullptr;
+  if (params.ncomp) {
+    ret = params.is_float ? encode_components(codec_f, params, src, factors, scales.size())
+                          : encode_components(codec_d, params, src, factors, scales.size());
+    *dst_len = comp_encoded.size();
+  }
+  else if (params.is_float) {
+    codec_f.set_params(params);
+    ret = codec_f.set_tolerance_scales(factors, scales.size());
+    if (ret == H5ZSPERR_OK)
+      ret = codec_f.encode(params.source ? widen(params, src) : static_cast<const float*>(src),
+                           params.nelem());
+    *dst_len = codec_f.encoded_size();
+  }
+  else {
+    codec_d.set_params(params);
+    ret = codec_d.set_tolerance_scales(factors, scales.size());
+    if (ret == H5ZSPERR_OK)
+      ret = codec_d.encode(static_cast<const double*>(src), params.nelem());
+    *dst_len = codec_d.encoded_size();
+  }
+  if (ret)
+    return ret;
+
+  *dst = std::malloc(*dst_len);
+  if (params.ncomp)
+    std::memcpy(*dst, comp_encoded.data(), *dst_len);
+  else if (params.is_float)
+    codec_f.copy_encoded(*dst);
+  else
+    codec_d.copy_encoded(*dst);
+
+  return H5ZSPERR_OK;
+}
+
+int C_API::H5Z_SPERR_decode_chunk(size_t cd_nelmts,
+                                  const unsigned int cd_values[],
+                                  const void* src,
+                                  size_t src_len,
+                                  void** dst,
+                                  size_t* dst_len)
+{
+  if (*dst != nullptr)
+    return H5ZSPERR_ERR_SIZE;
+  const size_t raw_bytes = h5zsperr_chunk_raw_bytes(cd_nelmts, cd_values);
+  if (raw_bytes == 0)
+    return H5ZSPERR_ERR_CD_VALUES;
+
+  void* out = std::malloc(raw_bytes);
+  int ret = h5zsperr_chunk_decode(cd_nelmts, cd_values, src, src_len, out, raw_bytes);
+  if (ret) {
+    std::free(out);
+    return ret;
+  }
+  *dst = out;
+  *dst_len = raw_bytes;
+
+  return H5ZSPERR_OK;
+}
+
+int C_API::H5Z_SPERR_decode_chunk_region(size_t cd_nelmts,
+                                         const unsigned int cd_values[],
+                                         const void* src,
+                                         size_t src_len,
+                                         const size_t start[],
+                                         const size_t count[],
+                                         void* dst)
+{
+  auto params = h5zsperr::ChunkParams();
+  int ret = h5zsperr::parse_cd_values(cd_nelmts, cd_values, &params);
+  if (ret)
+    return ret;
+
+  h5zsperr::TraceSpan span(h5zsperr::trace_event::chunk_decode, src_len);
+  if (params.ncomp) {
+    return params.is_float
+               ? decode_components(codec_f, params, src, src_len, dst, start, count)
+               : decode_components(codec_d, params, src, src_len, dst, start, count);
+  }
+  else if (params.source) {
+    const size_t nelem = count[0] * count[1] * (params.rank == 3 ? count[2] : 1);
+    codec_f.set_params(params);
+    widened.resize(nelem);
+    ret = codec_f.decode_region(src, src_len, start, count, widened.data());
+    if (ret == H5ZSPERR_OK)
+      h5zsperr::kernel_narrow(widened.data(), nelem, h5zsperr::narrow_type(params.source), dst);
+    return ret;
+  }
+  else if (params.is_float) {
+    codec_f.set_params(params);
+    return codec_f.decode_region(src, src_len, start, count, static_cast<float*>(dst));
+  }
+  else {
+    codec_d.set_params(params);
+    return codec_d.decode_region(src, src_len, start, count, static_cast<double*>(dst));
+  }
+}
+
+void C_API::H5Z_SPERR_set_chunk_cache(size_t max_bytes)
+{
+  h5zsperr::chunk_cache().set_capacity(max_bytes);
+}
+
+void C_API::H5Z_SPERR_chunk_cache_stats(size_t* hits,
+                                        size_t* misses,
+                                        size_t* entries,
+                                        size_t* bytes)
+{
+  const auto stats = h5zsperr::chunk_cache().stats();
+  *hits = stats.hits;
+  *misses = stats.misses;
+  *entries = stats.entries;
+  *bytes = stats.bytes;
+}
+
+void C_API::H5Z_SPERR_trace_start(size_t max_events)
+{
+  h5zsperr::trace_start(max_events);
+}
+
+void C_API::H5Z_SPERR_trace_stop()
+{
+  h5zsperr::trace_stop();
+}
+
+int C_API::H5Z_SPERR_trace_dump(const char* path)
+{
+  return h5zsperr::trace_dump(path);
+}
+
+const char* C_API::H5Z_SPERR_strerror(int status)
+{
+  switch (status) {
+    case H5ZSPERR_OK:
+      return "Success.";
+    case H5ZSPERR_ERR_CD_VALUES:
+      return "cd_values[] isn't valid.";
+    case H5ZSPERR_ERR_VERSION:
+      return "This file is produced by H5Z-SPERR of a different compatibility version.";
+    case H5ZSPERR_ERR_SIZE:
+      return "Input buffer len isn't right.";
+    case H5ZSPERR_ERR_MASK:
+      return "SPERR compacting bitmask failed.";
+    case H5ZSPERR_ERR_COMP:
+      return "SPERR compression failed.";
+    case H5ZSPERR_ERR_DECOMP:
+      return "SPERR decompression failed.";
+    case H5ZSPERR_ERR_CORRUPT:
+      return "The compressed chunk is malformed.";
+    case H5ZSPERR_ERR_HDF5:
+      return "An HDF5 call failed, or the dataset isn't supported.";
+    case H5ZSPERR_ERR_RESIDUAL:
+      return "The chunk holds residuals of a time series; read it using H5Z_SPERR_read_temporal().";
+    default:
+      return "Unknown error.";
+  }
+}
@@ -1,6 +1,5 @@
 #include <algorithm>
 #include <cassert>
-#include <cmath>  // isnan()
 #include <memory>
 
 #include <H5PLextern.h>
@@ -8,13 +7,26 @@
 #include "h5zsperr_helper.h"
 
 #include "compactor.h"
-#include "icecream.h"
+#include "h5zsperr_kernels.h"
+
+template <typename T>
+h5zsperr::missing_test<T> nan_test()
+{
+  return {h5zsperr::missing_kind::nan, T{0}};
+}
+
+template <typename T>
+h5zsperr::missing_test<T> large_mag_test()
+{
+  return {h5zsperr::missing_kind::large_mag,
+          sizeof(T) == 4 ? T(LARGE_MAGNITUDE_F) : T(LARGE_MAGNITUDE_D)};
+}
 
 unsigned int C_API::h5zsperr_pack_extra_info(int rank, int is_float, int missing_val_mode, int magic)
 {
   assert(rank == 3 || rank == 2);
   assert(is_float == 1 || is_float == 0);
-  assert(missing_val_mode >= 0 && missing_val_mode <= 2);
+  assert(missing_val_mode >= 0 && missing_val_mode <= 6);
   assert(magic >= 0 && magic <= 63);
 
   unsigned int ret = 0;
@@ -79,11 +91,11 @@ int C_API::h5zsperr_has_nan(const void* buf, size_t nelem, int is_float)
   assert(is_float == 1 || is_float == 0);
   if (is_float) {
     const float* p = (const float*)buf;
-    return std::any_of(p, p + nelem, [](auto v) { return std::isnan(v); });
+    return h5zsperr::kernel_find(p, nelem, nan_test<float>()) < nelem;
   }
   else {
     const double* p = (const double*)buf;
-    return std::any_of(p, p + nelem, [](auto v) { return std::isnan(v); });
+    return h5zsperr::kernel_find(p, nelem, nan_test<double>()) < nelem;
   }
 }
 
@@ -92,39 +104,25 @@ int C_API::h5zsperr_has_large_mag(const void* buf, size_t nelem, int is_float)
   assert(is_float == 1 || is_float == 0);
   if (is_float) {
     const float* p = (const float*)buf;
-    return std::any_of(p, p + nelem, [](auto v) { return std::abs(v) >= LARGE_MAGNITUDE_F; });
+    return h5zsperr::kernel_find(p, nelem, large_mag_test<float>()) < nelem;
   }
   else {
     const double* p = (const double*)buf;
-    return std::any_of(p, p + nelem, [](auto v) { return std::abs(v) >= LARGE_MAGNITUDE_D; });
+    return h5zsperr::kernel_find(p, nelem, large_mag_test<double>()) < nelem;
   }
 }
 
-int C_API::h5zsperr_make_mask_nan(const void* data_buf, size_t nelem, int is_float,
-                                  void* mask_buf, size_t mask_bytes, size_t* useful_bytes)
+template <typename T>
+int make_mask_impl(const T* data_buf, size_t nelem, h5zsperr::missing_test<T> test,
+                   void* mask_buf, size_t mask_bytes, size_t* useful_bytes)
 {
-  assert(is_float == 0 || is_float == 1);
-
   // First, make a naive mask.
   //
   auto nbytes = (nelem + 7) / 8;
   while (nbytes % 8)
     nbytes++;
-  auto mem = std::make_unique<uint8_t[]>(nbytes);
-  auto s1 = icecream();
-  icecream_use_mem(&s1, mem.get(), nbytes);
-
-  if (is_float) {
-    const float* p = (const float*)data_buf;
-    for (size_t i = 0; i < nelem; i++)
-      icecream_wbit(&s1, std::isnan(p[i]));
-  }
-  else {
-    const double* p = (const double*)data_buf;
-    for (size_t i = 0; i < nelem; i++)
-      icecream_wbit(&s1, std::isnan(p[i]));
-  }
-  icecream_flush(&s1);
+  auto mem = std::make_unique<uint64_t[]>(nbytes / 8);
+  h5zsperr::kernel_make_bits(data_buf, nelem, test, mem.get());
 
   // Second, compact this naive mask.
   //
@@ -138,67 +136,40 @@ int C_API::h5zsperr_make_mask_nan(const void* data_buf, size_t nelem, int is_flo
   return 0;
 }
 
+int C_API::h5zsperr_make_mask_nan(const void* data_buf, size_t nelem, int is_float,
+                                  void* mask_buf, size_t mask_bytes, size_t* useful_bytes)
+{
+  assert(is_float == 0 || is_float == 1);
+  if (is_float)
+    return make_mask_impl((const float*)data_buf, nelem, nan_test<float>(), mask_buf,
+                          mask_bytes, useful_bytes);
+  else
+    return make_mask_impl((const double*)data_buf, nelem, nan_test<double>(), mask_buf,
+                          mask_bytes, useful_bytes);
+}
+
 int C_API::h5zsperr_make_mask_large_mag(const void* data_buf, size_t nelem, int is_float,
                                         void* mask_buf, size_t mask_bytes, size_t* useful_bytes)
 {
   assert(is_float == 0 || is_float == 1);
-
-  // First, make a naive mask.
-  //
-  auto nbytes = (nelem + 7) / 8;
-  while (nbytes % 8)
-    nbytes++;
-  auto mem = std::make_unique<uint8_t[]>(nbytes);
-  auto s1 = icecream();
-  icecream_use_mem(&s1, mem.get(), nbytes);
-
-  if (is_float) {
-    const float* p = (const float*)data_buf;
-    for (size_t i = 0; i < nelem; i++)
-      icecream_wbit(&s1, std::abs(p[i]) >= LARGE_MAGNITUDE_F);
-  }
-  else {
-    const double* p = (const double*)data_buf;
-    for (size_t i = 0; i < nelem; i++)
-      icecream_wbit(&s1, std::abs(p[i]) >= LARGE_MAGNITUDE_D);
-  }
-  icecream_flush(&s1);
-
-  // Second, compact this naive mask.
-  //
-  while (mask_bytes % 8)
-    mask_bytes--;
-  if (mask_bytes < compactor_comp_size(mem.get(), nbytes))
-    return 1; // Not enough space!
-
-  *useful_bytes = compactor_encode(mem.get(), nbytes, mask_buf, mask_bytes);
-
-  return 0;
+  if (is_float)
+    return make_mask_impl((const float*)data_buf, nelem, large_mag_test<float>(), mask_buf,
+                          mask_bytes, useful_bytes);
+  else
+    return make_mask_impl((const double*)data_buf, nelem, large_mag_test<double>(), mask_buf,
+                          mask_bytes, useful_bytes);
 }
 
 template<typename T>
 T treat_nan_impl(T* buf, size_t nelem)
 {
   // First, find the mean value.
-  const size_t BLOCK = 2048;
-  double total_sum = 0.0, block_sum = 0.0;
-  size_t total_cnt = 0, block_cnt = 0;
-
-  for (size_t i = 0; i < nelem; i++) {
-    if (!std::isnan(buf[i])) {
-      block_sum += double(buf[i]);
-      if (++block_cnt == BLOCK) {
-        total_sum += block_sum;
-        total_cnt += BLOCK;
-        block_sum = 0.0;
-        block_cnt = 0;
-      }
-    }
-  }
-  double mean = (total_sum + block_sum) / double(total_cnt + block_cnt);
+  size_t cnt = 0;
+  double sum = h5zsperr::kernel_sum_valid(buf, nelem, nan_test<T>(), &cnt);
+  double mean = sum / double(cnt);
 
   // Second, replace every occurance of NaN
-  std::replace_if(buf, buf + nelem, [](auto v) { return std::isnan(v); }, T(mean));
+  h5zsperr::kernel_replace(buf, nelem, nan_test<T>(), T(mean));
 
   return T(mean);
 }
@@ -215,29 +186,16 @@ template<typename T>
 T treat_large_mag_impl(T* buf, size_t nelem)
 {
   // First, find the mean value.
-  constexpr T MAG = sizeof(T) == 4 ? LARGE_MAGNITUDE_F : LARGE_MAGNITUDE_D;
-  const size_t BLOCK = 2048;
-  double total_sum = 0.0, block_sum = 0.0;
-  size_t total_cnt = 0, block_cnt = 0;
-
-  for (size_t i = 0; i < nelem; i++) {
-    if (std::abs(buf[i]) < MAG) {
-      block_sum += double(buf[i]);
-      if (++block_cnt == BLOCK) {
-        total_sum += block_sum;
-        total_cnt += BLOCK;
-        block_sum = 0.0;
-        block_cnt = 0;
-      }
-    }
-  }
-  double mean = (total_sum + block_sum) / double(total_cnt + block_cnt);
+  const auto test = large_mag_test<T>();
+  size_t cnt = 0;
+  double sum = h5zsperr::kernel_sum_valid(buf, nelem, test, &cnt);
+  double mean = sum / double(cnt);
 
   // Second, find the first large magnitude value.
-  auto orig = *(std::find_if(buf, buf + nelem, [MAG](auto v) { return std::abs(v) >= MAG; }));
+  auto orig = buf[h5zsperr::kernel_find(buf, nelem, test)];
 
   // Third, replace every occurance of large magnitude
-  std::replace_if(buf, buf + nelem, [MAG](auto v) { return std::abs(v) >= MAG; }, T(mean));
+  h5zsperr::kernel_replace(buf, nelem, test, T(mean));
 
   return orig;
 }
@@ -249,3 +207,15 @@ double C_API::h5zsperr_treat_large_mag_f64(double* data_buf, size_t nelem)
 {
   return treat_large_mag_impl(data_buf, nelem);
 }
+
+void C_API::h5zsperr_fill_mask_f32(float* data_buf, size_t nelem, const void* mask, float fill_val)
+{
+  h5zsperr::kernel_fill_bits(data_buf, nelem, (const uint64_t*)mask, fill_val);
+}
+void C_API::h5zsperr_fill_mask_f64(double* data_buf,
+                                   size_t nelem,
+                                   const void* mask,
+                                   double fill_val)
+{
+  h5zsperr::kernel_fill_bits(data_buf, nelem, (const uint64_t*)mask, fill_val);
+}
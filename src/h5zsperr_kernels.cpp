@@ -0,0 +1,1082 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "h5zsperr_kernels.h"
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))
+#define H5ZSPERR_X86_SIMD 1
+#include <immintrin.h>
+#define H5ZSPERR_AVX2 __attribute__((target("avx2")))
+#define H5ZSPERR_AVX512 __attribute__((target("avx512f")))
+#endif
+
+namespace h5zsperr {
+
+// The most tests that `kernel_make_bits_multi()` takes at once.
+constexpr size_t MAX_TESTS = 8;
+
+//
+// Scalar kernels: the reference implementations, and the only ones on non-x86 platforms.
+//
+template <missing_kind K, typename T>
+inline bool is_missing(T v, T val)
+{
+  if (K == missing_kind::nan)
+    return std::isnan(v);
+  else if (K == missing_kind::large_mag)
+    return std::abs(v) >= val;
+  else
+    return v == val;
+}
+
+template <typename T>
+inline bool is_missing_one(T v, const missing_test<T>& t)
+{
+  switch (t.kind) {
+    case missing_kind::nan:
+      return is_missing<missing_kind::nan>(v, t.val);
+    case missing_kind::large_mag:
+      return is_missing<missing_kind::large_mag>(v, t.val);
+    default:
+      return is_missing<missing_kind::equal>(v, t.val);
+  }
+}
+
+template <typename T>
+inline bool is_missing_any(T v, const missing_test<T>* tests, size_t ntests)
+{
+  bool miss = false;
+  for (size_t t = 0; t < ntests; t++)
+    miss |= is_missing_one(v, tests[t]);
+  return miss;
+}
+
+struct isa_scalar {
+  template <typename T, missing_kind K>
+  static size_t find(const T* buf, size_t nelem, T val)
+  {
+    for (size_t i = 0; i < nelem; i++)
+      if (is_missing<K>(buf[i], val))
+        return i;
+    return nelem;
+  }
+
+  template <typename T, missing_kind K>
+  static size_t make_bits(const T* buf, size_t nelem, T val, uint64_t* bits)
+  {
+    size_t cnt = 0;
+    for (size_t i = 0; i < nelem; i += 64) {
+      const size_t n = std::min<size_t>(64, nelem - i);
+      uint64_t w = 0;
+      for (size_t j = 0; j < n; j++)
+        w |= uint64_t(is_missing<K>(buf[i + j], val)) << j;
+      bits[i / 64] = w;
+      cnt += __builtin_popcountll(w);
+    }
+    return cnt;
+  }
+
+  template <typename T>
+  static size_t make_bits_multi(const T* buf, size_t nelem, const missing_test<T>* tests,
+                                size_t ntests, uint64_t* bits)
+  {
+    size_t cnt = 0;
+    for (size_t i = 0; i < nelem; i += 64) {
+      const size_t n = std::min<size_t>(64, nelem - i);
+      uint64_t w = 0;
+      for (size_t j = 0; j < n; j++)
+        w |= uint64_t(is_missing_any(buf[i + j], tests, ntests)) << j;
+      bits[i / 64] = w;
+      cnt += __builtin_popcountll(w);
+    }
+    return cnt;
+  }
+
+  template <typename T, missing_kind K>
+  static double sum_valid(const T* buf, size_t nelem, T val, size_t* valid_cnt)
+  {
+    // Accumulate in blocks to limit the growth of rounding errors.
+    const size_t BLOCK = 2048;
+    double total_sum = 0.0, block_sum = 0.0;
+    size_t total_cnt = 0, block_cnt = 0;
+    for (size_t i = 0; i < nelem; i++) {
+      if (!is_missing<K>(buf[i], val)) {
+        block_sum += double(buf[i]);
+        if (++block_cnt == BLOCK) {
+          total_sum += block_sum;
+          total_cnt += BLOCK;
+          block_sum = 0.0;
+          block_cnt = 0;
+        }
+      }
+    }
+    *valid_cnt = total_cnt + block_cnt;
+    return total_sum + block_sum;
+  }
+
+  template <typename T, missing_kind K>
+  static void replace(T* buf, size_t nelem, T val, T fill)
+  {
+    for (size_t i = 0; i < nelem; i++)
+      if (is_missing<K>(buf[i], val))
+        buf[i] = fill;
+  }
+
+  template <typename T>
+  static void fill_bits(T* buf, size_t nelem, const uint64_t* bits, T fill)
+  {
+    for (size_t i = 0; i < nelem; i += 64) {
+      uint64_t w = bits[i / 64];
+      if (i + 64 > nelem)
+        w &= (uint64_t{1} << (nelem - i)) - 1;
+      while (w) {
+        buf[i + __builtin_ctzll(w)] = fill;
+        w &= w - 1;
+      }
+    }
+  }
+
+  // Update `lo` and `hi` with the values in `buf`.
+  template <typename T>
+  static void minmax(const T* buf, size_t nelem, T* lo, T* hi)
+  {
+    T l = *lo, h = *hi;
+    for (size_t i = 0; i < nelem; i++) {
+      l = std::min(l, buf[i]);
+      h = std::max(h, buf[i]);
+    }
+    *lo = l;
+    *hi = h;
+  }
+};
+
+#ifdef H5ZSPERR_X86_SIMD
+//
+// AVX2 kernels. The type-specific operations are in `avx2_ops`, and the loops are in `isa_avx2`.
+//
+template <typename T>
+struct avx2_ops;
+
+template <>
+struct avx2_ops<float> {
+  using vec = __m256;
+  static constexpr size_t width = 8;
+
+  H5ZSPERR_AVX2 static vec load(const float* p) { return _mm256_loadu_ps(p); }
+  H5ZSPERR_AVX2 static vec set1(float v) { return _mm256_set1_ps(v); }
+  H5ZSPERR_AVX2 static void store(float* p, vec v) { _mm256_storeu_ps(p, v); }
+  H5ZSPERR_AVX2 static vec min(vec a, vec b) { return _mm256_min_ps(a, b); }
+  H5ZSPERR_AVX2 static vec max(vec a, vec b) { return _mm256_max_ps(a, b); }
+  H5ZSPERR_AVX2 static uint32_t bits(vec m) { return uint32_t(_mm256_movemask_ps(m)); }
+
+  template <missing_kind K>
+  H5ZSPERR_AVX2 static vec cmp(vec x, vec v)
+  {
+    if (K == missing_kind::nan)
+      return _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+    else if (K == missing_kind::large_mag)
+      return _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.f), x), v, _CMP_GE_OQ);
+    else
+      return _mm256_cmp_ps(x, v, _CMP_EQ_OQ);
+  }
+
+  H5ZSPERR_AVX2 static void store_where(float* p, vec m, vec v)
+  {
+    _mm256_maskstore_ps(p, _mm256_castps_si256(m), v);
+  }
+
+  // Expand the lowest 8 bits of `b` into a lane mask.
+  H5ZSPERR_AVX2 static vec expand(uint32_t b)
+  {
+    const __m256i sel = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i m = _mm256_and_si256(_mm256_set1_epi32(int(b)), sel);
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(m, sel));
+  }
+
+  // Add the lanes of `x` where `m` is off to the two double accumulators.
+  H5ZSPERR_AVX2 static void accumulate(__m256d& acc0, __m256d& acc1, vec x, vec m)
+  {
+    const vec valid = _mm256_andnot_ps(m, x);
+    acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(valid)));
+    acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(valid, 1)));
+  }
+};
+
+template <>
+struct avx2_ops<double> {
+  using vec = __m256d;
+  static constexpr size_t width = 4;
+
+  H5ZSPERR_AVX2 static vec load(const double* p) { return _mm256_loadu_pd(p); }
+  H5ZSPERR_AVX2 static vec set1(double v) { return _mm256_set1_pd(v); }
+  H5ZSPERR_AVX2 static void store(double* p, vec v) { _mm256_storeu_pd(p, v); }
+  H5ZSPERR_AVX2 static vec min(vec a, vec b) { return _mm256_min_pd(a, b); }
+  H5ZSPERR_AVX2 static vec max(vec a, vec b) { return _mm256_max_pd(a, b); }
+  H5ZSPERR_AVX2 static uint32_t bits(vec m) { return uint32_t(_mm256_movemask_pd(m)); }
+
+  template <missing_kind K>
+  H5ZSPERR_AVX2 static vec cmp(vec x, vec v)
+  {
+    if (K == missing_kind::nan)
+      return _mm256_cmp_pd(x, x, _CMP_UNORD_Q);
+    else if (K == missing_kind::large_mag)
+      return _mm256_cmp_pd(_mm256_andnot_pd(_mm256_set1_pd(-0.0), x), v, _CMP_GE_OQ);
+    else
+      return _mm256_cmp_pd(x, v, _CMP_EQ_OQ);
+  }
+
+  H5ZSPERR_AVX2 static void store_where(double* p, vec m, vec v)
+  {
+    _mm256_maskstore_pd(p, _mm256_castpd_si256(m), v);
+  }
+
+  H5ZSPERR_AVX2 static vec expand(uint32_t b)
+  {
+    const __m256i sel = _mm256_setr_epi64x(1, 2, 4, 8);
+    const __m256i m = _mm256_and_si256(_mm256_set1_epi64x(int64_t(b)), sel);
+    return _mm256_castsi256_pd(_mm256_cmpeq_epi64(m, sel));
+  }
+
+  H5ZSPERR_AVX2 static void accumulate(__m256d& acc0, __m256d& acc1, vec x, vec m)
+  {
+    (void)acc1;
+    acc0 = _mm256_add_pd(acc0, _mm256_andnot_pd(m, x));
+  }
+};
+
+struct isa_avx2 {
+  template <typename T, missing_kind K>
+  H5ZSPERR_AVX2 static size_t find(const T* buf, size_t nelem, T val)
+  {
+    using O = avx2_ops<T>;
+    constexpr size_t W = O::width;
+    const auto v = O::set1(val);
+    size_t i = 0;
+    for (; i + 4 * W <= nelem; i += 4 * W) {
+      const auto m0 = O::template cmp<K>(O::load(buf + i), v);
+      const auto m1 = O::template cmp<K>(O::load(buf + i + W), v);
+      const auto m2 = O::template cmp<K>(O::load(buf + i + 2 * W), v);
+      const auto m3 = O::template cmp<K>(O::load(buf + i + 3 * W), v);
+      const uint32_t b = O::bits(m0) | (O::bits(m1) << W) | (O::bits(m2) << (2 * W)) |
+                         (O::bits(m3) << (3 * W));
+      if (b)
+        return i + __builtin_ctz(b);
+    }
+    return i + isa_scalar::find<T, K>(buf + i, nelem - i, val);
+  }
+
+  template <typename T, missing_kind K>
+  H5ZSPERR_AVX2 static size_t make_bits(const T* buf, size_t nelem, T val, uint64_t* bits)
+  {
+    using O = avx2_ops<T>;
+    const auto v = O::set1(val);
+    size_t cnt = 0, i = 0;
+    for (; i + 64 <= nelem; i += 64) {
+      uint64_t w = 0;
+      for (size_t j = 0; j < 64; j += O::width)
+        w |= uint64_t(O::bits(O::template cmp<K>(O::load(buf + i + j), v))) << j;
+      bits[i / 64] = w;
+      cnt += __builtin_popcountll(w);
+    }
+    if (i < nelem)
+      cnt += isa_scalar::make_bits<T, K>(buf + i, nelem - i, val, bits + i / 64);
+    return cnt;
+  }
+
+  template <typename T>
+  H5ZSPERR_AVX2 static uint32_t cmp_any(typename avx2_ops<T>::vec x,
+                                        const typename avx2_ops<T>::vec* v,
+                                        const missing_test<T>* tests,
+                                        size_t ntests)
+  {
+    using O = avx2_ops<T>;
+    uint32_t b = 0;
+    for (size_t t = 0; t < ntests; t++) {
+      if (tests[t].kind == missing_kind::nan)
+        b |= O::bits(O::template cmp<missing_kind::nan>(x, v[t]));
+      else if (tests[t].kind == missing_kind::large_mag)
+        b |= O::bits(O::template cmp<missing_kind::large_mag>(x, v[t]));
+      else
+        b |= O::bits(O::template cmp<missing_kind::equal>(x, v[t]));
+    }
+    return b;
+  }
+
+  template <typename T>
+  H5ZSPERR_AVX2 static size_t make_bits_multi(const T* buf, size_t nelem,
+                                              const missing_test<T>* tests, size_t ntests,
+                                              uint64_t* bits)
+  {
+    using O = avx2_ops<T>;
+    typename O::vec v[MAX_TESTS];
+    for (size_t t = 0; t < ntests; t++)
+      v[t] = O::set1(tests[t].val);
+    size_t cnt = 0, i = 0;
+    for (; i + 64 <= nelem; i += 64) {
+      uint64_t w = 0;
+      for (size_t j = 0; j < 64; j += O::width)
+        w |= uint64_t(cmp_any(O::load(buf + i + j), v, tests, ntests)) << j;
+      bits[i / 64] = w;
+      cnt += __builtin_popcountll(w);
+    }
+    if (i < nelem)
+      cnt += isa_scalar::make_bits_multi(buf + i, nelem - i, tests, ntests, bits + i / 64);
+    return cnt;
+  }
+
+  template <typename T, missing_kind K>
+  H5ZSPERR_AVX2 static double sum_valid(const T* buf, size_t nelem, T val, size_t* valid_cnt)
+  {
+    using O = avx2_ops<T>;
+    const auto v = O::set1(val);
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t nmiss = 0, i = 0;
+    for (; i + O::width <= nelem; i += O::width) {
+      const auto x = O::load(buf + i);
+      const auto m = O::template cmp<K>(x, v);
+      nmiss += __builtin_popcount(O::bits(m));
+      O::accumulate(acc0, acc1, x, m);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    size_t tail_cnt = 0;
+    const double tail_sum = isa_scalar::sum_valid<T, K>(buf + i, nelem - i, val, &tail_cnt);
+    *valid_cnt = i - nmiss + tail_cnt;
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + tail_sum;
+  }
+
+  template <typename T, missing_kind K>
+  H5ZSPERR_AVX2 static void replace(T* buf, size_t nelem, T val, T fill)
+  {
+    using O = avx2_ops<T>;
+    const auto v = O::set1(val);
+    const auto f = O::set1(fill);
+    size_t i = 0;
+    for (; i + O::width <= nelem; i += O::width)
+      O::store_where(buf + i, O::template cmp<K>(O::load(buf + i), v), f);
+    isa_scalar::replace<T, K>(buf + i, nelem - i, val, fill);
+  }
+
+  template <typename T>
+  H5ZSPERR_AVX2 static void fill_bits(T* buf, size_t nelem, const uint64_t* bits, T fill)
+  {
+    using O = avx2_ops<T>;
+    constexpr uint64_t lane_bits = (uint64_t{1} << O::width) - 1;
+    const auto f = O::set1(fill);
+    size_t i = 0;
+    for (; i + 64 <= nelem; i += 64) {
+      const uint64_t w = bits[i / 64];
+      if (w == 0)
+        continue;
+      for (size_t j = 0; j < 64; j += O::width) {
+        const uint32_t b = uint32_t((w >> j) & lane_bits);
+        if (b)
+          O::store_where(buf + i + j, O::expand(b), f);
+      }
+    }
+    if (i < nelem)
+      isa_scalar::fill_bits(buf + i, nelem - i, bits + i / 64, fill);
+  }
+  template <typename T>
+  H5ZSPERR_AVX2 static void minmax(const T* buf, size_t nelem, T* lo, T* hi)
+  {
+    using O = avx2_ops<T>;
+    constexpr size_t W = O::width;
+    auto vlo = O::set1(*lo), vhi = O::set1(*hi);
+    size_t i = 0;
+    for (; i + W <= nelem; i += W) {
+      const auto x = O::load(buf + i);
+      vlo = O::min(vlo, x);
+      vhi = O::max(vhi, x);
+    }
+    T l[W], h[W];
+    O::store(l, vlo);
+    O::store(h, vhi);
+    isa_scalar::minmax(l, W, lo, hi);
+    isa_scalar::minmax(h, W, lo, hi);
+    isa_scalar::minmax(buf + i, nelem - i, lo, hi);
+  }
+};
+
+//
+// AVX-512 kernels. Comparisons produce mask registers directly, which makes
+// the masked stores and the bit packing straightforward.
+//
+template <typename T>
+struct avx512_ops;
+
+template <>
+struct avx512_ops<float> {
+  using vec = __m512;
+  static constexpr size_t width = 16;
+
+  H5ZSPERR_AVX512 static vec load(const float* p) { return _mm512_loadu_ps(p); }
+  H5ZSPERR_AVX512 static vec set1(float v) { return _mm512_set1_ps(v); }
+  H5ZSPERR_AVX512 static void store(float* p, vec v) { _mm512_storeu_ps(p, v); }
+  H5ZSPERR_AVX512 static vec min(vec a, vec b) { return _mm512_min_ps(a, b); }
+  H5ZSPERR_AVX512 static vec max(vec a, vec b) { return _mm512_max_ps(a, b); }
+
+  template <missing_kind K>
+  H5ZSPERR_AVX512 static uint32_t cmp(vec x, vec v)
+  {
+    if (K == missing_kind::nan)
+      return _mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q);
+    else if (K == missing_kind::large_mag)
+      return _mm512_cmp_ps_mask(_mm512_abs_ps(x), v, _CMP_GE_OQ);
+    else
+      return _mm512_cmp_ps_mask(x, v, _CMP_EQ_OQ);
+  }
+
+  H5ZSPERR_AVX512 static void store_where(float* p, uint32_t m, vec v)
+  {
+    _mm512_mask_storeu_ps(p, __mmask16(m), v);
+  }
+
+  H5ZSPERR_AVX512 static void accumulate(__m512d& acc0, __m512d& acc1, vec x, uint32_t m)
+  {
+    const vec valid = _mm512_maskz_mov_ps(__mmask16(~m), x);
+    const __m256 lo = _mm512_castps512_ps256(valid);
+    const __m256 hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(valid), 1));
+    acc0 = _mm512_add_pd(acc0, _mm512_cvtps_pd(lo));
+    acc1 = _mm512_add_pd(acc1, _mm512_cvtps_pd(hi));
+  }
+};
+
+template <>
+struct avx512_ops<double> {
+  using vec = __m512d;
+  static constexpr size_t width = 8;
+
+  H5ZSPERR_AVX512 static vec load(const double* p) { return _mm512_loadu_pd(p); }
+  H5ZSPERR_AVX512 static vec set1(double v) { return _mm512_set1_pd(v); }
+  H5ZSPERR_AVX512 static void store(double* p, vec v) { _mm512_storeu_pd(p, v); }
+  H5ZSPERR_AVX512 static vec min(vec a, vec b) { return _mm512_min_pd(a, b); }
+  H5ZSPERR_AVX512 static vec max(vec a, vec b) { return _mm512_max_pd(a, b); }
+
+  template <missing_kind K>
+  H5ZSPERR_AVX512 static uint32_t cmp(vec x, vec v)
+  {
+    if (K == missing_kind::nan)
+      return _mm512_cmp_pd_mask(x, x, _CMP_UNORD_Q);
+    else if (K == missing_kind::large_mag)
+      return _mm512_cmp_pd_mask(_mm512_abs_pd(x), v, _CMP_GE_OQ);
+    else
+      return _mm512_cmp_pd_mask(x, v, _CMP_EQ_OQ);
+  }
+
+  H5ZSPERR_AVX512 static void store_where(double* p, uint32_t m, vec v)
+  {
+    _mm512_mask_storeu_pd(p, __mmask8(m), v);
+  }
+
+  H5ZSPERR_AVX512 static void accumulate(__m512d& acc0, __m512d& acc1, vec x, uint32_t m)
+  {
+    (void)acc1;
+    acc0 = _mm512_add_pd(acc0, _mm512_maskz_mov_pd(__mmask8(~m), x));
+  }
+};
+
+struct isa_avx512 {
+  template <typename T, missing_kind K>
+  H5ZSPERR_AVX512 static size_t find(const T* buf, size_t nelem, T val)
+  {
+    using O = avx512_ops<T>;
+    constexpr size_t W = O::width;
+    const auto v = O::set1(val);
+    size_t i = 0;
+    for (; i + 4 * W <= nelem; i += 4 * W) {
+      const uint64_t b = uint64_t(O::template cmp<K>(O::load(buf + i), v)) |
+                         (uint64_t(O::template cmp<K>(O::load(buf + i + W), v)) << W) |
+                         (uint64_t(O::template cmp<K>(O::load(buf + i + 2 * W), v)) << (2 * W)) |
+                         (uint64_t(O::template cmp<K>(O::load(buf + i + 3 * W), v)) << (3 * W));
+      if (b)
+        return i + __builtin_ctzll(b);
+    }
+    return i + isa_scalar::find<T, K>(buf + i, nelem - i, val);
+  }
+
+  template <typename T, missing_kind K>
+  H5ZSPERR_AVX512 static size_t make_bits(const T* buf, size_t nelem, T val, uint64_t* bits)
+  {
+    using O = avx512_ops<T>;
+    const auto v = O::set1(val);
+    size_t cnt = 0, i = 0;
+    for (; i + 64 <= nelem; i += 64) {
+      uint64_t w = 0;
+      for (size_t j = 0; j < 64; j += O::width)
+        w |= uint64_t(O::template cmp<K>(O::load(buf + i + j), v)) << j;
+      bits[i / 64] = w;
+      cnt += __builtin_popcountll(w);
+    }
+    if (i < nelem)
+      cnt += isa_scalar::make_bits<T, K>(buf + i, nelem - i, val, bits + i / 64);
+    return cnt;
+  }
+
+  template <typename T>
+  H5ZSPERR_AVX512 static uint32_t cmp_any(typename avx512_ops<T>::vec x,
+                                          const typename avx512_ops<T>::vec* v,
+                                          const missing_test<T>* tests,
+                                          size_t ntests)
+  {
+    using O = avx512_ops<T>;
+    uint32_t b = 0;
+    for (size_t t = 0; t < ntests; t++) {
+      if (tests[t].kind == missing_kind::nan)
+        b |= O::template cmp<missing_kind::nan>(x, v[t]);
+      else if (tests[t].kind == missing_kind::large_mag)
+        b |= O::template cmp<missing_kind::large_mag>(x, v[t]);
+      else
+        b |= O::template cmp<missing_kind::equal>(x, v[t]);
+    }
+    return b;
+  }
+
+  template <typename T>
+  H5ZSPERR_AVX512 static size_t make_bits_multi(const T* buf, size_t nelem,
+                                                const missing_test<T>* tests, size_t ntests,
+                                                uint64_t* bits)
+  {
+    using O = avx512_ops<T>;
+    typename O::vec v[MAX_TESTS];
+    for (size_t t = 0; t < ntests; t++)
+      v[t] = O::set1(tests[t].val);
+    size_t cnt = 0, i = 0;
+    for (; i + 64 <= nelem; i += 64) {
+      uint64_t w = 0;
+      for (size_t j = 0; j < 64; j += O::width)
+        w |= uint64_t(cmp_any(O::load(buf + i + j), v, tests, ntests)) << j;
+      bits[i / 64] = w;
+      cnt += __builtin_popcountll(w);
+    }
+    if (i < nelem)
+      cnt += isa_scalar::make_bits_multi(buf + i, nelem - i, tests, ntests, bits + i / 64);
+    return cnt;
+  }
+
+  template <typename T, missing_kind K>
+  H5ZSPERR_AVX512 static double sum_valid(const T* buf, size_t nelem, T val, size_t* valid_cnt)
+  {
+    using O = avx512_ops<T>;
+    const auto v = O::set1(val);
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+    size_t nmiss = 0, i = 0;
+    for (; i + O::width <= nelem; i += O::width) {
+      const auto x = O::load(buf + i);
+      const uint32_t m = O::template cmp<K>(x, v);
+      nmiss += __builtin_popcount(m);
+      O::accumulate(acc0, acc1, x, m);
+    }
+    size_t tail_cnt = 0;
+    const double tail_sum = isa_scalar::sum_valid<T, K>(buf + i, nelem - i, val, &tail_cnt);
+    *valid_cnt = i - nmiss + tail_cnt;
+    return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1)) + tail_sum;
+  }
+
+  template <typename T, missing_kind K>
+  H5ZSPERR_AVX512 static void replace(T* buf, size_t nelem, T val, T fill)
+  {
+    using O = avx512_ops<T>;
+    const auto v = O::set1(val);
+    const auto f = O::set1(fill);
+    size_t i = 0;
+    for (; i + O::width <= nelem; i += O::width)
+      O::store_where(buf + i, O::template cmp<K>(O::load(buf + i), v), f);
+    isa_scalar::replace<T, K>(buf + i, nelem - i, val, fill);
+  }
+
+  template <typename T>
+  H5ZSPERR_AVX512 static void fill_bits(T* buf, size_t nelem, const uint64_t* bits, T fill)
+  {
+    using O = avx512_ops<T>;
+    constexpr uint64_t lane_bits = (uint64_t{1} << O::width) - 1;
+    const auto f = O::set1(fill);
+    size_t i = 0;
+    for (; i + 64 <= nelem; i += 64) {
+      const uint64_t w = bits[i / 64];
+      if (w == 0)
+        continue;
+      for (size_t j = 0; j < 64; j += O::width)
+        O::store_where(buf + i + j, uint32_t((w >> j) & lane_bits), f);
+    }
+    if (i < nelem)
+      isa_scalar::fill_bits(buf + i, nelem - i, bits + i / 64, fill);
+  }
+  template <typename T>
+  H5ZSPERR_AVX512 static void minmax(const T* buf, size_t nelem, T* lo, T* hi)
+  {
+    using O = avx512_ops<T>;
+    constexpr size_t W = O::width;
+    auto vlo = O::set1(*lo), vhi = O::set1(*hi);
+    size_t i = 0;
+    for (; i + W <= nelem; i += W) {
+      const auto x = O::load(buf + i);
+      vlo = O::min(vlo, x);
+      vhi = O::max(vhi, x);
+    }
+    T l[W], h[W];
+    O::store(l, vlo);
+    O::store(h, vhi);
+    isa_scalar::minmax(l, W, lo, hi);
+    isa_scalar::minmax(h, W, lo, hi);
+    isa_scalar::minmax(buf + i, nelem - i, lo, hi);
+  }
+};
+#endif
+
+//
+// Runtime selection of the instruction set.
+//
+simd_isa simd_supported()
+{
+#ifdef H5ZSPERR_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return simd_isa::avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return simd_isa::avx2;
+#endif
+  return simd_isa::scalar;
+}
+
+static std::atomic<int> active_isa{-1};
+
+simd_isa simd_select(simd_isa isa)
+{
+  const auto best = simd_supported();
+  if (int(isa) > int(best))
+    isa = best;
+  active_isa.store(int(isa), std::memory_order_relaxed);
+  return isa;
+}
+
+simd_isa simd_active()
+{
+  int isa = active_isa.load(std::memory_order_relaxed);
+  if (isa < 0) {
+    auto want = simd_isa::avx512;
+    const char* env = std::getenv("H5ZSPERR_SIMD");
+    if (env && std::strcmp(env, "scalar") == 0)
+      want = simd_isa::scalar;
+    else if (env && std::strcmp(env, "avx2") == 0)
+      want = simd_isa::avx2;
+    isa = int(simd_select(want));
+  }
+  return simd_isa(isa);
+}
+
+const char* simd_name(simd_isa isa)
+{
+  switch (isa) {
+    case simd_isa::avx2:
+      return "avx2";
+    case simd_isa::avx512:
+      return "avx512";
+    default:
+      return "scalar";
+  }
+}
+
+//
+// Dispatch on the missing value test, then on the instruction set.
+//
+template <typename ISA, typename T>
+size_t find_impl(const T* buf, size_t nelem, missing_test<T> t)
+{
+  switch (t.kind) {
+    case missing_kind::nan:
+      return ISA::template find<T, missing_kind::nan>(buf, nelem, t.val);
+    case missing_kind::large_mag:
+      return ISA::template find<T, missing_kind::large_mag>(buf, nelem, t.val);
+    default:
+      return ISA::template find<T, missing_kind::equal>(buf, nelem, t.val);
+  }
+}
+
+template <typename ISA, typename T>
+size_t make_bits_impl(const T* buf, size_t nelem, missing_test<T> t, uint64_t* bits)
+{
+  switch (t.kind) {
+    case missing_kind::nan:
+      return ISA::template make_bits<T, missing_kind::nan>(buf, nelem, t.val, bits);
+    case missing_kind::large_mag:
+      return ISA::template make_bits<T, missing_kind::large_mag>(buf, nelem, t.val, bits);
+    default:
+      return ISA::template make_bits<T, missing_kind::equal>(buf, nelem, t.val, bits);
+  }
+}
+
+template <typename ISA, typename T>
+double sum_valid_impl(const T* buf, size_t nelem, missing_test<T> t, size_t* cnt)
+{
+  switch (t.kind) {
+    case missing_kind::nan:
+      return ISA::template sum_valid<T, missing_kind::nan>(buf, nelem, t.val, cnt);
+    case missing_kind::large_mag:
+      return ISA::template sum_valid<T, missing_kind::large_mag>(buf, nelem, t.val, cnt);
+    default:
+      return ISA::template sum_valid<T, missing_kind::equal>(buf, nelem, t.val, cnt);
+  }
+}
+
+template <typename ISA, typename T>
+void replace_impl(T* buf, size_t nelem, missing_test<T> t, T fill)
+{
+  switch (t.kind) {
+    case missing_kind::nan:
+      ISA::template replace<T, missing_kind::nan>(buf, nelem, t.val, fill);
+      break;
+    case missing_kind::large_mag:
+      ISA::template replace<T, missing_kind::large_mag>(buf, nelem, t.val, fill);
+      break;
+    default:
+      ISA::template replace<T, missing_kind::equal>(buf, nelem, t.val, fill);
+  }
+}
+
+template <typename T>
+size_t kernel_find(const T* buf, size_t nelem, missing_test<T> test)
+{
+#ifdef H5ZSPERR_X86_SIMD
+  switch (simd_active()) {
+    case simd_isa::avx512:
+      return find_impl<isa_avx512>(buf, nelem, test);
+    case simd_isa::avx2:
+      return find_impl<isa_avx2>(buf, nelem, test);
+    default:;
+  }
+#endif
+  return find_impl<isa_scalar>(buf, nelem, test);
+}
+
+template <typename T>
+size_t kernel_make_bits(const T* buf, size_t nelem, missing_test<T> test, uint64_t* bits)
+{
+#ifdef H5ZSPERR_X86_SIMD
+  switch (simd_active()) {
+    case simd_isa::avx512:
+      return make_bits_impl<isa_avx512>(buf, nelem, test, bits);
+    case simd_isa::avx2:
+      return make_bits_impl<isa_avx2>(buf, nelem, test, bits);
+    default:;
+  }
+#endif
+  return make_bits_impl<isa_scalar>(buf, nelem, test, bits);
+}
+
+template <typename T>
+size_t kernel_make_bits_multi(const T* buf,
+                              size_t nelem,
+                              const missing_test<T>* tests,
+                              size_t ntests,
+                              uint64_t* bits)
+{
+  ntests = std::min(ntests, MAX_TESTS);
+#ifdef H5ZSPERR_X86_SIMD
+  switch (simd_active()) {
+    case simd_isa::avx512:
+      return isa_avx512::make_bits_multi(buf, nelem, tests, ntests, bits);
+    case simd_isa::avx2:
+      return isa_avx2::make_bits_multi(buf, nelem, tests, ntests, bits);
+    default:;
+  }
+#endif
+  return isa_scalar::make_bits_multi(buf, nelem, tests, ntests, bits);
+}
+
+template <typename T>
+bool kernel_is_missing(T val, missing_test<T> test)
+{
+  return is_missing_one(val, test);
+}
+
+template <typename T>
+double kernel_sum_valid(const T* buf, size_t nelem, missing_test<T> test, size_t* valid_cnt)
+{
+#ifdef H5ZSPERR_X86_SIMD
+  switch (simd_active()) {
+    case simd_isa::avx512:
+      return sum_valid_impl<isa_avx512>(buf, nelem, test, valid_cnt);
+    case simd_isa::avx2:
+      return sum_valid_impl<isa_avx2>(buf, nelem, test, valid_cnt);
+    default:;
+  }
+#endif
+  return sum_valid_impl<isa_scalar>(buf, nelem, test, valid_cnt);
+}
+
+template <typename T>
+void kernel_replace(T* buf, size_t nelem, missing_test<T> test, T val)
+{
+#ifdef H5ZSPERR_X86_SIMD
+  switch (simd_active()) {
+    case simd_isa::avx512:
+      return replace_impl<isa_avx512>(buf, nelem, test, val);
+    case simd_isa::avx2:
+      return replace_impl<isa_avx2>(buf, nelem, test, val);
+    default:;
+  }
+#endif
+  replace_impl<isa_scalar>(buf, nelem, test, val);
+}
+
+template <typename T>
+void kernel_fill_bits(T* buf, size_t nelem, const uint64_t* bits, T val)
+{
+#ifdef H5ZSPERR_X86_SIMD
+  switch (simd_active()) {
+    case simd_isa::avx512:
+      return isa_avx512::fill_bits(buf, nelem, bits, val);
+    case simd_isa::avx2:
+      return isa_avx2::fill_bits(buf, nelem, bits, val);
+    default:;
+  }
+#endif
+  isa_scalar::fill_bits(buf, nelem, bits, val);
+}
+
+template <typename T>
+void kernel_minmax(const T* buf, size_t nelem, T* min, T* max)
+{
+  *min = buf[0];
+  *max = buf[0];
+#ifdef H5ZSPERR_X86_SIMD
+  switch (simd_active()) {
+    case simd_isa::avx512:
+      return isa_avx512::minmax(buf, nelem, min, max);
+    case simd_isa::avx2:
+      return isa_avx2::minmax(buf, nelem, min, max);
+    default:;
+  }
+#endif
+  isa_scalar::minmax(buf, nelem, min, max);
+}
+
+//
+// Conversion of 16-bit values. Half-precision values are converted bit by bit, in the same way as
+// F16C instructions do, including that NaNs come out quiet. There are no AVX-512 versions, since
+// the AVX2 ones already keep up with memory bandwidth.
+//
+inline float half_to_float(uint16_t h)
+{
+  const uint32_t sign = uint32_t(h & 0x8000u) << 16;
+  uint32_t exp = (h >> 10) & 0x1fu;
+  uint32_t mant = h & 0x3ffu;
+  uint32_t bits = 0;
+  if (exp == 0x1f)
+    bits = sign | 0x7f800000u | (mant << 13) | (mant ? 0x400000u : 0u);
+  else if (exp != 0)
+    bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  else if (mant == 0)
+    bits = sign;
+  else { /* subnormal, which is normal as a float */
+    exp = 127 - 15 + 1;
+    while ((mant & 0x400u) == 0) {
+      mant <<= 1;
+      exp--;
+    }
+    bits = sign | (exp << 23) | ((mant & 0x3ffu) << 13);
+  }
+  float f = 0.f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+inline uint16_t float_to_half(float f)
+{
+  uint32_t x = 0;
+  std::memcpy(&x, &f, sizeof(x));
+  const auto sign = uint16_t((x >> 16) & 0x8000u);
+  const uint32_t absx = x & 0x7fffffffu;
+  if (absx > 0x7f800000u) /* NaN */
+    return uint16_t(sign | 0x7e00u | ((absx >> 13) & 0x3ffu));
+  if (absx >= 0x477ff000u) /* 65520 and above round to infinity */
+    return uint16_t(sign | 0x7c00u);
+  uint32_t h = 0, rem = 0, half = 0;
+  if (absx >= 0x38800000u) { /* normal, i.e., at least 2^-14 */
+    h = (absx - 0x38000000u) >> 13;
+    rem = absx & 0x1fffu;
+    half = 0x1000u;
+  }
+  else if (absx >= 0x33000000u) { /* subnormal, in units of 2^-24 */
+    const uint32_t shift = 126 - (absx >> 23);
+    const uint32_t mant = (absx & 0x7fffffu) | 0x800000u;
+    h = mant >> shift;
+    rem = mant & ((1u << shift) - 1);
+    half = 1u << (shift - 1);
+  }
+  if (rem > half || (rem == half && (h & 1)))
+    h++; /* which may carry into the exponent, as it should */
+  return uint16_t(sign | h);
+}
+
+template <typename I>
+inline I float_to_int(float v)
+{
+  const float lo = float(std::numeric_limits<I>::min());
+  const float hi = float(std::numeric_limits<I>::max());
+  if (!(v >= lo)) /* NaN as well */
+    v = lo;
+  if (v > hi)
+    v = hi;
+  return I(std::nearbyint(v));
+}
+
+struct convert_scalar {
+  static void widen(const void* src, size_t nelem, narrow_type type, float* dst)
+  {
+    if (type == narrow_type::int16) {
+      const auto* p = static_cast<const int16_t*>(src);
+      for (size_t i = 0; i < nelem; i++)
+        dst[i] = float(p[i]);
+    }
+    else if (type == narrow_type::uint16) {
+      const auto* p = static_cast<const uint16_t*>(src);
+      for (size_t i = 0; i < nelem; i++)
+        dst[i] = float(p[i]);
+    }
+    else {
+      const auto* p = static_cast<const uint16_t*>(src);
+      for (size_t i = 0; i < nelem; i++)
+        dst[i] = half_to_float(p[i]);
+    }
+  }
+
+  static void narrow(const float* src, size_t nelem, narrow_type type, void* dst)
+  {
+    if (type == narrow_type::int16) {
+      auto* p = static_cast<int16_t*>(dst);
+      for (size_t i = 0; i < nelem; i++)
+        p[i] = float_to_int<int16_t>(src[i]);
+    }
+    else if (type == narrow_type::uint16) {
+      auto* p = static_cast<uint16_t*>(dst);
+      for (size_t i = 0; i < nelem; i++)
+        p[i] = float_to_int<uint16_t>(src[i]);
+    }
+    else {
+      auto* p = static_cast<uint16_t*>(dst);
+      for (size_t i = 0; i < nelem; i++)
+        p[i] = float_to_half(src[i]);
+    }
+  }
+};
+
+#ifdef H5ZSPERR_X86_SIMD
+#define H5ZSPERR_F16C __attribute__((target("avx2,f16c")))
+
+struct convert_avx2 {
+  H5ZSPERR_AVX2 static void widen_int(const void* src, size_t nelem, bool is_signed, float* dst)
+  {
+    const auto* p = static_cast<const uint8_t*>(src);
+    size_t i = 0;
+    for (; i + 8 <= nelem; i += 8) {
+      const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2 * i));
+      const __m256i y = is_signed ? _mm256_cvtepi16_epi32(x) : _mm256_cvtepu16_epi32(x);
+      _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(y));
+    }
+    convert_scalar::widen(p + 2 * i, nelem - i,
+                          is_signed ? narrow_type::int16 : narrow_type::uint16, dst + i);
+  }
+
+  H5ZSPERR_AVX2 static void narrow_int(const float* src, size_t nelem, bool is_signed, void* dst)
+  {
+    auto* p = static_cast<uint8_t*>(dst);
+    const auto type = is_signed ? narrow_type::int16 : narrow_type::uint16;
+    const __m256 lo = _mm256_set1_ps(is_signed ? -32768.f : 0.f);
+    const __m256 hi = _mm256_set1_ps(is_signed ? 32767.f : 65535.f);
+    size_t i = 0;
+    for (; i + 16 <= nelem; i += 16) {
+      // `max` returns its second operand when the first is a NaN.
+      const __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), lo), hi);
+      const __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i + 8), lo), hi);
+      const __m256i ia = _mm256_cvtps_epi32(a), ib = _mm256_cvtps_epi32(b);
+      const __m256i packed =
+          is_signed ? _mm256_packs_epi32(ia, ib) : _mm256_packus_epi32(ia, ib);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + 2 * i),
+                          _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+    convert_scalar::narrow(src + i, nelem - i, type, p + 2 * i);
+  }
+
+  H5ZSPERR_F16C static void widen_half(const void* src, size_t nelem, float* dst)
+  {
+    const auto* p = static_cast<const uint8_t*>(src);
+    size_t i = 0;
+    for (; i + 8 <= nelem; i += 8) {
+      const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2 * i));
+      _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(x));
+    }
+    convert_scalar::widen(p + 2 * i, nelem - i, narrow_type::float16, dst + i);
+  }
+
+  H5ZSPERR_F16C static void narrow_half(const float* src, size_t nelem, void* dst)
+  {
+    auto* p = static_cast<uint8_t*>(dst);
+    size_t i = 0;
+    for (; i + 8 <= nelem; i += 8) {
+      const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 2 * i), h);
+    }
+    convert_scalar::narrow(src + i, nelem - i, narrow_type::float16, p + 2 * i);
+  }
+};
+
+/* F16C comes with every AVX2 CPU in practice, but it is a feature of its own. */
+static bool has_f16c()
+{
+  static const bool yes = __builtin_cpu_supports("f16c");
+  return yes;
+}
+#endif
+
+void kernel_widen(const void* src, size_t nelem, narrow_type type, float* dst)
+{
+#ifdef H5ZSPERR_X86_SIMD
+  if (simd_active() != simd_isa::scalar) {
+    if (type != narrow_type::float16)
+      return convert_avx2::widen_int(src, nelem, type == narrow_type::int16, dst);
+    if (has_f16c())
+      return convert_avx2::widen_half(src, nelem, dst);
+  }
+#endif
+  convert_scalar::widen(src, nelem, type, dst);
+}
+
+void kernel_narrow(const float* src, size_t nelem, narrow_type type, void* dst)
+{
+#ifdef H5ZSPERR_X86_SIMD
+  if (simd_active() != simd_isa::scalar) {
+    if (type != narrow_type::float16)
+      return convert_avx2::narrow_int(src, nelem, type == narrow_type::int16, dst);
+    if (has_f16c())
+      return convert_avx2::narrow_half(src, nelem, dst);
+  }
+#endif
+  convert_scalar::narrow(src, nelem, type, dst);
+}
+
+template size_t kernel_find(const float*, size_t, missing_test<float>);
+template size_t kernel_find(const double*, size_t, missing_test<double>);
+template size_t kernel_make_bits(const float*, size_t, missing_test<float>, uint64_t*);
+template size_t kernel_make_bits(const double*, size_t, missing_test<double>, uint64_t*);
+template size_t kernel_make_bits_multi(const float*, size_t, const missing_test<float>*, size_t,
+                                       uint64_t*);
+template size_t kernel_make_bits_multi(const double*, size_t, const missing_test<double>*, size_t,
+                                       uint64_t*);
+template bool kernel_is_missing(float, missing_test<float>);
+template bool kernel_is_missing(double, missing_test<double>);
+template double kernel_sum_valid(const float*, size_t, missing_test<float>, size_t*);
+template double kernel_sum_valid(const double*, size_t, missing_test<double>, size_t*);
+template void kernel_replace(float*, size_t, missing_test<float>, float);
+template void kernel_replace(double*, size_t, missing_test<double>, double);
+template void kernel_fill_bits(float*, size_t, const uint64_t*, float);
+template void kernel_fill_bits(double*, size_t, const uint64_t*, double);
+template void kernel_minmax(const float*, size_t, float*, float*);
+template void kernel_minmax(const double*, size_t, double*, double*);
+
+}  // namespace h5zsperr
@@ -0,0 +1,39 @@
+#include "h5zsperr_mask_cache.h"
+
+#include <algorithm>
+
+namespace h5zsperr {
+
+void mask_bits_to_runs(const uint64_t* bits, size_t nelem, MaskRuns* runs)
+{
+  /* Find the next position at or after `pos` whose bit is `one`, skipping whole words. */
+  const size_t nwords = (nelem + 63) / 64;
+  auto next = [bits, nelem, nwords](size_t pos, bool one) -> size_t {
+    size_t w = pos / 64;
+    uint64_t word = (one ? bits[w] : ~bits[w]) & (~uint64_t(0) << (pos % 64));
+    while (word == 0) {
+      if (++w == nwords)
+        return nelem;
+      word = one ? bits[w] : ~bits[w];
+    }
+    return std::min(w * 64 + __builtin_ctzll(word), nelem);
+  };
+
+  runs->clear();
+  size_t pos = 0;
+  while (pos < nelem) {
+    const size_t start = next(pos, true);
+    if (start == nelem)
+      break;
+    pos = next(start, false);
+    runs->push_back({uint32_t(start), uint32_t(pos - start)});
+  }
+}
+
+MaskCache& mask_cache()
+{
+  static MaskCache cache(cache_capacity_from_env("H5ZSPERR_MASK_CACHE_MB", 64));
+  return cache;
+}
+
+}  // namespace h5zsperr
@@ -0,0 +1,173 @@
+#include "h5zsperr_rate_alloc.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+#include "h5z-sperr-chunk.h"
+#include "h5zsperr_codec.h"
+
+namespace {
+
+template <typename T>
+h5zsperr::ValueStats value_stats(const h5zsperr::ChunkParams& p, const T* vals, size_t n)
+{
+  auto stats = h5zsperr::ValueStats();
+  for (size_t i = 0; i < n; i++) {
+    const T v = vals[i];
+    if (!std::isfinite(v) || h5zsperr::is_missing(p, v))
+      continue;
+    if (stats.nvalid == 0 || double(v) < stats.lo)
+      stats.lo = double(v);
+    if (stats.nvalid == 0 || double(v) > stats.hi)
+      stats.hi = double(v);
+    stats.nvalid++;
+  }
+  return stats;
+}
+
+template <typename T>
+double sum_squared_error(const h5zsperr::ChunkParams& p, const T* orig, const T* dec, size_t n)
+{
+  double sse = 0.0;
+  for (size_t i = 0; i < n; i++)
+    if (std::isfinite(orig[i]) && !h5zsperr::is_missing(p, orig[i])) {
+      const double diff = double(dec[i]) - double(orig[i]);
+      sse += diff * diff;
+    }
+  return sse;
+}
+
+/* The point of each chunk that minimizes `bytes + lambda * sse`; ties go to the smaller error. */
+double pick_points(const h5zsperr::RatePoint* points,
+                   size_t nchunks,
+                   size_t nrates,
+                   double lambda,
+                   size_t* picks)
+{
+  double total = 0.0;
+  for (size_t c = 0; c < nchunks; c++) {
+    const auto* pts = points + c * nrates;
+    size_t best = 0;
+    double best_cost = std::numeric_limits<double>::infinity();
+    for (size_t r = 0; r < nrates; r++) {
+      const double cost =
+          std::isinf(lambda) ? pts[r].sse : double(pts[r].bytes) + lambda * pts[r].sse;
+      if (cost < best_cost || (cost == best_cost && pts[r].sse < pts[best].sse)) {
+        best = r;
+        best_cost = cost;
+      }
+    }
+    picks[c] = best;
+    total += pts[best].sse;
+  }
+  return total;
+}
+
+}  // namespace
+
+void h5zsperr::ValueStats::merge(const ValueStats& other)
+{
+  if (other.nvalid == 0)
+    return;
+  lo = nvalid ? std::min(lo, other.lo) : other.lo;
+  hi = nvalid ? std::max(hi, other.hi) : other.hi;
+  nvalid += other.nvalid;
+}
+
+std::vector<double> h5zsperr::trial_bitrates(bool is_float)
+{
+  auto rates = std::vector<double>{0.25, 0.5, 1.0, 1.5, 2.0, 3.0, 4.0, 6.0, 8.0, 12.0, 16.0};
+  if (!is_float) {
+    rates.push_back(24.0);
+    rates.push_back(32.0);
+  }
+  return rates;
+}
+
+int h5zsperr::trial_encode(size_t cd_nelmts,
+                           const unsigned int cd_values[],
+                           const void* buf,
+                           size_t nbytes,
+                           const unsigned int rate_words[],
+                           size_t nrates,
+                           RatePoint points[],
+                           ValueStats* stats)
+{
+  auto params = ChunkParams();
+  int ret = parse_cd_values(cd_nelmts, cd_values, &params);
+  if (ret)
+    return ret;
+  if (params.ncomp || params.source)
+    return H5ZSPERR_ERR_CD_VALUES;
+  if (nbytes != params.raw_bytes())
+    return H5ZSPERR_ERR_SIZE;
+  const size_t nelem = params.nelem();
+  if (params.is_float)
+    *stats = value_stats(params, static_cast<const float*>(buf), nelem);
+  else
+    *stats = value_stats(params, static_cast<const double*>(buf), nelem);
+
+  auto cd = std::vector<unsigned int>(cd_values, cd_values + cd_nelmts);
+  for (size_t r = 0; r < nrates; r++) {
+    cd[1] = rate_words[r];
+    void* enc = nullptr;
+    size_t enc_len = 0;
+    ret = C_API::H5Z_SPERR_encode_chunk(cd.size(), cd.data(), buf, nbytes, &enc, &enc_len);
+    void* dec = nullptr;
+    size_t dec_len = 0;
+    if (ret == H5ZSPERR_OK)
+      ret = C_API::H5Z_SPERR_decode_chunk(cd.size(), cd.data(), enc, enc_len, &dec, &dec_len);
+    if (ret == H5ZSPERR_OK && dec_len != nbytes)
+      ret = H5ZSPERR_ERR_DECOMP;
+    if (ret == H5ZSPERR_OK) {
+      points[r].bytes = enc_len;
+      if (params.is_float)
+        points[r].sse = sum_squared_error(params, static_cast<const float*>(buf),
+                                          static_cast<const float*>(dec), nelem);
+      else
+        points[r].sse = sum_squared_error(params, static_cast<const double*>(buf),
+                                          static_cast<const double*>(dec), nelem);
+    }
+    std::free(enc);
+    std::free(dec);
+    if (ret)
+      return ret;
+  }
+  return H5ZSPERR_OK;
+}
+
+bool h5zsperr::allocate_rates(const RatePoint* points,
+                              size_t nchunks,
+                              size_t nrates,
+                              double budget,
+                              size_t* picks,
+                              double* sse)
+{
+  /* The most accurate points, and then the smallest ones, bound what's possible. */
+  const double inf = std::numeric_limits<double>::infinity();
+  *sse = pick_points(points, nchunks, nrates, inf, picks);
+  if (*sse > budget)
+    return false;
+  *sse = pick_points(points, nchunks, nrates, 0.0, picks);
+  if (*sse <= budget)
+    return true;
+
+  /*
+   * The total error falls as lambda grows; bisect on its logarithm for the smallest fit.
+   * 2^1000 is still finite, so that `bytes + lambda * sse` never turns into inf - inf.
+   */
+  double lo = -1000.0, hi = 1000.0;
+  for (int i = 0; i < 100 && hi - lo > 1e-6; i++) {
+    const double mid = 0.5 * (lo + hi);
+    if (pick_points(points, nchunks, nrates, std::exp2(mid), picks) <= budget)
+      hi = mid;
+    else
+      lo = mid;
+  }
+  *sse = pick_points(points, nchunks, nrates, std::exp2(hi), picks);
+  if (*sse > budget) /* errors so small that even 2^1000 doesn't weigh them */
+    *sse = pick_points(points, nchunks, nrates, inf, picks);
+  return true;
+}
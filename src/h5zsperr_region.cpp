@@ -0,0 +1,605 @@
+#include "h5z-sperr-region.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "h5z-sperr-chunk.h"
+#include "h5zsperr_codec.h"
+
+namespace {
+
+constexpr int max_rank = 4;
+
+/* Closes HDF5 identifiers when going out of scope. */
+struct Closer {
+  hid_t id = H5I_INVALID_HID;
+  herr_t (*close)(hid_t) = nullptr;
+
+  Closer() = default;
+  Closer(const Closer&) = delete;
+  Closer& operator=(const Closer&) = delete;
+  ~Closer()
+  {
+    if (id >= 0)
+      close(id);
+  }
+  void set(hid_t new_id, herr_t (*new_close)(hid_t))
+  {
+    id = new_id;
+    close = new_close;
+  }
+};
+
+/*
+ * Copy a box of `len` elements, each of `esize` bytes, between two C-ordered arrays of rank
+ * `ndims`; a null `src` fills the box with the value at `fill` instead.
+ */
+void copy_nd(const uint8_t* src,
+             const hsize_t src_dims[],
+             const hsize_t src_origin[],
+             uint8_t* dst,
+             const hsize_t dst_dims[],
+             const hsize_t dst_origin[],
+             const hsize_t len[],
+             int ndims,
+             size_t esize,
+             const uint8_t* fill)
+{
+  for (int i = 0; i < ndims; i++)
+    if (len[i] == 0)
+      return;
+
+  const int last = ndims - 1;
+  const size_t row_bytes = len[last] * esize;
+  hsize_t idx[max_rank] = {0, 0, 0, 0};
+  while (true) {
+    size_t s = 0, d = 0;
+    for (int i = 0; i < ndims; i++) {
+      s = s * src_dims[i] + src_origin[i] + idx[i];
+      d = d * dst_dims[i] + dst_origin[i] + idx[i];
+    }
+    if (src)
+      std::memcpy(dst + d * esize, src + s * esize, row_bytes);
+    else
+      for (size_t k = 0; k < len[last]; k++)
+        std::memcpy(dst + (d + k) * esize, fill, esize);
+
+    int i = last - 1;
+    for (; i >= 0; i--) {
+      if (++idx[i] < len[i])
+        break;
+      idx[i] = 0;
+    }
+    if (i < 0)
+      return;
+  }
+}
+
+/* What the reader and the writer need to know about a dataset, and the ids to release. */
+struct Dataset {
+  Closer dcpl, space, type;
+  int ndims = 0;
+  hsize_t dims[max_rank] = {0, 0, 0, 0};
+  hsize_t chunks[max_rank] = {0, 0, 0, 0};
+  unsigned int cd_values[H5Z_SPERR_MAX_CD_VALUES] = {};
+  size_t cd_nelmts = H5Z_SPERR_MAX_CD_VALUES;
+  h5zsperr::ChunkParams params;
+  size_t esize = 0;
+
+  /* Only datasets that H5Z-SPERR alone compresses are supported. */
+  int open(hid_t dset)
+  {
+    dcpl.set(H5Dget_create_plist(dset), H5Pclose);
+    space.set(H5Dget_space(dset), H5Sclose);
+    type.set(H5Dget_type(dset), H5Tclose);
+    if (dcpl.id < 0 || space.id < 0 || type.id < 0)
+      return H5ZSPERR_ERR_HDF5;
+
+    ndims = H5Sget_simple_extent_ndims(space.id);
+    if (ndims < 2 || ndims > max_rank || H5Sget_simple_extent_dims(space.id, dims, NULL) != ndims)
+      return H5ZSPERR_ERR_HDF5;
+    if (H5Pget_layout(dcpl.id) != H5D_CHUNKED || H5Pget_chunk(dcpl.id, ndims, chunks) != ndims)
+      return H5ZSPERR_ERR_HDF5;
+
+    unsigned int flags = 0;
+    if (H5Pget_nfilters(dcpl.id) != 1 ||
+        H5Pget_filter_by_id2(dcpl.id, H5Z_FILTER_SPERR, &flags, &cd_nelmts, cd_values, 0, NULL,
+                             NULL) < 0)
+      return H5ZSPERR_ERR_HDF5;
+    int ret = h5zsperr::parse_cd_values(cd_nelmts, cd_values, &params);
+    if (ret)
+      return ret;
+    esize = params.is_float ? 4 : 8;
+    if (H5Tget_class(type.id) != H5T_FLOAT || H5Tget_size(type.id) != esize)
+      return H5ZSPERR_ERR_HDF5;
+    return H5ZSPERR_OK;
+  }
+
+  /* Check that a region is within the dataset; `*empty` tells whether it holds no value. */
+  int check(const hsize_t start[], const hsize_t count[], bool* empty) const
+  {
+    *empty = false;
+    for (int i = 0; i < ndims; i++) {
+      if (start[i] + count[i] > dims[i])
+        return H5ZSPERR_ERR_SIZE;
+      *empty = *empty || count[i] == 0;
+    }
+    return H5ZSPERR_OK;
+  }
+
+  /* Pick the elements of `full` (`ndims` of them) along which chunks are longer than 1. */
+  template <typename U>
+  int real(const hsize_t full[], U out[3]) const
+  {
+    int n = 0;
+    for (int i = 0; i < ndims; i++)
+      if (chunks[i] > 1 && n < 3)
+        out[n++] = U(full[i]);
+    return n == params.rank ? H5ZSPERR_OK : H5ZSPERR_ERR_HDF5;
+  }
+};
+
+/*
+ * Read the box of `len` values at `lo` within the chunk at `offset` into `part`, in C order.
+ * Chunks that aren't allocated read as `fill`, and `*allocated` tells whether it was. With
+ * `whole`, the chunk is decoded in full, which goes through the process-wide chunk cache.
+ * With a non-null `residual`, a chunk of residuals along time decodes as well, and `*residual`
+ * tells whether it was one; otherwise, decoding such a chunk fails.
+ */
+int read_part(hid_t dset,
+              const Dataset& ds,
+              const hsize_t offset[],
+              const hsize_t lo[],
+              const hsize_t len[],
+              const uint8_t* fill,
+              bool whole,
+              std::vector<uint8_t>* raw,
+              std::vector<uint8_t>* part,
+              bool* allocated,
+              bool* residual)
+{
+  const int ndims = ds.ndims;
+  const size_t esize = ds.esize;
+  const hsize_t zero[max_rank] = {0, 0, 0, 0};
+  size_t chunk_nelem = 1, part_nelem = 1;
+  for (int i = 0; i < ndims; i++) {
+    chunk_nelem *= ds.chunks[i];
+    part_nelem *= len[i];
+  }
+  part->resize(part_nelem * esize);
+
+  hsize_t nbytes = 0;
+  *allocated = H5Dget_chunk_storage_size(dset, offset, &nbytes) >= 0 && nbytes > 0;
+  if (residual)
+    *residual = false;
+  if (!*allocated) {
+    copy_nd(nullptr, len, zero, part->data(), len, zero, len, ndims, esize, fill);
+    return H5ZSPERR_OK;
+  }
+
+  uint32_t filter_mask = 0;
+  raw->resize(std::max(size_t(nbytes), chunk_nelem * esize));
+  if (H5Dread_chunk(dset, H5P_DEFAULT, offset, &filter_mask, raw->data()) < 0)
+    return H5ZSPERR_ERR_HDF5;
+
+  if (filter_mask & 1u) {
+    /* The filter was skipped for this chunk, which is stored as is. */
+    copy_nd(raw->data(), ds.chunks, lo, part->data(), len, zero, len, ndims, esize, nullptr);
+    return H5ZSPERR_OK;
+  }
+  if (residual && nbytes > 0 && ((*raw)[0] & h5zsperr::residual_flag)) {
+    (*raw)[0] &= uint8_t(~h5zsperr::residual_flag); /* the chunk decodes like any other now */
+    *residual = true;
+  }
+  if (whole) {
+    void* dec = nullptr;
+    size_t dec_len = 0;
+    int ret = C_API::H5Z_SPERR_decode_chunk(ds.cd_nelmts, ds.cd_values, raw->data(),
+                                            size_t(nbytes), &dec, &dec_len);
+    if (ret)
+      return ret;
+    copy_nd(static_cast<const uint8_t*>(dec), ds.chunks, lo, part->data(), len, zero, len, ndims,
+            esize, nullptr);
+    std::free(dec);
+    return H5ZSPERR_OK;
+  }
+
+  /* The codec only knows of the dimensions longer than 1. */
+  size_t real_start[3] = {0, 0, 0}, real_count[3] = {1, 1, 1};
+  int ret = ds.real(lo, real_start);
+  if (ret == H5ZSPERR_OK)
+    ret = ds.real(len, real_count);
+  if (ret == H5ZSPERR_OK)
+    ret = C_API::H5Z_SPERR_decode_chunk_region(ds.cd_nelmts, ds.cd_values, raw->data(),
+                                               size_t(nbytes), real_start, real_count,
+                                               part->data());
+  return ret;
+}
+
+//
+// Keyframes and residuals along time.
+//
+
+/* The keyframe interval that `H5Z_SPERR_write_temporal()` recorded; 0 if there's none. */
+unsigned int keyframe_interval(hid_t dset)
+{
+  unsigned int interval = 0;
+  if (H5Aexists(dset, H5Z_SPERR_KEYFRAME_ATTR) <= 0)
+    return 0;
+  Closer attr;
+  attr.set(H5Aopen(dset, H5Z_SPERR_KEYFRAME_ATTR, H5P_DEFAULT), H5Aclose);
+  if (attr.id < 0 || H5Aread(attr.id, H5T_NATIVE_UINT, &interval) < 0)
+    return 0;
+  return interval;
+}
+
+/*
+ * Turn `n` values into residuals against the decoded values of their keyframe (`sign` of -1),
+ * or residuals back into values (`sign` of 1). Missing values stay as they are, so that the
+ * codec keeps them exactly, and missing values of the keyframe count as zero.
+ */
+template <typename T>
+void apply_keyframe(const h5zsperr::ChunkParams& p, const uint8_t* key, uint8_t* vals, size_t n,
+                    int sign)
+{
+  const auto* k = reinterpret_cast<const T*>(key);
+  auto* v = reinterpret_cast<T*>(vals);
+  for (size_t i = 0; i < n; i++)
+    if (!h5zsperr::is_missing(p, v[i]) && !h5zsperr::is_missing(p, k[i]))
+      v[i] += T(sign) * k[i];
+}
+
+void apply_keyframe(const Dataset& ds, const uint8_t* key, uint8_t* vals, size_t n, int sign)
+{
+  if (ds.params.is_float)
+    apply_keyframe<float>(ds.params, key, vals, n, sign);
+  else
+    apply_keyframe<double>(ds.params, key, vals, n, sign);
+}
+
+}  // namespace
+
+int C_API::H5Z_SPERR_read_region(hid_t dset,
+                                 const hsize_t start[],
+                                 const hsize_t count[],
+                                 void* buf)
+{
+  Dataset ds;
+  int ret = ds.open(dset);
+  bool empty = false;
+  if (ret == H5ZSPERR_OK)
+    ret = ds.check(start, count, &empty);
+  if (ret || empty)
+    return ret;
+  const int ndims = ds.ndims;
+  const hsize_t* chunks = ds.chunks;
+  const size_t esize = ds.esize;
+
+  auto fill = std::vector<uint8_t>(esize, 0);
+  if (H5Pget_fill_value(ds.dcpl.id, ds.type.id, fill.data()) < 0)
+    return H5ZSPERR_ERR_HDF5;
+
+  auto raw = std::vector<uint8_t>();
+  auto part = std::vector<uint8_t>();
+  auto* out = static_cast<uint8_t*>(buf);
+
+  /* Visit every chunk that the region touches, in C order. */
+  hsize_t first[max_rank], last[max_rank], idx[max_rank];
+  for (int i = 0; i < ndims; i++) {
+    first[i] = start[i] / chunks[i];
+    last[i] = (start[i] + count[i] - 1) / chunks[i];
+    idx[i] = first[i];
+  }
+  while (true) {
+    hsize_t offset[max_rank], lo[max_rank], len[max_rank], out_origin[max_rank];
+    for (int i = 0; i < ndims; i++) {
+      offset[i] = idx[i] * chunks[i];
+      lo[i] = std::max(start[i], offset[i]) - offset[i];
+      len[i] = std::min(start[i] + count[i], offset[i] + chunks[i]) - offset[i] - lo[i];
+      out_origin[i] = offset[i] + lo[i] - start[i];
+    }
+
+    bool allocated = false;
+    ret = read_part(dset, ds, offset, lo, len, fill.data(), false, &raw, &part, &allocated,
+                    nullptr);
+    if (ret)
+      return ret;
+    const hsize_t zero[max_rank] = {0, 0, 0, 0};
+    copy_nd(part.data(), len, zero, out, count, out_origin, len, ndims, esize, nullptr);
+
+    int i = ndims - 1;
+    for (; i >= 0; i--) {
+      if (++idx[i] <= last[i])
+        break;
+      idx[i] = first[i];
+    }
+    if (i < 0)
+      return H5ZSPERR_OK;
+  }
+}
+
+int C_API::H5Z_SPERR_write_region(hid_t dset,
+                                  const hsize_t start[],
+                                  const hsize_t count[],
+                                  const void* buf,
+                                  const H5Z_SPERR_quality_map* map)
+{
+  Dataset ds;
+  int ret = ds.open(dset);
+  bool empty = false;
+  if (ret == H5ZSPERR_OK)
+    ret = ds.check(start, count, &empty);
+  if (ret || empty)
+    return ret;
+  const int ndims = ds.ndims;
+  const hsize_t* chunks = ds.chunks;
+  const size_t esize = ds.esize;
+  for (int i = 0; i < ndims; i++)
+    if (start[i] % chunks[i] || count[i] % chunks[i])
+      return H5ZSPERR_ERR_SIZE;
+
+  auto chunk = std::vector<uint8_t>(ds.params.raw_bytes());
+  const auto* in = static_cast<const uint8_t*>(buf);
+  hsize_t idx[max_rank] = {0, 0, 0, 0};
+  while (true) {
+    hsize_t offset[max_rank], in_origin[max_rank];
+    for (int i = 0; i < ndims; i++) {
+      in_origin[i] = idx[i] * chunks[i];
+      offset[i] = start[i] + in_origin[i];
+    }
+    const hsize_t zero[max_rank] = {0, 0, 0, 0};
+    copy_nd(in, count, in_origin, chunk.data(), chunks, zero, chunks, ndims, esize, nullptr);
+
+    size_t real_offset[3] = {0, 0, 0};
+    ret = ds.real(offset, real_offset);
+    if (ret)
+      return ret;
+    void* enc = nullptr;
+    size_t enc_len = 0;
+    ret = C_API::H5Z_SPERR_encode_chunk_map(ds.cd_nelmts, ds.cd_values, chunk.data(),
+                                            chunk.size(), map, real_offset, &enc, &enc_len);
+    if (ret)
+      return ret;
+    const herr_t status = H5Dwrite_chunk(dset, H5P_DEFAULT, 0, offset, enc_len, enc);
+    std::free(enc);
+    if (status < 0)
+      return H5ZSPERR_ERR_HDF5;
+
+    int i = ndims - 1;
+    for (; i >= 0; i--) {
+      if (++idx[i] < count[i] / chunks[i])
+        break;
+      idx[i] = 0;
+    }
+    if (i < 0)
+      return H5ZSPERR_OK;
+  }
+}
+
+int C_API::H5Z_SPERR_write_temporal(hid_t dset,
+                                    hsize_t t0,
+                                    hsize_t nt,
+                                    const void* buf,
+                                    unsigned int interval)
+{
+  Dataset ds;
+  int ret = ds.open(dset);
+  if (ret)
+    return ret;
+  const int ndims = ds.ndims;
+  const hsize_t* chunks = ds.chunks;
+  const size_t esize = ds.esize;
+  if (ndims < 3 || chunks[0] != 1 || interval == 0)
+    return H5ZSPERR_ERR_HDF5;
+
+  /* The steps span all of the other dimensions, which are whole chunks. */
+  hsize_t start[max_rank] = {t0, 0, 0, 0}, count[max_rank] = {nt, 0, 0, 0};
+  size_t ntiles = 1;
+  for (int i = 1; i < ndims; i++) {
+    count[i] = ds.dims[i];
+    if (ds.dims[i] % chunks[i])
+      return H5ZSPERR_ERR_SIZE;
+    ntiles *= ds.dims[i] / chunks[i];
+  }
+  bool empty = false;
+  ret = ds.check(start, count, &empty);
+  if (ret || empty)
+    return ret;
+
+  /* Record the interval, which has to stay the same across calls. */
+  const unsigned int stored = keyframe_interval(dset);
+  if (stored == 0) {
+    Closer attr_space, attr;
+    attr_space.set(H5Screate(H5S_SCALAR), H5Sclose);
+    attr.set(H5Acreate2(dset, H5Z_SPERR_KEYFRAME_ATTR, H5T_NATIVE_UINT, attr_space.id,
+                        H5P_DEFAULT, H5P_DEFAULT),
+             H5Aclose);
+    if (attr.id < 0 || H5Awrite(attr.id, H5T_NATIVE_UINT, &interval) < 0)
+      return H5ZSPERR_ERR_HDF5;
+  }
+  else if (stored != interval)
+    return H5ZSPERR_ERR_HDF5;
+
+  /* The decoded keyframe of each tile, i.e., the chunks of a step, for the current keyframe. */
+  auto keys = std::vector<std::vector<uint8_t>>(ntiles);
+  hsize_t key_time = ~hsize_t{0};
+  auto chunk = std::vector<uint8_t>(ds.params.raw_bytes());
+  auto raw = std::vector<uint8_t>();
+  const auto fill = std::vector<uint8_t>(esize, 0);
+  const auto* in = static_cast<const uint8_t*>(buf);
+  const hsize_t zero[max_rank] = {0, 0, 0, 0};
+  for (hsize_t t = t0; t < t0 + nt; t++) {
+    const hsize_t kt = t - t % interval;
+    if (kt != key_time) {
+      for (auto& key : keys)
+        key.clear();
+      key_time = kt;
+    }
+    hsize_t idx[max_rank] = {0, 0, 0, 0};
+    for (size_t tile = 0; tile < ntiles; tile++) {
+      hsize_t offset[max_rank] = {t, 0, 0, 0}, in_origin[max_rank] = {t - t0, 0, 0, 0};
+      for (int i = 1; i < ndims; i++)
+        offset[i] = in_origin[i] = idx[i] * chunks[i];
+      copy_nd(in, count, in_origin, chunk.data(), chunks, zero, chunks, ndims, esize, nullptr);
+
+      /* Steps between keyframes hold residuals; a keyframe before `t0` is read back. */
+      auto& key = keys[tile];
+      if (t != kt) {
+        if (key.empty()) {
+          hsize_t key_offset[max_rank];
+          std::copy(offset, offset + ndims, key_offset);
+          key_offset[0] = kt;
+          bool allocated = false;
+          ret = read_part(dset, ds, key_offset, zero, chunks, fill.data(), true, &raw, &key,
+                          &allocated, nullptr);
+          if (ret == H5ZSPERR_OK && !allocated)
+            ret = H5ZSPERR_ERR_HDF5; /* the keyframe hasn't been written */
+          if (ret)
+            return ret;
+        }
+        apply_keyframe(ds, key.data(), chunk.data(), chunk.size() / esize, -1);
+      }
+
+      void* enc = nullptr;
+      size_t enc_len = 0;
+      ret = C_API::H5Z_SPERR_encode_chunk(ds.cd_nelmts, ds.cd_values, chunk.data(), chunk.size(),
+                                          &enc, &enc_len);
+      if (ret)
+        return ret;
+
+      /*
+       * Residuals are flagged, so that only `H5Z_SPERR_read_temporal()` decodes them, and refer
+       * to what readers decode of the keyframe, so that errors don't add up.
+       */
+      if (t != kt)
+        static_cast<uint8_t*>(enc)[0] |= h5zsperr::residual_flag;
+      else {
+        void* dec = nullptr;
+        size_t dec_len = 0;
+        ret = C_API::H5Z_SPERR_decode_chunk(ds.cd_nelmts, ds.cd_values, enc, enc_len, &dec,
+                                            &dec_len);
+        if (ret == H5ZSPERR_OK) {
+          const auto* p = static_cast<const uint8_t*>(dec);
+          key.assign(p, p + dec_len);
+        }
+        std::free(dec);
+      }
+      const herr_t status = ret ? 0 : H5Dwrite_chunk(dset, H5P_DEFAULT, 0, offset, enc_len, enc);
+      std::free(enc);
+      if (ret)
+        return ret;
+      if (status < 0)
+        return H5ZSPERR_ERR_HDF5;
+
+      for (int i = ndims - 1; i >= 1; i--) {
+        if (++idx[i] < ds.dims[i] / chunks[i])
+          break;
+        idx[i] = 0;
+      }
+    }
+  }
+  return H5ZSPERR_OK;
+}
+
+int C_API::H5Z_SPERR_read_temporal(hid_t dset,
+                                   const hsize_t start[],
+                                   const hsize_t count[],
+                                   void* buf)
+{
+  const unsigned int interval = keyframe_interval(dset);
+  if (interval == 0)
+    return H5Z_SPERR_read_region(dset, start, count, buf);
+
+  Dataset ds;
+  int ret = ds.open(dset);
+  bool empty = false;
+  if (ret == H5ZSPERR_OK)
+    ret = ds.check(start, count, &empty);
+  if (ret || empty)
+    return ret;
+  const int ndims = ds.ndims;
+  const hsize_t* chunks = ds.chunks;
+  const size_t esize = ds.esize;
+  if (ndims < 3 || chunks[0] != 1)
+    return H5ZSPERR_ERR_HDF5;
+
+  auto fill = std::vector<uint8_t>(esize, 0);
+  if (H5Pget_fill_value(ds.dcpl.id, ds.type.id, fill.data()) < 0)
+    return H5ZSPERR_ERR_HDF5;
+
+  /* Visit every chunk that the region touches, in C order, i.e., one step after another. */
+  hsize_t first[max_rank], last[max_rank], idx[max_rank];
+  size_t ntiles = 1;
+  for (int i = 0; i < ndims; i++) {
+    first[i] = start[i] / chunks[i];
+    last[i] = (start[i] + count[i] - 1) / chunks[i];
+    idx[i] = first[i];
+    if (i > 0)
+      ntiles *= last[i] - first[i] + 1;
+  }
+
+  /* The part of the keyframe of each tile that the region needs, for the current keyframe. */
+  auto keys = std::vector<std::vector<uint8_t>>(ntiles);
+  hsize_t key_time = ~hsize_t{0};
+  auto raw = std::vector<uint8_t>();
+  auto part = std::vector<uint8_t>();
+  auto* out = static_cast<uint8_t*>(buf);
+  while (true) {
+    hsize_t offset[max_rank], lo[max_rank], len[max_rank], out_origin[max_rank];
+    size_t tile = 0;
+    for (int i = 0; i < ndims; i++) {
+      offset[i] = idx[i] * chunks[i];
+      lo[i] = std::max(start[i], offset[i]) - offset[i];
+      len[i] = std::min(start[i] + count[i], offset[i] + chunks[i]) - offset[i] - lo[i];
+      out_origin[i] = offset[i] + lo[i] - start[i];
+      if (i > 0)
+        tile = tile * (last[i] - first[i] + 1) + (idx[i] - first[i]);
+    }
+    const hsize_t t = offset[0], kt = t - t % interval;
+    if (kt != key_time) {
+      for (auto& key : keys)
+        key.clear();
+      key_time = kt;
+    }
+
+    /* Keyframes are decoded in full, so that the chunk cache keeps them across calls. */
+    bool allocated = false, residual = false;
+    ret = read_part(dset, ds, offset, lo, len, fill.data(), t == kt, &raw, &part, &allocated,
+                    t == kt ? nullptr : &residual);
+    if (ret)
+      return ret;
+    auto& key = keys[tile];
+    if (t == kt && allocated)
+      key = part;
+    else if (residual) {
+      if (key.empty()) {
+        hsize_t key_offset[max_rank];
+        std::copy(offset, offset + ndims, key_offset);
+        key_offset[0] = kt;
+        auto key_raw = std::vector<uint8_t>();
+        bool key_allocated = false;
+        ret = read_part(dset, ds, key_offset, lo, len, fill.data(), true, &key_raw, &key,
+                        &key_allocated, nullptr);
+        if (ret == H5ZSPERR_OK && !key_allocated)
+          ret = H5ZSPERR_ERR_HDF5; /* a residual without its keyframe */
+        if (ret)
+          return ret;
+      }
+      apply_keyframe(ds, key.data(), part.data(), part.size() / esize, 1);
+    }
+    const hsize_t zero[max_rank] = {0, 0, 0, 0};
+    copy_nd(part.data(), len, zero, out, count, out_origin, len, ndims, esize, nullptr);
+
+    int i = ndims - 1;
+    for (; i >= 0; i--) {
+      if (++idx[i] <= last[i])
+        break;
+      idx[i] = first[i];
+    }
+    if (i < 0)
+      return H5ZSPERR_OK;
+  }
+}
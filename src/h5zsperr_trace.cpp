@@ -0,0 +1,245 @@
+#include "h5zsperr_trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace h5zsperr {
+
+namespace {
+
+/*
+ * One slot of the ring buffer. Writers mark a slot busy (seq = 0) before filling it and publish
+ * it with the index of the event plus one; readers accept a slot only if it carries the expected
+ * index before and after reading it.
+ */
+struct Slot {
+  std::atomic<uint64_t> seq{0};
+  std::atomic<uint64_t> begin{0};
+  std::atomic<uint64_t> dur{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> tid_ev{0}; /* thread id in the upper 56 bits, and the event */
+};
+
+struct TraceState {
+  std::unique_ptr<Slot[]> slots;
+  size_t mask = 0;
+  std::atomic<uint64_t> next{0};
+  std::atomic<bool> on{false};
+  std::string exit_path;
+
+  TraceState()
+  {
+    const char* path = std::getenv("H5ZSPERR_TRACE");
+    if (path && *path) {
+      exit_path = trace_path(path);
+      size_t max_events = 65536;
+      const char* env = std::getenv("H5ZSPERR_TRACE_EVENTS");
+      if (env && std::atoll(env) > 0)
+        max_events = size_t(std::atoll(env));
+      start(max_events);
+      std::atexit(dump_at_exit);
+    }
+  }
+
+  void start(size_t max_events)
+  {
+    on.store(false);
+    size_t cap = 1;
+    while (cap < max_events)
+      cap *= 2;
+    slots.reset(new Slot[cap]);
+    mask = cap - 1;
+    next.store(0);
+    on.store(true);
+  }
+
+  static void dump_at_exit();
+};
+
+/* Never destroyed, so that threads still running and the exit handler can use it. */
+TraceState& state()
+{
+  static auto* s = new TraceState();
+  return *s;
+}
+
+void TraceState::dump_at_exit()
+{
+  auto& s = state();
+  s.on.store(false);
+  trace_dump(s.exit_path.c_str());
+}
+
+uint64_t now_ns()
+{
+  const auto t = std::chrono::steady_clock::now().time_since_epoch();
+  return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(t).count());
+}
+
+uint64_t thread_id()
+{
+#ifdef __linux__
+  thread_local const uint64_t tid = uint64_t(syscall(SYS_gettid));
+#else
+  static std::atomic<uint64_t> counter{1};
+  thread_local const uint64_t tid = counter.fetch_add(1);
+#endif
+  return tid;
+}
+
+uint64_t process_id()
+{
+#ifdef __linux__
+  return uint64_t(getpid());
+#else
+  return 1;
+#endif
+}
+
+}  // namespace
+
+const char* trace_event_name(trace_event ev)
+{
+  switch (ev) {
+    case trace_event::chunk_encode:
+      return "chunk_encode";
+    case trace_event::chunk_decode:
+      return "chunk_decode";
+    case trace_event::mask_build:
+      return "mask_build";
+    case trace_event::mask_compact:
+      return "mask_compact";
+    case trace_event::mean_fill:
+      return "mean_fill";
+    case trace_event::sperr_encode:
+      return "sperr_encode";
+    case trace_event::sperr_decode:
+      return "sperr_decode";
+    case trace_event::mask_decode:
+      return "mask_decode";
+    case trace_event::fill:
+      return "fill";
+    case trace_event::assemble:
+      return "assemble";
+    default:
+      return "unknown";
+  }
+}
+
+void trace_start(size_t max_events)
+{
+  state().start(max_events ? max_events : 1);
+}
+
+void trace_stop()
+{
+  state().on.store(false);
+}
+
+bool trace_enabled()
+{
+  return state().on.load(std::memory_order_relaxed);
+}
+
+int trace_dump(const char* path)
+{
+  auto& s = state();
+  if (!s.slots)
+    return 1;
+  FILE* f = std::fopen(path, "w");
+  if (!f)
+    return 1;
+
+  const uint64_t pid = process_id();
+  const uint64_t next = s.next.load(std::memory_order_acquire);
+  const uint64_t first = (next > s.mask + 1) ? next - (s.mask + 1) : 0;
+  std::fprintf(f, "{\"traceEvents\":[");
+  bool comma = false;
+  for (uint64_t i = first; i < next; i++) {
+    auto& slot = s.slots[i & s.mask];
+    if (slot.seq.load(std::memory_order_acquire) != i + 1)
+      continue;
+    const uint64_t begin = slot.begin.load(std::memory_order_relaxed);
+    const uint64_t dur = slot.dur.load(std::memory_order_relaxed);
+    const uint64_t bytes = slot.bytes.load(std::memory_order_relaxed);
+    const uint64_t tid_ev = slot.tid_ev.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != i + 1)
+      continue; /* overwritten while being read */
+
+    std::fprintf(f,
+                 "%s\n{\"name\":\"%s\",\"cat\":\"h5zsperr\",\"ph\":\"X\",\"ts\":%.3f,"
+                 "\"dur\":%.3f,\"pid\":%llu,\"tid\":%llu,\"args\":{\"bytes\":%llu}}",
+                 comma ? "," : "", trace_event_name(trace_event(tid_ev & 0xff)),
+                 double(begin) / 1e3, double(dur) / 1e3, (unsigned long long)pid,
+                 (unsigned long long)(tid_ev >> 8), (unsigned long long)bytes);
+    comma = true;
+  }
+  std::fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+  return std::fclose(f) == 0 ? 0 : 1;
+}
+
+TraceSpan::TraceSpan(trace_event ev, size_t bytes) : m_ev(ev), m_bytes(bytes)
+{
+  if (trace_enabled()) {
+    m_active = true;
+    m_begin = now_ns();
+  }
+}
+
+void TraceSpan::end()
+{
+  if (!m_active)
+    return;
+  m_active = false;
+  const uint64_t stop = now_ns();
+  auto& s = state();
+  if (!s.on.load(std::memory_order_relaxed))
+    return;
+
+  const uint64_t idx = s.next.fetch_add(1, std::memory_order_relaxed);
+  auto& slot = s.slots[idx & s.mask];
+  slot.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.begin.store(m_begin, std::memory_order_relaxed);
+  slot.dur.store(stop - m_begin, std::memory_order_relaxed);
+  slot.bytes.store(m_bytes, std::memory_order_relaxed);
+  slot.tid_ev.store((thread_id() << 8) | uint64_t(m_ev), std::memory_order_relaxed);
+  slot.seq.store(idx + 1, std::memory_order_release);
+}
+
+std::string trace_path(const char* pattern)
+{
+  /* Open MPI, MPICH and Intel MPI (PMI), PMIx launchers, MVAPICH2, and Slurm's srun. */
+  const char* rank_vars[] = {"OMPI_COMM_WORLD_RANK", "PMI_RANK", "PMIX_RANK",
+                             "MV2_COMM_WORLD_RANK", "SLURM_PROCID"};
+  auto rank = std::string();
+  for (const char* var : rank_vars) {
+    const char* val = std::getenv(var);
+    if (val && *val) {
+      rank = val;
+      break;
+    }
+  }
+#ifdef __linux__
+  if (rank.empty())
+    rank = std::to_string(getpid());
+#endif
+
+  auto path = std::string(pattern);
+  for (auto pos = path.find("%r"); pos != std::string::npos; pos = path.find("%r", pos)) {
+    path.replace(pos, 2, rank);
+    pos += rank.size();
+  }
+  return path;
+}
+
+}  // namespace h5zsperr
@@ -0,0 +1,325 @@
+/*
+ * Microbenchmarks of the missing value path: the icecream bitstream, the bitmask compactor, and
+ * the h5zsperr_* helpers. Each kernel runs over fields of 64^2 to 512^3 values whose missing values
+ * follow one of four masks:
+ *   empty:     no missing value;
+ *   full:      every value is missing;
+ *   coastline: a smooth "land" region, as in ocean model output;
+ *   random:    every value is missing with a probability of 1/2.
+ * Besides the time per iteration, every benchmark reports the time per value (`per_elem`), and
+ * `bytes_per_second`, counting the input values, or the naive bitmask for the bit kernels.
+ *
+ * Run a subset using, e.g., `h5zsperr_bench --benchmark_filter=compactor_encode/coastline`,
+ * or skip the largest fields using `--benchmark_filter=-512x512x512`.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "compactor.h"
+#include "h5zsperr_helper.h"
+#include "icecream.h"
+
+namespace {
+
+enum class mask_pattern { empty = 0, full = 1, coastline = 2, random = 3 };
+
+const char* pattern_name(mask_pattern p)
+{
+  switch (p) {
+    case mask_pattern::empty:
+      return "empty";
+    case mask_pattern::full:
+      return "full";
+    case mask_pattern::coastline:
+      return "coastline";
+    default:
+      return "random";
+  }
+}
+
+/* The field sizes, as {nx, ny, nz}. */
+const size_t field_sizes[][3] = {{64, 64, 1},    {512, 512, 1},  {64, 64, 64},
+                                 {128, 128, 128}, {256, 256, 256}, {512, 512, 512}};
+constexpr int num_sizes = sizeof(field_sizes) / sizeof(field_sizes[0]);
+
+/* The mask of one horizontal level; a coastline stays the same through the vertical levels. */
+std::vector<bool> level_mask(mask_pattern p, size_t nx, size_t ny)
+{
+  auto mask = std::vector<bool>(nx * ny, p == mask_pattern::full);
+  if (p == mask_pattern::coastline)
+    for (size_t y = 0; y < ny; y++)
+      for (size_t x = 0; x < nx; x++)
+        mask[y * nx + x] = std::sin(0.05 * double(x)) * std::cos(0.03 * double(y)) +
+                               0.3 * std::sin(0.011 * double(x + 2 * y)) >
+                           0.35;
+  return mask;
+}
+
+/*
+ * A field with its missing values, which are NaNs or, with `large`, 1e36, and the naive bitmask
+ * marking them in the layout that `icecream_wbit()` produces.
+ * Only the latest field is kept, since a 512^3 one of doubles takes 1 GiB.
+ */
+template <typename T>
+struct Field {
+  mask_pattern pattern = mask_pattern::empty;
+  int size = -1;
+  bool large = false;
+  size_t nelem = 0;
+  std::vector<T> vals;
+  std::vector<uint64_t> bits;
+
+  static const Field& get(mask_pattern pattern, int size, bool large = false)
+  {
+    static Field f;
+    if (f.pattern != pattern || f.size != size || f.large != large)
+      f.make(pattern, size, large);
+    return f;
+  }
+
+  void make(mask_pattern p, int s, bool l)
+  {
+    pattern = p;
+    size = s;
+    large = l;
+    const size_t* dims = field_sizes[s];
+    nelem = dims[0] * dims[1] * dims[2];
+    vals.clear();
+    vals.resize(nelem);
+    bits.assign((nelem + 63) / 64, 0);
+
+    const T missing = large ? T(1e36) : std::numeric_limits<T>::quiet_NaN();
+    const auto level = level_mask(p, dims[0], dims[1]);
+    const size_t level_len = level.size();
+    auto gen = std::mt19937_64(42);
+    uint64_t coins = 0;
+    for (size_t i = 0; i < nelem; i++) {
+      if (i % 64 == 0)
+        coins = gen();
+      const bool miss = p == mask_pattern::random ? (coins >> (i % 64)) & 1u : level[i % level_len];
+      if (miss) {
+        vals[i] = missing;
+        bits[i / 64] |= uint64_t{1} << (i % 64);
+      }
+      else
+        vals[i] = T(10.0 + 0.001 * double(i % 4099));
+    }
+  }
+};
+
+/* Name a benchmark run as, e.g., "compactor_encode/coastline/64x64x64". */
+std::string run_name(const char* kernel, mask_pattern p, int size)
+{
+  const size_t* dims = field_sizes[size];
+  auto name = std::string(kernel) + "/" + pattern_name(p) + "/" + std::to_string(dims[0]) + "x" +
+              std::to_string(dims[1]);
+  if (dims[2] > 1)
+    name += "x" + std::to_string(dims[2]);
+  return name;
+}
+
+/* Report the time per element and GB/s, given the number of elements and the bytes they occupy. */
+void report(benchmark::State& state, size_t nelem, size_t bytes)
+{
+  state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(nelem));
+  state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(bytes));
+  state.counters["per_elem"] = benchmark::Counter(
+      double(nelem), benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+//
+// icecream
+//
+void bm_icecream_wbit(benchmark::State& state, mask_pattern p, int size)
+{
+  const auto& f = Field<float>::get(p, size);
+  auto mem = std::vector<uint64_t>(f.bits.size());
+  auto s = icecream();
+  for (auto _ : state) {
+    icecream_use_mem(&s, mem.data(), mem.size() * 8);
+    for (size_t i = 0; i < f.nelem; i++)
+      icecream_wbit(&s, int(f.bits[i / 64] >> (i % 64)) & 1);
+    icecream_flush(&s);
+    benchmark::DoNotOptimize(mem.data());
+  }
+  report(state, f.nelem, f.bits.size() * 8);
+}
+
+void bm_icecream_rbit(benchmark::State& state, mask_pattern p, int size)
+{
+  const auto& f = Field<float>::get(p, size);
+  auto mem = f.bits;
+  auto s = icecream();
+  for (auto _ : state) {
+    icecream_use_mem(&s, mem.data(), mem.size() * 8);
+    size_t ones = 0;
+    for (size_t i = 0; i < f.nelem; i++)
+      ones += icecream_rbit(&s);
+    benchmark::DoNotOptimize(ones);
+  }
+  report(state, f.nelem, f.bits.size() * 8);
+}
+
+//
+// compactor
+//
+void bm_compactor_comp_size(benchmark::State& state, mask_pattern p, int size)
+{
+  const auto& f = Field<float>::get(p, size);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(compactor_comp_size(f.bits.data(), f.bits.size() * 8));
+  report(state, f.nelem, f.bits.size() * 8);
+}
+
+void bm_compactor_encode(benchmark::State& state, mask_pattern p, int size)
+{
+  const auto& f = Field<float>::get(p, size);
+  const size_t bytes = f.bits.size() * 8;
+  auto comp = std::vector<uint64_t>((compactor_comp_size(f.bits.data(), bytes) + 7) / 8);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(compactor_encode(f.bits.data(), bytes, comp.data(), comp.size() * 8));
+  report(state, f.nelem, bytes);
+}
+
+void bm_compactor_decode(benchmark::State& state, mask_pattern p, int size)
+{
+  const auto& f = Field<float>::get(p, size);
+  const size_t bytes = f.bits.size() * 8;
+  auto comp = std::vector<uint64_t>((compactor_comp_size(f.bits.data(), bytes) + 7) / 8);
+  compactor_encode(f.bits.data(), bytes, comp.data(), comp.size() * 8);
+  auto out = std::vector<uint64_t>(f.bits.size() + 1);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(compactor_decode(comp.data(), comp.size() * 8, out.data()));
+  report(state, f.nelem, bytes);
+}
+
+//
+// h5zsperr_* helpers, on floats (`is_float` = 1) and doubles (0).
+//
+template <typename T>
+void bm_has_nan(benchmark::State& state, mask_pattern p, int size)
+{
+  const auto& f = Field<T>::get(p, size);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(
+        C_API::h5zsperr_has_nan(f.vals.data(), f.nelem, sizeof(T) == 4 ? 1 : 0));
+  report(state, f.nelem, f.nelem * sizeof(T));
+}
+
+template <typename T>
+void bm_has_large_mag(benchmark::State& state, mask_pattern p, int size)
+{
+  const auto& f = Field<T>::get(p, size, true);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(
+        C_API::h5zsperr_has_large_mag(f.vals.data(), f.nelem, sizeof(T) == 4 ? 1 : 0));
+  report(state, f.nelem, f.nelem * sizeof(T));
+}
+
+template <typename T, bool Large>
+void bm_make_mask(benchmark::State& state, mask_pattern p, int size)
+{
+  const auto& f = Field<T>::get(p, size, Large);
+  const size_t bytes = f.bits.size() * 8;
+  auto mask = std::vector<uint64_t>((compactor_comp_size(f.bits.data(), bytes) + 7) / 8);
+  const auto make = Large ? C_API::h5zsperr_make_mask_large_mag : C_API::h5zsperr_make_mask_nan;
+  size_t useful = 0;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(make(f.vals.data(), f.nelem, sizeof(T) == 4 ? 1 : 0, mask.data(),
+                                  mask.size() * 8, &useful));
+  report(state, f.nelem, f.nelem * sizeof(T));
+}
+
+/* The treat_* helpers overwrite the missing values, so every iteration starts from a copy. */
+template <typename T, T (*Treat)(T*, size_t), bool Large>
+void bm_treat(benchmark::State& state, mask_pattern p, int size)
+{
+  const auto& f = Field<T>::get(p, size, Large);
+  auto buf = f.vals;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::memcpy(buf.data(), f.vals.data(), f.nelem * sizeof(T));
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(Treat(buf.data(), f.nelem));
+  }
+  report(state, f.nelem, f.nelem * sizeof(T));
+}
+
+template <typename T, void (*Fill)(T*, size_t, const void*, T)>
+void bm_fill_mask(benchmark::State& state, mask_pattern p, int size)
+{
+  const auto& f = Field<T>::get(p, size);
+  auto buf = f.vals;
+  for (auto _ : state) {
+    Fill(buf.data(), f.nelem, f.bits.data(), T(-999.0));
+    benchmark::DoNotOptimize(buf.data());
+  }
+  report(state, f.nelem, f.nelem * sizeof(T));
+}
+
+void bm_pack_extra_info(benchmark::State& state)
+{
+  int rank = 0, is_float = 0, mode = 0, magic = 0;
+  for (auto _ : state) {
+    const unsigned int meta = C_API::h5zsperr_pack_extra_info(3, 1, 1, 42);
+    C_API::h5zsperr_unpack_extra_info(meta, &rank, &is_float, &mode, &magic);
+    benchmark::DoNotOptimize(rank + is_float + mode + magic);
+  }
+  report(state, 1, sizeof(unsigned int));
+}
+
+using kernel_fn = void (*)(benchmark::State&, mask_pattern, int);
+
+const struct {
+  const char* name;
+  kernel_fn fn;
+} kernels[] = {
+    {"icecream_wbit", bm_icecream_wbit},
+    {"icecream_rbit", bm_icecream_rbit},
+    {"compactor_comp_size", bm_compactor_comp_size},
+    {"compactor_encode", bm_compactor_encode},
+    {"compactor_decode", bm_compactor_decode},
+    {"has_nan_f32", bm_has_nan<float>},
+    {"has_nan_f64", bm_has_nan<double>},
+    {"has_large_mag_f32", bm_has_large_mag<float>},
+    {"has_large_mag_f64", bm_has_large_mag<double>},
+    {"make_mask_nan_f32", bm_make_mask<float, false>},
+    {"make_mask_nan_f64", bm_make_mask<double, false>},
+    {"make_mask_large_mag_f32", bm_make_mask<float, true>},
+    {"make_mask_large_mag_f64", bm_make_mask<double, true>},
+    {"treat_nan_f32", bm_treat<float, C_API::h5zsperr_treat_nan_f32, false>},
+    {"treat_nan_f64", bm_treat<double, C_API::h5zsperr_treat_nan_f64, false>},
+    {"treat_large_mag_f32", bm_treat<float, C_API::h5zsperr_treat_large_mag_f32, true>},
+    {"treat_large_mag_f64", bm_treat<double, C_API::h5zsperr_treat_large_mag_f64, true>},
+    {"fill_mask_f32", bm_fill_mask<float, C_API::h5zsperr_fill_mask_f32>},
+    {"fill_mask_f64", bm_fill_mask<double, C_API::h5zsperr_fill_mask_f64>},
+};
+
+}  // namespace
+
+/* Sweep every kernel over all masks and sizes; the field of a run is reused by the next one. */
+int main(int argc, char** argv)
+{
+  for (const auto& k : kernels)
+    for (int p = 0; p < 4; p++)
+      for (int s = 0; s < num_sizes; s++)
+        benchmark::RegisterBenchmark(run_name(k.name, mask_pattern(p), s).c_str(), k.fn,
+                                     mask_pattern(p), s)
+            ->Unit(benchmark::kMicrosecond);
+  benchmark::RegisterBenchmark("pack_extra_info", bm_pack_extra_info);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
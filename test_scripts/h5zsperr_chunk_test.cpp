@@ -0,0 +1,710 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <H5PLextern.h>
+#include <hdf5.h>
+
+#include "h5z-sperr-chunk.h"
+#include "h5z-sperr.h"
+
+namespace {
+
+const size_t NX = 32, NY = 24, NZ = 20; // chunk dimensions, in the HDF5 (C) order
+
+std::vector<float> make_chunk(size_t idx)
+{
+  auto vec = std::vector<float>(NX * NY * NZ);
+  for (size_t i = 0; i < vec.size(); i++)
+    vec[i] = float(std::cos(double(i + idx * 7) * 0.02) * 5.0);
+  for (size_t i = idx; i < vec.size(); i += 29)
+    vec[i] = std::nanf("1");
+  return vec;
+}
+
+TEST(h5zsperr_chunk, cd_values)
+{
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1};
+  const size_t chunk_dims[4] = {1, NX, NY, NZ};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, 4, chunk_dims, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+  EXPECT_EQ(cd_nelmts, 5);
+  EXPECT_EQ(cd[1], user_cd[0]);
+  EXPECT_EQ(cd[2], NX);
+  EXPECT_EQ(cd[4], NZ);
+
+  // Invalid missing value mode, or chunks that are not 2D or 3D.
+  const unsigned int bad_cd[2] = {user_cd[0], 9};
+  EXPECT_NE(C_API::H5Z_SPERR_chunk_cd_values(bad_cd, 2, 1, 4, chunk_dims, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+  const size_t dims_1d[2] = {1, NX};
+  EXPECT_NE(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, 2, dims_1d, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+}
+
+TEST(h5zsperr_chunk, cd_values_exact_missing)
+{
+  // A double missing value given to a float dataset is kept as a float, in mode 3.
+  const double missing = -999.0;
+  unsigned int user_cd[4] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 4, 0, 0};
+  std::memcpy(&user_cd[2], &missing, sizeof(missing));
+  const size_t chunk_dims[3] = {NX, NY, NZ};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 4, 1, 3, chunk_dims, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+  ASSERT_EQ(cd_nelmts, 6);
+  EXPECT_EQ(((cd[0] >> 6) & 15u), 3);
+  float val = 0.f;
+  std::memcpy(&val, &cd[5], sizeof(val));
+  EXPECT_EQ(val, -999.f);
+
+  // The missing value itself is mandatory without a dataset.
+  EXPECT_NE(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, 3, chunk_dims, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+}
+
+//
+// Missing value mode 4 without the missing value takes the fill value of the dataset.
+//
+TEST(h5zsperr_chunk, fill_value_as_missing)
+{
+  ASSERT_GE(H5Zregister(H5PLget_plugin_info()), 0);
+
+  const char* fname = "h5zsperr_chunk_fill.h5";
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  const hsize_t dims[3] = {NX, NY, NZ};
+  hid_t space = H5Screate_simple(3, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, dims);
+  const double fill_val = 9.969209968386869e36;
+  H5Pset_fill_value(dcpl, H5T_NATIVE_DOUBLE, &fill_val);
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 4};
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 2, user_cd);
+  hid_t dset = H5Dcreate(file, "var", H5T_NATIVE_DOUBLE, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+
+  auto orig = std::vector<double>(NX * NY * NZ);
+  for (size_t i = 0; i < orig.size(); i++)
+    orig[i] = (i % 17 == 0) ? fill_val : std::sin(double(i) * 0.01);
+  ASSERT_GE(H5Dwrite(dset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, orig.data()), 0);
+  H5Dclose(dset);
+
+  dset = H5Dopen(file, "var", H5P_DEFAULT);
+  auto out = std::vector<double>(orig.size());
+  ASSERT_GE(H5Dread(dset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, out.data()), 0);
+  for (size_t i = 0; i < orig.size(); i++) {
+    if (i % 17 == 0) {
+      ASSERT_EQ(out[i], fill_val);
+    }
+    else {
+      ASSERT_LE(std::abs(out[i] - orig[i]), 1e-3);
+    }
+  }
+
+  // Without a user-defined fill value, the dataset can't be created.
+  hid_t dcpl2 = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl2, 3, dims);
+  H5Pset_filter(dcpl2, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 2, user_cd);
+  hid_t dset2 = -1;
+  H5E_BEGIN_TRY
+  {
+    dset2 = H5Dcreate(file, "var2", H5T_NATIVE_DOUBLE, space, H5P_DEFAULT, dcpl2, H5P_DEFAULT);
+  }
+  H5E_END_TRY;
+  EXPECT_LT(dset2, 0);
+
+  H5Pclose(dcpl2);
+  H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Fclose(file);
+  std::remove(fname);
+}
+
+//
+// The fill value is taken at the precision of the dataset, whichever of mode 3 or 4 is asked for.
+//
+template <typename T>
+void fill_value_precision(unsigned int missing_mode, hid_t type)
+{
+  const char* fname = "h5zsperr_chunk_fill_precision.h5";
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  const hsize_t dims[3] = {NX, NY, NZ};
+  hid_t space = H5Screate_simple(3, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, dims);
+  const T fill_val = T(0.1); /* not exactly a float when T is double */
+  H5Pset_fill_value(dcpl, type, &fill_val);
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-2, 0), missing_mode};
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 2, user_cd);
+  hid_t dset = H5Dcreate(file, "var", type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+
+  auto orig = std::vector<T>(NX * NY * NZ);
+  for (size_t i = 0; i < orig.size(); i++)
+    orig[i] = (i % 17 == 0) ? fill_val : T(std::sin(double(i) * 0.01));
+  ASSERT_GE(H5Dwrite(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, orig.data()), 0);
+  H5Dclose(dset);
+
+  dset = H5Dopen(file, "var", H5P_DEFAULT);
+  auto out = std::vector<T>(orig.size());
+  ASSERT_GE(H5Dread(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, out.data()), 0);
+  for (size_t i = 0; i < orig.size(); i++) {
+    if (i % 17 == 0) {
+      ASSERT_EQ(out[i], fill_val) << "i = " << i;
+    }
+    else {
+      ASSERT_LE(std::abs(out[i] - orig[i]), 1e-2) << "i = " << i;
+    }
+  }
+
+  H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Fclose(file);
+  std::remove(fname);
+}
+
+TEST(h5zsperr_chunk, fill_value_precision)
+{
+  ASSERT_GE(H5Zregister(H5PLget_plugin_info()), 0);
+  fill_value_precision<double>(3, H5T_NATIVE_DOUBLE);
+  fill_value_precision<double>(4, H5T_NATIVE_DOUBLE);
+  fill_value_precision<float>(4, H5T_NATIVE_FLOAT);
+}
+
+//
+// Encode chunks using the standalone API, write them using `H5Dwrite_chunk()`,
+// and read them back through the filter.
+//
+TEST(h5zsperr_chunk, write_chunk_read_filter)
+{
+  ASSERT_GE(H5Zregister(H5PLget_plugin_info()), 0);
+
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1};
+  const size_t chunk_dims[3] = {NX, NY, NZ};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, 3, chunk_dims, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+
+  const char* fname = "h5zsperr_chunk_test.h5";
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  const hsize_t dims[3] = {NX * 2, NY, NZ};
+  const hsize_t chunks[3] = {NX, NY, NZ};
+  hid_t space = H5Screate_simple(3, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, chunks);
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 2, user_cd);
+  hid_t dset = H5Dcreate(file, "var", H5T_NATIVE_FLOAT, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+
+  for (size_t c = 0; c < 2; c++) {
+    const auto chunk = make_chunk(c);
+    void* enc = NULL;
+    size_t enc_len = 0;
+    ASSERT_EQ(C_API::H5Z_SPERR_encode_chunk(cd_nelmts, cd, chunk.data(), chunk.size() * 4, &enc,
+                                            &enc_len),
+              H5ZSPERR_OK);
+    const hsize_t offset[3] = {NX * c, 0, 0};
+    ASSERT_GE(H5Dwrite_chunk(dset, H5P_DEFAULT, 0, offset, enc_len, enc), 0);
+    std::free(enc);
+  }
+  H5Dclose(dset);
+
+  // Read through the filter, and compare with the standalone decoder.
+  dset = H5Dopen(file, "var", H5P_DEFAULT);
+  auto all = std::vector<float>(NX * NY * NZ * 2);
+  ASSERT_GE(H5Dread(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, all.data()), 0);
+  for (size_t c = 0; c < 2; c++) {
+    const auto chunk = make_chunk(c);
+    const hsize_t offset[3] = {NX * c, 0, 0};
+    hsize_t nbytes = 0;
+    ASSERT_GE(H5Dget_chunk_storage_size(dset, offset, &nbytes), 0);
+    auto raw = std::vector<uint8_t>(nbytes);
+    uint32_t filter_mask = 0;
+    ASSERT_GE(H5Dread_chunk(dset, H5P_DEFAULT, offset, &filter_mask, raw.data()), 0);
+    void* dec = NULL;
+    size_t dec_len = 0;
+    ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk(cd_nelmts, cd, raw.data(), raw.size(), &dec, &dec_len),
+              H5ZSPERR_OK);
+    ASSERT_EQ(dec_len, chunk.size() * 4);
+    const float* p = static_cast<const float*>(dec);
+    for (size_t i = 0; i < chunk.size(); i++) {
+      const float v = all[c * chunk.size() + i];
+      if (std::isnan(chunk[i])) {
+        ASSERT_TRUE(std::isnan(v));
+        ASSERT_TRUE(std::isnan(p[i]));
+      }
+      else {
+        ASSERT_LE(std::abs(v - chunk[i]), 1e-3);
+        ASSERT_EQ(v, p[i]);
+      }
+    }
+    std::free(dec);
+  }
+
+  H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Fclose(file);
+  std::remove(fname);
+}
+
+//
+// The cache of decoded chunks survives closing and reopening a dataset.
+//
+TEST(h5zsperr_chunk, decoded_chunk_cache)
+{
+  ASSERT_GE(H5Zregister(H5PLget_plugin_info()), 0);
+  C_API::H5Z_SPERR_set_chunk_cache(64 << 20);
+  size_t hits = 0, misses = 0, entries = 0, bytes = 0;
+  C_API::H5Z_SPERR_chunk_cache_stats(&hits, &misses, &entries, &bytes);
+  const size_t hits0 = hits, misses0 = misses;
+
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1};
+  const char* fname = "h5zsperr_chunk_cache_test.h5";
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  const hsize_t dims[3] = {NX * 2, NY, NZ};
+  const hsize_t chunks[3] = {NX, NY, NZ};
+  hid_t space = H5Screate_simple(3, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, chunks);
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 2, user_cd);
+  hid_t dset = H5Dcreate(file, "var", H5T_NATIVE_FLOAT, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+  auto orig = make_chunk(0);
+  const auto second = make_chunk(1);
+  orig.insert(orig.end(), second.begin(), second.end());
+  ASSERT_GE(H5Dwrite(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, orig.data()), 0);
+  H5Dclose(dset);
+
+  // The first pass decodes both chunks, and the second pass finds them in the cache.
+  auto first = std::vector<float>(orig.size());
+  for (int pass = 0; pass < 2; pass++) {
+    dset = H5Dopen(file, "var", H5P_DEFAULT);
+    auto out = std::vector<float>(orig.size());
+    ASSERT_GE(H5Dread(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out.data()), 0);
+    H5Dclose(dset);
+    if (pass == 0)
+      first = out;
+    for (size_t i = 0; i < orig.size(); i++) {
+      if (std::isnan(orig[i])) {
+        ASSERT_TRUE(std::isnan(out[i]));
+      }
+      else {
+        ASSERT_EQ(out[i], first[i]);
+      }
+    }
+    C_API::H5Z_SPERR_chunk_cache_stats(&hits, &misses, &entries, &bytes);
+    EXPECT_EQ(misses - misses0, 2ul);
+    EXPECT_EQ(hits - hits0, pass == 0 ? 0ul : 2ul);
+  }
+  EXPECT_GE(bytes, orig.size() * sizeof(float));
+
+  // Turning the cache off drops its entries.
+  C_API::H5Z_SPERR_set_chunk_cache(0);
+  C_API::H5Z_SPERR_chunk_cache_stats(&hits, &misses, &entries, &bytes);
+  EXPECT_EQ(entries, 0ul);
+  EXPECT_EQ(bytes, 0ul);
+
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Fclose(file);
+  std::remove(fname);
+}
+
+//
+// Collective writes in parallel HDF5 exchange the size of every chunk, so a chunk needs to encode
+// to the same bytes no matter what the same thread encoded before.
+//
+TEST(h5zsperr_chunk, deterministic_output)
+{
+  const size_t chunk_dims[3] = {NX, NY, NZ};
+  auto encode = [&chunk_dims](const unsigned int* user_cd, size_t n, int is_float,
+                              const void* data, size_t bytes) {
+    unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+    size_t cd_nelmts = 0;
+    void* enc = nullptr;
+    size_t enc_len = 0;
+    EXPECT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, n, is_float, 3, chunk_dims, cd,
+                                               &cd_nelmts),
+              H5ZSPERR_OK);
+    EXPECT_EQ(C_API::H5Z_SPERR_encode_chunk(cd_nelmts, cd, data, bytes, &enc, &enc_len),
+              H5ZSPERR_OK);
+    const auto* p = static_cast<const uint8_t*>(enc);
+    auto out = std::vector<uint8_t>(p, p + enc_len);
+    std::free(enc);
+    return out;
+  };
+
+  const auto chunk = make_chunk(3);
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, H5Z_SPERR_SWAP_AUTO), 6};
+  const auto first = encode(user_cd, 2, 1, chunk.data(), chunk.size() * sizeof(float));
+
+  // Encode other chunks in between: doubles with several missing values, sub-blocks, max effort.
+  auto dbl = std::vector<double>(chunk.begin(), chunk.end());
+  for (size_t i = 5; i < dbl.size(); i += 31)
+    dbl[i] = -999.0;
+  const unsigned int dbl_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-6, 0), 6};
+  encode(dbl_cd, 2, 0, dbl.data(), dbl.size() * sizeof(double));
+  const auto other = make_chunk(4);
+  const unsigned int sub_cd[2] = {H5Z_SPERR_make_cd_values(1, 3.0, 0),
+                                  1 | H5Z_SPERR_make_subblocks(8) |
+                                      H5Z_SPERR_make_effort(H5Z_SPERR_EFFORT_MAX)};
+  encode(sub_cd, 2, 1, other.data(), other.size() * sizeof(float));
+
+  EXPECT_EQ(encode(user_cd, 2, 1, chunk.data(), chunk.size() * sizeof(float)), first);
+}
+
+//
+// Compound values of floats (with a gap after the last member) are compressed component by
+// component, each with its own tolerance.
+//
+struct Wind {
+  float u, v, w;
+  int32_t pad;
+};
+
+TEST(h5zsperr_chunk, compound_components)
+{
+  ASSERT_GE(H5Zregister(H5PLget_plugin_info()), 0);
+
+  const char* fname = "h5zsperr_chunk_compound.h5";
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(Wind));
+  H5Tinsert(type, "u", HOFFSET(Wind, u), H5T_NATIVE_FLOAT);
+  H5Tinsert(type, "v", HOFFSET(Wind, v), H5T_NATIVE_FLOAT);
+  H5Tinsert(type, "w", HOFFSET(Wind, w), H5T_NATIVE_FLOAT);
+  const hsize_t dims[3] = {NX, NY, NZ};
+  hid_t space = H5Screate_simple(3, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, dims);
+  const double tol[3] = {1e-2, 1e-3, 1e-5};
+  const unsigned int user_cd[5] = {H5Z_SPERR_make_cd_values(3, 1.0, 0),
+                                   1 | H5Z_SPERR_make_components(3),
+                                   H5Z_SPERR_make_cd_values(3, tol[0], 0),
+                                   H5Z_SPERR_make_cd_values(3, tol[1], 0),
+                                   H5Z_SPERR_make_cd_values(3, tol[2], 0)};
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 5, user_cd);
+  hid_t dset = H5Dcreate(file, "wind", type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+
+  const auto chunk = make_chunk(1);
+  auto orig = std::vector<Wind>(chunk.size());
+  for (size_t i = 0; i < orig.size(); i++)
+    orig[i] = Wind{chunk[i], float(std::sin(double(i) * 0.003)), 0.01f * chunk[i], 0};
+  ASSERT_GE(H5Dwrite(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, orig.data()), 0);
+  H5Dclose(dset);
+
+  dset = H5Dopen(file, "wind", H5P_DEFAULT);
+  auto out = std::vector<Wind>(orig.size());
+  ASSERT_GE(H5Dread(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, out.data()), 0);
+  double max_err[3] = {0.0, 0.0, 0.0};
+  for (size_t i = 0; i < orig.size(); i++) {
+    if (std::isnan(orig[i].u)) {
+      ASSERT_TRUE(std::isnan(out[i].u));
+    }
+    else
+      max_err[0] = std::max(max_err[0], std::abs(double(out[i].u) - orig[i].u));
+    max_err[1] = std::max(max_err[1], std::abs(double(out[i].v) - orig[i].v));
+    if (std::isnan(orig[i].w)) {
+      ASSERT_TRUE(std::isnan(out[i].w));
+    }
+    else
+      max_err[2] = std::max(max_err[2], std::abs(double(out[i].w) - orig[i].w));
+  }
+  for (int c = 0; c < 3; c++)
+    EXPECT_LE(max_err[c], tol[c]);
+  EXPECT_GT(max_err[0], tol[1]); // the looser tolerance of u is really used
+
+  // The stored cd_values[] keep the layout of the values and the parameters of each component.
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = H5Z_SPERR_MAX_CD_VALUES;
+  hid_t plist = H5Dget_create_plist(dset);
+  ASSERT_GE(H5Pget_filter_by_id(plist, H5Z_FILTER_SPERR, NULL, &cd_nelmts, cd, 0, NULL, NULL), 0);
+  ASSERT_EQ(cd_nelmts, 5 + 1 + 2 * 3);
+  EXPECT_EQ((cd[0] >> 22) & 7u, 3u);
+  EXPECT_EQ(cd[5], sizeof(Wind));
+  EXPECT_EQ(cd[8], offsetof(Wind, v));
+  EXPECT_EQ(cd[9], user_cd[3]);
+  H5Pclose(plist);
+
+  // Compound types with members other than floats can't take the filter.
+  hid_t mixed = H5Tcreate(H5T_COMPOUND, sizeof(Wind));
+  H5Tinsert(mixed, "u", HOFFSET(Wind, u), H5T_NATIVE_FLOAT);
+  H5Tinsert(mixed, "pad", HOFFSET(Wind, pad), H5T_NATIVE_INT32);
+  hid_t dcpl2 = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl2, 3, dims);
+  H5Pset_filter(dcpl2, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 1, user_cd);
+  hid_t dset2 = -1;
+  H5E_BEGIN_TRY
+  {
+    dset2 = H5Dcreate(file, "mixed", mixed, space, H5P_DEFAULT, dcpl2, H5P_DEFAULT);
+  }
+  H5E_END_TRY;
+  EXPECT_LT(dset2, 0);
+
+  H5Pclose(dcpl2);
+  H5Tclose(mixed);
+  H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Tclose(type);
+  H5Fclose(file);
+  std::remove(fname);
+}
+
+//
+// Array values of doubles go through the chunk API as well, including region decoding.
+//
+TEST(h5zsperr_chunk, array_components)
+{
+  const size_t chunk_dims[3] = {NX, NY, NZ};
+  const size_t offsets[2] = {0, sizeof(double)};
+  const unsigned int user_cd[1] = {H5Z_SPERR_make_cd_values(3, 1e-6, 0)};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_component_cd_values(user_cd, 1, 0, 3, chunk_dims, 2,
+                                                 2 * sizeof(double), offsets, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+  ASSERT_EQ(cd_nelmts, 5 + 1 + 2 * 2);
+  EXPECT_EQ(cd[7], user_cd[0]);
+  EXPECT_EQ(cd[9], user_cd[0]);
+
+  // One value of each component is missing, in the default missing value mode.
+  const size_t nelem = NX * NY * NZ;
+  auto orig = std::vector<double>(2 * nelem);
+  for (size_t i = 0; i < nelem; i++) {
+    orig[2 * i] = std::cos(double(i) * 0.01);
+    orig[2 * i + 1] = 100.0 * std::sin(double(i) * 0.002);
+  }
+  orig[2 * 17] = std::nan("1");
+  orig[2 * 4000 + 1] = 1e36;
+
+  void* enc = nullptr;
+  size_t enc_len = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_encode_chunk(cd_nelmts, cd, orig.data(), orig.size() * 8, &enc,
+                                          &enc_len),
+            H5ZSPERR_OK);
+  void* dec = nullptr;
+  size_t dec_len = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk(cd_nelmts, cd, enc, enc_len, &dec, &dec_len),
+            H5ZSPERR_OK);
+  ASSERT_EQ(dec_len, orig.size() * 8);
+  const auto* out = static_cast<const double*>(dec);
+  for (size_t i = 0; i < orig.size(); i++) {
+    if (i == 2 * 17) {
+      ASSERT_TRUE(std::isnan(out[i]));
+    }
+    else {
+      ASSERT_LE(std::abs(out[i] - orig[i]), 1e-6) << i;
+    }
+  }
+
+  // A region holds whole array values.
+  const size_t start[3] = {3, 5, 7}, count[3] = {10, 9, 11};
+  auto region = std::vector<double>(2 * count[0] * count[1] * count[2]);
+  ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk_region(cd_nelmts, cd, enc, enc_len, start, count,
+                                                 region.data()),
+            H5ZSPERR_OK);
+  size_t k = 0;
+  for (size_t x = start[0]; x < start[0] + count[0]; x++)
+    for (size_t y = start[1]; y < start[1] + count[1]; y++)
+      for (size_t z = start[2]; z < start[2] + count[2]; z++, k += 2) {
+        const size_t i = (x * NY + y) * NZ + z;
+        ASSERT_EQ(region[k], out[2 * i]);
+        ASSERT_EQ(region[k + 1], out[2 * i + 1]);
+      }
+  std::free(dec);
+  std::free(enc);
+
+  // Per-component parameters need one for each component, and plain values take none.
+  const unsigned int bad_cd[3] = {user_cd[0], 6 | H5Z_SPERR_make_components(1), user_cd[0]};
+  EXPECT_NE(C_API::H5Z_SPERR_component_cd_values(bad_cd, 3, 0, 3, chunk_dims, 2,
+                                                 2 * sizeof(double), offsets, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+  EXPECT_NE(C_API::H5Z_SPERR_chunk_cd_values(bad_cd, 3, 0, 3, chunk_dims, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+}
+
+//
+// 16-bit integers come back exactly with a PWE tolerance below 0.5, and missing values of
+// unsigned integers can be the fill value of the dataset.
+//
+TEST(h5zsperr_chunk, int16_datasets)
+{
+  ASSERT_GE(H5Zregister(H5PLget_plugin_info()), 0);
+
+  const char* fname = "h5zsperr_chunk_int16.h5";
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  const hsize_t dims[3] = {NX, NY, NZ};
+  hid_t space = H5Screate_simple(3, dims, NULL);
+  const size_t nelem = NX * NY * NZ;
+
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, dims);
+  const unsigned int exact_cd = H5Z_SPERR_make_cd_values(3, 0.49, 0);
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 1, &exact_cd);
+  hid_t dset = H5Dcreate(file, "signed", H5T_STD_I16LE, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+  auto orig = std::vector<int16_t>(nelem);
+  for (size_t i = 0; i < nelem; i++)
+    orig[i] = int16_t(std::lround(32000.0 * std::sin(double(i) * 0.001)));
+  ASSERT_GE(H5Dwrite(dset, H5T_NATIVE_INT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, orig.data()), 0);
+  H5Dclose(dset);
+  dset = H5Dopen(file, "signed", H5P_DEFAULT);
+  auto out = std::vector<int16_t>(nelem);
+  ASSERT_GE(H5Dread(dset, H5T_NATIVE_INT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, out.data()), 0);
+  EXPECT_EQ(out, orig);
+  H5Dclose(dset);
+
+  hid_t dcpl2 = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl2, 3, dims);
+  const uint16_t fill_val = 65535;
+  H5Pset_fill_value(dcpl2, H5T_NATIVE_UINT16, &fill_val);
+  const unsigned int lossy_cd[2] = {H5Z_SPERR_make_cd_values(3, 4.0, 0), 3};
+  H5Pset_filter(dcpl2, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 2, lossy_cd);
+  dset = H5Dcreate(file, "unsigned", H5T_STD_U16LE, space, H5P_DEFAULT, dcpl2, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+  auto uorig = std::vector<uint16_t>(nelem);
+  for (size_t i = 0; i < nelem; i++)
+    uorig[i] = (i % 13 == 0) ? fill_val : uint16_t(1000.0 + 900.0 * std::cos(double(i) * 0.01));
+  ASSERT_GE(H5Dwrite(dset, H5T_NATIVE_UINT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, uorig.data()), 0);
+  H5Dclose(dset);
+  dset = H5Dopen(file, "unsigned", H5P_DEFAULT);
+  auto uout = std::vector<uint16_t>(nelem);
+  ASSERT_GE(H5Dread(dset, H5T_NATIVE_UINT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, uout.data()), 0);
+  for (size_t i = 0; i < nelem; i++) {
+    if (i % 13 == 0) {
+      ASSERT_EQ(uout[i], fill_val);
+    }
+    else {
+      ASSERT_LE(std::abs(int(uout[i]) - int(uorig[i])), 4) << i;
+    }
+  }
+
+  H5Dclose(dset);
+  H5Pclose(dcpl2);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Fclose(file);
+  std::remove(fname);
+}
+
+//
+// IEEE half-precision values, including NaNs and infinities as missing values.
+//
+TEST(h5zsperr_chunk, float16_dataset)
+{
+  ASSERT_GE(H5Zregister(H5PLget_plugin_info()), 0);
+
+  hid_t half = H5Tcopy(H5T_IEEE_F32LE);
+  H5Tset_fields(half, 15, 10, 5, 0, 10);
+  H5Tset_size(half, 2);
+  H5Tset_ebias(half, 15);
+
+  const char* fname = "h5zsperr_chunk_float16.h5";
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  const hsize_t dims[3] = {NX, NY, NZ};
+  hid_t space = H5Screate_simple(3, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, dims);
+  const double tol = 1e-3;
+  const unsigned int cd = H5Z_SPERR_make_cd_values(3, tol, 0);
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 1, &cd);
+  hid_t dset = H5Dcreate(file, "half", half, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+
+  // Write floats, which HDF5 converts to half precision; read them back as floats too.
+  const auto chunk = make_chunk(2);
+  auto orig = std::vector<float>(chunk.size());
+  for (size_t i = 0; i < orig.size(); i++)
+    orig[i] = (i % 101 == 0) ? INFINITY : chunk[i] * 0.3f;
+  ASSERT_GE(H5Dwrite(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, orig.data()), 0);
+  H5Dclose(dset);
+  dset = H5Dopen(file, "half", H5P_DEFAULT);
+  auto out = std::vector<float>(orig.size());
+  ASSERT_GE(H5Dread(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out.data()), 0);
+
+  // What half-precision values hold, by way of HDF5's own conversion.
+  auto halfs = orig;
+  H5Tconvert(H5T_NATIVE_FLOAT, half, halfs.size(), halfs.data(), NULL, H5P_DEFAULT);
+  H5Tconvert(half, H5T_NATIVE_FLOAT, halfs.size(), halfs.data(), NULL, H5P_DEFAULT);
+  for (size_t i = 0; i < orig.size(); i++) {
+    if (std::isnan(orig[i])) {
+      ASSERT_TRUE(std::isnan(out[i]));
+    }
+    else if (std::isinf(orig[i])) {
+      ASSERT_EQ(out[i], orig[i]);
+    }
+    else { // within the tolerance, and the rounding to half precision after decoding
+      ASSERT_LE(std::abs(out[i] - halfs[i]), tol + std::ldexp(1.0, -10)) << i;
+    }
+  }
+
+  H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Fclose(file);
+  H5Tclose(half);
+  std::remove(fname);
+}
+
+//
+// The chunk API takes 16-bit values as well, including region decoding.
+//
+TEST(h5zsperr_chunk, uint16_chunk_region)
+{
+  const size_t chunk_dims[3] = {NX, NY, NZ};
+  const unsigned int user_cd[1] = {H5Z_SPERR_make_cd_values(3, 0.25, 0)};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 1, H5Z_SPERR_TYPE_UINT16, 3, chunk_dims,
+                                             cd, &cd_nelmts),
+            H5ZSPERR_OK);
+  auto orig = std::vector<uint16_t>(NX * NY * NZ);
+  for (size_t i = 0; i < orig.size(); i++)
+    orig[i] = uint16_t(30000.0 + 29000.0 * std::sin(double(i) * 0.0007));
+  void* enc = nullptr;
+  size_t enc_len = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_encode_chunk(cd_nelmts, cd, orig.data(), orig.size() * 2, &enc,
+                                          &enc_len),
+            H5ZSPERR_OK);
+  void* dec = nullptr;
+  size_t dec_len = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk(cd_nelmts, cd, enc, enc_len, &dec, &dec_len),
+            H5ZSPERR_OK);
+  ASSERT_EQ(dec_len, orig.size() * 2);
+  EXPECT_EQ(std::memcmp(dec, orig.data(), dec_len), 0);
+
+  const size_t start[3] = {4, 0, 9}, count[3] = {12, 24, 9};
+  auto region = std::vector<uint16_t>(count[0] * count[1] * count[2]);
+  ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk_region(cd_nelmts, cd, enc, enc_len, start, count,
+                                                 region.data()),
+            H5ZSPERR_OK);
+  size_t k = 0;
+  for (size_t x = start[0]; x < start[0] + count[0]; x++)
+    for (size_t y = start[1]; y < start[1] + count[1]; y++)
+      for (size_t z = start[2]; z < start[2] + count[2]; z++)
+        ASSERT_EQ(region[k++], orig[(x * NY + y) * NZ + z]);
+  std::free(dec);
+  std::free(enc);
+
+  // 16-bit values can't be components of compound or array values.
+  const size_t offsets[2] = {0, 2};
+  EXPECT_NE(C_API::H5Z_SPERR_component_cd_values(user_cd, 1, H5Z_SPERR_TYPE_INT16, 3,
+                                                 chunk_dims, 2, 4, offsets, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+}
+
+}  // namespace
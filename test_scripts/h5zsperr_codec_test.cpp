@@ -0,0 +1,735 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "h5z-sperr-chunk.h"
+#include "h5z-sperr.h"
+#include "h5zsperr_codec.h"
+
+namespace {
+
+// Make a smooth field of `N` values, with every `every`-th value replaced by `missing`.
+template <typename T>
+std::vector<T> make_field(size_t N, size_t every, T missing)
+{
+  auto vec = std::vector<T>(N);
+  for (size_t i = 0; i < N; i++)
+    vec[i] = T(std::sin(double(i) * 0.01) * 10.0);
+  if (every)
+    for (size_t i = 0; i < N; i += every)
+      vec[i] = missing;
+  return vec;
+}
+
+// Produce cd_values[] as `H5Z_set_local_sperr()` does, for a 3D chunk.
+std::vector<unsigned int> make_cd_values(int is_float, int missing_mode, double pwe,
+                                         double missing_val = 0.0)
+{
+  auto cd = std::vector<unsigned int>(5);
+  cd[0] = C_API::h5zsperr_pack_extra_info(3, is_float, missing_mode, H5ZSPERR_COMPATIBILITY);
+  cd[1] = H5Z_SPERR_make_cd_values(3, pwe, 0);
+  cd[2] = 16;
+  cd[3] = 20;
+  cd[4] = 24;
+  if (missing_mode == 3) {
+    const float val = float(missing_val);
+    cd.push_back(0);
+    std::memcpy(&cd[5], &val, sizeof(val));
+  }
+  else if (missing_mode == 4) {
+    cd.resize(7);
+    std::memcpy(&cd[5], &missing_val, sizeof(missing_val));
+  }
+  return cd;
+}
+
+template <typename T>
+void roundtrip(int missing_mode, T missing)
+{
+  const double pwe = 1e-3;
+  const auto cd = make_cd_values(sizeof(T) == 4, missing_mode, pwe, double(missing));
+  auto params = h5zsperr::ChunkParams();
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+  const size_t N = params.nelem();
+  ASSERT_EQ(N, 16ul * 20 * 24);
+
+  const auto orig = make_field<T>(N, 37, missing);
+  auto codec = h5zsperr::ChunkCodec<T>();
+  ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+  ASSERT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+  auto stream = std::vector<uint8_t>(codec.encoded_size());
+  codec.copy_encoded(stream.data());
+  EXPECT_EQ(stream[0] & 0x3f, missing_mode);
+  EXPECT_EQ(stream[0] >> 6, sizeof(T) == 8 ? 1 : 0); /* a double chunk that fits in floats */
+
+  // Encoding in place gives the same chunk.
+  auto copy = orig;
+  ASSERT_EQ(codec.encode_inplace(copy.data(), N), H5ZSPERR_OK);
+  auto stream2 = std::vector<uint8_t>(codec.encoded_size());
+  codec.copy_encoded(stream2.data());
+  EXPECT_EQ(stream, stream2);
+
+  // A moved-to codec decodes it.
+  auto codec2 = std::move(codec);
+  auto out = std::vector<T>(N);
+  ASSERT_EQ(codec2.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+  for (size_t i = 0; i < N; i++) {
+    if (std::isnan(orig[i])) {
+      ASSERT_TRUE(std::isnan(out[i])) << "i = " << i;
+    }
+    else if (i % 37 == 0 && missing_mode >= 2) {
+      ASSERT_EQ(out[i], orig[i]) << "i = " << i;
+    }
+    else {
+      ASSERT_LE(std::abs(out[i] - orig[i]), pwe) << "i = " << i;
+    }
+  }
+
+  // Decoding a chunk with its bitmask truncated fails gracefully.
+  if (missing_mode != 0) {
+    EXPECT_EQ(codec2.decode(stream.data(), 3, out.data(), N), H5ZSPERR_ERR_CORRUPT);
+  }
+}
+
+TEST(h5zsperr_codec, parse_cd_values)
+{
+  auto cd = make_cd_values(1, 0, 1e-3);
+  auto params = h5zsperr::ChunkParams();
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+  EXPECT_EQ(params.rank, 3);
+  EXPECT_EQ(params.is_float, 1);
+  EXPECT_EQ(params.comp_mode, 3);
+  EXPECT_EQ(params.dims[0], 16);
+  EXPECT_EQ(params.dims[2], 24);
+
+  // Rank swap
+  cd[1] = H5Z_SPERR_make_cd_values(3, 1e-3, 1);
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+  EXPECT_EQ(params.dims[0], 24);
+  EXPECT_EQ(params.dims[2], 16);
+
+  // Wrong number of elements or versions
+  EXPECT_EQ(h5zsperr::parse_cd_values(4, cd.data(), &params), H5ZSPERR_ERR_CD_VALUES);
+  cd[0] = C_API::h5zsperr_pack_extra_info(3, 1, 0, H5ZSPERR_COMPATIBILITY + 1);
+  EXPECT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_ERR_VERSION);
+
+  // Files of earlier generations stay readable.
+  for (int magic = 0; magic < H5ZSPERR_COMPATIBILITY; magic++) {
+    cd[0] = C_API::h5zsperr_pack_extra_info(3, 1, 0, magic);
+    EXPECT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK) << magic;
+    EXPECT_EQ(params.magic, magic);
+  }
+}
+
+TEST(h5zsperr_codec, type_mismatch)
+{
+  const auto cd = make_cd_values(0, 0, 1e-3);
+  auto params = h5zsperr::ChunkParams();
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+  auto codec = h5zsperr::ChunkCodec<float>();
+  EXPECT_EQ(codec.set_params(params), H5ZSPERR_ERR_CD_VALUES);
+}
+
+TEST(h5zsperr_codec, roundtrip_float)
+{
+  roundtrip<float>(0, 1.f);
+  roundtrip<float>(1, std::nanf("1"));
+  roundtrip<float>(2, -9.9e35f);
+  roundtrip<float>(3, 9.96921e36f);
+  roundtrip<float>(3, -999.f);
+}
+
+TEST(h5zsperr_codec, roundtrip_double)
+{
+  roundtrip<double>(0, 1.0);
+  roundtrip<double>(1, std::nan("1"));
+  roundtrip<double>(2, 1e36);
+  roundtrip<double>(4, 9.969209968386869e36);
+  roundtrip<double>(4, -999.0);
+}
+
+// Mix NaN, a land value, and a "below detection" value, each in its own regions.
+template <typename T>
+void roundtrip_multi()
+{
+  const double sentinels[3] = {std::nan("1"), 9.96921e36, -999.0};
+  const size_t user_n = 3;
+  auto user_cd = std::vector<unsigned int>(3 + 2 * user_n);
+  user_cd[0] = H5Z_SPERR_make_cd_values(3, 1e-3, 0);
+  user_cd[1] = 5;
+  user_cd[2] = user_n;
+  std::memcpy(&user_cd[3], sentinels, sizeof(sentinels));
+  const size_t chunk_dims[3] = {24, 20, 16};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd.data(), user_cd.size(), sizeof(T) == 4, 3,
+                                             chunk_dims, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+  auto params = h5zsperr::ChunkParams();
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd_nelmts, cd, &params), H5ZSPERR_OK);
+  ASSERT_EQ(params.num_sentinels, 3);
+  EXPECT_EQ(T(params.sentinels[1]), T(9.96921e36));
+
+  const size_t N = params.nelem();
+  auto orig = make_field<T>(N, 0, T{0});
+  for (size_t i = 0; i < N; i++) {
+    if (i % 500 < 40)
+      orig[i] = T(sentinels[(i / 500) % 3]);
+    else if (i % 97 == 0)
+      orig[i] = T(-999.0);
+  }
+  auto codec = h5zsperr::ChunkCodec<T>();
+  ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+  ASSERT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+  auto stream = std::vector<uint8_t>(codec.encoded_size());
+  codec.copy_encoded(stream.data());
+  EXPECT_EQ(stream[0] & 0x3f, 5);
+  EXPECT_EQ(stream[1], 3);
+  auto layout = h5zsperr::ChunkLayout();
+  ASSERT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 64, stream.size(), &layout),
+            H5ZSPERR_OK);
+  EXPECT_GT(layout.class_bytes, 0);
+
+  // Decode in place.
+  auto out = std::vector<T>(N);
+  std::memcpy(out.data(), stream.data(), stream.size());
+  ASSERT_EQ(codec.decode(out.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+  for (size_t i = 0; i < N; i++) {
+    if (std::isnan(orig[i])) {
+      ASSERT_TRUE(std::isnan(out[i])) << "i = " << i;
+    }
+    else if (orig[i] == T(-999.0) || orig[i] == T(9.96921e36)) {
+      ASSERT_EQ(out[i], orig[i]) << "i = " << i;
+    }
+    else {
+      ASSERT_LE(std::abs(out[i] - orig[i]), 1e-3) << "i = " << i;
+    }
+  }
+
+  // A damaged class map is detected.
+  stream[layout.class_offset] = 7;
+  EXPECT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_ERR_CORRUPT);
+
+  // Only one of the missing values present: no class map at all.
+  for (size_t i = 0; i < N; i++)
+    if (orig[i] == T(-999.0) || std::isnan(orig[i]))
+      orig[i] = T(9.96921e36);
+  ASSERT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+  stream.resize(codec.encoded_size());
+  codec.copy_encoded(stream.data());
+  EXPECT_EQ(stream[1], 1);
+  ASSERT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 64, stream.size(), &layout),
+            H5ZSPERR_OK);
+  EXPECT_EQ(layout.class_bytes, 0);
+  ASSERT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+  for (size_t i = 0; i < N; i++)
+    if (orig[i] == T(9.96921e36)) {
+      ASSERT_EQ(out[i], orig[i]) << "i = " << i;
+    }
+}
+
+TEST(h5zsperr_codec, roundtrip_multi)
+{
+  roundtrip_multi<float>();
+  roundtrip_multi<double>();
+}
+
+// Without a missing value mode, each chunk finds out its own missing values.
+template <typename T>
+void roundtrip_auto()
+{
+  const unsigned int user_cd[1] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0)};
+  const size_t chunk_dims[3] = {24, 20, 16};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 1, sizeof(T) == 4, 3, chunk_dims, cd,
+                                             &cd_nelmts),
+            H5ZSPERR_OK);
+  auto params = h5zsperr::ChunkParams();
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd_nelmts, cd, &params), H5ZSPERR_OK);
+  ASSERT_EQ(params.missing_val_mode, 6);
+  const size_t N = params.nelem();
+  auto codec = h5zsperr::ChunkCodec<T>();
+  ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+
+  // Returns the real missing mode of the chunk, and checks the decoded values.
+  auto check = [&](const std::vector<T>& orig) {
+    EXPECT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+    auto stream = std::vector<uint8_t>(codec.encoded_size());
+    codec.copy_encoded(stream.data());
+    auto out = std::vector<T>(N);
+    EXPECT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+    for (size_t i = 0; i < N; i++) {
+      if (std::isnan(orig[i])) {
+        EXPECT_TRUE(std::isnan(out[i])) << "i = " << i;
+      }
+      else if (std::abs(orig[i]) >= T(1e35)) {
+        EXPECT_GE(std::abs(out[i]), T(1e35)) << "i = " << i;
+      }
+      else {
+        EXPECT_LE(std::abs(out[i] - orig[i]), 1e-3) << "i = " << i;
+      }
+    }
+    return std::make_pair(int(stream[0] & 0x3f), out);
+  };
+
+  auto orig = make_field<T>(N, 0, T{0});
+  EXPECT_EQ(check(orig).first, 0);
+  for (size_t i = 0; i < N; i += 41)
+    orig[i] = std::numeric_limits<T>::quiet_NaN();
+  EXPECT_EQ(check(orig).first, 1);
+
+  // A netCDF default fill value alone, restored exactly.
+  orig = make_field<T>(N, 41, T(9.96921e36));
+  auto res = check(orig);
+  EXPECT_EQ(res.first, 2);
+  for (size_t i = 0; i < N; i += 41)
+    EXPECT_EQ(res.second[i], T(9.96921e36));
+
+  // NaN, the fill value, and an infinity, each restored exactly.
+  for (size_t i = 0; i < N; i += 59)
+    orig[i] = std::numeric_limits<T>::quiet_NaN();
+  orig[7] = -std::numeric_limits<T>::infinity();
+  res = check(orig);
+  EXPECT_EQ(res.first, 5);
+  for (size_t i = 0; i < N; i++)
+    if (!std::isnan(orig[i]) && std::abs(orig[i]) >= T(1e35)) {
+      EXPECT_EQ(res.second[i], orig[i]) << "i = " << i;
+    }
+
+  // Too many distinct large values to keep: NaNs stay NaNs nevertheless.
+  for (size_t i = 1; i < 8; i++)
+    orig[i * 100] = T(1e35 * double(i + 1));
+  res = check(orig);
+  EXPECT_EQ(res.first, 5);
+}
+
+TEST(h5zsperr_codec, roundtrip_auto)
+{
+  roundtrip_auto<float>();
+  roundtrip_auto<double>();
+}
+
+TEST(h5zsperr_codec, capped_cd_values)
+{
+  int mode = 0, swap = 0;
+  double pwe = 0.0;
+  const unsigned int cd = H5Z_SPERR_make_capped_cd_values(1e-6, 2.5, 1);
+  H5Z_SPERR_decode_cd_values(cd, &mode, &pwe, &swap);
+  EXPECT_EQ(mode, 4);
+  EXPECT_EQ(swap, 1);
+  EXPECT_LE(pwe, 1e-6);
+  EXPECT_GT(pwe, 0.999e-6);
+  EXPECT_EQ(H5Z_SPERR_decode_max_bpp(cd), 2.5);
+  EXPECT_EQ(H5Z_SPERR_decode_max_bpp(H5Z_SPERR_make_cd_values(1, 2.5, 0)), 0.0);
+}
+
+// Fixed PWE with a bitrate cap: a tight tolerance hits the cap, and a loose one doesn't.
+TEST(h5zsperr_codec, roundtrip_capped)
+{
+  auto cd = make_cd_values(1, 1, 1e-3);
+  auto params = h5zsperr::ChunkParams();
+  const size_t N = 16 * 20 * 24;
+  const auto orig = make_field<float>(N, 23, std::nanf("1"));
+  auto codec = h5zsperr::ChunkCodec<float>();
+  auto out = std::vector<float>(N);
+
+  for (double pwe : {1e-6, 1.0}) {
+    cd[1] = H5Z_SPERR_make_capped_cd_values(pwe, 6.0, 0);
+    ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+    ASSERT_EQ(params.comp_mode, 4);
+    ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+    ASSERT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+    auto stream = std::vector<uint8_t>(codec.encoded_size());
+    codec.copy_encoded(stream.data());
+    auto layout = h5zsperr::ChunkLayout();
+    ASSERT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 64, stream.size(), &layout),
+              H5ZSPERR_OK);
+    EXPECT_EQ(layout.missing_mode, 1);
+    EXPECT_EQ(layout.mask_offset, 9);
+    EXPECT_LE(layout.sperr_bytes, 6 * N / 8 + 64); /* allow for the SPERR header */
+    if (pwe < 1e-3) {
+      EXPECT_GT(layout.max_error, params.quality);
+    }
+    else {
+      EXPECT_EQ(layout.max_error, params.quality);
+    }
+
+    // The recorded error holds.
+    ASSERT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+    for (size_t i = 0; i < N; i++) {
+      if (std::isnan(orig[i])) {
+        ASSERT_TRUE(std::isnan(out[i])) << "i = " << i;
+      }
+      else {
+        ASSERT_LE(std::abs(out[i] - orig[i]), layout.max_error) << "i = " << i;
+      }
+    }
+  }
+}
+
+// Relative PWE: fields of very different magnitudes get the same relative accuracy.
+TEST(h5zsperr_codec, roundtrip_relative)
+{
+  auto cd = make_cd_values(0, 2, 1e-3);
+  cd[1] = H5Z_SPERR_make_cd_values(5, 1e-4, 0);
+  auto params = h5zsperr::ChunkParams();
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+  ASSERT_EQ(params.comp_mode, 5);
+  EXPECT_NEAR(params.quality, 1e-4, 1e-8);
+  const size_t N = params.nelem();
+  auto codec = h5zsperr::ChunkCodec<double>();
+  ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+  auto out = std::vector<double>(N);
+
+  for (double scale : {1e-9, 1.0, 1e9}) {
+    auto orig = make_field<double>(N, 0, 0.0);
+    for (auto& v : orig)
+      v = v * scale + 3.0 * scale;
+    for (size_t i = 0; i < N; i += 31)
+      orig[i] = -9.9e35; /* doesn't count towards the range */
+    ASSERT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+    auto stream = std::vector<uint8_t>(codec.encoded_size());
+    codec.copy_encoded(stream.data());
+    auto layout = h5zsperr::ChunkLayout();
+    ASSERT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 64, stream.size(), &layout),
+              H5ZSPERR_OK);
+    EXPECT_EQ(layout.missing_mode, 2);
+    EXPECT_EQ(layout.fill_offset, 9);
+    EXPECT_NEAR(layout.range, 20.0 * scale, 0.01 * scale);
+
+    ASSERT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+    for (size_t i = 0; i < N; i++) {
+      if (i % 31 == 0) {
+        ASSERT_EQ(out[i], orig[i]) << "i = " << i;
+      }
+      else {
+        ASSERT_LE(std::abs(out[i] - orig[i]), 1e-4 * layout.range) << "i = " << i;
+      }
+    }
+  }
+}
+
+// With automatic rank swaps, each chunk is laid out the way its values are smooth.
+TEST(h5zsperr_codec, auto_swap)
+{
+  int mode = 0, swap = 0;
+  double quality = 0.0;
+  auto cd = make_cd_values(1, 1, 1e-3);
+  cd[1] = H5Z_SPERR_make_cd_values(3, 1e-3, H5Z_SPERR_SWAP_AUTO);
+  H5Z_SPERR_decode_cd_values(cd[1], &mode, &quality, &swap);
+  EXPECT_EQ(mode, 3);
+  EXPECT_EQ(swap, H5Z_SPERR_SWAP_AUTO);
+  EXPECT_NEAR(quality, 1e-3, 1e-7);
+  auto params = h5zsperr::ChunkParams();
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+  EXPECT_EQ(params.dims[0], 16); /* not swapped up front */
+  const size_t N = params.nelem();
+  auto codec = h5zsperr::ChunkCodec<float>();
+  ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+  auto out = std::vector<float>(N);
+
+  // A field that is smooth in the C order of the chunk dimensions (16, 20, 24), and another one
+  // that is smooth when the dimensions are taken as they are, i.e., the first one varies fastest.
+  for (bool c_order : {true, false}) {
+    auto orig = std::vector<float>(N);
+    for (size_t i = 0; i < 16; i++)
+      for (size_t j = 0; j < 20; j++)
+        for (size_t k = 0; k < 24; k++) {
+          const float v = float(std::sin(0.2 * double(i)) + std::cos(0.3 * double(j)) + 0.1 * k);
+          orig[c_order ? (i * 20 + j) * 24 + k : (k * 20 + j) * 16 + i] = v;
+        }
+    orig[5] = std::nanf("1");
+    ASSERT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+    auto stream = std::vector<uint8_t>(codec.encoded_size());
+    codec.copy_encoded(stream.data());
+    auto layout = h5zsperr::ChunkLayout();
+    ASSERT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 64, stream.size(), &layout),
+              H5ZSPERR_OK);
+    EXPECT_EQ(layout.swapped, c_order ? 1 : 0);
+    EXPECT_EQ(layout.missing_mode, 1);
+
+    ASSERT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+    EXPECT_TRUE(std::isnan(out[5]));
+    for (size_t i = 0; i < N; i++)
+      if (i != 5) {
+        ASSERT_LE(std::abs(out[i] - orig[i]), 1e-3) << "i = " << i;
+      }
+  }
+}
+
+// Effort presets change how chunks are compressed, but not how they decode.
+TEST(h5zsperr_codec, effort_presets)
+{
+  const unsigned int comp = H5Z_SPERR_make_cd_values(3, 1e-3, H5Z_SPERR_SWAP_AUTO);
+  const size_t chunk_dims[3] = {16, 20, 24};
+  const size_t N = 16 * 20 * 24;
+  auto orig = std::vector<float>(N);
+  for (size_t k = 0; k < 24; k++)
+    for (size_t j = 0; j < 20; j++)
+      for (size_t i = 0; i < 16; i++)
+        orig[(k * 20 + j) * 16 + i] =
+            float(std::sin(0.2 * double(i)) + std::cos(0.3 * double(j)) + 0.1 * k);
+
+  size_t sizes[3] = {0, 0, 0};
+  for (int effort : {H5Z_SPERR_EFFORT_BALANCED, H5Z_SPERR_EFFORT_FAST, H5Z_SPERR_EFFORT_MAX}) {
+    const unsigned int user_cd[2] = {comp, 1u | H5Z_SPERR_make_effort(effort)};
+    unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+    size_t cd_nelmts = 0;
+    ASSERT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, 3, chunk_dims, cd, &cd_nelmts),
+              H5ZSPERR_OK);
+    EXPECT_EQ((cd[0] >> 20) & 3u, unsigned(effort));
+    auto params = h5zsperr::ChunkParams();
+    ASSERT_EQ(h5zsperr::parse_cd_values(cd_nelmts, cd, &params), H5ZSPERR_OK);
+    EXPECT_EQ(params.effort, effort);
+    EXPECT_EQ(params.missing_val_mode, 1);
+
+    auto codec = h5zsperr::ChunkCodec<float>();
+    ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+    ASSERT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+    auto stream = std::vector<uint8_t>(codec.encoded_size());
+    codec.copy_encoded(stream.data());
+    sizes[effort] = stream.size();
+    auto layout = h5zsperr::ChunkLayout();
+    ASSERT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 64, stream.size(), &layout),
+              H5ZSPERR_OK);
+    if (effort == H5Z_SPERR_EFFORT_FAST) {
+      EXPECT_EQ(layout.swapped, 0); /* no analysis, no swap */
+    }
+
+    auto out = std::vector<float>(N);
+    ASSERT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+    for (size_t i = 0; i < N; i++)
+      ASSERT_LE(std::abs(out[i] - orig[i]), 1e-3) << "i = " << i;
+  }
+  EXPECT_LE(sizes[H5Z_SPERR_EFFORT_MAX], sizes[H5Z_SPERR_EFFORT_BALANCED]);
+
+  // There are only three presets.
+  const unsigned int user_cd[2] = {comp, 1u | (3u << EFFORT_SHIFT)};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  EXPECT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, 3, chunk_dims, cd, &cd_nelmts),
+            H5ZSPERR_ERR_CD_VALUES);
+}
+
+// The fast preset only changes how 3D chunks that are long, or swapped automatically, compress.
+TEST(h5zsperr_codec, fast_effort_applies)
+{
+  auto applies = [](int ndims, const size_t* chunk_dims, int swap, size_t subblock) {
+    unsigned int extra = H5Z_SPERR_make_effort(H5Z_SPERR_EFFORT_FAST);
+    if (subblock)
+      extra |= H5Z_SPERR_make_subblocks(subblock);
+    const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, swap), 1u | extra};
+    unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+    size_t cd_nelmts = 0;
+    auto params = h5zsperr::ChunkParams();
+    EXPECT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, ndims, chunk_dims, cd, &cd_nelmts),
+              H5ZSPERR_OK);
+    EXPECT_EQ(h5zsperr::parse_cd_values(cd_nelmts, cd, &params), H5ZSPERR_OK);
+    return h5zsperr::fast_effort_applies(params);
+  };
+  const size_t plane[2] = {256, 256}, cube[3] = {64, 64, 64}, tall[3] = {65, 64, 64};
+  const size_t big[3] = {128, 128, 128};
+  EXPECT_FALSE(applies(2, plane, H5Z_SPERR_SWAP_AUTO, 0));
+  EXPECT_FALSE(applies(3, cube, 0, 0));
+  EXPECT_TRUE(applies(3, cube, H5Z_SPERR_SWAP_AUTO, 0));
+  EXPECT_TRUE(applies(3, tall, 0, 0));
+  EXPECT_TRUE(applies(3, big, 0, 0));
+  EXPECT_FALSE(applies(3, big, H5Z_SPERR_SWAP_AUTO, 32)); /* sub-blocks of 32, and no swaps */
+}
+
+// A double chunk goes through SPERR as floats only when float rounding is well within the PWE.
+TEST(h5zsperr_codec, demotion)
+{
+  auto cd = make_cd_values(0, 0, 1e-3);
+  auto params = h5zsperr::ChunkParams();
+  auto codec = h5zsperr::ChunkCodec<double>();
+  auto orig = make_field<double>(16 * 20 * 24, 0, 0.0);
+  for (auto& v : orig)
+    v += 1e6;
+  const size_t N = orig.size();
+  auto out = std::vector<double>(N);
+
+  for (double pwe : {1e-3, 1.0}) {
+    cd[1] = H5Z_SPERR_make_cd_values(3, pwe, 0);
+    ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+    ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+    ASSERT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+    auto stream = std::vector<uint8_t>(codec.encoded_size());
+    codec.copy_encoded(stream.data());
+    auto layout = h5zsperr::ChunkLayout();
+    ASSERT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 64, stream.size(), &layout),
+              H5ZSPERR_OK);
+    EXPECT_EQ(layout.demoted, pwe > 0.5 ? 1 : 0);
+    EXPECT_EQ(layout.missing_mode, 0);
+    ASSERT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+    for (size_t i = 0; i < N; i++)
+      ASSERT_LE(std::abs(out[i] - orig[i]), pwe) << "i = " << i;
+  }
+
+  // Rounding happens on the way in and on the way out, so it may cost at most 1/16 of the PWE.
+  double mag = 0.0;
+  for (double v : orig)
+    mag = std::max(mag, std::abs(v));
+  const double rounding = mag * std::ldexp(1.0, -24);
+  for (double pwe : {8.5 * rounding, 16.5 * rounding}) {
+    cd[1] = H5Z_SPERR_make_cd_values(3, pwe, 0);
+    ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+    ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+    ASSERT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+    auto stream = std::vector<uint8_t>(codec.encoded_size());
+    codec.copy_encoded(stream.data());
+    auto layout = h5zsperr::ChunkLayout();
+    ASSERT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 64, stream.size(), &layout),
+              H5ZSPERR_OK);
+    EXPECT_EQ(layout.demoted, pwe > 16.0 * rounding ? 1 : 0);
+    ASSERT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+    for (size_t i = 0; i < N; i++)
+      ASSERT_LE(std::abs(out[i] - orig[i]), pwe) << "i = " << i;
+  }
+}
+
+// Tolerance factors tighten or loosen the PWE, and the strictest one decides on demotion.
+TEST(h5zsperr_codec, tolerance_scales)
+{
+  auto cd = make_cd_values(0, 0, 1.0);
+  auto params = h5zsperr::ChunkParams();
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+  auto codec = h5zsperr::ChunkCodec<double>();
+  ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+  auto orig = make_field<double>(16 * 20 * 24, 0, 0.0);
+  for (auto& v : orig)
+    v += 1e6;
+  const size_t N = orig.size();
+  auto out = std::vector<double>(N);
+
+  const float bad[] = {1.0f, 0.0f, -1.0f, NAN};
+  EXPECT_EQ(codec.set_tolerance_scales(bad, 2), H5ZSPERR_ERR_CD_VALUES); /* one per chunk */
+  for (int i = 1; i < 4; i++)
+    EXPECT_EQ(codec.set_tolerance_scales(bad + i, 1), H5ZSPERR_ERR_CD_VALUES);
+
+  for (float scale : {1.0f, 1e-6f}) {
+    ASSERT_EQ(codec.set_tolerance_scales(&scale, 1), H5ZSPERR_OK);
+    ASSERT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+    auto stream = std::vector<uint8_t>(codec.encoded_size());
+    codec.copy_encoded(stream.data());
+    auto layout = h5zsperr::ChunkLayout();
+    ASSERT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 64, stream.size(), &layout),
+              H5ZSPERR_OK);
+    EXPECT_EQ(layout.demoted, scale == 1.0f ? 1 : 0);
+    ASSERT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+    for (size_t i = 0; i < N; i++)
+      ASSERT_LE(std::abs(out[i] - orig[i]), double(scale)) << "i = " << i;
+  }
+
+  // New parameters drop the factors, and modes other than PWE don't take them.
+  cd[1] = H5Z_SPERR_make_cd_values(1, 16.0, 0);
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+  ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+  const float scale = 0.5f;
+  EXPECT_EQ(codec.set_tolerance_scales(&scale, 1), H5ZSPERR_ERR_CD_VALUES);
+  EXPECT_EQ(codec.encode(orig.data(), N), H5ZSPERR_OK);
+}
+
+TEST(h5zsperr_codec, chunk_layout)
+{
+  const auto cd = make_cd_values(0, 2, 1e-3);
+  auto params = h5zsperr::ChunkParams();
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+  const auto orig = make_field<double>(params.nelem(), 13, 1e36);
+  auto codec = h5zsperr::ChunkCodec<double>();
+  ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+  ASSERT_EQ(codec.encode(orig.data(), orig.size()), H5ZSPERR_OK);
+  auto stream = std::vector<uint8_t>(codec.encoded_size());
+  codec.copy_encoded(stream.data());
+
+  // The first 16 bytes tell where everything is.
+  auto layout = h5zsperr::ChunkLayout();
+  ASSERT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 16, stream.size(), &layout),
+            H5ZSPERR_OK);
+  EXPECT_EQ(layout.missing_mode, 2);
+  EXPECT_EQ(layout.fill_offset, 1);
+  EXPECT_EQ(layout.fill_bytes, 8);
+  EXPECT_EQ(layout.mask_offset, 9);
+  EXPECT_GT(layout.mask_bytes, 0);
+  EXPECT_EQ(layout.sperr_offset, layout.mask_offset + layout.mask_bytes);
+  EXPECT_EQ(layout.sperr_offset + layout.sperr_bytes, stream.size());
+
+  // A chunk too short to hold its bitmask.
+  EXPECT_EQ(h5zsperr::parse_chunk_layout(params, stream.data(), 16, layout.sperr_offset - 1,
+                                         &layout),
+            H5ZSPERR_ERR_CORRUPT);
+}
+
+TEST(h5zsperr_codec, c_wrappers)
+{
+  const auto cd = make_cd_values(1, 1, 1e-3);
+  const size_t N = 16 * 20 * 24;
+  ASSERT_EQ(C_API::h5zsperr_chunk_raw_bytes(cd.size(), cd.data()), N * 4);
+
+  auto buf = make_field<float>(N, 11, std::nanf("1"));
+  size_t len = 0;
+  EXPECT_EQ(C_API::h5zsperr_chunk_encode(cd.size(), cd.data(), buf.data(), N, &len),
+            H5ZSPERR_ERR_SIZE);
+  ASSERT_EQ(C_API::h5zsperr_chunk_encode(cd.size(), cd.data(), buf.data(), N * 4, &len),
+            H5ZSPERR_OK);
+
+  // Decode in place, as the filter does when the buffer is big enough.
+  auto mem = std::vector<uint8_t>(N * 4);
+  C_API::h5zsperr_chunk_copy_encoded(mem.data());
+  ASSERT_EQ(C_API::h5zsperr_chunk_decode(cd.size(), cd.data(), mem.data(), len, mem.data(), N * 4),
+            H5ZSPERR_OK);
+  const float* out = reinterpret_cast<const float*>(mem.data());
+  for (size_t i = 0; i < N; i++)
+    EXPECT_EQ(std::isnan(out[i]), i % 11 == 0);
+}
+
+TEST(h5zsperr_codec, constant_chunks)
+{
+  const auto cd = make_cd_values(1, 1, 1e-3);
+  const auto cd2 = make_cd_values(1, 1, 1e-1);
+  const size_t N = 16 * 20 * 24;
+  auto encode = [&](const std::vector<unsigned int>& c, std::vector<float> buf) {
+    size_t len = 0;
+    EXPECT_EQ(C_API::h5zsperr_chunk_encode(c.size(), c.data(), buf.data(), N * 4, &len),
+              H5ZSPERR_OK);
+    auto out = std::vector<uint8_t>(len);
+    C_API::h5zsperr_chunk_copy_encoded(out.data());
+    return out;
+  };
+  auto decode = [&](const std::vector<unsigned int>& c, const std::vector<uint8_t>& enc) {
+    auto out = std::vector<float>(N);
+    EXPECT_EQ(C_API::h5zsperr_chunk_decode(c.size(), c.data(), enc.data(), enc.size(),
+                                           out.data(), N * 4),
+              H5ZSPERR_OK);
+    return out;
+  };
+  auto near = [&](const std::vector<float>& a, const std::vector<float>& b) {
+    for (size_t i = 0; i < N; i++)
+      if (std::abs(a[i] - b[i]) > 1e-3f)
+        return false;
+    return true;
+  };
+
+  // The same constant chunk encodes to the same bytes, whether or not it was the latest one.
+  const auto fill = encode(cd, std::vector<float>(N, 7.5f));
+  EXPECT_EQ(encode(cd, std::vector<float>(N, 7.5f)), fill);
+  EXPECT_TRUE(near(decode(cd, fill), std::vector<float>(N, 7.5f)));
+
+  // A different value, different parameters, or a varying chunk is encoded on its own.
+  const auto other = encode(cd, std::vector<float>(N, -2.f));
+  EXPECT_NE(other, fill);
+  EXPECT_TRUE(near(decode(cd, other), std::vector<float>(N, -2.f)));
+  const auto coarse = encode(cd2, std::vector<float>(N, 7.5f));
+  EXPECT_TRUE(near(decode(cd2, coarse), std::vector<float>(N, 7.5f)));
+  const auto field = make_field<float>(N, 0, 0.f);
+  EXPECT_TRUE(near(decode(cd, encode(cd, field)), field));
+  EXPECT_EQ(encode(cd, std::vector<float>(N, 7.5f)), fill);
+}
+
+}  // namespace
@@ -0,0 +1,209 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "h5zsperr_kernels.h"
+
+namespace {
+
+using h5zsperr::missing_kind;
+using h5zsperr::simd_isa;
+
+// Make an array where about `1 / every` of the values are missing values of `kind`.
+template <typename T>
+std::vector<T> make_field(size_t N, missing_kind kind, T val, int every)
+{
+  auto gen = std::mt19937(17);
+  auto dist = std::uniform_real_distribution<T>(-100.0, 100.0);
+  auto vec = std::vector<T>(N);
+  for (size_t i = 0; i < N; i++) {
+    if (gen() % every == 0)
+      vec[i] = (kind == missing_kind::nan) ? std::nan("1") : val;
+    else
+      vec[i] = dist(gen);
+  }
+  return vec;
+}
+
+template <typename T>
+void compare_isa(simd_isa isa)
+{
+  const T sentinel = -999.0;
+  const T mag = T(1e35);
+  const auto tests = std::vector<h5zsperr::missing_test<T>>{
+      {missing_kind::nan, T{0}}, {missing_kind::large_mag, mag}, {missing_kind::equal, sentinel}};
+
+  for (auto t : tests) {
+    const T val = (t.kind == missing_kind::large_mag) ? T(-3e35) : sentinel;
+    for (size_t N : {1ul, 7ul, 63ul, 64ul, 65ul, 200ul, 1000ul, 4099ul}) {
+      for (int every : {3, 50, 100000}) {
+        const auto field = make_field<T>(N, t.kind, val, every);
+
+        h5zsperr::simd_select(simd_isa::scalar);
+        const auto find0 = h5zsperr::kernel_find(field.data(), N, t);
+        auto bits0 = std::vector<uint64_t>((N + 63) / 64);
+        const auto cnt0 = h5zsperr::kernel_make_bits(field.data(), N, t, bits0.data());
+        size_t valid0 = 0;
+        const auto sum0 = h5zsperr::kernel_sum_valid(field.data(), N, t, &valid0);
+        auto rep0 = field;
+        h5zsperr::kernel_replace(rep0.data(), N, t, T(1.5));
+        auto fill0 = std::vector<T>(N, T(2.0));
+        h5zsperr::kernel_fill_bits(fill0.data(), N, bits0.data(), T(3.0));
+
+        h5zsperr::simd_select(isa);
+        EXPECT_EQ(h5zsperr::kernel_find(field.data(), N, t), find0) << "N = " << N;
+        auto bits1 = std::vector<uint64_t>((N + 63) / 64);
+        EXPECT_EQ(h5zsperr::kernel_make_bits(field.data(), N, t, bits1.data()), cnt0);
+        EXPECT_EQ(bits1, bits0) << "N = " << N;
+        size_t valid1 = 0;
+        const auto sum1 = h5zsperr::kernel_sum_valid(field.data(), N, t, &valid1);
+        EXPECT_EQ(valid1, valid0);
+        EXPECT_NEAR(sum1, sum0, 1e-9 * N * 100.0);
+        auto rep1 = field;
+        h5zsperr::kernel_replace(rep1.data(), N, t, T(1.5));
+        for (size_t i = 0; i < N; i++)
+          ASSERT_TRUE(rep1[i] == rep0[i] || (std::isnan(rep1[i]) && std::isnan(rep0[i])));
+        auto fill1 = std::vector<T>(N, T(2.0));
+        h5zsperr::kernel_fill_bits(fill1.data(), N, bits1.data(), T(3.0));
+        EXPECT_EQ(fill1, fill0);
+
+        // The range of a field whose missing values are replaced.
+        T lo0 = 0, hi0 = 0, lo1 = 0, hi1 = 0;
+        h5zsperr::simd_select(simd_isa::scalar);
+        h5zsperr::kernel_minmax(rep0.data(), N, &lo0, &hi0);
+        EXPECT_EQ(lo0, *std::min_element(rep0.begin(), rep0.end()));
+        EXPECT_EQ(hi0, *std::max_element(rep0.begin(), rep0.end()));
+        h5zsperr::simd_select(isa);
+        h5zsperr::kernel_minmax(rep0.data(), N, &lo1, &hi1);
+        EXPECT_EQ(lo1, lo0) << "N = " << N;
+        EXPECT_EQ(hi1, hi0) << "N = " << N;
+      }
+    }
+  }
+
+  // All tests at once, on a field that mixes all kinds of missing values.
+  for (size_t N : {1ul, 63ul, 64ul, 65ul, 1000ul, 4099ul}) {
+    auto field = make_field<T>(N, missing_kind::nan, T{0}, 5);
+    for (size_t i = 0; i < N; i += 7)
+      field[i] = (i % 2) ? sentinel : T(-3e35);
+    h5zsperr::simd_select(simd_isa::scalar);
+    auto bits0 = std::vector<uint64_t>((N + 63) / 64);
+    const auto cnt0 = h5zsperr::kernel_make_bits_multi(field.data(), N, tests.data(), tests.size(),
+                                                       bits0.data());
+    for (size_t i = 0; i < N; i++)
+      ASSERT_EQ((bits0[i / 64] >> (i % 64)) & 1,
+                std::isnan(field[i]) || std::abs(field[i]) >= mag || field[i] == sentinel);
+    h5zsperr::simd_select(isa);
+    auto bits1 = std::vector<uint64_t>((N + 63) / 64);
+    EXPECT_EQ(h5zsperr::kernel_make_bits_multi(field.data(), N, tests.data(), tests.size(),
+                                               bits1.data()),
+              cnt0);
+    EXPECT_EQ(bits1, bits0) << "N = " << N;
+  }
+  h5zsperr::simd_select(simd_isa::avx512);
+}
+
+TEST(h5zsperr_kernels, isa_selection)
+{
+  const auto best = h5zsperr::simd_supported();
+  EXPECT_EQ(h5zsperr::simd_select(simd_isa::scalar), simd_isa::scalar);
+  EXPECT_EQ(h5zsperr::simd_active(), simd_isa::scalar);
+  EXPECT_EQ(h5zsperr::simd_select(simd_isa::avx512), best);
+  EXPECT_EQ(h5zsperr::simd_active(), best);
+}
+
+TEST(h5zsperr_kernels, avx2_matches_scalar)
+{
+  if (int(h5zsperr::simd_supported()) < int(simd_isa::avx2))
+    GTEST_SKIP() << "AVX2 not supported on this CPU";
+  compare_isa<float>(simd_isa::avx2);
+  compare_isa<double>(simd_isa::avx2);
+}
+
+TEST(h5zsperr_kernels, avx512_matches_scalar)
+{
+  if (h5zsperr::simd_supported() != simd_isa::avx512)
+    GTEST_SKIP() << "AVX-512 not supported on this CPU";
+  compare_isa<float>(simd_isa::avx512);
+  compare_isa<double>(simd_isa::avx512);
+}
+
+//
+// Conversions of 16-bit values: every half-precision value goes to float and back unchanged,
+// integers round and saturate, and all instruction sets agree bit for bit.
+//
+TEST(h5zsperr_kernels, narrow_types)
+{
+  using h5zsperr::narrow_type;
+  auto halfs = std::vector<uint16_t>(65536);
+  for (size_t i = 0; i < halfs.size(); i++)
+    halfs[i] = uint16_t(i);
+  auto floats = std::vector<float>(halfs.size());
+  auto back = std::vector<uint16_t>(halfs.size());
+
+  h5zsperr::simd_select(simd_isa::scalar);
+  h5zsperr::kernel_widen(halfs.data(), halfs.size(), narrow_type::float16, floats.data());
+  h5zsperr::kernel_narrow(floats.data(), floats.size(), narrow_type::float16, back.data());
+  for (size_t i = 0; i < halfs.size(); i++) {
+    const bool nan = (i & 0x7c00u) == 0x7c00u && (i & 0x3ffu) != 0;
+    ASSERT_EQ(std::isnan(floats[i]), nan) << i;
+    ASSERT_EQ(back[i], nan ? (halfs[i] | 0x200u) : halfs[i]) << i; // NaNs come back quiet
+  }
+  EXPECT_EQ(floats[0x3c00], 1.f);
+  EXPECT_EQ(floats[0xc000], -2.f);
+  EXPECT_EQ(floats[0x7bff], 65504.f);
+  EXPECT_EQ(floats[0x0001], std::ldexp(1.f, -24));
+
+  // Rounding and saturation.
+  const auto specials = std::vector<float>{0.5f,   1.5f,    2.5f,  -0.5f, -1.5f,   32767.4f,
+                                           40000.f, -40000.f, 65535.6f, 1e30f, -1e30f, 65519.f,
+                                           65520.f, std::ldexp(1.f, -25), std::nanf("1"), 2049.f};
+  auto i16 = std::vector<int16_t>(specials.size());
+  auto u16 = std::vector<uint16_t>(specials.size());
+  auto f16 = std::vector<uint16_t>(specials.size());
+  h5zsperr::kernel_narrow(specials.data(), specials.size(), narrow_type::int16, i16.data());
+  h5zsperr::kernel_narrow(specials.data(), specials.size(), narrow_type::uint16, u16.data());
+  h5zsperr::kernel_narrow(specials.data(), specials.size(), narrow_type::float16, f16.data());
+  EXPECT_EQ(i16, (std::vector<int16_t>{0, 2, 2, 0, -2, 32767, 32767, -32768, 32767, 32767, -32768,
+                                       32767, 32767, 0, -32768, 2049}));
+  EXPECT_EQ(u16, (std::vector<uint16_t>{0, 2, 2, 0, 0, 32767, 40000, 0, 65535, 65535, 0, 65519,
+                                        65520, 0, 0, 2049}));
+  EXPECT_EQ(f16[11], 0x7bffu); // 65519 rounds down to 65504
+  EXPECT_EQ(f16[12], 0x7c00u); // 65520 rounds up to infinity
+  EXPECT_EQ(f16[13], 0x0000u); // 2^-25 ties to even, i.e., zero
+  EXPECT_EQ(f16[15], 0x6800u); // 2049 ties to even, i.e., 2048
+
+  const auto best = h5zsperr::simd_supported();
+  if (best != simd_isa::scalar) {
+    // Random bit patterns and the special values, at lengths that leave remainders.
+    auto gen = std::mt19937(5);
+    auto bits = std::vector<uint32_t>(4099);
+    for (auto& b : bits)
+      b = uint32_t(gen());
+    auto rnd = std::vector<float>(bits.size());
+    std::memcpy(rnd.data(), bits.data(), bits.size() * sizeof(float));
+    for (size_t i = 0; i < rnd.size(); i += 3)
+      rnd[i] = float(int32_t(gen() % 140000) - 70000) * 0.37f;
+    std::copy(specials.begin(), specials.end(), rnd.begin() + 100);
+
+    for (auto type : {narrow_type::int16, narrow_type::uint16, narrow_type::float16}) {
+      auto out0 = std::vector<uint16_t>(rnd.size()), out1 = out0;
+      auto wide0 = std::vector<float>(halfs.size()), wide1 = wide0;
+      h5zsperr::simd_select(simd_isa::scalar);
+      h5zsperr::kernel_narrow(rnd.data(), rnd.size(), type, out0.data());
+      h5zsperr::kernel_widen(halfs.data(), halfs.size() - 3, type, wide0.data());
+      h5zsperr::simd_select(best);
+      h5zsperr::kernel_narrow(rnd.data(), rnd.size(), type, out1.data());
+      h5zsperr::kernel_widen(halfs.data(), halfs.size() - 3, type, wide1.data());
+      EXPECT_EQ(out1, out0) << int(type);
+      EXPECT_EQ(std::memcmp(wide1.data(), wide0.data(), wide0.size() * sizeof(float)), 0);
+    }
+  }
+  h5zsperr::simd_select(simd_isa::avx512);
+}
+
+}  // namespace
@@ -0,0 +1,153 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "h5z-sperr.h"
+#include "h5zsperr_codec.h"
+#include "h5zsperr_mask_cache.h"
+
+namespace {
+
+auto make_runs(std::initializer_list<h5zsperr::MaskRun> list)
+{
+  return std::make_shared<const h5zsperr::MaskRuns>(list);
+}
+
+TEST(h5zsperr_mask_cache, bits_to_runs)
+{
+  const size_t N = 300;
+  auto bits = std::vector<uint64_t>((N + 63) / 64, 0);
+  auto set = [&bits](size_t i) { bits[i / 64] |= uint64_t{1} << (i % 64); };
+  set(0);
+  for (size_t i = 60; i < 200; i++)  // across three words, including a full one
+    set(i);
+  set(255);
+  set(299);
+
+  auto runs = h5zsperr::MaskRuns();
+  h5zsperr::mask_bits_to_runs(bits.data(), N, &runs);
+  ASSERT_EQ(runs.size(), 4ul);
+  EXPECT_EQ(runs[0].start, 0u);
+  EXPECT_EQ(runs[0].len, 1u);
+  EXPECT_EQ(runs[1].start, 60u);
+  EXPECT_EQ(runs[1].len, 140u);
+  EXPECT_EQ(runs[2].start, 255u);
+  EXPECT_EQ(runs[2].len, 1u);
+  EXPECT_EQ(runs[3].start, 299u);
+  EXPECT_EQ(runs[3].len, 1u);
+
+  // All missing, and none missing.
+  std::fill(bits.begin(), bits.end(), 0);
+  for (size_t i = 0; i < N; i++)
+    set(i);
+  h5zsperr::mask_bits_to_runs(bits.data(), N, &runs);
+  ASSERT_EQ(runs.size(), 1ul);
+  EXPECT_EQ(runs[0].len, N);
+  std::fill(bits.begin(), bits.end(), 0);
+  h5zsperr::mask_bits_to_runs(bits.data(), N, &runs);
+  EXPECT_TRUE(runs.empty());
+}
+
+TEST(h5zsperr_mask_cache, lru)
+{
+  const uint8_t mask_a[5] = {1, 2, 3, 4, 5};
+  const uint8_t mask_b[5] = {1, 2, 3, 4, 6};
+  const uint8_t mask_c[9] = {9, 8, 7, 6, 5, 4, 3, 2, 1};
+
+  h5zsperr::MaskCache probe(1 << 20);
+  probe.insert(mask_a, sizeof(mask_a), 100, make_runs({{0, 1}}));
+  const size_t entry_bytes = probe.stats().bytes;
+
+  // Room for two entries only.
+  h5zsperr::MaskCache cache(entry_bytes * 2 + 8);
+  EXPECT_EQ(cache.find(mask_a, sizeof(mask_a), 100), nullptr);
+  cache.insert(mask_a, sizeof(mask_a), 100, make_runs({{0, 1}}));
+  cache.insert(mask_b, sizeof(mask_b), 100, make_runs({{5, 2}}));
+  auto hit = cache.find(mask_a, sizeof(mask_a), 100);
+  ASSERT_NE(hit, nullptr);
+  EXPECT_EQ((*hit)[0].start, 0u);
+
+  // The same bytes covering a different number of values are a different mask.
+  EXPECT_EQ(cache.find(mask_a, sizeof(mask_a), 200), nullptr);
+
+  // `mask_b` is the least recently used, so it goes first.
+  cache.insert(mask_c, sizeof(mask_c), 100, make_runs({{7, 3}}));
+  EXPECT_EQ(cache.find(mask_b, sizeof(mask_b), 100), nullptr);
+  EXPECT_NE(cache.find(mask_a, sizeof(mask_a), 100), nullptr);
+  EXPECT_NE(cache.find(mask_c, sizeof(mask_c), 100), nullptr);
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 3ul);
+  EXPECT_EQ(stats.misses, 3ul);
+  EXPECT_EQ(stats.entries, 2ul);
+  EXPECT_LE(stats.bytes, cache.capacity());
+
+  // Shrinking evicts, and a capacity of 0 disables the cache.
+  cache.set_capacity(entry_bytes + 8);
+  EXPECT_EQ(cache.stats().entries, 1ul);
+  cache.set_capacity(0);
+  EXPECT_EQ(cache.stats().entries, 0ul);
+  cache.insert(mask_a, sizeof(mask_a), 100, make_runs({{0, 1}}));
+  EXPECT_EQ(cache.find(mask_a, sizeof(mask_a), 100), nullptr);
+
+  // The cached runs stay valid after they are evicted.
+  cache.set_capacity(1 << 20);
+  cache.insert(mask_a, sizeof(mask_a), 100, make_runs({{0, 1}}));
+  hit = cache.find(mask_a, sizeof(mask_a), 100);
+  cache.clear();
+  EXPECT_EQ(cache.stats().entries, 0ul);
+  EXPECT_EQ((*hit)[0].len, 1u);
+}
+
+// Chunks of a time series share a mask; decoding them takes the cached runs.
+TEST(h5zsperr_mask_cache, codec_time_series)
+{
+  auto cd = std::vector<unsigned int>(5);
+  cd[0] = C_API::h5zsperr_pack_extra_info(3, 1, 1, H5ZSPERR_COMPATIBILITY);
+  cd[1] = H5Z_SPERR_make_cd_values(3, 1e-3, 0);
+  cd[2] = 16;
+  cd[3] = 20;
+  cd[4] = 24;
+  auto params = h5zsperr::ChunkParams();
+  ASSERT_EQ(h5zsperr::parse_cd_values(cd.size(), cd.data(), &params), H5ZSPERR_OK);
+  const size_t N = params.nelem();
+
+  auto& cache = h5zsperr::mask_cache();
+  cache.set_capacity(1 << 20);
+  cache.clear();
+
+  auto codec = h5zsperr::ChunkCodec<float>();
+  ASSERT_EQ(codec.set_params(params), H5ZSPERR_OK);
+  auto out = std::vector<float>(N);
+  for (int step = 0; step < 3; step++) {
+    auto field = std::vector<float>(N);
+    for (size_t i = 0; i < N; i++) {
+      const bool land = (i % 100) < 30 || i % 7 == 0;
+      field[i] = land ? std::nanf("") : float(std::sin(double(i) * 0.01 + step) * 10.0);
+    }
+    ASSERT_EQ(codec.encode(field.data(), N), H5ZSPERR_OK);
+    auto stream = std::vector<uint8_t>(codec.encoded_size());
+    codec.copy_encoded(stream.data());
+    ASSERT_EQ(codec.decode(stream.data(), stream.size(), out.data(), N), H5ZSPERR_OK);
+    for (size_t i = 0; i < N; i++) {
+      if (std::isnan(field[i])) {
+        ASSERT_TRUE(std::isnan(out[i]));
+      }
+      else {
+        ASSERT_LE(std::abs(out[i] - field[i]), 1e-3);
+      }
+    }
+  }
+
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.misses, 1ul);
+  EXPECT_EQ(stats.hits, 2ul);
+  EXPECT_EQ(stats.entries, 1ul);
+  cache.clear();
+}
+
+}  // namespace
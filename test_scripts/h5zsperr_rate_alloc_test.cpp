@@ -0,0 +1,95 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <vector>
+
+#include "h5z-sperr-chunk.h"
+#include "h5z-sperr.h"
+#include "h5zsperr_rate_alloc.h"
+
+namespace {
+
+using h5zsperr::RatePoint;
+
+// A smooth chunk that costs little to get right, and a busy one, at three rates each.
+const RatePoint points[2 * 3] = {{10, 100.0}, {20, 1.0},   {40, 0.01},
+                                 {10, 1000.0}, {20, 100.0}, {40, 1.0}};
+
+TEST(h5zsperr_rate_alloc, allocate)
+{
+  size_t picks[2] = {9, 9};
+  double sse = 0.0;
+
+  // The smallest pair within the budget spends the same on both chunks.
+  ASSERT_TRUE(h5zsperr::allocate_rates(points, 2, 3, 110.0, picks, &sse));
+  EXPECT_EQ(picks[0], 1ul);
+  EXPECT_EQ(picks[1], 1ul);
+  EXPECT_EQ(sse, 101.0);
+
+  // A loose budget takes the smallest points, and a tight one the busy chunk's best.
+  ASSERT_TRUE(h5zsperr::allocate_rates(points, 2, 3, 2000.0, picks, &sse));
+  EXPECT_EQ(picks[0], 0ul);
+  EXPECT_EQ(picks[1], 0ul);
+  ASSERT_TRUE(h5zsperr::allocate_rates(points, 2, 3, 2.0, picks, &sse));
+  EXPECT_EQ(picks[0], 1ul);
+  EXPECT_EQ(picks[1], 2ul);
+  EXPECT_EQ(sse, 2.0);
+
+  // A budget that nothing meets picks the most accurate points, and says so.
+  EXPECT_FALSE(h5zsperr::allocate_rates(points, 2, 3, 0.5, picks, &sse));
+  EXPECT_EQ(picks[0], 2ul);
+  EXPECT_EQ(picks[1], 2ul);
+  EXPECT_NEAR(sse, 1.01, 1e-12);
+
+  // A budget that only the most accurate points meet, even for errors too small to weigh.
+  ASSERT_TRUE(h5zsperr::allocate_rates(points, 2, 3, 0.01 + 1.0, picks, &sse));
+  EXPECT_EQ(picks[0], 2ul);
+  EXPECT_EQ(picks[1], 2ul);
+  EXPECT_FALSE(std::isnan(sse));
+  const RatePoint tiny[2] = {{10, 2e-305}, {20, 1e-305}};
+  ASSERT_TRUE(h5zsperr::allocate_rates(tiny, 1, 2, 1e-305, picks, &sse));
+  EXPECT_EQ(picks[0], 1ul);
+  EXPECT_EQ(sse, 1e-305);
+}
+
+TEST(h5zsperr_rate_alloc, trial_encode)
+{
+  const size_t NX = 16, NY = 20, NZ = 24;
+  auto vals = std::vector<float>(NX * NY * NZ);
+  size_t nvalid = 0;
+  for (size_t i = 0; i < vals.size(); i++) {
+    vals[i] = (i % 37 == 0) ? NAN : float(std::sin(0.05 * double(i)) * 3.0);
+    nvalid += std::isnan(vals[i]) ? 0 : 1;
+  }
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(2, 80.0, 0), 1};
+  const size_t chunk_dims[3] = {NX, NY, NZ};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, 3, chunk_dims, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+
+  const auto rates = h5zsperr::trial_bitrates(true);
+  auto words = std::vector<unsigned int>();
+  for (double r : rates)
+    words.push_back(H5Z_SPERR_make_cd_values(1, r, 0));
+  auto trials = std::vector<RatePoint>(rates.size());
+  auto stats = h5zsperr::ValueStats();
+  ASSERT_EQ(h5zsperr::trial_encode(cd_nelmts, cd, vals.data(), vals.size() * 4, words.data(),
+                                   words.size(), trials.data(), &stats),
+            H5ZSPERR_OK);
+  EXPECT_EQ(stats.nvalid, nvalid);
+  EXPECT_NEAR(stats.lo, -3.0, 1e-3);
+  EXPECT_NEAR(stats.hi, 3.0, 1e-3);
+  for (size_t r = 1; r < rates.size(); r++) {
+    EXPECT_GE(trials[r].bytes, trials[r - 1].bytes) << "rate " << rates[r];
+    EXPECT_LE(trials[r].sse, trials[r - 1].sse) << "rate " << rates[r];
+  }
+  EXPECT_LT(trials.back().sse, trials.front().sse);
+
+  // The chunk has to be the size that cd_values[] describe.
+  EXPECT_EQ(h5zsperr::trial_encode(cd_nelmts, cd, vals.data(), vals.size() * 2, words.data(),
+                                   words.size(), trials.data(), &stats),
+            H5ZSPERR_ERR_SIZE);
+}
+
+}  // namespace
@@ -0,0 +1,530 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <H5PLextern.h>
+#include <hdf5.h>
+
+#include "h5z-sperr-chunk.h"
+#include "h5z-sperr-region.h"
+#include "h5z-sperr.h"
+
+namespace {
+
+const size_t NX = 32, NY = 24, NZ = 20; // chunk dimensions, in the HDF5 (C) order
+
+template <typename T>
+std::vector<T> make_chunk(size_t idx)
+{
+  auto vec = std::vector<T>(NX * NY * NZ);
+  for (size_t x = 0; x < NX; x++)
+    for (size_t y = 0; y < NY; y++)
+      for (size_t z = 0; z < NZ; z++)
+        vec[(x * NY + y) * NZ + z] =
+            T(std::sin(0.1 * double(x + idx)) * 5.0 + std::cos(0.2 * double(y)) + 0.05 * z);
+  for (size_t i = idx; i < vec.size(); i += 41)
+    vec[i] = T(NAN);
+  return vec;
+}
+
+// Produce cd_values[] for a chunk as the filter does, given the user cd_values[].
+std::vector<unsigned int> chunk_cd(unsigned int comp, unsigned int missing, int is_float)
+{
+  const unsigned int user_cd[2] = {comp, missing};
+  const size_t chunk_dims[3] = {NX, NY, NZ};
+  auto cd = std::vector<unsigned int>(H5Z_SPERR_MAX_CD_VALUES);
+  size_t cd_nelmts = 0;
+  EXPECT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, is_float, 3, chunk_dims, cd.data(),
+                                             &cd_nelmts),
+            H5ZSPERR_OK);
+  cd.resize(cd_nelmts);
+  return cd;
+}
+
+size_t count_events(const char* name)
+{
+  const char* fname = "h5zsperr_region_trace.json";
+  EXPECT_EQ(C_API::H5Z_SPERR_trace_dump(fname), 0);
+  auto in = std::ifstream(fname);
+  auto ss = std::stringstream();
+  ss << in.rdbuf();
+  in.close();
+  std::remove(fname);
+  const auto json = ss.str();
+  const auto sub = std::string("\"name\":\"") + name + "\"";
+  size_t n = 0;
+  for (auto pos = json.find(sub); pos != std::string::npos; pos = json.find(sub, pos + 1))
+    n++;
+  return n;
+}
+
+// A region of a chunk decodes to the same values as the whole chunk, with or without sub-blocks.
+template <typename T>
+void region_matches_full(unsigned int comp, unsigned int subblocks, double tol)
+{
+  const auto cd = chunk_cd(comp, 1 | subblocks, sizeof(T) == 4);
+  const auto orig = make_chunk<T>(3);
+  void* enc = NULL;
+  size_t enc_len = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_encode_chunk(cd.size(), cd.data(), orig.data(),
+                                          orig.size() * sizeof(T), &enc, &enc_len),
+            H5ZSPERR_OK);
+  void* dec = NULL;
+  size_t dec_len = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk(cd.size(), cd.data(), enc, enc_len, &dec, &dec_len),
+            H5ZSPERR_OK);
+  ASSERT_EQ(dec_len, orig.size() * sizeof(T));
+  const T* full = static_cast<const T*>(dec);
+  for (size_t i = 0; i < orig.size(); i++) {
+    if (std::isnan(orig[i])) {
+      ASSERT_TRUE(std::isnan(full[i])) << "i = " << i;
+    }
+    else {
+      ASSERT_LE(std::abs(full[i] - orig[i]), tol) << "i = " << i;
+    }
+  }
+
+  const size_t regions[][6] = {
+      {0, 0, 0, NX, NY, NZ}, {5, 3, 7, 1, 1, 1}, {0, 9, 4, NX, 1, 1}, {7, 2, 15, 19, 17, 5}};
+  for (const auto& r : regions) {
+    auto out = std::vector<T>(r[3] * r[4] * r[5]);
+    ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk_region(cd.size(), cd.data(), enc, enc_len, r, r + 3,
+                                                   out.data()),
+              H5ZSPERR_OK);
+    size_t idx = 0;
+    for (size_t x = r[0]; x < r[0] + r[3]; x++)
+      for (size_t y = r[1]; y < r[1] + r[4]; y++)
+        for (size_t z = r[2]; z < r[2] + r[5]; z++, idx++) {
+          const T v = full[(x * NY + y) * NZ + z];
+          if (std::isnan(v)) {
+            ASSERT_TRUE(std::isnan(out[idx]));
+          }
+          else {
+            ASSERT_EQ(out[idx], v) << x << ", " << y << ", " << z;
+          }
+        }
+  }
+
+  // Regions reaching outside the chunk are rejected.
+  const size_t start[3] = {NX - 1, 0, 0}, count[3] = {2, 1, 1};
+  auto out = std::vector<T>(2);
+  EXPECT_EQ(C_API::H5Z_SPERR_decode_chunk_region(cd.size(), cd.data(), enc, enc_len, start, count,
+                                                 out.data()),
+            H5ZSPERR_ERR_SIZE);
+  std::free(enc);
+  std::free(dec);
+}
+
+TEST(h5zsperr_region, subblock_cd_values)
+{
+  EXPECT_EQ(H5Z_SPERR_make_subblocks(8), 3u << SUBBLOCK_SHIFT);
+  EXPECT_EQ(H5Z_SPERR_make_subblocks(1024), 10u << SUBBLOCK_SHIFT);
+
+  // The request doesn't disturb the missing value mode, and lands in cd_values[0].
+  const auto plain = chunk_cd(H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1, 1);
+  const auto cd =
+      chunk_cd(H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1 | H5Z_SPERR_make_subblocks(16), 1);
+  ASSERT_EQ(cd.size(), plain.size());
+  EXPECT_EQ(cd[0], plain[0] | (4u << 16));
+  for (size_t i = 1; i < cd.size(); i++)
+    EXPECT_EQ(cd[i], plain[i]);
+
+  // Edge lengths that aren't a power of 2 in [8, 1024] are rejected.
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1u | (2u << 8)};
+  const size_t chunk_dims[3] = {NX, NY, NZ};
+  unsigned int out[H5Z_SPERR_MAX_CD_VALUES];
+  size_t nelmts = 0;
+  EXPECT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, 3, chunk_dims, out, &nelmts),
+            H5ZSPERR_ERR_CD_VALUES);
+}
+
+TEST(h5zsperr_region, region_float)
+{
+  const auto pwe = H5Z_SPERR_make_cd_values(3, 1e-3, 0);
+  region_matches_full<float>(pwe, 0, 1e-3);
+  region_matches_full<float>(pwe, H5Z_SPERR_make_subblocks(8), 1e-3);
+  region_matches_full<float>(H5Z_SPERR_make_cd_values(3, 1e-3, 1), H5Z_SPERR_make_subblocks(16),
+                             1e-3);
+  region_matches_full<float>(H5Z_SPERR_make_cd_values(5, 1e-4, 0), H5Z_SPERR_make_subblocks(8),
+                             1e-4 * 15.0);
+}
+
+TEST(h5zsperr_region, region_double)
+{
+  region_matches_full<double>(H5Z_SPERR_make_cd_values(3, 1e-9, 0), H5Z_SPERR_make_subblocks(8),
+                              1e-9);
+  region_matches_full<double>(H5Z_SPERR_make_cd_values(3, 1e-2, 0), H5Z_SPERR_make_subblocks(8),
+                              1e-2); /* goes through SPERR as floats */
+  region_matches_full<double>(H5Z_SPERR_make_cd_values(3, 1e-9, 0), 0, 1e-9);
+}
+
+// Only the sub-blocks that a region overlaps are decompressed.
+TEST(h5zsperr_region, decodes_overlapping_subblocks)
+{
+  const auto cd =
+      chunk_cd(H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1 | H5Z_SPERR_make_subblocks(8), 1);
+  const auto orig = make_chunk<float>(0);
+  void* enc = NULL;
+  size_t enc_len = 0;
+  C_API::H5Z_SPERR_trace_start(4096);
+  ASSERT_EQ(C_API::H5Z_SPERR_encode_chunk(cd.size(), cd.data(), orig.data(), orig.size() * 4,
+                                          &enc, &enc_len),
+            H5ZSPERR_OK);
+  C_API::H5Z_SPERR_trace_stop();
+  EXPECT_EQ(count_events("sperr_encode"), 4ul * 3 * 2); /* 32 / 8, 24 / 8, 20 / 8 */
+
+  // A time series along the slowest axis touches one sub-block of the other two axes.
+  const size_t start[3] = {0, 9, 4}, count[3] = {NX, 1, 1};
+  auto out = std::vector<float>(NX);
+  C_API::H5Z_SPERR_trace_start(4096);
+  ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk_region(cd.size(), cd.data(), enc, enc_len, start, count,
+                                                 out.data()),
+            H5ZSPERR_OK);
+  C_API::H5Z_SPERR_trace_stop();
+  EXPECT_EQ(count_events("sperr_decode"), 4ul);
+  for (size_t x = 0; x < NX; x++) {
+    const float v = orig[(x * NY + 9) * NZ + 4];
+    if (std::isnan(v)) {
+      EXPECT_TRUE(std::isnan(out[x]));
+    }
+    else {
+      EXPECT_NEAR(out[x], v, 1e-3);
+    }
+  }
+  std::free(enc);
+}
+
+// A tolerance map keeps the sub-blocks that it marks more accurately, and the others less so.
+TEST(h5zsperr_region, quality_map_chunk)
+{
+  const auto cd =
+      chunk_cd(H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1 | H5Z_SPERR_make_subblocks(8), 1);
+  const auto orig = make_chunk<float>(1);
+
+  // The first 8 values along the fastest varying axis take 1/100 of the tolerance.
+  const float factors[3] = {0.01f, 1.0f, 1.0f};
+  auto map = C_API::H5Z_SPERR_quality_map();
+  map.rank = 3;
+  map.dims[0] = map.dims[1] = 1;
+  map.dims[2] = 3;
+  map.cell[0] = map.cell[1] = 1000;
+  map.cell[2] = 8;
+  map.factors = factors;
+  const size_t offset[3] = {0, 0, 0};
+
+  size_t sizes[2] = {0, 0};
+  for (int pass = 0; pass < 2; pass++) {
+    void* enc = NULL;
+    size_t enc_len = 0;
+    ASSERT_EQ(C_API::H5Z_SPERR_encode_chunk_map(cd.size(), cd.data(), orig.data(),
+                                                orig.size() * 4, pass ? &map : NULL, offset,
+                                                &enc, &enc_len),
+              H5ZSPERR_OK);
+    sizes[pass] = enc_len;
+    void* dec = NULL;
+    size_t dec_len = 0;
+    ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk(cd.size(), cd.data(), enc, enc_len, &dec, &dec_len),
+              H5ZSPERR_OK);
+    const float* out = static_cast<const float*>(dec);
+    double max_err[2] = {0.0, 0.0};
+    for (size_t i = 0; i < orig.size(); i++)
+      if (!std::isnan(orig[i])) {
+        const size_t z = i % NZ;
+        max_err[z < 8] = std::max(max_err[z < 8], double(std::abs(out[i] - orig[i])));
+      }
+    EXPECT_LE(max_err[0], 1e-3);
+    EXPECT_LE(max_err[1], pass ? 1.1e-5 : 1e-3); /* plus float rounding */
+    EXPECT_GT(max_err[0], 1e-5);
+    std::free(enc);
+    std::free(dec);
+  }
+  EXPECT_GT(sizes[1], sizes[0]);
+
+  // Without sub-blocks, the strictest factor over the chunk applies.
+  const auto plain = chunk_cd(H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1, 1);
+  void* enc = NULL;
+  size_t enc_len = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_encode_chunk_map(plain.size(), plain.data(), orig.data(),
+                                              orig.size() * 4, &map, offset, &enc, &enc_len),
+            H5ZSPERR_OK);
+  void* dec = NULL;
+  size_t dec_len = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk(plain.size(), plain.data(), enc, enc_len, &dec,
+                                          &dec_len),
+            H5ZSPERR_OK);
+  const float* out = static_cast<const float*>(dec);
+  for (size_t i = 0; i < orig.size(); i++) {
+    if (!std::isnan(orig[i])) {
+      ASSERT_LE(std::abs(out[i] - orig[i]), 1.1e-5);
+    }
+  }
+  std::free(enc);
+  std::free(dec);
+
+  // A map of another rank, or a mode other than PWE, is rejected.
+  map.rank = 2;
+  enc = NULL;
+  EXPECT_EQ(C_API::H5Z_SPERR_encode_chunk_map(cd.size(), cd.data(), orig.data(), orig.size() * 4,
+                                              &map, offset, &enc, &enc_len),
+            H5ZSPERR_ERR_CD_VALUES);
+  map.rank = 3;
+  const auto bpp = chunk_cd(H5Z_SPERR_make_cd_values(1, 8.0, 0), 1, 1);
+  EXPECT_EQ(C_API::H5Z_SPERR_encode_chunk_map(bpp.size(), bpp.data(), orig.data(),
+                                              orig.size() * 4, &map, offset, &enc, &enc_len),
+            H5ZSPERR_ERR_CD_VALUES);
+}
+
+TEST(h5zsperr_region, read_region)
+{
+  ASSERT_GE(H5Zregister(H5PLget_plugin_info()), 0);
+
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0),
+                                   1 | H5Z_SPERR_make_subblocks(8)};
+  const char* fname = "h5zsperr_region_test.h5";
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  const hsize_t dims[4] = {3, NX, NY * 2, NZ};
+  const hsize_t chunks[4] = {1, NX, NY, NZ};
+  const float fill = -1.0f;
+  hid_t space = H5Screate_simple(4, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 4, chunks);
+  H5Pset_fill_value(dcpl, H5T_NATIVE_FLOAT, &fill);
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 2, user_cd);
+  hid_t dset = H5Dcreate(file, "var", H5T_NATIVE_FLOAT, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+
+  // Write the first two time steps only; the third one reads as the fill value.
+  auto orig = std::vector<float>(2 * NX * NY * 2 * NZ);
+  for (size_t i = 0; i < orig.size(); i++)
+    orig[i] = (i % 53 == 0) ? NAN : float(std::sin(double(i) * 0.001) * 3.0);
+  const hsize_t wstart[4] = {0, 0, 0, 0}, wcount[4] = {2, NX, NY * 2, NZ};
+  hid_t wspace = H5Scopy(space);
+  H5Sselect_hyperslab(wspace, H5S_SELECT_SET, wstart, NULL, wcount, NULL);
+  hid_t mspace = H5Screate_simple(4, wcount, NULL);
+  ASSERT_GE(H5Dwrite(dset, H5T_NATIVE_FLOAT, mspace, wspace, H5P_DEFAULT, orig.data()), 0);
+  H5Sclose(mspace);
+  H5Sclose(wspace);
+  H5Dclose(dset);
+
+  // Compare with reading the same hyperslab through the filter.
+  dset = H5Dopen(file, "var", H5P_DEFAULT);
+  const hsize_t regions[][8] = {{0, 0, 0, 0, 3, NX, NY * 2, NZ},
+                                {0, 10, 20, 5, 3, 1, 8, 1},
+                                {1, 3, 0, 17, 1, 20, NY * 2, 3}};
+  for (const auto& r : regions) {
+    const hsize_t* start = r;
+    const hsize_t* count = r + 4;
+    const size_t n = count[0] * count[1] * count[2] * count[3];
+    auto ref = std::vector<float>(n);
+    auto out = std::vector<float>(n);
+    hid_t fspace = H5Dget_space(dset);
+    H5Sselect_hyperslab(fspace, H5S_SELECT_SET, start, NULL, count, NULL);
+    hid_t mem = H5Screate_simple(4, count, NULL);
+    ASSERT_GE(H5Dread(dset, H5T_NATIVE_FLOAT, mem, fspace, H5P_DEFAULT, ref.data()), 0);
+    H5Sclose(mem);
+    H5Sclose(fspace);
+
+    ASSERT_EQ(C_API::H5Z_SPERR_read_region(dset, start, count, out.data()), H5ZSPERR_OK);
+    for (size_t i = 0; i < n; i++) {
+      if (std::isnan(ref[i])) {
+        ASSERT_TRUE(std::isnan(out[i])) << "i = " << i;
+      }
+      else {
+        ASSERT_EQ(out[i], ref[i]) << "i = " << i;
+      }
+    }
+    if (start[0] + count[0] == 3) {
+      EXPECT_EQ(out[n - 1], fill);
+    }
+  }
+
+  const hsize_t start[4] = {0, 0, 0, 0}, count[4] = {4, 1, 1, 1};
+  float val = 0.0f;
+  EXPECT_EQ(C_API::H5Z_SPERR_read_region(dset, start, count, &val), H5ZSPERR_ERR_SIZE);
+
+  H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Fclose(file);
+  std::remove(fname);
+}
+
+// The writer encodes chunks following a tolerance map over the whole dataset.
+TEST(h5zsperr_region, write_region)
+{
+  ASSERT_GE(H5Zregister(H5PLget_plugin_info()), 0);
+
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0),
+                                   1 | H5Z_SPERR_make_subblocks(8)};
+  const char* fname = "h5zsperr_region_write_test.h5";
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  const hsize_t dims[3] = {2, NY * 2, NZ};
+  const hsize_t chunks[3] = {1, NY, NZ};
+  hid_t space = H5Screate_simple(3, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, chunks);
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 2, user_cd);
+  hid_t dset = H5Dcreate(file, "var", H5T_NATIVE_FLOAT, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+
+  // A 2 x 3 map over the (NY * 2) x NZ plane; only its first cell is strict.
+  const float factors[6] = {0.01f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+  auto map = C_API::H5Z_SPERR_quality_map();
+  map.rank = 2;
+  map.dims[0] = 2;
+  map.dims[1] = 3;
+  map.cell[0] = NY;
+  map.cell[1] = 8;
+  map.factors = factors;
+
+  auto orig = std::vector<float>(2 * NY * 2 * NZ);
+  for (size_t i = 0; i < orig.size(); i++)
+    orig[i] = (i % 61 == 0) ? NAN : float(std::cos(double(i) * 0.003) * 4.0);
+  const hsize_t start[3] = {0, 0, 0};
+  ASSERT_EQ(C_API::H5Z_SPERR_write_region(dset, start, dims, orig.data(), &map), H5ZSPERR_OK);
+  const hsize_t unaligned[3] = {0, 1, 0};
+  EXPECT_EQ(C_API::H5Z_SPERR_write_region(dset, unaligned, chunks, orig.data(), &map),
+            H5ZSPERR_ERR_SIZE);
+
+  // Read through the filter.
+  auto out = std::vector<float>(orig.size());
+  ASSERT_GE(H5Dread(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out.data()), 0);
+  double max_err[2] = {0.0, 0.0};
+  for (size_t t = 0; t < 2; t++)
+    for (size_t y = 0; y < NY * 2; y++)
+      for (size_t z = 0; z < NZ; z++) {
+        const size_t i = (t * NY * 2 + y) * NZ + z;
+        if (std::isnan(orig[i])) {
+          ASSERT_TRUE(std::isnan(out[i]));
+          continue;
+        }
+        const bool strict = y < NY && z < 8; /* the sub-blocks within the first cell */
+        max_err[strict] = std::max(max_err[strict], double(std::abs(out[i] - orig[i])));
+      }
+  EXPECT_LE(max_err[0], 1e-3);
+  EXPECT_GT(max_err[0], 1e-5);
+  EXPECT_LE(max_err[1], 1.1e-5);
+
+  H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Fclose(file);
+  std::remove(fname);
+}
+
+// Steps between keyframes are stored as residuals, and read back as values.
+TEST(h5zsperr_region, temporal_keyframes)
+{
+  ASSERT_GE(H5Zregister(H5PLget_plugin_info()), 0);
+
+  const float missing = -999.0f;
+  unsigned int user_cd[3] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 3, 0};
+  std::memcpy(&user_cd[2], &missing, sizeof(missing));
+  const char* fname = "h5zsperr_region_temporal_test.h5";
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  const hsize_t NT = 7, NS = 20;
+  const hsize_t dims[4] = {NT, NS, NY, NZ};
+  const hsize_t chunks[4] = {1, NS / 2, NY, NZ};
+  hid_t space = H5Screate_simple(4, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 4, chunks);
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 3, user_cd);
+  hid_t dset = H5Dcreate(file, "var", H5T_NATIVE_FLOAT, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(dset, 0);
+
+  const size_t step = NS * NY * NZ;
+  auto orig = std::vector<float>(NT * step);
+  for (size_t t = 0; t < NT; t++)
+    for (size_t i = 0; i < step; i++)
+      orig[t * step + i] =
+          (i % 53 == t) ? missing : float(std::sin(double(i) * 0.01) * 4.0 + 0.02 * t);
+
+  // Steps 4 and 5 refer to keyframe 3 of the first call, which the second one reads back.
+  const unsigned int interval = 3;
+  ASSERT_EQ(C_API::H5Z_SPERR_write_temporal(dset, 0, 4, orig.data(), interval), H5ZSPERR_OK);
+  ASSERT_EQ(C_API::H5Z_SPERR_write_temporal(dset, 4, 3, orig.data() + 4 * step, interval),
+            H5ZSPERR_OK);
+  EXPECT_EQ(C_API::H5Z_SPERR_write_temporal(dset, 0, 1, orig.data(), 2), H5ZSPERR_ERR_HDF5);
+
+  auto check = [&](const hsize_t start[4], const hsize_t count[4]) {
+    auto out = std::vector<float>(count[0] * count[1] * count[2] * count[3]);
+    ASSERT_EQ(C_API::H5Z_SPERR_read_temporal(dset, start, count, out.data()), H5ZSPERR_OK);
+    size_t idx = 0;
+    for (hsize_t t = start[0]; t < start[0] + count[0]; t++)
+      for (hsize_t s = start[1]; s < start[1] + count[1]; s++)
+        for (hsize_t y = start[2]; y < start[2] + count[2]; y++)
+          for (hsize_t z = start[3]; z < start[3] + count[3]; z++, idx++) {
+            const float v = orig[t * step + (s * NY + y) * NZ + z];
+            if (v == missing) {
+              ASSERT_EQ(out[idx], v) << t << ", " << s << ", " << y << ", " << z;
+            }
+            else {
+              ASSERT_LE(std::abs(out[idx] - v), 1e-3) << t << ", " << s << ", " << y << ", " << z;
+            }
+          }
+  };
+  const hsize_t all_start[4] = {0, 0, 0, 0};
+  check(all_start, dims);
+
+  // The filter refuses the chunks of residuals, while keyframes read through it as usual.
+  auto filtered = std::vector<float>(NT * step);
+  herr_t status = 0;
+  H5E_BEGIN_TRY
+  {
+    status = H5Dread(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, filtered.data());
+  }
+  H5E_END_TRY;
+  EXPECT_LT(status, 0);
+  const hsize_t key_start[4] = {3, 0, 0, 0}, key_count[4] = {1, NS, NY, NZ};
+  hid_t key_space = H5Scopy(space);
+  H5Sselect_hyperslab(key_space, H5S_SELECT_SET, key_start, NULL, key_count, NULL);
+  hid_t mem = H5Screate_simple(4, key_count, NULL);
+  ASSERT_GE(H5Dread(dset, H5T_NATIVE_FLOAT, mem, key_space, H5P_DEFAULT, filtered.data()), 0);
+  H5Sclose(mem);
+  H5Sclose(key_space);
+  for (size_t i = 0; i < step; i++) {
+    ASSERT_LE(std::abs(filtered[i] - orig[3 * step + i]), 1e-3) << i;
+  }
+
+  const hsize_t res_offset[4] = {1, 0, 0, 0};
+  hsize_t nbytes = 0;
+  ASSERT_GE(H5Dget_chunk_storage_size(dset, res_offset, &nbytes), 0);
+  auto raw = std::vector<uint8_t>(nbytes);
+  uint32_t filter_mask = 0;
+  ASSERT_GE(H5Dread_chunk(dset, H5P_DEFAULT, res_offset, &filter_mask, raw.data()), 0);
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = H5Z_SPERR_MAX_CD_VALUES;
+  hid_t dcpl_in = H5Dget_create_plist(dset);
+  ASSERT_GE(H5Pget_filter_by_id2(dcpl_in, H5Z_FILTER_SPERR, NULL, &cd_nelmts, cd, 0, NULL, NULL),
+            0);
+  H5Pclose(dcpl_in);
+  void* dec = NULL;
+  size_t dec_len = 0;
+  EXPECT_EQ(C_API::H5Z_SPERR_decode_chunk(cd_nelmts, cd, raw.data(), raw.size(), &dec, &dec_len),
+            H5ZSPERR_ERR_RESIDUAL);
+  EXPECT_EQ(dec, nullptr);
+  const hsize_t sub_start[4] = {4, 5, 3, 2}, sub_count[4] = {3, 7, 10, 9};
+  check(sub_start, sub_count);
+
+  // Residuals can't be written before their keyframe.
+  hid_t other = H5Dcreate(file, "other", H5T_NATIVE_FLOAT, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  ASSERT_GE(other, 0);
+  EXPECT_EQ(C_API::H5Z_SPERR_write_temporal(other, 4, 1, orig.data() + 4 * step, interval),
+            H5ZSPERR_ERR_HDF5);
+  H5Dclose(other);
+
+  H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Fclose(file);
+  std::remove(fname);
+}
+
+}  // namespace
@@ -0,0 +1,107 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "h5z-sperr-chunk.h"
+#include "h5z-sperr.h"
+#include "h5zsperr_trace.h"
+
+namespace {
+
+std::string slurp(const char* fname)
+{
+  auto in = std::ifstream(fname);
+  auto ss = std::stringstream();
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+size_t count(const std::string& str, const std::string& sub)
+{
+  size_t n = 0;
+  for (auto pos = str.find(sub); pos != std::string::npos; pos = str.find(sub, pos + 1))
+    n++;
+  return n;
+}
+
+TEST(h5zsperr_trace, chunk_events)
+{
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1};
+  const size_t chunk_dims[3] = {16, 20, 24};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, 3, chunk_dims, cd, &cd_nelmts),
+            H5ZSPERR_OK);
+  auto chunk = std::vector<float>(16 * 20 * 24);
+  for (size_t i = 0; i < chunk.size(); i++)
+    chunk[i] = (i % 13 == 0) ? std::nanf("") : float(std::sin(double(i) * 0.01));
+
+  C_API::H5Z_SPERR_trace_start(1024);
+  void* enc = NULL;
+  size_t enc_len = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_encode_chunk(cd_nelmts, cd, chunk.data(), chunk.size() * 4, &enc,
+                                          &enc_len),
+            H5ZSPERR_OK);
+  void* dec = NULL;
+  size_t dec_len = 0;
+  ASSERT_EQ(C_API::H5Z_SPERR_decode_chunk(cd_nelmts, cd, enc, enc_len, &dec, &dec_len),
+            H5ZSPERR_OK);
+  std::free(enc);
+  std::free(dec);
+  C_API::H5Z_SPERR_trace_stop();
+
+  const char* fname = "h5zsperr_trace_test.json";
+  ASSERT_EQ(C_API::H5Z_SPERR_trace_dump(fname), 0);
+  const auto json = slurp(fname);
+  std::remove(fname);
+  EXPECT_EQ(json.find("{\"traceEvents\":["), 0ul);
+  for (auto name : {"chunk_encode", "mask_build", "mask_compact", "mean_fill", "sperr_encode",
+                    "assemble", "chunk_decode", "mask_decode", "sperr_decode", "fill"})
+    EXPECT_EQ(count(json, std::string("\"name\":\"") + name + "\""), 1ul) << name;
+  EXPECT_EQ(count(json, "\"bytes\":" + std::to_string(enc_len)), 2ul); /* assemble, decode */
+}
+
+TEST(h5zsperr_trace, ring_buffer)
+{
+  // Only the latest 8 events are kept, from whichever thread.
+  h5zsperr::trace_start(8);
+  auto work = [] {
+    for (int i = 0; i < 100; i++)
+      h5zsperr::TraceSpan span(h5zsperr::trace_event::fill, size_t(i));
+  };
+  auto t1 = std::thread(work), t2 = std::thread(work);
+  t1.join();
+  t2.join();
+  h5zsperr::trace_stop();
+
+  // Nothing is recorded after stopping.
+  {
+    h5zsperr::TraceSpan span(h5zsperr::trace_event::assemble, 0);
+  }
+  EXPECT_FALSE(h5zsperr::trace_enabled());
+
+  const char* fname = "h5zsperr_trace_ring.json";
+  ASSERT_EQ(h5zsperr::trace_dump(fname), 0);
+  const auto json = slurp(fname);
+  std::remove(fname);
+  EXPECT_EQ(count(json, "\"ph\":\"X\""), 8ul);
+  EXPECT_EQ(count(json, "\"name\":\"assemble\""), 0ul);
+}
+
+TEST(h5zsperr_trace, per_rank_path)
+{
+  setenv("OMPI_COMM_WORLD_RANK", "17", 1);
+  EXPECT_EQ(h5zsperr::trace_path("/tmp/trace-%r.json"), "/tmp/trace-17.json");
+  EXPECT_EQ(h5zsperr::trace_path("%r/%r"), "17/17");
+  EXPECT_EQ(h5zsperr::trace_path("/tmp/trace.json"), "/tmp/trace.json");
+  unsetenv("OMPI_COMM_WORLD_RANK");
+}
+
+}  // namespace
@@ -0,0 +1,155 @@
+/*
+ * Weak and strong scaling of collective H5Z-SPERR writes through parallel HDF5 (MPI-IO).
+ *
+ * Usage: mpirun -n N h5zsperr_mpi_bench weak|strong [-c edge] [-n chunks] [-t pwe] [-r] [-o file]
+ *   weak:   every rank writes `chunks` chunks (8 by default), so the dataset grows with N;
+ *   strong: all ranks together write `chunks` chunks (64 by default), which N has to divide.
+ *   -c      edge length of the cubic chunks (64 by default);
+ *   -t      PWE tolerance of compression mode 3 (1e-4 by default);
+ *   -r      write without the filter, for a reference;
+ *   -o      output file (h5zsperr_mpi_bench.h5 by default), which is removed afterwards.
+ * Every rank owns a slab of whole chunks along the slowest axis. The slowest rank's time of each
+ * phase is reported (dataset creation, the collective write, and closing the file), together
+ * with the aggregate throughput in raw bytes and the compression ratio, as a line that is easy
+ * to collect across runs:
+ *   mode ranks chunks raw_GB create_s write_s close_s GB/s ratio
+ */
+
+#include <H5PLextern.h>
+#include <hdf5.h>
+#include <mpi.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "h5z-sperr.h"
+
+namespace {
+
+/* A smooth field with some small-scale structure, so that chunks don't compress trivially. */
+void fill_slab(std::vector<float>& slab, size_t z0, size_t nz, size_t ny, size_t nx)
+{
+  size_t i = 0;
+  for (size_t z = z0; z < z0 + nz; z++)
+    for (size_t y = 0; y < ny; y++)
+      for (size_t x = 0; x < nx; x++, i++)
+        slab[i] = float(std::sin(0.031 * double(x)) * std::cos(0.027 * double(y + z)) +
+                        0.05 * std::sin(0.7 * double(x + 3 * y + 5 * z)));
+}
+
+double max_over_ranks(double val)
+{
+  double out = 0.0;
+  MPI_Allreduce(&val, &out, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  return out;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  MPI_Init(&argc, &argv);
+  int rank = 0, nranks = 1;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+
+  bool weak = true, raw = false;
+  size_t edge = 64, nchunks = 0;
+  double pwe = 1e-4;
+  std::string fname = "h5zsperr_mpi_bench.h5";
+  bool ok = argc > 1 && (std::strcmp(argv[1], "weak") == 0 || std::strcmp(argv[1], "strong") == 0);
+  if (ok)
+    weak = std::strcmp(argv[1], "weak") == 0;
+  for (int i = 2; ok && i < argc; i++) {
+    const bool has_val = i + 1 < argc;
+    if (std::strcmp(argv[i], "-r") == 0)
+      raw = true;
+    else if (std::strcmp(argv[i], "-c") == 0 && has_val)
+      edge = size_t(std::atoll(argv[++i]));
+    else if (std::strcmp(argv[i], "-n") == 0 && has_val)
+      nchunks = size_t(std::atoll(argv[++i]));
+    else if (std::strcmp(argv[i], "-t") == 0 && has_val)
+      pwe = std::atof(argv[++i]);
+    else if (std::strcmp(argv[i], "-o") == 0 && has_val)
+      fname = argv[++i];
+    else
+      ok = false;
+  }
+  if (nchunks == 0)
+    nchunks = weak ? 8 : 64;
+  const size_t total_chunks = weak ? nchunks * size_t(nranks) : nchunks;
+  if (!ok || edge < 9 || pwe <= 0.0 || total_chunks % size_t(nranks)) {
+    if (rank == 0)
+      std::fprintf(stderr,
+                   "Usage: mpirun -n N %s weak|strong [-c edge] [-n chunks] [-t pwe] [-r] "
+                   "[-o file]\n(strong scaling needs N to divide the number of chunks)\n",
+                   argv[0]);
+    MPI_Finalize();
+    return 1;
+  }
+  H5Zregister(H5PLget_plugin_info());
+
+  // The chunks of a rank form a slab of `per_rank` chunks along the slowest axis.
+  const size_t per_rank = total_chunks / size_t(nranks);
+  const hsize_t dims[3] = {hsize_t(total_chunks * edge), edge, edge};
+  const hsize_t chunks[3] = {edge, edge, edge};
+  const hsize_t start[3] = {hsize_t(size_t(rank) * per_rank * edge), 0, 0};
+  const hsize_t count[3] = {hsize_t(per_rank * edge), edge, edge};
+  auto slab = std::vector<float>(per_rank * edge * edge * edge);
+  fill_slab(slab, size_t(start[0]), size_t(count[0]), edge, edge);
+
+  hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+  H5Pset_fapl_mpio(fapl, MPI_COMM_WORLD, MPI_INFO_NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, chunks);
+  H5Pset_fill_time(dcpl, H5D_FILL_TIME_NEVER);
+  if (!raw) {
+    const unsigned int cd = H5Z_SPERR_make_cd_values(3, pwe, 0);
+    H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, 1, &cd);
+  }
+  hid_t dxpl = H5Pcreate(H5P_DATASET_XFER);
+  H5Pset_dxpl_mpio(dxpl, H5FD_MPIO_COLLECTIVE);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  double t0 = MPI_Wtime();
+  hid_t file = H5Fcreate(fname.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+  hid_t space = H5Screate_simple(3, dims, NULL);
+  hid_t dset = H5Dcreate(file, "field", H5T_NATIVE_FLOAT, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  const double create_s = max_over_ranks(MPI_Wtime() - t0);
+
+  hid_t mspace = H5Screate_simple(3, count, NULL);
+  H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+  t0 = MPI_Wtime();
+  const herr_t status = H5Dwrite(dset, H5T_NATIVE_FLOAT, mspace, space, dxpl, slab.data());
+  const double write_s = max_over_ranks(MPI_Wtime() - t0);
+  const hsize_t stored = H5Dget_storage_size(dset);
+
+  t0 = MPI_Wtime();
+  H5Dclose(dset);
+  H5Fclose(file);
+  const double close_s = max_over_ranks(MPI_Wtime() - t0);
+
+  int failed = status < 0 ? 1 : 0, any_failed = 0;
+  MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  if (rank == 0) {
+    const double raw_gb = double(total_chunks) * double(edge * edge * edge) * 4.0 / 1e9;
+    std::printf("# mode ranks chunks raw_GB create_s write_s close_s GB/s ratio\n");
+    std::printf("%s%s %d %zu %.3f %.4f %.4f %.4f %.3f %.2f%s\n", weak ? "weak" : "strong",
+                raw ? "-raw" : "", nranks, total_chunks, raw_gb, create_s, write_s, close_s,
+                raw_gb / (create_s + write_s + close_s),
+                stored ? raw_gb * 1e9 / double(stored) : 0.0, any_failed ? " FAILED" : "");
+    std::remove(fname.c_str());
+  }
+
+  H5Sclose(mspace);
+  H5Sclose(space);
+  H5Pclose(dxpl);
+  H5Pclose(dcpl);
+  H5Pclose(fapl);
+  MPI_Finalize();
+  return any_failed;
+}
@@ -0,0 +1,192 @@
+/*
+ * Collective writes of H5Z-SPERR compressed datasets through parallel HDF5 (MPI-IO), which
+ * supports filters since 1.10.2. Every rank writes a slab of each dataset collectively, and
+ * then reads the whole dataset back. The test checks that
+ *   - the error bound holds and missing values come back, on every rank;
+ *   - every stored chunk has exactly the bytes that the chunk API produces for it serially,
+ *     i.e., compressing in parallel doesn't change the output.
+ * Slabs are half a chunk thick, so pairs of ranks share chunks, which HDF5 then assembles
+ * on one of them before compressing.
+ *
+ * Run it as, e.g., `mpirun -n 4 h5zsperr_mpi_test [file.h5]`; it returns 0 upon success.
+ */
+
+#include <H5PLextern.h>
+#include <hdf5.h>
+#include <mpi.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "h5z-sperr-chunk.h"
+#include "h5z-sperr.h"
+
+namespace {
+
+const hsize_t SLAB = 10;           // values along the slowest axis that each rank writes
+const hsize_t NY = 40, NX = 36;    // the other axes
+const hsize_t CY = 20, CX = 36;    // chunks are 2 * SLAB x CY x CX
+int rank = 0, nranks = 1;
+int failures = 0;
+
+#define CHECK(cond)                                                                       \
+  do {                                                                                    \
+    if (!(cond)) {                                                                        \
+      std::fprintf(stderr, "rank %d: %s:%d: check failed: %s\n", rank, __FILE__, __LINE__, \
+                   #cond);                                                                \
+      failures++;                                                                         \
+    }                                                                                     \
+  } while (0)
+
+template <typename T>
+T value_at(hsize_t z, hsize_t y, hsize_t x)
+{
+  if ((z * NY + y) * NX % 23 == x)
+    return T(-999.0);
+  return T(3.0 * std::sin(0.1 * double(x) + 0.05 * double(z)) * std::cos(0.07 * double(y)));
+}
+
+struct Case {
+  const char* name;
+  hid_t type;
+  unsigned int user_cd[4];
+  size_t user_nelmts;
+  double tolerance;
+};
+
+template <typename T>
+void run_case(hid_t file, const Case& c)
+{
+  const hsize_t nz = SLAB * hsize_t(nranks);
+  const hsize_t dims[3] = {nz, NY, NX};
+  const hsize_t chunks[3] = {std::min(2 * SLAB, nz), CY, CX};
+  hid_t space = H5Screate_simple(3, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, chunks);
+  H5Pset_filter(dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, c.user_nelmts, c.user_cd);
+  // Don't compress chunks of fill values at creation, which the write replaces anyway.
+  H5Pset_fill_time(dcpl, H5D_FILL_TIME_NEVER);
+  hid_t dset = H5Dcreate(file, c.name, c.type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  CHECK(dset >= 0);
+  if (dset < 0)
+    return;
+
+  // Each rank writes its own slab, collectively.
+  auto slab = std::vector<T>(SLAB * NY * NX);
+  const hsize_t z0 = SLAB * hsize_t(rank);
+  for (hsize_t z = 0; z < SLAB; z++)
+    for (hsize_t y = 0; y < NY; y++)
+      for (hsize_t x = 0; x < NX; x++)
+        slab[(z * NY + y) * NX + x] = value_at<T>(z0 + z, y, x);
+  const hsize_t start[3] = {z0, 0, 0}, count[3] = {SLAB, NY, NX};
+  hid_t fspace = H5Screate_simple(3, dims, NULL);
+  H5Sselect_hyperslab(fspace, H5S_SELECT_SET, start, NULL, count, NULL);
+  hid_t mspace = H5Screate_simple(3, count, NULL);
+  hid_t dxpl = H5Pcreate(H5P_DATASET_XFER);
+  H5Pset_dxpl_mpio(dxpl, H5FD_MPIO_COLLECTIVE);
+  CHECK(H5Dwrite(dset, c.type, mspace, fspace, dxpl, slab.data()) >= 0);
+  H5Dclose(dset);
+
+  // Every rank reads everything back.
+  dset = H5Dopen(file, c.name, H5P_DEFAULT);
+  auto all = std::vector<T>(nz * NY * NX);
+  CHECK(H5Dread(dset, c.type, H5S_ALL, H5S_ALL, dxpl, all.data()) >= 0);
+  double max_err = 0.0;
+  size_t i = 0;
+  for (hsize_t z = 0; z < nz; z++)
+    for (hsize_t y = 0; y < NY; y++)
+      for (hsize_t x = 0; x < NX; x++, i++) {
+        const T orig = value_at<T>(z, y, x);
+        if (orig == T(-999.0))
+          CHECK(all[i] == orig);
+        else
+          max_err = std::max(max_err, std::abs(double(all[i]) - double(orig)));
+      }
+  CHECK(max_err <= c.tolerance);
+
+  // Every stored chunk equals the serial encoding of the same values; partial chunks at the end
+  // are skipped, since what HDF5 puts beyond the extent isn't defined.
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  const size_t chunk_dims[3] = {size_t(chunks[0]), size_t(chunks[1]), size_t(chunks[2])};
+  CHECK(C_API::H5Z_SPERR_chunk_cd_values(c.user_cd, c.user_nelmts, sizeof(T) == 4, 3, chunk_dims,
+                                         cd, &cd_nelmts) == H5ZSPERR_OK);
+  auto chunk = std::vector<T>(chunks[0] * chunks[1] * chunks[2]);
+  auto stored = std::vector<uint8_t>();
+  for (hsize_t cz = 0; cz + chunks[0] <= nz; cz += chunks[0])
+    for (hsize_t cy = 0; cy < NY; cy += chunks[1]) {
+      size_t k = 0;
+      for (hsize_t z = cz; z < cz + chunks[0]; z++)
+        for (hsize_t y = cy; y < cy + chunks[1]; y++)
+          for (hsize_t x = 0; x < chunks[2]; x++)
+            chunk[k++] = value_at<T>(z, y, x);
+      void* enc = nullptr;
+      size_t enc_len = 0;
+      CHECK(C_API::H5Z_SPERR_encode_chunk(cd_nelmts, cd, chunk.data(), chunk.size() * sizeof(T),
+                                          &enc, &enc_len) == H5ZSPERR_OK);
+      const hsize_t offset[3] = {cz, cy, 0};
+      hsize_t nbytes = 0;
+      CHECK(H5Dget_chunk_storage_size(dset, offset, &nbytes) >= 0);
+      CHECK(nbytes == enc_len);
+      if (nbytes == enc_len) {
+        uint32_t filter_mask = 0;
+        stored.resize(nbytes);
+        CHECK(H5Dread_chunk(dset, H5P_DEFAULT, offset, &filter_mask, stored.data()) >= 0);
+        CHECK(std::memcmp(stored.data(), enc, enc_len) == 0);
+      }
+      std::free(enc);
+    }
+
+  H5Pclose(dxpl);
+  H5Sclose(mspace);
+  H5Sclose(fspace);
+  H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+  const char* fname = argc > 1 ? argv[1] : "h5zsperr_mpi_test.h5";
+  CHECK(H5Zregister(H5PLget_plugin_info()) >= 0);
+
+  hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+  H5Pset_fapl_mpio(fapl, MPI_COMM_WORLD, MPI_INFO_NULL);
+  hid_t file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+  CHECK(file >= 0);
+
+  // Fixed PWE on floats with a missing value, and relative PWE on doubles with sub-blocks.
+  auto pwe = Case{"pwe_f32", H5T_NATIVE_FLOAT, {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 4}, 4, 1e-3};
+  const double missing = -999.0;
+  std::memcpy(&pwe.user_cd[2], &missing, sizeof(missing));
+  run_case<float>(file, pwe);
+  auto rel = Case{"rel_f64",
+                  H5T_NATIVE_DOUBLE,
+                  {H5Z_SPERR_make_cd_values(5, 1e-5, 0), 4 | H5Z_SPERR_make_subblocks(8)},
+                  4,
+                  6.0 * 1e-5};
+  std::memcpy(&rel.user_cd[2], &missing, sizeof(missing));
+  run_case<double>(file, rel);
+
+  H5Fclose(file);
+  H5Pclose(fapl);
+
+  int total = 0;
+  MPI_Allreduce(&failures, &total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  if (rank == 0) {
+    std::printf("%s: %d rank(s), %d failed check(s)\n", total ? "FAILED" : "PASSED", nranks,
+                total);
+    std::remove(fname);
+  }
+  MPI_Finalize();
+  return total ? 1 : 0;
+}
@@ -0,0 +1,480 @@
+/*
+ * h5zsperr_perf: the performance regression suite of H5Z-SPERR.
+ *
+ * Each case compresses a field from test_data/ or a generated field with missing values through
+ * the chunk API, which produces exactly what the filter stores, and measures the compression
+ * ratio, the encode and decode throughput, and the point-wise error. The results are compared
+ * against a baseline JSON file:
+ *   - the error bound of the PWE modes always holds, and missing values come back exactly;
+ *   - the compression ratio may not drop, and the max error may not grow, by more than the
+ *     "ratio" tolerance (a fraction);
+ *   - the throughput, relative to copying the same bytes with memcpy() in the same run, may not
+ *     drop by more than the "throughput" tolerance.
+ * Ratios and errors don't depend on the machine, but they do on the SPERR library, and so does
+ * the throughput. The baseline thus records a fingerprint of the SPERR build, i.e., a hash of
+ * one small encoding, and is only compared against when the fingerprint matches; otherwise, the
+ * results are reported and only the error bounds are checked.
+ *
+ * Usage: h5zsperr_perf test_data_dir baseline.json [--update]
+ * `--update` writes the measured values to the baseline file instead of comparing; it needs an
+ * optimized build (NDEBUG). The environment variable H5ZSPERR_PERF_THROUGHPUT_TOL overrides the
+ * throughput tolerance, e.g., on a shared machine.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "h5z-sperr-chunk.h"
+#include "h5z-sperr.h"
+
+namespace {
+
+struct Case {
+  std::string name;
+  std::vector<uint8_t> data; /* the field, in the HDF5 (C) order */
+  bool is_float = true;
+  std::vector<size_t> dims;
+  std::vector<unsigned int> user_cd;
+  double error_bound = 0.0; /* absolute; 0 means not checked */
+};
+
+struct Result {
+  double ratio = 0.0;
+  double encode_mbps = 0.0;
+  double decode_mbps = 0.0;
+  double encode_rel = 0.0; /* the throughputs relative to memcpy() */
+  double decode_rel = 0.0;
+  double max_error = 0.0;
+  std::string failure; /* empty when the error checks pass */
+};
+
+//
+// A reader of the small subset of JSON that baselines use: objects, numbers, and strings.
+//
+class Json {
+ public:
+  explicit Json(std::string text) : m_text(std::move(text)) {}
+
+  /* Flatten all numbers into "outer.inner" keys; returns false on malformed input. */
+  bool parse(std::map<std::string, double>* out)
+  {
+    m_pos = 0;
+    return m_object("", out) && (m_skip(), m_pos == m_text.size());
+  }
+
+ private:
+  std::string m_text;
+  size_t m_pos = 0;
+
+  void m_skip()
+  {
+    while (m_pos < m_text.size() && std::strchr(" \t\r\n", m_text[m_pos]))
+      m_pos++;
+  }
+
+  bool m_eat(char c)
+  {
+    m_skip();
+    if (m_pos < m_text.size() && m_text[m_pos] == c) {
+      m_pos++;
+      return true;
+    }
+    return false;
+  }
+
+  bool m_string(std::string* str)
+  {
+    if (!m_eat('"'))
+      return false;
+    const size_t end = m_text.find('"', m_pos);
+    if (end == std::string::npos)
+      return false;
+    *str = m_text.substr(m_pos, end - m_pos);
+    m_pos = end + 1;
+    return true;
+  }
+
+  bool m_object(const std::string& prefix, std::map<std::string, double>* out)
+  {
+    if (!m_eat('{'))
+      return false;
+    if (m_eat('}'))
+      return true;
+    do {
+      std::string key;
+      if (!m_string(&key) || !m_eat(':'))
+        return false;
+      key = prefix.empty() ? key : prefix + "." + key;
+      m_skip();
+      if (m_pos < m_text.size() && m_text[m_pos] == '{') {
+        if (!m_object(key, out))
+          return false;
+      }
+      else if (m_pos < m_text.size() && m_text[m_pos] == '"') {
+        std::string ignored;
+        if (!m_string(&ignored))
+          return false;
+      }
+      else {
+        const char* begin = m_text.c_str() + m_pos;
+        char* end = nullptr;
+        const double val = std::strtod(begin, &end);
+        if (end == begin)
+          return false;
+        m_pos += size_t(end - begin);
+        (*out)[key] = val;
+      }
+    } while (m_eat(','));
+    return m_eat('}');
+  }
+};
+
+bool read_file(const std::string& path, std::vector<uint8_t>* buf)
+{
+  auto in = std::ifstream(path, std::ios::binary);
+  if (!in)
+    return false;
+  buf->assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  return true;
+}
+
+template <typename T>
+std::vector<uint8_t> as_bytes(const std::vector<T>& vals)
+{
+  const auto* p = reinterpret_cast<const uint8_t*>(vals.data());
+  return std::vector<uint8_t>(p, p + vals.size() * sizeof(T));
+}
+
+template <typename T>
+double value_range(const std::vector<uint8_t>& data)
+{
+  const T* v = reinterpret_cast<const T*>(data.data());
+  const size_t n = data.size() / sizeof(T);
+  double lo = HUGE_VAL, hi = -HUGE_VAL;
+  for (size_t i = 0; i < n; i++)
+    if (std::isfinite(v[i]) && std::abs(v[i]) < 1e35) {
+      lo = std::min(lo, double(v[i]));
+      hi = std::max(hi, double(v[i]));
+    }
+  return hi > lo ? hi - lo : 0.0;
+}
+
+/* A smooth 3D field where a fixed "land" region holds missing values. */
+template <typename T>
+std::vector<T> masked_field(size_t nz, size_t ny, size_t nx, T missing)
+{
+  auto vals = std::vector<T>(nz * ny * nx);
+  for (size_t z = 0; z < nz; z++)
+    for (size_t y = 0; y < ny; y++)
+      for (size_t x = 0; x < nx; x++) {
+        const double land = std::sin(0.07 * double(x)) * std::cos(0.05 * double(y));
+        vals[(z * ny + y) * nx + x] =
+            land > 0.4 ? missing
+                       : T(20.0 + 5.0 * std::sin(0.1 * double(x + z)) * std::cos(0.08 * double(y)));
+      }
+  return vals;
+}
+
+std::vector<Case> make_cases(const std::string& data_dir)
+{
+  auto cases = std::vector<Case>();
+  auto c = Case();
+
+  if (read_file(data_dir + "/vorticity.128x128x41.f32", &c.data)) {
+    c.is_float = true;
+    c.dims = {41, 128, 128};
+    const double range = value_range<float>(c.data);
+    c.name = "vorticity_pwe";
+    c.user_cd = {H5Z_SPERR_make_cd_values(3, range * 1e-4, 0), 0};
+    c.error_bound = range * 1e-4;
+    cases.push_back(c);
+    c.name = "vorticity_bpp";
+    c.user_cd = {H5Z_SPERR_make_cd_values(1, 4.0, 0), 0};
+    c.error_bound = 0.0;
+    cases.push_back(c);
+    c.name = "vorticity_fast";
+    c.user_cd = {H5Z_SPERR_make_cd_values(3, range * 1e-4, 0),
+                 H5Z_SPERR_make_effort(H5Z_SPERR_EFFORT_FAST)};
+    c.error_bound = range * 1e-4;
+    cases.push_back(c);
+  }
+
+  if (read_file(data_dir + "/density_128x128.d64", &c.data)) {
+    c.is_float = false;
+    c.dims = {128, 128};
+    const double range = value_range<double>(c.data);
+    c.name = "density_pwe";
+    c.user_cd = {H5Z_SPERR_make_cd_values(3, range * 1e-8, 0), 0};
+    c.error_bound = range * 1e-8;
+    cases.push_back(c);
+  }
+
+  // Generated fields with missing values: NaNs in floats, and a fill value in doubles.
+  c.is_float = true;
+  c.dims = {32, 96, 96};
+  c.data = as_bytes(masked_field<float>(32, 96, 96, NAN));
+  c.name = "masked_nan";
+  c.user_cd = {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 1};
+  c.error_bound = 1e-3;
+  cases.push_back(c);
+
+  c.is_float = false;
+  c.data = as_bytes(masked_field<double>(32, 96, 96, -999.0));
+  const double fill = -999.0;
+  c.name = "masked_fill";
+  c.user_cd = {H5Z_SPERR_make_cd_values(3, 1e-6, 0), 4, 0, 0};
+  std::memcpy(&c.user_cd[2], &fill, sizeof(fill));
+  c.error_bound = 1e-6;
+  cases.push_back(c);
+
+  return cases;
+}
+
+/* Run `fn` until at least 0.2 seconds pass, and return the best time of a single run. */
+template <typename Fn>
+double best_seconds(Fn fn)
+{
+  using clock = std::chrono::steady_clock;
+  double best = HUGE_VAL, total = 0.0;
+  for (int i = 0; i < 100 && (i < 3 || total < 0.2); i++) {
+    const auto t0 = clock::now();
+    fn();
+    const double secs = std::chrono::duration<double>(clock::now() - t0).count();
+    best = std::min(best, secs);
+    total += secs;
+  }
+  return best;
+}
+
+template <typename T>
+void check_errors(const Case& c, const void* out, Result* res)
+{
+  const T* orig = reinterpret_cast<const T*>(c.data.data());
+  const T* dec = static_cast<const T*>(out);
+  const size_t n = c.data.size() / sizeof(T);
+  for (size_t i = 0; i < n; i++) {
+    const bool missing = std::isnan(orig[i]) || orig[i] == T(-999.0);
+    if (missing) {
+      if (!(std::isnan(orig[i]) ? std::isnan(dec[i]) : dec[i] == orig[i])) {
+        res->failure = "missing value " + std::to_string(i) + " isn't restored";
+        return;
+      }
+      continue;
+    }
+    res->max_error = std::max(res->max_error, std::abs(double(dec[i]) - double(orig[i])));
+  }
+  if (c.error_bound > 0.0 && res->max_error > c.error_bound)
+    res->failure = "max error exceeds the bound of " + std::to_string(c.error_bound);
+}
+
+/* A hash of one small encoding, which tells apart SPERR builds that compress differently. */
+double sperr_fingerprint()
+{
+  const size_t dims[3] = {16, 16, 16};
+  auto vals = std::vector<float>(16 * 16 * 16);
+  for (size_t i = 0; i < vals.size(); i++)
+    vals[i] = float(std::sin(0.1 * double(i)) + 0.01 * double(i % 16));
+  const unsigned int user_cd[2] = {H5Z_SPERR_make_cd_values(3, 1e-3, 0), 0};
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  void* enc = nullptr;
+  size_t enc_len = 0;
+  if (C_API::H5Z_SPERR_chunk_cd_values(user_cd, 2, 1, 3, dims, cd, &cd_nelmts) ||
+      C_API::H5Z_SPERR_encode_chunk(cd_nelmts, cd, vals.data(), vals.size() * sizeof(float), &enc,
+                                    &enc_len))
+    return 0.0;
+  uint32_t hash = 2166136261u; /* FNV-1a */
+  for (size_t i = 0; i < enc_len; i++)
+    hash = (hash ^ static_cast<const uint8_t*>(enc)[i]) * 16777619u;
+  std::free(enc);
+  return double(hash);
+}
+
+int run_case(const Case& c, Result* res)
+{
+  unsigned int cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = 0;
+  int ret = C_API::H5Z_SPERR_chunk_cd_values(c.user_cd.data(), c.user_cd.size(), c.is_float,
+                                             int(c.dims.size()), c.dims.data(), cd, &cd_nelmts);
+  if (ret)
+    return ret;
+
+  void* enc = nullptr;
+  size_t enc_len = 0;
+  const double enc_secs = best_seconds([&] {
+    std::free(enc);
+    enc = nullptr;
+    ret = ret ? ret
+              : C_API::H5Z_SPERR_encode_chunk(cd_nelmts, cd, c.data.data(), c.data.size(), &enc,
+                                              &enc_len);
+  });
+  if (ret)
+    return ret;
+
+  void* dec = nullptr;
+  size_t dec_len = 0;
+  const double dec_secs = best_seconds([&] {
+    std::free(dec);
+    dec = nullptr;
+    ret = ret ? ret : C_API::H5Z_SPERR_decode_chunk(cd_nelmts, cd, enc, enc_len, &dec, &dec_len);
+  });
+  /* Copying the same bytes on the same machine is the reference for throughputs. */
+  auto copy = std::vector<uint8_t>(c.data.size());
+  const double copy_secs =
+      best_seconds([&] { std::memcpy(copy.data(), c.data.data(), copy.size()); });
+  if (ret == H5ZSPERR_OK) {
+    const double mb = double(c.data.size()) / 1e6;
+    res->ratio = double(c.data.size()) / double(enc_len);
+    res->encode_mbps = mb / enc_secs;
+    res->decode_mbps = mb / dec_secs;
+    res->encode_rel = copy_secs / enc_secs;
+    res->decode_rel = copy_secs / dec_secs;
+    if (copy != c.data)
+      res->failure = "memcpy() went wrong";
+    if (c.is_float)
+      check_errors<float>(c, dec, res);
+    else
+      check_errors<double>(c, dec, res);
+  }
+  std::free(enc);
+  std::free(dec);
+  return ret;
+}
+
+bool write_baseline(const std::string& path,
+                    double fingerprint,
+                    const std::vector<Case>& cases,
+                    const std::vector<Result>& results,
+                    const std::map<std::string, double>& old)
+{
+  auto get = [&old](const std::string& key, double fallback) {
+    auto it = old.find(key);
+    return it == old.end() ? fallback : it->second;
+  };
+  FILE* f = std::fopen(path.c_str(), "w");
+  if (!f)
+    return false;
+  std::fprintf(f, "{\n  \"tolerances\": {\"ratio\": %g, \"throughput\": %g},\n",
+               get("tolerances.ratio", 0.02), get("tolerances.throughput", 0.5));
+  std::fprintf(f, "  \"sperr_fingerprint\": %.0f,\n  \"cases\": {\n", fingerprint);
+  for (size_t i = 0; i < cases.size(); i++) {
+    const auto& r = results[i];
+    std::fprintf(f,
+                 "    \"%s\": {\"ratio\": %.4f, \"max_error\": %.6g, \"encode_rel\": %.4g, "
+                 "\"decode_rel\": %.4g}%s\n",
+                 cases[i].name.c_str(), r.ratio, r.max_error, r.encode_rel, r.decode_rel,
+                 i + 1 < cases.size() ? "," : "");
+  }
+  std::fprintf(f, "  }\n}\n");
+  return std::fclose(f) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc < 3) {
+    std::fprintf(stderr, "Usage: h5zsperr_perf test_data_dir baseline.json [--update]\n");
+    return 2;
+  }
+  const std::string baseline_path = argv[2];
+  const bool update = argc > 3 && std::strcmp(argv[3], "--update") == 0;
+#ifndef NDEBUG
+  if (update) {
+    std::fprintf(stderr, "Refusing to record a baseline from an unoptimized build\n");
+    return 2;
+  }
+#endif
+
+  auto baseline = std::map<std::string, double>();
+  auto text = std::vector<uint8_t>();
+  if (read_file(baseline_path, &text) &&
+      !Json(std::string(text.begin(), text.end())).parse(&baseline)) {
+    std::fprintf(stderr, "Cannot parse %s\n", baseline_path.c_str());
+    return 2;
+  }
+  const double ratio_tol = baseline.count("tolerances.ratio") ? baseline["tolerances.ratio"] : 0.02;
+  double speed_tol = baseline.count("tolerances.throughput") ? baseline["tolerances.throughput"]
+                                                             : 0.5;
+  const char* env = std::getenv("H5ZSPERR_PERF_THROUGHPUT_TOL");
+  if (env && *env)
+    speed_tol = std::atof(env);
+
+  /* A baseline of another SPERR build says nothing about this one. */
+  const double fingerprint = sperr_fingerprint();
+  const bool comparable = !update && baseline.count("sperr_fingerprint") &&
+                          baseline["sperr_fingerprint"] == fingerprint;
+  if (!update && !comparable)
+    std::printf("The baseline is of another SPERR build (fingerprint %.0f, this one %.0f); only "
+                "the error bounds are checked. `make perf_baseline` records one.\n",
+                baseline.count("sperr_fingerprint") ? baseline["sperr_fingerprint"] : 0.0,
+                fingerprint);
+
+  const auto cases = make_cases(argv[1]);
+  auto results = std::vector<Result>(cases.size());
+  int failures = 0;
+  std::printf("%-16s %10s %12s %12s %12s %12s %12s\n", "case", "ratio", "max error",
+              "encode MB/s", "decode MB/s", "enc/memcpy", "dec/memcpy");
+  for (size_t i = 0; i < cases.size(); i++) {
+    const auto& c = cases[i];
+    auto& r = results[i];
+    const int ret = run_case(c, &r);
+    if (ret)
+      r.failure = C_API::H5Z_SPERR_strerror(ret);
+    std::printf("%-16s %10.3f %12.4g %12.2f %12.2f %12.4f %12.4f\n", c.name.c_str(), r.ratio,
+                r.max_error, r.encode_mbps, r.decode_mbps, r.encode_rel, r.decode_rel);
+    if (update)
+      continue;
+    if (!r.failure.empty()) {
+      std::printf("  FAILED: %s\n", r.failure.c_str());
+      failures++;
+      continue;
+    }
+    if (!comparable)
+      continue;
+
+    /*
+     * Compare against the baseline, which records every metric of the cases that it knows of;
+     * `sign` is 1 for metrics that may not drop, and -1 for those that may not grow.
+     */
+    const std::string key = "cases." + c.name + ".";
+    auto regressed = [&](const char* metric, double val, double tol, int sign) {
+      auto it = baseline.find(key + metric);
+      if (it == baseline.end()) {
+        std::printf("  UNRECORDED: the baseline has no %s; run `make perf_baseline`\n", metric);
+        failures++;
+        return;
+      }
+      if (sign * (val - it->second * (1.0 - sign * tol)) >= 0.0)
+        return;
+      std::printf("  REGRESSION: %s %.4g is %s than the baseline %.4g (tolerance %g)\n", metric,
+                  val, sign > 0 ? "lower" : "higher", it->second, tol);
+      failures++;
+    };
+    regressed("ratio", r.ratio, ratio_tol, 1);
+    regressed("max_error", r.max_error, ratio_tol, -1);
+    regressed("encode_rel", r.encode_rel, speed_tol, 1);
+    regressed("decode_rel", r.decode_rel, speed_tol, 1);
+  }
+
+  if (update) {
+    if (!write_baseline(baseline_path, fingerprint, cases, results, baseline)) {
+      std::fprintf(stderr, "Cannot write %s\n", baseline_path.c_str());
+      return 2;
+    }
+    std::printf("Wrote %s\n", baseline_path.c_str());
+    return 0;
+  }
+  std::printf("%d regression(s) or failure(s)\n", failures);
+  return failures ? 1 : 0;
+}
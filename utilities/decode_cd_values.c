@@ -28,11 +28,21 @@ int main(int argc, char* argv[])
     case 3:
         printf("means fixed-PWE compression with a PWE tolerance of %.4g, ", quality);
       break;
+    case 4:
+        printf("means fixed-PWE compression with a PWE tolerance of %.4g capped at a bitrate of "
+               "%.2f, ", quality, H5Z_SPERR_decode_max_bpp((unsigned int)cd_values));
+      break;
+    case 5:
+        printf("means relative-PWE compression with a tolerance of %.4g of each chunk's range, ",
+               quality);
+      break;
     default:
         exit(1);
   }
 
-  if (swap)
+  if (swap == H5Z_SPERR_SWAP_AUTO)
+    printf("choosing rank orders for each chunk.\n");
+  else if (swap)
     printf("swapping rank orders.\n");
   else
     printf("without swapping rank orders.\n");
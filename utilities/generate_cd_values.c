@@ -1,18 +1,45 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "h5z-sperr.h"
 
 int main(int argc, char* argv[])
 {
-  if (argc < 3 || argc > 4) {
+  if (argc < 3 || argc > 5 || (argc == 5 && atoi(argv[1]) != 4)) {
     printf("Usage: ./generate_cd_values  compression_mode  compression_quality  [rank_swap_flag]\n");
+    printf("       ./generate_cd_values  4  PWE_tolerance  max_bitrate  [rank_swap_flag]\n");
+    printf("A rank_swap_flag of \"auto\" lets the filter decide for each chunk.\n");
     exit(1);
   }
 
   int mode = atoi(argv[1]);
   double quality = atof(argv[2]);
+  double max_bpp = 0.0;
   int swap = argc == 3 ? 0 : 1;
-  unsigned int cd_values = H5Z_SPERR_make_cd_values(mode, quality, swap);
+  if (argc == 4 && strcmp(argv[3], "auto") == 0)
+    swap = H5Z_SPERR_SWAP_AUTO;
+  unsigned int cd_values = 0;
+  if (mode == 4) {
+    if (argc < 4) {
+      printf("Mode 4 needs a PWE tolerance and a max bitrate.\n");
+      exit(1);
+    }
+    max_bpp = atof(argv[3]);
+    swap = argc == 4 ? 0 : 1;
+    if (argc == 5 && strcmp(argv[4], "auto") == 0)
+      swap = H5Z_SPERR_SWAP_AUTO;
+    if (quality <= 0.0 || max_bpp < 0.25 || max_bpp >= 64.0) {
+      printf("PWE tolerance should be greater than 0.0, and max bitrate in between of 0.25 and 64.0\n");
+      exit(1);
+    }
+    cd_values = H5Z_SPERR_make_capped_cd_values(quality, max_bpp, swap);
+  }
+  else if ((mode >= 1 && mode <= 3) || mode == 5)
+    cd_values = H5Z_SPERR_make_cd_values(mode, quality, swap);
+  else {
+    printf("Compression mode should be 1, 2, 3, 4, or 5\n");
+    exit(1);
+  }
 
   H5Z_SPERR_decode_cd_values(cd_values, &mode, &quality, &swap);
 
@@ -41,12 +68,27 @@ int main(int argc, char* argv[])
         exit(1);
       }
       break;
+    case 4:
+      printf("For fixed-PWE compression with a PWE tolerance of %.4g capped at a bitrate of %.2f,",
+             quality, H5Z_SPERR_decode_max_bpp(cd_values));
+      break;
+    case 5:
+      if (quality > 0.0)
+        printf("For relative-PWE compression with a tolerance of %.4g of each chunk's range,",
+               quality);
+      else {
+        printf("Relative PWE tolerance should be greater than 0.0.\n");
+        exit(1);
+      }
+      break;
     default:
-      printf("Compression mode should be 1, 2, or 3\n");
+      printf("Compression mode should be 1, 2, 3, 4, or 5\n");
         exit(1);
   }
 
-  if (swap)
+  if (swap == H5Z_SPERR_SWAP_AUTO)
+    printf(" choosing rank orders for each chunk,\n");
+  else if (swap)
     printf(" swapping rank orders,\n");
   else
     printf(" without swapping rank orders,\n");
@@ -0,0 +1,466 @@
+/*
+ * h5sperr-inspect: report per-chunk encoding statistics of H5Z-SPERR datasets without decoding.
+ *
+ * Only the header of each chunk (missing value mode, fill value, length of the compact bitmask,
+ * and the SPERR header) is looked at. When the file uses the default (sec2) driver, those few
+ * bytes are read directly from the file at the address reported by `H5Dget_chunk_info()`;
+ * otherwise, chunks are read whole using `H5Dread_chunk()`.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <hdf5.h>
+
+#include <SPERR_C_API.h>
+#include "h5z-sperr.h"
+#include "h5zsperr_codec.h"
+#include "h5zsperr_rate_alloc.h"
+
+namespace {
+
+struct Options {
+  bool all_chunks = false;
+  size_t top = 10;
+  size_t nbins = 10;
+  bool full_read = false;
+};
+
+struct ChunkStat {
+  std::vector<hsize_t> offset;
+  size_t stored = 0;
+  int missing_mode = -1; /* -1: stored unfiltered */
+  double fill_val = 0.0;
+  size_t mask_bytes = 0;
+  size_t sperr_bytes = 0;
+  size_t class_bytes = 0;
+  int num_vals = 0;
+  double max_error = 0.0; /* in compression mode 4 */
+  double range = 0.0;     /* in compression mode 5 */
+  bool swapped = false;   /* with automatic rank swaps */
+  bool demoted = false;   /* a double chunk compressed as floats */
+  bool residual = false;  /* residuals against a keyframe along time */
+  bool bad = false;
+  double bpp = 0.0;
+};
+
+// Reads the beginning of each chunk, either directly from the file or through HDF5.
+class HeadReader {
+ public:
+  HeadReader(hid_t file, bool full_read)
+  {
+    if (full_read)
+      return;
+    hid_t fapl = H5Fget_access_plist(file);
+    hid_t fcpl = H5Fget_create_plist(file);
+    const bool sec2 = H5Pget_driver(fapl) == H5FD_SEC2;
+    hsize_t userblock = 0;
+    H5Pget_userblock(fcpl, &userblock);
+    H5Pclose(fcpl);
+    H5Pclose(fapl);
+    ssize_t len = H5Fget_name(file, NULL, 0);
+    auto name = std::string(size_t(std::max<ssize_t>(len, 0)) + 1, '\0');
+    H5Fget_name(file, &name[0], name.size());
+    if (sec2 && len > 0) {
+      m_fd = open(name.c_str(), O_RDONLY);
+      m_base = haddr_t(userblock); /* chunk addresses are relative to the base address */
+    }
+  }
+  HeadReader(const HeadReader&) = delete;
+  HeadReader& operator=(const HeadReader&) = delete;
+  ~HeadReader()
+  {
+    if (m_fd >= 0)
+      close(m_fd);
+  }
+
+  // Read `len` bytes at `pos` of the chunk at `offset`, whose address is `addr`.
+  bool read(hid_t dset, const hsize_t* offset, haddr_t addr, size_t stored, size_t pos,
+            size_t len, uint8_t* dst)
+  {
+    if (m_fd >= 0)
+      return pread(m_fd, dst, len, off_t(m_base + addr + pos)) == ssize_t(len);
+
+    if (m_chunk_addr != addr || m_chunk.size() != stored) {
+      m_chunk.resize(stored);
+      uint32_t filter_mask = 0;
+      if (H5Dread_chunk(dset, H5P_DEFAULT, offset, &filter_mask, m_chunk.data()) < 0)
+        return false;
+      m_chunk_addr = addr;
+    }
+    std::copy(m_chunk.begin() + pos, m_chunk.begin() + pos + len, dst);
+    return true;
+  }
+
+ private:
+  int m_fd = -1;
+  haddr_t m_base = 0;
+  haddr_t m_chunk_addr = HADDR_UNDEF;
+  std::vector<uint8_t> m_chunk;
+};
+
+std::string offset_str(const std::vector<hsize_t>& offset)
+{
+  auto str = std::string("[");
+  for (size_t i = 0; i < offset.size(); i++)
+    str += (i ? "," : "") + std::to_string(offset[i]);
+  return str + "]";
+}
+
+void print_chunk(const ChunkStat& c)
+{
+  printf("  %-20s %10zu bytes %8.3f bpp", offset_str(c.offset).c_str(), c.stored, c.bpp);
+  if (c.bad)
+    printf("  CORRUPT");
+  else if (c.missing_mode < 0)
+    printf("  unfiltered");
+  else {
+    printf("  missing mode %d", c.missing_mode);
+    if (c.missing_mode >= 2 && c.missing_mode <= 4)
+      printf(" (fill %g)", c.fill_val);
+    if (c.missing_mode == 5)
+      printf(" (%d values, class map %zu bytes)", c.num_vals, c.class_bytes);
+    if (c.missing_mode != 0)
+      printf(", mask %zu bytes", c.mask_bytes);
+    if (c.max_error > 0.0)
+      printf(", max error %g", c.max_error);
+    if (c.range > 0.0)
+      printf(", range %g", c.range);
+    if (c.swapped)
+      printf(", swapped");
+    if (c.demoted)
+      printf(", as floats");
+    if (c.residual)
+      printf(", residuals");
+  }
+  printf("\n");
+}
+
+int inspect(hid_t file, const char* name, const Options& opt, HeadReader& reader)
+{
+  hid_t dset = H5Dopen(file, name, H5P_DEFAULT);
+  if (dset < 0) {
+    fprintf(stderr, "Cannot open dataset %s\n", name);
+    return 1;
+  }
+  hid_t dcpl = H5Dget_create_plist(dset);
+  unsigned int flags = 0, cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t cd_nelmts = H5Z_SPERR_MAX_CD_VALUES;
+  herr_t has_sperr = -1;
+  H5E_BEGIN_TRY
+  {
+    has_sperr = H5Pget_filter_by_id2(dcpl, H5Z_FILTER_SPERR, &flags, &cd_nelmts, cd, 0, NULL, NULL);
+  }
+  H5E_END_TRY;
+  H5Pclose(dcpl);
+  auto params = h5zsperr::ChunkParams();
+  if (has_sperr < 0 || h5zsperr::parse_cd_values(cd_nelmts, cd, &params) != H5ZSPERR_OK) {
+    H5Dclose(dset);
+    return 0; /* not an H5Z-SPERR dataset */
+  }
+  const size_t nelem = params.nelem();
+
+  /* Chunks of `h5sperr-repack -G` are held to a PSNR over the whole dataset, not each. */
+  double dataset_psnr = 0.0;
+  bool has_dataset_psnr = false;
+  if (H5Aexists(dset, H5Z_SPERR_PSNR_ATTR) > 0) {
+    hid_t attr = H5Aopen(dset, H5Z_SPERR_PSNR_ATTR, H5P_DEFAULT);
+    has_dataset_psnr = attr >= 0 && H5Aread(attr, H5T_NATIVE_DOUBLE, &dataset_psnr) >= 0;
+    if (attr >= 0)
+      H5Aclose(attr);
+  }
+
+  hid_t space = H5Dget_space(dset);
+  const int ndims = H5Sget_simple_extent_ndims(space);
+  hsize_t nchunks = 0;
+  H5Dget_num_chunks(dset, space, &nchunks);
+
+  // Collect per-chunk statistics.
+  auto stats = std::vector<ChunkStat>(nchunks);
+  uint8_t head[64];
+  for (hsize_t idx = 0; idx < nchunks; idx++) {
+    auto& c = stats[idx];
+    c.offset.resize(ndims);
+    unsigned filter_mask = 0;
+    haddr_t addr = 0;
+    hsize_t size = 0;
+    if (H5Dget_chunk_info(dset, space, idx, c.offset.data(), &filter_mask, &addr, &size) < 0) {
+      c.bad = true;
+      continue;
+    }
+    c.stored = size_t(size);
+    c.bpp = double(c.stored) * 8.0 / double(nelem);
+    if (filter_mask != 0)
+      continue;
+
+    // Components of compound or array values come one after another, behind an index of where
+    // each of them ends; look into the first one.
+    const auto cparams = params.ncomp ? params.component(0) : params;
+    size_t base = 0, body = c.stored;
+    if (params.ncomp) {
+      uint8_t index[4] = {};
+      uint32_t end = 0;
+      base = 4 * size_t(params.ncomp);
+      if (c.stored < base || !reader.read(dset, c.offset.data(), addr, c.stored, 0, 4, index)) {
+        c.bad = true;
+        continue;
+      }
+      std::memcpy(&end, index, 4);
+      if (end > c.stored - base) {
+        c.bad = true;
+        continue;
+      }
+      body = end;
+    }
+
+    auto layout = h5zsperr::ChunkLayout();
+    const size_t head_len = std::min(sizeof(head), body);
+    if (!reader.read(dset, c.offset.data(), addr, c.stored, base, head_len, head) ||
+        h5zsperr::parse_chunk_layout(cparams, head, head_len, body, &layout) != H5ZSPERR_OK) {
+      c.bad = true;
+      continue;
+    }
+    c.missing_mode = layout.missing_mode;
+    c.mask_bytes = layout.mask_bytes;
+    c.sperr_bytes = layout.sperr_bytes;
+    c.class_bytes = layout.class_bytes;
+    c.max_error = layout.max_error;
+    c.range = layout.range;
+    c.swapped = layout.swapped != 0;
+    c.demoted = layout.demoted != 0;
+    c.residual = layout.residual != 0;
+    if (layout.missing_mode == 5)
+      c.num_vals = int(layout.fill_bytes / (params.is_float ? 4 : 8)); /* only the number */
+    else if (layout.fill_bytes == 4) {
+      float v = 0.f;
+      std::copy(head + layout.fill_offset, head + layout.fill_offset + 4,
+                reinterpret_cast<uint8_t*>(&v));
+      c.fill_val = v;
+    }
+    else if (layout.fill_bytes == 8) {
+      std::copy(head + layout.fill_offset, head + layout.fill_offset + 8,
+                reinterpret_cast<uint8_t*>(&c.fill_val));
+    }
+
+    // Sub-blocks come with an index; make sure it has one entry per sub-block.
+    if (params.subblock) {
+      uint8_t count[4] = {};
+      uint32_t n = 0;
+      if (c.sperr_bytes < 4 || !reader.read(dset, c.offset.data(), addr, c.stored,
+                                            base + layout.sperr_offset, 4, count)) {
+        c.bad = true;
+        continue;
+      }
+      std::memcpy(&n, count, 4);
+      c.bad = (n != h5zsperr::BlockGrid(params).count());
+    }
+    // 3D SPERR bitstreams carry a header of their own; make sure it agrees with cd_values[].
+    else if (params.rank == 3) {
+      uint8_t sperr_head[32] = {};
+      const size_t len = std::min(sizeof(sperr_head), c.sperr_bytes);
+      size_t dimx = 0, dimy = 0, dimz = 0;
+      int is_float = 0;
+      if (len < 14 ||
+          !reader.read(dset, c.offset.data(), addr, c.stored, base + layout.sperr_offset, len,
+                       sperr_head)) {
+        c.bad = true;
+        continue;
+      }
+      C_API::sperr_parse_header(sperr_head, &dimx, &dimy, &dimz, &is_float);
+      /* Swapped chunks trade their slowest and fastest axes, as the codec does, and demoted
+       * double chunks are compressed as floats. */
+      size_t dims[3] = {cparams.dims[0], cparams.dims[1], cparams.dims[2]};
+      if (layout.swapped)
+        std::swap(dims[0], dims[2]);
+      c.bad = (dimx != dims[0] || dimy != dims[1] || dimz != dims[2] ||
+               is_float != (layout.demoted ? 1 : params.is_float));
+    }
+  }
+  H5Sclose(space);
+  H5Dclose(dset);
+
+  // Report.
+  size_t stored = 0, mask = 0, nbad = 0, nraw = 0;
+  auto nmode = std::map<int, size_t>();
+  double min_bpp = 0.0, max_bpp = 0.0, max_error = 0.0;
+  size_t ncapped = 0, nswapped = 0, ndemoted = 0, nresidual = 0;
+  for (const auto& c : stats) {
+    stored += c.stored;
+    mask += c.mask_bytes;
+    if (c.bad)
+      nbad++;
+    else if (c.missing_mode < 0)
+      nraw++;
+    else
+      nmode[c.missing_mode]++;
+    min_bpp = (&c == &stats[0]) ? c.bpp : std::min(min_bpp, c.bpp);
+    max_bpp = std::max(max_bpp, c.bpp);
+    max_error = std::max(max_error, c.max_error);
+    if (!c.bad && c.max_error > params.quality)
+      ncapped++;
+    if (!c.bad && c.swapped)
+      nswapped++;
+    if (!c.bad && c.demoted)
+      ndemoted++;
+    if (!c.bad && c.residual)
+      nresidual++;
+  }
+  const size_t raw = size_t(nchunks) * params.raw_bytes();
+  const char* types[] = {params.is_float ? "float" : "double", "int16 (as floats)",
+                         "uint16 (as floats)", "float16 (as floats)"};
+  printf("%s: %s, %dD chunks of %zu x %zu x %zu, compression mode %d, ", name,
+         types[params.source], params.rank, params.dims[0], params.dims[1], params.dims[2],
+         params.comp_mode);
+  if (has_dataset_psnr)
+    printf("bitrates picked per chunk for a PSNR of %g dB over the dataset\n", dataset_psnr);
+  else
+    printf("quality %g\n", params.quality);
+  printf("  %" PRIuHSIZE " chunks written, %zu bytes stored, ratio %.2f, %.3f bpp on average\n",
+         nchunks, stored, stored ? double(raw) / double(stored) : 0.0,
+         nchunks ? double(stored) * 8.0 / double(size_t(nchunks) * nelem) : 0.0);
+  for (const auto& m : nmode)
+    printf("  %zu chunks in missing value mode %d\n", m.second, m.first);
+  if (params.ncomp)
+    printf("  %d components in each value of %zu bytes; the chunk statistics are of the first\n",
+           params.ncomp, params.elem_size);
+  if (params.effort != H5Z_SPERR_EFFORT_BALANCED)
+    printf("  compressed with the %s effort preset%s\n",
+           params.effort == H5Z_SPERR_EFFORT_FAST ? "fast" : "max",
+           params.effort == H5Z_SPERR_EFFORT_FAST && !h5zsperr::fast_effort_applies(params)
+               ? ", which has no effect on these chunks"
+               : "");
+  if (params.subblock)
+    printf("  %zu sub-blocks of edge length %zu in each chunk\n",
+           h5zsperr::BlockGrid(params).count(), params.subblock);
+  if (params.swap == H5Z_SPERR_SWAP_AUTO)
+    printf("  %zu chunks have their rank orders swapped\n", nswapped);
+  if (ndemoted)
+    printf("  %zu chunks are compressed as floats\n", ndemoted);
+  if (nresidual)
+    printf("  %zu chunks hold residuals against keyframes; read them using "
+           "H5Z_SPERR_read_temporal()\n",
+           nresidual);
+  if (params.comp_mode == 4)
+    printf("  %zu chunks hit the bitrate cap of %g; max error %g\n", ncapped, params.max_bpp,
+           max_error);
+  printf("  bitmasks take %zu bytes (%.2f%%)\n", mask,
+         stored ? 100.0 * double(mask) / double(stored) : 0.0);
+  if (nraw)
+    printf("  %zu chunks are stored unfiltered\n", nraw);
+  if (nbad)
+    printf("  %zu chunks are CORRUPT\n", nbad);
+
+  // Histogram of bits-per-value.
+  if (nchunks && opt.nbins) {
+    const double width = (max_bpp - min_bpp) / double(opt.nbins);
+    auto bins = std::vector<size_t>(opt.nbins, 0);
+    for (const auto& c : stats) {
+      size_t b = width > 0.0 ? size_t((c.bpp - min_bpp) / width) : 0;
+      bins[std::min(b, opt.nbins - 1)]++;
+    }
+    const size_t peak = *std::max_element(bins.begin(), bins.end());
+    printf("  bits-per-value histogram:\n");
+    for (size_t b = 0; b < opt.nbins; b++) {
+      printf("  %9.3f - %9.3f %8zu ", min_bpp + width * double(b),
+             min_bpp + width * double(b + 1), bins[b]);
+      const size_t bar = peak ? (bins[b] * 40 + peak - 1) / peak : 0;
+      printf("%s\n", std::string(bar, '#').c_str());
+      if (width <= 0.0)
+        break;
+    }
+  }
+
+  if (opt.all_chunks) {
+    printf("  all chunks:\n");
+    for (const auto& c : stats)
+      print_chunk(c);
+  }
+  else if (opt.top && nchunks) {
+    const size_t n = std::min(opt.top, stats.size());
+    std::partial_sort(stats.begin(), stats.begin() + n, stats.end(),
+                      [](const ChunkStat& a, const ChunkStat& b) { return a.stored > b.stored; });
+    printf("  %zu largest chunks:\n", n);
+    for (size_t i = 0; i < n; i++)
+      print_chunk(stats[i]);
+  }
+
+  return nbad ? 1 : 0;
+}
+
+herr_t collect_dataset(hid_t, const char* name, const H5O_info_t* info, void* list)
+{
+  if (info->type == H5O_TYPE_DATASET)
+    static_cast<std::vector<std::string>*>(list)->emplace_back(name);
+  return 0;
+}
+
+void usage()
+{
+  printf(
+      "Usage: h5sperr-inspect [options] file.h5 [dataset ...]\n"
+      "  -a           list all chunks\n"
+      "  -n num       list the num largest chunks (default: 10)\n"
+      "  -b bins      number of bins of the bits-per-value histogram (default: 10)\n"
+      "  -f           read whole chunks through HDF5 instead of reading headers from the file\n"
+      "Without dataset names, all H5Z-SPERR datasets are inspected.\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  auto opt = Options();
+  int c = 0;
+  while ((c = getopt(argc, argv, "an:b:f")) != -1) {
+    switch (c) {
+      case 'a':
+        opt.all_chunks = true;
+        break;
+      case 'n':
+        opt.top = size_t(atol(optarg));
+        break;
+      case 'b':
+        opt.nbins = size_t(atol(optarg));
+        break;
+      case 'f':
+        opt.full_read = true;
+        break;
+      default:
+        usage();
+        exit(1);
+    }
+  }
+  if (argc - optind < 1) {
+    usage();
+    exit(1);
+  }
+
+  hid_t file = H5Fopen(argv[optind], H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (file < 0) {
+    fprintf(stderr, "Cannot open %s\n", argv[optind]);
+    exit(1);
+  }
+
+  auto names = std::vector<std::string>(argv + optind + 1, argv + argc);
+  if (names.empty())
+    H5Ovisit(file, H5_INDEX_NAME, H5_ITER_NATIVE, collect_dataset, &names);
+
+  int ret = 0;
+  {
+    HeadReader reader(file, opt.full_read);
+    for (const auto& name : names)
+      ret |= inspect(file, name.c_str(), opt, reader);
+  }
+
+  H5Fclose(file);
+  return ret;
+}
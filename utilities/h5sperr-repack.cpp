@@ -0,0 +1,867 @@
+/*
+ * h5sperr-repack: (re)compress floating-point datasets with H5Z-SPERR.
+ *
+ * Input datasets can be uncompressed, deflate-compressed (optionally with shuffle), or
+ * already SPERR-compressed. Chunks stream through a bounded pipeline:
+ *
+ *    read (H5Dread_chunk) --> decode --> SPERR encode --> write (H5Dwrite_chunk)
+ *
+ * All HDF5 calls happen on the main thread, while decoding and encoding run on N worker threads.
+ * The total amount of memory held by chunks in flight is capped. Chunks with other filters
+ * in their pipeline are read (and decoded) through `H5Dread()` on the main thread instead.
+ *
+ * With a PSNR target over each whole dataset (-G), chunks go through the pipeline twice: first
+ * to encode each of them at a ladder of bitrates, and then to encode each at the bitrate that
+ * the dataset-wide allocation picked for it (see h5zsperr_rate_alloc.h).
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <H5PLextern.h>
+#include <hdf5.h>
+
+#ifdef H5ZSPERR_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "h5z-sperr-chunk.h"
+#include "h5z-sperr.h"
+#include "h5zsperr_codec.h"
+#include "h5zsperr_rate_alloc.h"
+
+using C_API::H5Z_SPERR_decode_chunk;
+using C_API::H5Z_SPERR_encode_chunk;
+using C_API::H5Z_SPERR_encode_chunk_map;
+using C_API::H5Z_SPERR_strerror;
+
+namespace {
+
+struct Options {
+  int mode = 0;
+  double quality = 0.0;
+  double max_bpp = 0.0; /* in mode 4 */
+  int swap = 0;
+  int missing_mode = -1;          /* -1: keep what the input uses, or 6 */
+  std::vector<double> missing_vals; /* in missing value mode 3, 4, or 5 */
+  int subblock = 0;                 /* the edge length of sub-blocks; 0 means none */
+  int effort = H5Z_SPERR_EFFORT_BALANCED;
+  size_t nthreads = 0;
+  size_t mem_cap = size_t(1024) << 20;
+  bool progress = false;
+  bool global = false; /* meet the PSNR target over each dataset rather than each chunk */
+  std::vector<hsize_t> chunk_dims; /* for contiguous inputs */
+  std::vector<size_t> map_dims;    /* of the tolerance map, if any */
+  std::vector<float> map_factors;
+};
+
+// How the raw bytes of an input chunk are decoded.
+enum class InputKind { raw, deflate, sperr, library };
+
+struct Job {
+  std::vector<hsize_t> offset;
+  std::vector<uint8_t> in; /* raw chunk bytes; or decoded values when `decoded` is true */
+  bool decoded = false;
+  void* out = nullptr; /* encoded chunk, allocated using malloc() */
+  size_t out_len = 0;
+  size_t charge = 0; /* memory counted against the cap */
+  size_t index = 0;  /* of the chunk in the dataset */
+  unsigned int rate_word = 0; /* replaces the output cd_values[1] when not 0 */
+  std::vector<h5zsperr::RatePoint> trials; /* at each trial bitrate, with -G */
+  h5zsperr::ValueStats stats;
+  int status = H5ZSPERR_OK;
+  std::string error;
+};
+
+//
+// A bounded pipeline: the main thread submits jobs and collects results,
+// worker threads decode and encode.
+//
+class Pipeline {
+ public:
+  using Work = void (*)(Job&, const void* ctx);
+
+  Pipeline(size_t nthreads, size_t mem_cap, Work work, const void* ctx)
+      : m_cap(mem_cap), m_work(work), m_ctx(ctx)
+  {
+    for (size_t i = 0; i < nthreads; i++)
+      m_threads.emplace_back([this] { m_run(); });
+  }
+
+  ~Pipeline()
+  {
+    {
+      std::lock_guard<std::mutex> lk(m_mtx);
+      m_stop = true;
+    }
+    m_todo_cv.notify_all();
+    for (auto& t : m_threads)
+      t.join();
+  }
+
+  // Whether a job of `charge` bytes fits under the memory cap right now.
+  // A job is always admitted when nothing else is in flight.
+  bool fits(size_t charge)
+  {
+    std::lock_guard<std::mutex> lk(m_mtx);
+    return m_inflight == 0 || m_inflight + charge <= m_cap;
+  }
+
+  void submit(Job* job)
+  {
+    {
+      std::lock_guard<std::mutex> lk(m_mtx);
+      m_inflight += job->charge;
+      m_todo.push_back(job);
+    }
+    m_todo_cv.notify_one();
+  }
+
+  // Take one finished job; block until there's one if `wait` is true.
+  Job* collect(bool wait)
+  {
+    std::unique_lock<std::mutex> lk(m_mtx);
+    if (wait)
+      m_done_cv.wait(lk, [this] { return !m_done.empty(); });
+    if (m_done.empty())
+      return nullptr;
+    Job* job = m_done.front();
+    m_done.pop_front();
+    m_inflight -= job->charge;
+    return job;
+  }
+
+ private:
+  size_t m_cap = 0;
+  size_t m_inflight = 0;
+  Work m_work = nullptr;
+  const void* m_ctx = nullptr;
+  bool m_stop = false;
+  std::mutex m_mtx;
+  std::condition_variable m_todo_cv, m_done_cv;
+  std::deque<Job*> m_todo, m_done;
+  std::vector<std::thread> m_threads;
+
+  void m_run()
+  {
+    while (true) {
+      Job* job = nullptr;
+      {
+        std::unique_lock<std::mutex> lk(m_mtx);
+        m_todo_cv.wait(lk, [this] { return m_stop || !m_todo.empty(); });
+        if (m_todo.empty())
+          return;
+        job = m_todo.front();
+        m_todo.pop_front();
+      }
+      m_work(*job, m_ctx);
+      {
+        std::lock_guard<std::mutex> lk(m_mtx);
+        m_done.push_back(job);
+      }
+      m_done_cv.notify_one();
+    }
+  }
+};
+
+// Everything a worker needs to know about the dataset being repacked.
+struct DatasetCtx {
+  InputKind kind = InputKind::raw;
+  bool shuffled = false;
+  size_t elem_size = 4;
+  size_t raw_bytes = 0;
+  std::vector<unsigned int> in_cd;  /* stored cd_values of a SPERR input */
+  std::vector<unsigned int> out_cd; /* stored cd_values of the output */
+  std::vector<int> map_axes;        /* the axes that the tolerance map covers; empty means none */
+  C_API::H5Z_SPERR_quality_map map = {};
+  std::vector<unsigned int> trial_words; /* the bitrates to try; empty unless trying them */
+};
+
+void unshuffle(const uint8_t* src, uint8_t* dst, size_t nbytes, size_t elem_size)
+{
+  const size_t nelem = nbytes / elem_size;
+  for (size_t b = 0; b < elem_size; b++)
+    for (size_t i = 0; i < nelem; i++)
+      dst[i * elem_size + b] = src[b * nelem + i];
+}
+
+void work(Job& job, const void* ctx_ptr)
+{
+  const auto& ctx = *static_cast<const DatasetCtx*>(ctx_ptr);
+
+  // Step 1: decode the input chunk, unless it's already done.
+  std::vector<uint8_t> values;
+  const uint8_t* data = job.in.data();
+  if (!job.decoded) {
+    switch (ctx.kind) {
+      case InputKind::sperr: {
+        void* dec = nullptr;
+        size_t dec_len = 0;
+        job.status = H5Z_SPERR_decode_chunk(ctx.in_cd.size(), ctx.in_cd.data(), job.in.data(),
+                                            job.in.size(), &dec, &dec_len);
+        if (job.status) {
+          job.error = H5Z_SPERR_strerror(job.status);
+          return;
+        }
+        values.assign(static_cast<uint8_t*>(dec), static_cast<uint8_t*>(dec) + dec_len);
+        std::free(dec);
+        data = values.data();
+        break;
+      }
+#ifdef H5ZSPERR_HAVE_ZLIB
+      case InputKind::deflate: {
+        values.resize(ctx.raw_bytes);
+        uLongf len = ctx.raw_bytes;
+        if (uncompress(values.data(), &len, job.in.data(), job.in.size()) != Z_OK ||
+            len != ctx.raw_bytes) {
+          job.status = H5ZSPERR_ERR_CORRUPT;
+          job.error = "inflating a deflate chunk failed";
+          return;
+        }
+        if (ctx.shuffled) {
+          job.in.resize(ctx.raw_bytes);
+          unshuffle(values.data(), job.in.data(), ctx.raw_bytes, ctx.elem_size);
+          values.swap(job.in);
+        }
+        data = values.data();
+        break;
+      }
+#endif
+      default:
+        break;
+    }
+  }
+  if (data == job.in.data() && job.in.size() != ctx.raw_bytes) {
+    job.status = H5ZSPERR_ERR_SIZE;
+    job.error = "unexpected chunk size";
+    return;
+  }
+
+  // Step 2: encode with the new settings, at the allocated bitrate, or at each trial bitrate.
+  if (!ctx.trial_words.empty()) {
+    job.trials.resize(ctx.trial_words.size());
+    job.status = h5zsperr::trial_encode(ctx.out_cd.size(), ctx.out_cd.data(), data,
+                                        ctx.raw_bytes, ctx.trial_words.data(),
+                                        ctx.trial_words.size(), job.trials.data(), &job.stats);
+  }
+  else if (job.rate_word) {
+    auto cd = ctx.out_cd;
+    cd[1] = job.rate_word;
+    job.status =
+        H5Z_SPERR_encode_chunk(cd.size(), cd.data(), data, ctx.raw_bytes, &job.out, &job.out_len);
+  }
+  else if (ctx.map_axes.empty()) {
+    job.status = H5Z_SPERR_encode_chunk(ctx.out_cd.size(), ctx.out_cd.data(), data,
+                                        ctx.raw_bytes, &job.out, &job.out_len);
+  }
+  else {
+    size_t offset[3] = {0, 0, 0};
+    for (size_t i = 0; i < ctx.map_axes.size(); i++)
+      offset[i] = size_t(job.offset[ctx.map_axes[i]]);
+    job.status = H5Z_SPERR_encode_chunk_map(ctx.out_cd.size(), ctx.out_cd.data(), data,
+                                            ctx.raw_bytes, &ctx.map, offset, &job.out,
+                                            &job.out_len);
+  }
+  if (job.status)
+    job.error = H5Z_SPERR_strerror(job.status);
+
+  // Release the input early to keep the memory footprint low.
+  std::vector<uint8_t>().swap(job.in);
+}
+
+// Read the stored cd_values[] of the SPERR filter in a dataset creation property list.
+std::vector<unsigned int> sperr_cd_values(hid_t dcpl)
+{
+  unsigned int flags = 0, cd[H5Z_SPERR_MAX_CD_VALUES];
+  size_t nelmts = H5Z_SPERR_MAX_CD_VALUES;
+  if (H5Pget_filter_by_id2(dcpl, H5Z_FILTER_SPERR, &flags, &nelmts, cd, 0, NULL, NULL) < 0)
+    return {};
+  return std::vector<unsigned int>(cd, cd + nelmts);
+}
+
+// Figure out how chunks of the input dataset can be decoded outside of the HDF5 library.
+InputKind input_kind(hid_t dcpl, bool* shuffled)
+{
+  *shuffled = false;
+  const int nfilters = H5Pget_nfilters(dcpl);
+  std::vector<H5Z_filter_t> ids;
+  for (int i = 0; i < nfilters; i++) {
+    unsigned int flags = 0, cd[8];
+    size_t nelmts = 8;
+    ids.push_back(H5Pget_filter2(dcpl, unsigned(i), &flags, &nelmts, cd, 0, NULL, NULL));
+  }
+
+  if (ids.empty())
+    return InputKind::raw;
+  if (ids.size() == 1 && ids[0] == H5Z_FILTER_SPERR)
+    return InputKind::sperr;
+#ifdef H5ZSPERR_HAVE_ZLIB
+  if (ids.size() == 1 && ids[0] == H5Z_FILTER_DEFLATE)
+    return InputKind::deflate;
+  if (ids.size() == 2 && ids[0] == H5Z_FILTER_SHUFFLE && ids[1] == H5Z_FILTER_DEFLATE) {
+    *shuffled = true;
+    return InputKind::deflate;
+  }
+#endif
+  return InputKind::library;
+}
+
+// Copy all attributes of one object to another, except the dataset PSNR of an earlier -G.
+herr_t copy_attr(hid_t loc, const char* name, const H5A_info_t*, void* dst_ptr)
+{
+  const hid_t dst = *static_cast<hid_t*>(dst_ptr);
+  if (std::strcmp(name, H5Z_SPERR_PSNR_ATTR) == 0)
+    return 0;
+  hid_t attr = H5Aopen(loc, name, H5P_DEFAULT);
+  hid_t type = H5Aget_type(attr);
+  hid_t space = H5Aget_space(attr);
+  const size_t npoints = size_t(H5Sget_simple_extent_npoints(space));
+  auto buf = std::vector<uint8_t>(std::max<size_t>(1, npoints) * H5Tget_size(type));
+  herr_t ret = H5Aread(attr, type, buf.data());
+  if (ret >= 0) {
+    hid_t out = H5Acreate2(dst, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+    ret = H5Awrite(out, type, buf.data());
+    H5Aclose(out);
+    if (H5Tdetect_class(type, H5T_VLEN) > 0 || H5Tis_variable_str(type) > 0)
+      H5Dvlen_reclaim(type, space, H5P_DEFAULT, buf.data());
+  }
+  H5Sclose(space);
+  H5Tclose(type);
+  H5Aclose(attr);
+  return ret;
+}
+
+int repack(hid_t in_file, hid_t out_file, const char* name, const Options& opt)
+{
+  hid_t in = H5Dopen(in_file, name, H5P_DEFAULT);
+  if (in < 0) {
+    fprintf(stderr, "Cannot open dataset %s\n", name);
+    return 1;
+  }
+  hid_t ftype = H5Dget_type(in);
+  hid_t space = H5Dget_space(in);
+  hid_t in_dcpl = H5Dget_create_plist(in);
+  const int ndims = H5Sget_simple_extent_ndims(space);
+  auto dims = std::vector<hsize_t>(std::max(ndims, 0));
+  H5Sget_simple_extent_dims(space, dims.data(), NULL);
+
+  auto cleanup = [&](int ret) {
+    H5Pclose(in_dcpl);
+    H5Sclose(space);
+    H5Tclose(ftype);
+    H5Dclose(in);
+    return ret;
+  };
+
+  if (H5Tget_class(ftype) != H5T_FLOAT || (H5Tget_size(ftype) != 4 && H5Tget_size(ftype) != 8)) {
+    fprintf(stderr, "Skipping %s: not a float or double dataset\n", name);
+    return cleanup(1);
+  }
+  const bool is_float = H5Tget_size(ftype) == 4;
+  hid_t mtype = is_float ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE;
+
+  // Decide on the chunk dimensions and how to decode input chunks.
+  auto ctx = DatasetCtx();
+  ctx.elem_size = is_float ? 4 : 8;
+  auto chunks = std::vector<hsize_t>(dims.size());
+  if (H5Pget_layout(in_dcpl) == H5D_CHUNKED) {
+    H5Pget_chunk(in_dcpl, ndims, chunks.data());
+    ctx.kind = input_kind(in_dcpl, &ctx.shuffled);
+    if (ctx.kind == InputKind::sperr)
+      ctx.in_cd = sperr_cd_values(in_dcpl);
+  }
+  else if (opt.chunk_dims.size() == dims.size()) {
+    chunks = opt.chunk_dims;
+    ctx.kind = InputKind::library;
+  }
+  else {
+    fprintf(stderr, "Skipping %s: not chunked; please specify chunk dimensions with -c\n", name);
+    return cleanup(1);
+  }
+  size_t chunk_nelem = 1;
+  for (size_t i = 0; i < dims.size(); i++) {
+    chunk_nelem *= chunks[i];
+    if (dims[i] % chunks[i]) {
+      fprintf(stderr, "Skipping %s: dimensions are not divisible by chunk dimensions\n", name);
+      return cleanup(1);
+    }
+  }
+  ctx.raw_bytes = chunk_nelem * ctx.elem_size;
+
+  // Create the output dataset.
+  int missing_mode = opt.missing_mode;
+  auto missing_vals = opt.missing_vals;
+  auto in_params = h5zsperr::ChunkParams();
+  if (missing_mode < 0) {
+    missing_mode = 6;
+    if (ctx.kind == InputKind::sperr &&
+        h5zsperr::parse_cd_values(ctx.in_cd.size(), ctx.in_cd.data(), &in_params) == H5ZSPERR_OK) {
+      missing_mode = in_params.missing_val_mode;
+      if (missing_mode == 3 || missing_mode == 4)
+        missing_vals.assign(1, in_params.missing_val);
+      else if (missing_mode == 5)
+        missing_vals.assign(in_params.sentinels, in_params.sentinels + in_params.num_sentinels);
+    }
+  }
+  unsigned int user_cd[H5Z_SPERR_MAX_CD_VALUES] = {
+      opt.mode == 4 ? H5Z_SPERR_make_capped_cd_values(opt.quality, opt.max_bpp, opt.swap)
+                    : H5Z_SPERR_make_cd_values(opt.mode, opt.quality, opt.swap),
+      unsigned(missing_mode)};
+  size_t user_cd_nelmts = 2;
+  if ((missing_mode == 3 || missing_mode == 4) && !missing_vals.empty()) {
+    if (is_float) {
+      const float val = float(missing_vals[0]);
+      std::memcpy(&user_cd[2], &val, sizeof(val));
+      user_cd[1] = 3;
+      user_cd_nelmts = 3;
+    }
+    else {
+      std::memcpy(&user_cd[2], &missing_vals[0], sizeof(double));
+      user_cd[1] = 4;
+      user_cd_nelmts = 4;
+    }
+  }
+  else if (missing_mode == 3 || missing_mode == 4) {
+    /* Let the filter take the fill value of the input dataset. */
+    H5D_fill_value_t status = H5D_FILL_VALUE_UNDEFINED;
+    H5Pfill_value_defined(in_dcpl, &status);
+    if (status != H5D_FILL_VALUE_USER_DEFINED) {
+      fprintf(stderr, "Skipping %s: missing value mode %d needs a missing value\n", name,
+              missing_mode);
+      return cleanup(1);
+    }
+  }
+  else if (missing_mode == 5) {
+    if (missing_vals.empty() || missing_vals.size() > H5Z_SPERR_MAX_SENTINELS) {
+      fprintf(stderr, "Skipping %s: missing value mode 5 needs 1 to %d missing values\n", name,
+              H5Z_SPERR_MAX_SENTINELS);
+      return cleanup(1);
+    }
+    user_cd[2] = unsigned(missing_vals.size());
+    std::memcpy(&user_cd[3], missing_vals.data(), missing_vals.size() * sizeof(double));
+    user_cd_nelmts = 3 + 2 * missing_vals.size();
+  }
+  if (opt.subblock)
+    user_cd[1] |= H5Z_SPERR_make_subblocks(opt.subblock);
+  user_cd[1] |= H5Z_SPERR_make_effort(opt.effort);
+  H5D_fill_value_t fill_status = H5D_FILL_VALUE_UNDEFINED;
+  hid_t out_dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(out_dcpl, ndims, chunks.data());
+  if (H5Pfill_value_defined(in_dcpl, &fill_status) >= 0 &&
+      fill_status == H5D_FILL_VALUE_USER_DEFINED) {
+    auto fill = std::vector<uint8_t>(ctx.elem_size);
+    H5Pget_fill_value(in_dcpl, ftype, fill.data());
+    H5Pset_fill_value(out_dcpl, ftype, fill.data());
+  }
+  H5Pset_filter(out_dcpl, H5Z_FILTER_SPERR, H5Z_FLAG_MANDATORY, user_cd_nelmts, user_cd);
+  hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+  H5Pset_create_intermediate_group(lcpl, 1);
+  hid_t out = H5Dcreate2(out_file, name, ftype, space, lcpl, out_dcpl, H5P_DEFAULT);
+  H5Pclose(lcpl);
+  H5Pclose(out_dcpl);
+  if (out < 0) {
+    fprintf(stderr, "Cannot create output dataset %s\n", name);
+    return cleanup(1);
+  }
+  H5Aiterate2(in, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, copy_attr, &out);
+  out_dcpl = H5Dget_create_plist(out);
+  ctx.out_cd = sperr_cd_values(out_dcpl);
+  H5Pclose(out_dcpl);
+  auto out_params = h5zsperr::ChunkParams();
+  if (opt.effort == H5Z_SPERR_EFFORT_FAST &&
+      h5zsperr::parse_cd_values(ctx.out_cd.size(), ctx.out_cd.data(), &out_params) ==
+          H5ZSPERR_OK &&
+      !h5zsperr::fast_effort_applies(out_params))
+    fprintf(stderr, "%s: the fast effort preset has no effect on these chunks; see the README\n",
+            name);
+
+  // The tolerance map covers the axes along which chunks are longer than 1, stretched to fit.
+  if (!opt.map_dims.empty()) {
+    for (size_t i = 0; i < dims.size(); i++)
+      if (chunks[i] > 1)
+        ctx.map_axes.push_back(int(i));
+    if (ctx.map_axes.size() == opt.map_dims.size()) {
+      ctx.map.rank = int(opt.map_dims.size());
+      ctx.map.factors = opt.map_factors.data();
+      for (size_t i = 0; i < opt.map_dims.size(); i++) {
+        const size_t len = size_t(dims[ctx.map_axes[i]]);
+        ctx.map.dims[i] = opt.map_dims[i];
+        ctx.map.cell[i] = std::max<size_t>((len + opt.map_dims[i] - 1) / opt.map_dims[i], 1);
+      }
+    }
+    else {
+      fprintf(stderr,
+              "%s: the rank of the tolerance map differs from that of its chunks; not using it\n",
+              name);
+      ctx.map_axes.clear();
+    }
+  }
+
+  // The grid of chunks.
+  size_t nchunks = 1;
+  auto grid = std::vector<hsize_t>(dims.size());
+  for (size_t i = 0; i < dims.size(); i++) {
+    grid[i] = dims[i] / chunks[i];
+    nchunks *= grid[i];
+  }
+
+  size_t nthreads = opt.nthreads;
+  if (nthreads == 0)
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+  Pipeline pipe(nthreads, opt.mem_cap, work, &ctx);
+  size_t inflight = 0, nwritten = 0, in_bytes = 0, out_bytes = 0;
+  int ret = 0;
+  auto start = std::chrono::steady_clock::now();
+  auto last_report = start;
+
+  // With -G, the trial pass fills in the error and size of every chunk at every trial bitrate.
+  if (opt.global)
+    for (double rate : h5zsperr::trial_bitrates(is_float))
+      ctx.trial_words.push_back(H5Z_SPERR_make_cd_values(1, rate, opt.swap));
+  const size_t ntrials = ctx.trial_words.size();
+  auto trials = std::vector<h5zsperr::RatePoint>(nchunks * ntrials);
+  auto tried = std::vector<size_t>();     /* the chunks that were tried, in order */
+  auto rate_words = std::vector<unsigned int>(); /* per chunk, once allocated */
+  auto stats = h5zsperr::ValueStats();
+
+  auto report = [&](bool final) {
+    const auto now = std::chrono::steady_clock::now();
+    if (!opt.progress || (!final && now - last_report < std::chrono::seconds(1)))
+      return;
+    last_report = now;
+    const double secs = std::chrono::duration<double>(now - start).count();
+    const double mbps = double(nwritten) * ctx.raw_bytes / 1e6 / std::max(secs, 1e-9);
+    if (!ctx.trial_words.empty())
+      fprintf(stderr, "\r%s: %zu / %zu chunks tried, %.1f MB/s", name, nwritten, nchunks, mbps);
+    else
+      fprintf(stderr, "\r%s: %zu / %zu chunks, %.1f MB/s, ratio %.2f", name, nwritten, nchunks,
+              mbps, out_bytes ? double(nwritten) * ctx.raw_bytes / double(out_bytes) : 0.0);
+    if (final)
+      fprintf(stderr, "\n");
+  };
+
+  // Write a finished job to the output dataset, or keep its trials, on the main thread.
+  auto finish = [&](Job* job) {
+    inflight--;
+    if (job->status) {
+      fprintf(stderr, "%s: chunk failed: %s\n", name, job->error.c_str());
+      ret = 1;
+    }
+    else if (!ctx.trial_words.empty()) {
+      std::copy(job->trials.begin(), job->trials.end(), trials.begin() + job->index * ntrials);
+      tried.push_back(job->index);
+      stats.merge(job->stats);
+    }
+    else if (H5Dwrite_chunk(out, H5P_DEFAULT, 0, job->offset.data(), job->out_len, job->out) < 0) {
+      fprintf(stderr, "%s: H5Dwrite_chunk failed\n", name);
+      ret = 1;
+    }
+    out_bytes += job->out_len;
+    nwritten++;
+    std::free(job->out);
+    delete job;
+    report(false);
+  };
+
+  // Walk through all the chunks once.
+  auto walk = [&]() {
+    auto offset = std::vector<hsize_t>(dims.size());
+    for (size_t c = 0; c < nchunks && ret == 0; c++) {
+      size_t rem = c;
+      for (size_t i = dims.size(); i-- > 0;) {
+        offset[i] = (rem % grid[i]) * chunks[i];
+        rem /= grid[i];
+      }
+
+      auto job = new Job;
+      job->offset = offset;
+      job->index = c;
+      if (!rate_words.empty())
+        job->rate_word = rate_words[c];
+      uint32_t filter_mask = 0;
+      hsize_t stored = 0;
+      if (ctx.kind != InputKind::library) {
+        if (H5Dget_chunk_storage_size(in, offset.data(), &stored) < 0 || stored == 0) {
+          delete job; /* never written; leave it to the fill value */
+          nwritten++;
+          continue;
+        }
+      }
+      job->charge = size_t(stored) + 2 * ctx.raw_bytes;
+
+      // Wait for room under the memory cap, writing out finished chunks meanwhile.
+      while (!pipe.fits(job->charge))
+        finish(pipe.collect(true));
+      while (Job* done = pipe.collect(false))
+        finish(done);
+
+      herr_t status = 0;
+      if (ctx.kind != InputKind::library) {
+        job->in.resize(stored);
+        status = H5Dread_chunk(in, H5P_DEFAULT, offset.data(), &filter_mask, job->in.data());
+      }
+      if (ctx.kind == InputKind::library || filter_mask != 0) {
+        /* Let the HDF5 library read and decode this chunk. */
+        job->in.resize(ctx.raw_bytes);
+        hid_t fspace = H5Scopy(space);
+        hid_t mspace = H5Screate_simple(ndims, chunks.data(), NULL);
+        H5Sselect_hyperslab(fspace, H5S_SELECT_SET, offset.data(), NULL, chunks.data(), NULL);
+        status = H5Dread(in, mtype, mspace, fspace, H5P_DEFAULT, job->in.data());
+        H5Sclose(mspace);
+        H5Sclose(fspace);
+        job->decoded = true;
+      }
+      if (status < 0) {
+        fprintf(stderr, "%s: reading chunk %zu failed\n", name, c);
+        delete job;
+        ret = 1;
+        break;
+      }
+      in_bytes += stored;
+      pipe.submit(job);
+      inflight++;
+    }
+
+    // Drain the pipeline.
+    while (inflight > 0)
+      finish(pipe.collect(true));
+    report(true);
+  };
+  walk();
+
+  // Pick the bitrate of each chunk so that the whole dataset meets the PSNR target, where
+  // PSNR = 10 log10(range^2 / MSE) over the valid values, and then encode at those bitrates.
+  if (opt.global && ret == 0) {
+    const double range = stats.hi - stats.lo;
+    const double mse_target = range * range * std::pow(10.0, -opt.quality / 10.0);
+    const double budget = mse_target * double(stats.nvalid);
+    auto points = std::vector<h5zsperr::RatePoint>();
+    for (size_t c : tried)
+      points.insert(points.end(), trials.begin() + c * ntrials, trials.begin() + (c + 1) * ntrials);
+    auto picks = std::vector<size_t>(tried.size());
+    double sse = 0.0;
+    const bool met =
+        h5zsperr::allocate_rates(points.data(), tried.size(), ntrials, budget, picks.data(), &sse);
+    const double mse = stats.nvalid ? sse / double(stats.nvalid) : 0.0;
+    const double psnr = mse > 0.0 ? 10.0 * std::log10(range * range / mse) : HUGE_VAL;
+    if (!met)
+      fprintf(stderr, "%s: PSNR %.2f dB is out of reach; using the most accurate bitrates\n",
+              name, opt.quality);
+    if (opt.progress)
+      fprintf(stderr, "%s: allocated bitrates for a PSNR of %.2f dB, RMSE %g\n", name, psnr,
+              std::sqrt(mse));
+
+    // Record what the dataset meets as a whole, since its cd_values[] claim a PSNR per chunk.
+    const double reached = std::min(opt.quality, psnr);
+    hid_t attr_space = H5Screate(H5S_SCALAR);
+    hid_t attr = H5Acreate2(out, H5Z_SPERR_PSNR_ATTR, H5T_NATIVE_DOUBLE, attr_space,
+                            H5P_DEFAULT, H5P_DEFAULT);
+    if (attr < 0 || H5Awrite(attr, H5T_NATIVE_DOUBLE, &reached) < 0) {
+      fprintf(stderr, "%s: cannot record the dataset PSNR\n", name);
+      ret = 1;
+    }
+    if (attr >= 0)
+      H5Aclose(attr);
+    H5Sclose(attr_space);
+
+    rate_words.assign(nchunks, 0);
+    for (size_t k = 0; k < tried.size(); k++)
+      rate_words[tried[k]] = ctx.trial_words[picks[k]];
+    ctx.trial_words.clear();
+    nwritten = in_bytes = out_bytes = 0;
+    start = last_report = std::chrono::steady_clock::now();
+    walk();
+  }
+
+  H5Dclose(out);
+  return cleanup(ret);
+}
+
+herr_t collect_dataset(hid_t, const char* name, const H5O_info_t* info, void* list)
+{
+  if (info->type == H5O_TYPE_DATASET)
+    static_cast<std::vector<std::string>*>(list)->emplace_back(name);
+  return 0;
+}
+
+// Read a tolerance map from "file:dataset", a 2D or 3D dataset of positive values.
+bool load_map(const char* spec, Options* opt)
+{
+  const char* colon = strrchr(spec, ':');
+  if (!colon)
+    return false;
+  const auto fname = std::string(spec, colon);
+  hid_t file = H5Fopen(fname.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (file < 0)
+    return false;
+  hid_t dset = H5Dopen(file, colon + 1, H5P_DEFAULT);
+  hid_t space = dset < 0 ? H5I_INVALID_HID : H5Dget_space(dset);
+  const int ndims = space < 0 ? 0 : H5Sget_simple_extent_ndims(space);
+  bool ok = (ndims == 2 || ndims == 3);
+  if (ok) {
+    hsize_t dims[3] = {1, 1, 1};
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    opt->map_dims.assign(dims, dims + ndims);
+    opt->map_factors.resize(dims[0] * dims[1] * dims[2]);
+    ok = H5Dread(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                 opt->map_factors.data()) >= 0;
+    for (float f : opt->map_factors)
+      ok = ok && f > 0.0f && f < HUGE_VALF;
+  }
+  if (space >= 0)
+    H5Sclose(space);
+  if (dset >= 0)
+    H5Dclose(dset);
+  H5Fclose(file);
+  if (!ok)
+    opt->map_dims.clear();
+  return ok;
+}
+
+void usage()
+{
+  printf(
+      "Usage: h5sperr-repack [options] -m mode -q quality  input.h5  output.h5  [dataset ...]\n"
+      "  -m mode      SPERR compression mode: 1 (BPP), 2 (PSNR), 3 (PWE), 4 (PWE with -b),\n"
+      "               or 5 (PWE relative to the value range of each chunk)\n"
+      "  -q quality   compression quality of the chosen mode\n"
+      "  -b bpp       bitrate cap of each chunk in mode 4\n"
+      "  -s           swap rank orders\n"
+      "  -S           decide whether to swap rank orders for each chunk\n"
+      "  -M mode[:v]  missing value mode, and the exact missing value(s) in mode 3, 4, or 5,\n"
+      "               e.g., -M 5:nan,-999,9.96921e36 (default: same as a SPERR input, or 6;\n"
+      "               the fill value if v is omitted in mode 3 or 4)\n"
+      "  -B edge      compress chunks as independent sub-blocks of this edge length (8 to 1024,\n"
+      "               a power of 2), so that regions of chunks can be decoded on their own\n"
+      "  -Q file:dset factors of the PWE tolerance over each dataset, read from a 2D or 3D\n"
+      "               dataset that is stretched to cover it (modes 3, 4, and 5 only)\n"
+      "  -E effort    fast, balanced (default), or max: how hard SPERR and the filter work\n"
+      "               for a better compression ratio\n"
+      "  -t threads   number of worker threads (default: all hardware threads)\n"
+      "  -x MiB       cap of memory held by chunks in flight (default: 1024)\n"
+      "  -c d0,d1,..  chunk dimensions for contiguous inputs\n"
+      "  -G           with -m 2, meet the PSNR target over each whole dataset rather than\n"
+      "               each chunk, at the smallest size, by trying each chunk at several bitrates\n"
+      "  -p           report progress\n"
+      "Without dataset names, all floating-point datasets are repacked.\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  auto opt = Options();
+  int c = 0;
+  while ((c = getopt(argc, argv, "m:q:b:sSM:B:E:Q:t:x:c:Gp")) != -1) {
+    switch (c) {
+      case 'm':
+        opt.mode = atoi(optarg);
+        break;
+      case 'q':
+        opt.quality = atof(optarg);
+        break;
+      case 'b':
+        opt.max_bpp = atof(optarg);
+        break;
+      case 's':
+        opt.swap = 1;
+        break;
+      case 'S':
+        opt.swap = H5Z_SPERR_SWAP_AUTO;
+        break;
+      case 'M': {
+        opt.missing_mode = atoi(optarg);
+        char* colon = strchr(optarg, ':');
+        if (colon)
+          for (char* tok = strtok(colon + 1, ","); tok; tok = strtok(NULL, ","))
+            opt.missing_vals.push_back(atof(tok));
+        break;
+      }
+      case 'B':
+        opt.subblock = atoi(optarg);
+        break;
+      case 'E':
+        if (strcmp(optarg, "fast") == 0)
+          opt.effort = H5Z_SPERR_EFFORT_FAST;
+        else if (strcmp(optarg, "balanced") == 0)
+          opt.effort = H5Z_SPERR_EFFORT_BALANCED;
+        else if (strcmp(optarg, "max") == 0)
+          opt.effort = H5Z_SPERR_EFFORT_MAX;
+        else {
+          usage();
+          exit(1);
+        }
+        break;
+      case 'Q':
+        if (!load_map(optarg, &opt)) {
+          fprintf(stderr, "Cannot read a tolerance map from %s\n", optarg);
+          exit(1);
+        }
+        break;
+      case 't':
+        opt.nthreads = size_t(atol(optarg));
+        break;
+      case 'x':
+        opt.mem_cap = size_t(atol(optarg)) << 20;
+        break;
+      case 'c':
+        for (char* tok = strtok(optarg, ","); tok; tok = strtok(NULL, ","))
+          opt.chunk_dims.push_back(hsize_t(atoll(tok)));
+        break;
+      case 'G':
+        opt.global = true;
+        break;
+      case 'p':
+        opt.progress = true;
+        break;
+      default:
+        usage();
+        exit(1);
+    }
+  }
+  if (argc - optind < 2 || opt.mode < 1 || opt.mode > 5 || opt.quality <= 0.0 ||
+      (!opt.map_dims.empty() && opt.mode < 3) || (opt.global && opt.mode != 2) ||
+      (opt.mode == 4 && (opt.max_bpp < 0.25 || opt.max_bpp >= 64.0)) ||
+      (opt.subblock && (opt.subblock < 8 || opt.subblock > 1024 ||
+                        (opt.subblock & (opt.subblock - 1))))) {
+    usage();
+    exit(1);
+  }
+
+  /* Make the filter available without relying on HDF5_PLUGIN_PATH. */
+  H5Zregister(H5PLget_plugin_info());
+
+  hid_t in_file = H5Fopen(argv[optind], H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (in_file < 0) {
+    fprintf(stderr, "Cannot open %s\n", argv[optind]);
+    exit(1);
+  }
+  hid_t out_file = H5Fcreate(argv[optind + 1], H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  if (out_file < 0) {
+    fprintf(stderr, "Cannot create %s\n", argv[optind + 1]);
+    exit(1);
+  }
+
+  auto names = std::vector<std::string>(argv + optind + 2, argv + argc);
+  if (names.empty())
+    H5Ovisit(in_file, H5_INDEX_NAME, H5_ITER_NATIVE, collect_dataset, &names);
+
+  int ret = 0;
+  for (const auto& name : names)
+    ret |= repack(in_file, out_file, name.c_str(), opt);
+
+  H5Fclose(out_file);
+  H5Fclose(in_file);
+  return ret;
+}